@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Streaming heatshrink decoder for compressed Gecko slot images.
+ *
+ * The stream is MSB first bits: a 1 tag is followed by an 8 bit literal, a
+ * 0 tag by a back-reference of (distance - 1) in window bits and
+ * (length - 1) in lookahead bits. Output is pulled a page at a time, so RAM
+ * use is the window plus a small input buffer whatever the image size.
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(dfu_gecko_hs, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "dfu_gecko_hs.h"
+
+#define HS_MAX_WINDOW (1 << CONFIG_DFU_GECKO_HEATSHRINK_WINDOW_BITS)
+#define HS_IN_SIZE    256
+
+static struct {
+	struct fs_file_t *file;
+	uint8_t in[HS_IN_SIZE];
+	size_t in_len;
+	size_t in_pos;
+	uint8_t bits;
+	uint8_t bit_mask;
+	uint8_t window_sz2;
+	uint8_t lookahead_sz2;
+	uint16_t head;
+	uint16_t copy_dist;
+	uint16_t copy_left;
+	uint32_t out_total;
+	uint32_t raw_size;
+} hs;
+
+static uint8_t window[HS_MAX_WINDOW];
+
+static int next_byte(void)
+{
+	if (hs.in_pos == hs.in_len) {
+		ssize_t ret = fs_read(hs.file, hs.in, sizeof(hs.in));
+
+		if (ret <= 0) {
+			return -1;
+		}
+		hs.in_len = ret;
+		hs.in_pos = 0;
+	}
+	return hs.in[hs.in_pos++];
+}
+
+static int get_bits(int count)
+{
+	int val = 0;
+
+	while (count--) {
+		if (hs.bit_mask == 0) {
+			int byte = next_byte();
+
+			if (byte < 0) {
+				return -1;
+			}
+			hs.bits = byte;
+			hs.bit_mask = 0x80;
+		}
+		val = (val << 1) | ((hs.bits & hs.bit_mask) ? 1 : 0);
+		hs.bit_mask >>= 1;
+	}
+	return val;
+}
+
+int dfu_hs_rewind(void)
+{
+	int ret = fs_seek(hs.file, DFU_HS_HEADER_SIZE, FS_SEEK_SET);
+
+	hs.in_len = 0;
+	hs.in_pos = 0;
+	hs.bit_mask = 0;
+	hs.head = 0;
+	hs.copy_left = 0;
+	hs.out_total = 0;
+	memset(window, 0, sizeof(window));
+	return ret;
+}
+
+int dfu_hs_open(struct fs_file_t *file)
+{
+	uint8_t hdr[DFU_HS_HEADER_SIZE];
+	ssize_t ret;
+
+	hs.file = file;
+	ret = fs_read(file, hdr, sizeof(hdr));
+	if (ret != sizeof(hdr) || memcmp(hdr, DFU_HS_MAGIC, 4)) {
+		fs_seek(file, 0, FS_SEEK_SET);
+		return ret < 0 ? ret : -ENOMSG;
+	}
+	hs.window_sz2 = hdr[4];
+	hs.lookahead_sz2 = hdr[5];
+	hs.raw_size = sys_get_le32(&hdr[8]);
+	if (hs.window_sz2 < 4 || hs.window_sz2 > CONFIG_DFU_GECKO_HEATSHRINK_WINDOW_BITS ||
+			hs.lookahead_sz2 < 3 || hs.lookahead_sz2 >= hs.window_sz2) {
+		LOG_ERR("Unsupported image window %u/%u", hs.window_sz2, hs.lookahead_sz2);
+		return -ENOTSUP;
+	}
+	ret = dfu_hs_rewind();
+	if (ret) {
+		return ret;
+	}
+	LOG_INF("Compressed image, window %u, raw size %u", 1 << hs.window_sz2, hs.raw_size);
+	return hs.raw_size;
+}
+
+int dfu_hs_read(uint8_t *out, size_t len)
+{
+	uint16_t mask = (1 << hs.window_sz2) - 1;
+	size_t n = 0;
+
+	while (n < len && hs.out_total < hs.raw_size) {
+		uint8_t c;
+
+		if (hs.copy_left) {
+			c = window[(uint16_t)(hs.head - hs.copy_dist) & mask];
+			hs.copy_left--;
+		} else {
+			int tag = get_bits(1);
+			int val;
+
+			if (tag < 0) {
+				return -EIO;
+			}
+			if (tag) {
+				val = get_bits(8);
+				if (val < 0) {
+					return -EIO;
+				}
+				c = val;
+			} else {
+				int index = get_bits(hs.window_sz2);
+				int count = get_bits(hs.lookahead_sz2);
+
+				if (index < 0 || count < 0) {
+					return -EIO;
+				}
+				hs.copy_dist = index + 1;
+				hs.copy_left = count + 1;
+				continue;
+			}
+		}
+		window[hs.head++ & mask] = c;
+		out[n++] = c;
+		hs.out_total++;
+	}
+	return n;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef DFU_GECKO_HS_H
+#define DFU_GECKO_HS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/fs/fs.h>
+
+/*
+ * Compressed slot image, as written by scripts/fw_pack.py:
+ *
+ *   "HSZ1" | window bits (1) | lookahead bits (1) | 0 (2) | raw size (4, LE) | heatshrink stream
+ *
+ * The .sha1 that goes with it is the digest of the raw image.
+ */
+#define DFU_HS_MAGIC       "HSZ1"
+#define DFU_HS_HEADER_SIZE 12
+
+/**
+ * @brief Start decoding an image file
+ *
+ * @return raw image size, -ENOMSG if the file is not compressed (it is
+ * then rewound), or a negative errno for a bad header.
+ */
+int dfu_hs_open(struct fs_file_t *file);
+
+/**
+ * @brief Decode up to len bytes of the raw image
+ *
+ * @return bytes decoded, 0 at the end of the image, -EIO if the stream is
+ * truncated or read fails.
+ */
+int dfu_hs_read(uint8_t *out, size_t len);
+
+/** @brief Restart decoding from the first raw byte */
+int dfu_hs_rewind(void);
+
+#endif
@@ -25,6 +25,9 @@ LOG_MODULE_REGISTER(dfu_gecko_lib, LOG_LEVEL_INF);
 #include <mbedtls/sha1.h>
 #include <zephyr/sys/byteorder.h>
 #include "dfu_gecko_lib.h"
+#ifdef CONFIG_DFU_GECKO_HEATSHRINK
+#include "dfu_gecko_hs.h"
+#endif
 
 // SHAs are set to 0 since they are unknown before a build
 const struct dfu_file_t dfu_files_mcu[] = {
@@ -88,8 +91,16 @@ gecko_app_cb_t gecko_app_cb;
 // FW send variable , buffer
 static uint32_t chunk_cnt = 0u, chunk_check = 0u, offset = 0u, fw_image_size = 0u;
 static int32_t status = 0;
-static uint8_t image_buffer[DFU_CHUNK_SIZE] = { 0 };
-static uint8_t check_buf[DFU_CHUNK_SIZE + 1];
+/* Both live in one buffer lent by the caller for the length of an update */
+static uint8_t *image_buffer;
+static uint8_t *check_buf;
+static dfu_gecko_buf_get_t buf_get;
+static dfu_gecko_buf_put_t buf_put;
+#if !IS_ENABLED(CONFIG_DFU_GECKO_BUF_OPS)
+/* Used when the application registers no buffer ops */
+static uint8_t static_buf[DFU_GECKO_BUF_SIZE];
+#endif
+BUILD_ASSERT(DFU_GECKO_BUF_SIZE >= 2 * DFU_CHUNK_SIZE + 1);
 static int requested_slot_to_upgrade = -1;
 
 #define GECKO_INCRE_PAGE 0
@@ -98,6 +109,7 @@ static int requested_slot_to_upgrade = -1;
 extern int read_image_from_flash(uint8_t *flash_read_buffer, int readBytes, uint32_t flashStartSector, int ImageFileNum);
 
 static struct fs_file_t geckofile = {0};
+static bool image_compressed;
 static int readbytes = 0;
 static int totalreadbytes = 0;
 static int totalwritebytes = 0;
@@ -295,6 +307,27 @@ int print_gecko_slot_info(void)
 	return 0;
 }
 
+/* Read the raw image, decompressing it if it was staged compressed */
+static int image_read(uint8_t *buf, size_t len)
+{
+#ifdef CONFIG_DFU_GECKO_HEATSHRINK
+	if (image_compressed) {
+		return dfu_hs_read(buf, len);
+	}
+#endif
+	return fs_read(&geckofile, buf, len);
+}
+
+static int image_rewind(void)
+{
+#ifdef CONFIG_DFU_GECKO_HEATSHRINK
+	if (image_compressed) {
+		return dfu_hs_rewind();
+	}
+#endif
+	return fs_seek(&geckofile, 0, FS_SEEK_SET);
+}
+
 // This function gets the size of the Gecko zephyr firmware
 static uint32_t get_gecko_fw_size(void)
 {
@@ -303,7 +336,7 @@ static uint32_t get_gecko_fw_size(void)
 
 	while (notdone)
 	{
-		readbytes = fs_read(&geckofile, image_buffer, DFU_XFER_SIZE_2K);
+		readbytes = image_read(image_buffer, DFU_XFER_SIZE_2K);
 		if (readbytes < 0) {
 			printf("Could not read file /tmo/zephyr.bin\n");
 			return -1;
@@ -371,6 +404,18 @@ static int get_gecko_sha1(void)
 	return 0;
 }
 
+static dfu_gecko_stage_cb_t stage_cb;
+static uint64_t erase_cycles;
+static uint64_t program_cycles;
+static uint64_t verify_cycles;
+
+static void report_stage(enum dfu_gecko_stage stage, uint32_t usec, uint32_t bytes)
+{
+	if (stage_cb) {
+		stage_cb(stage, usec, bytes);
+	}
+}
+
 static int erase_image(uint32_t start_sector)
 {
         if (flash_erase(gecko_flash_dev, start_sector, DFU_XFER_SIZE_2K) != 0) {
@@ -391,6 +436,8 @@ static int write_image_chunk_to_flash(int imageBytes, uint8_t* writedata, uint32
 	}
 
 	uint32_t page_addr = startSector + (page * DFU_XFER_SIZE_2K);
+	uint32_t start = k_cycle_get_32();
+	uint32_t now;
 
 	page++;
 
@@ -398,18 +445,25 @@ static int write_image_chunk_to_flash(int imageBytes, uint8_t* writedata, uint32
 	if (flash_erase(gecko_flash_dev, page_addr, DFU_XFER_SIZE_2K) != 0) {
 		printf("\nGecko 2K page erase failed\n");
 	}
+	now = k_cycle_get_32();
+	erase_cycles += now - start;
+	start = now;
 
 	/* This will also zero pad out the last 2K page write with the image remainder bytes. */
 	if (flash_write(gecko_flash_dev, page_addr, writedata, DFU_XFER_SIZE_2K) != 0) {
 		printf("Gecko flash write internal ERROR!");
 		return -EIO;
 	}
+	now = k_cycle_get_32();
+	program_cycles += now - start;
+	start = now;
 
 	flash_read(gecko_flash_dev, page_addr, check_buf, imageBytes);
 	if (memcmp(writedata, check_buf, imageBytes) != 0) {
 		printf("\nGecko flash erase-write-read ERROR!\n");
 		return -EIO;
 	}
+	verify_cycles += k_cycle_get_32() - start;
 
 	totalwritebytes += imageBytes;
 	// printf("2. write flash addr %x total %d\n", page_addr, totalwritebytes);
@@ -418,7 +472,7 @@ static int write_image_chunk_to_flash(int imageBytes, uint8_t* writedata, uint32
 
 static int file_read_flash(uint32_t offset)
 {
-	readbytes = fs_read(&geckofile, image_buffer, DFU_XFER_SIZE_2K);
+	readbytes = image_read(image_buffer, DFU_XFER_SIZE_2K);
 	if (readbytes < 0) {
 		printf("Could not read file /tmo/zephyr.slotx.bin\n");
 		status = -1;
@@ -443,6 +497,7 @@ static int file_read_flash(uint32_t offset)
 }
 
 static uint8_t fw_upgrade_done = 0;
+static bool defer_reboot;
 int32_t dfu_gecko_write_image(int slot_to_upgrade, char *bin_file, char *sha_file)
 {
 	char requested_binary_file[DFU_FILE_LEN];
@@ -490,6 +545,20 @@ int32_t dfu_gecko_write_image(int slot_to_upgrade, char *bin_file, char *sha_fil
 		return -1;
 	}
 
+	image_compressed = false;
+#ifdef CONFIG_DFU_GECKO_HEATSHRINK
+	int raw_size = dfu_hs_open(&geckofile);
+
+	if (raw_size >= 0) {
+		printf("The Gecko FW file is compressed, %d bytes unpacked\n", raw_size);
+		image_compressed = true;
+	} else if (raw_size != -ENOMSG) {
+		printf("The compressed Gecko FW file can not be unpacked: %d\n", raw_size);
+		fs_close(&geckofile);
+		return -1;
+	}
+#endif
+
 	/* We do a dummy call here to init (reset) the incrementing page address var */
 	write_image_chunk_to_flash(readbytes, image_buffer, GECKO_FLASH_SECTOR, GECKO_INIT_PAGE);
 
@@ -512,6 +581,8 @@ int32_t dfu_gecko_write_image(int slot_to_upgrade, char *bin_file, char *sha_fil
 
 			case GECKO_FW_UPGRADE:
 				{
+					int64_t digest_start = k_uptime_get();
+
 					/* Send the first chunk to extract header */
 					fw_image_size = get_gecko_fw_size();
 					if ((fw_image_size == 0) || (fw_image_size < DFU_CHUNK_SIZE)) {
@@ -530,6 +601,12 @@ int32_t dfu_gecko_write_image(int slot_to_upgrade, char *bin_file, char *sha_fil
 						printf("ERROR: GECKO SHA1 is miscompares!\n");
 						return -1;
 					}
+					report_stage(DFU_GECKO_STAGE_DIGEST,
+							(uint32_t)(k_uptime_get() - digest_start) * USEC_PER_MSEC,
+							fw_image_size);
+					erase_cycles = 0;
+					program_cycles = 0;
+					verify_cycles = 0;
 
 					/* Calculate the total number of chunks */
 					chunk_check = (fw_image_size / DFU_CHUNK_SIZE);
@@ -538,7 +615,7 @@ int32_t dfu_gecko_write_image(int slot_to_upgrade, char *bin_file, char *sha_fil
 					}
 
 					printf("image size: %d, 2048 byte chunks: %d\n", fw_image_size, chunk_check);
-					fs_seek(&geckofile, 0, FS_SEEK_SET);
+					image_rewind();
 
 					readbytes = 0;
 					totalreadbytes = 0;
@@ -581,7 +658,7 @@ int32_t dfu_gecko_write_image(int slot_to_upgrade, char *bin_file, char *sha_fil
 							}
 						}
 						offset += readbytes;
-						memset(image_buffer, 0, sizeof(image_buffer));
+						memset(image_buffer, 0, DFU_CHUNK_SIZE);
 						chunk_cnt++;
 					}       /* end While Loop */
 				}               /* End case of  */
@@ -594,8 +671,19 @@ int32_t dfu_gecko_write_image(int slot_to_upgrade, char *bin_file, char *sha_fil
 
 					printf("\tCalculated program CRC32 is %x\n", crc32);
 					printf("\tTotal bytes read       = %d bytes\n", totalreadbytes);
+					report_stage(DFU_GECKO_STAGE_ERASE,
+							k_cyc_to_us_floor32(erase_cycles), totalwritebytes);
+					report_stage(DFU_GECKO_STAGE_PROGRAM,
+							k_cyc_to_us_floor32(program_cycles), totalwritebytes);
+					report_stage(DFU_GECKO_STAGE_VERIFY,
+							k_cyc_to_us_floor32(verify_cycles), totalwritebytes);
+					if (defer_reboot) {
+						printf("GECKO FW update has completed, reboot to activate\n");
+						break;
+					}
 					printf("GECKO FW update has completed, rebooting now\n");
 					k_sleep(K_SECONDS(3));
+					report_stage(DFU_GECKO_STAGE_REBOOT_WAIT, 3 * USEC_PER_SEC, 0);
 					sys_reboot(SYS_REBOOT_COLD);
 				}
 				break;
@@ -638,10 +726,45 @@ int dfu_mcu_firmware_upgrade(int slot_to_upgrade, char *bin_file, char *sha_file
 	int ret = 0;
 
 	printf("*** Performing the Pearl Gecko FW update ***\n");
+	if (buf_get) {
+		image_buffer = buf_get(DFU_GECKO_BUF_SIZE);
+	} else {
+#if IS_ENABLED(CONFIG_DFU_GECKO_BUF_OPS)
+		printf("No buffer ops registered with dfu_mcu_set_buf_ops()\n");
+#else
+		image_buffer = static_buf;
+#endif
+	}
+	if (image_buffer == NULL) {
+		printf("No buffer for the Gecko FW update\n");
+		return -ENOMEM;
+	}
+	check_buf = image_buffer + DFU_CHUNK_SIZE;
 	ret = dfu_gecko_write_image(slot_to_upgrade, bin_file, sha_file);
+	if (buf_get) {
+		buf_put(image_buffer);
+	}
+	image_buffer = NULL;
+	check_buf = NULL;
 	return ret;
 }
 
+void dfu_mcu_defer_reboot(bool defer)
+{
+	defer_reboot = defer;
+}
+
+void dfu_mcu_set_stage_cb(dfu_gecko_stage_cb_t cb)
+{
+	stage_cb = cb;
+}
+
+void dfu_mcu_set_buf_ops(dfu_gecko_buf_get_t get, dfu_gecko_buf_put_t put)
+{
+	buf_get = get;
+	buf_put = put;
+}
+
 /* Convert the desired type to system endianness and icnrement the buffer. This is just a wrapper to
  * avoid writing the following a ton of times: sys_le32_to_cpu(*((uint32_t*)var));
  * var=((uint8_t*)var)+sizeof(uint32_t);
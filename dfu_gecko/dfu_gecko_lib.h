@@ -28,6 +28,22 @@ struct dfu_file_t {
 };
 #endif /* __DFU_FILE__ */
 
+enum dfu_gecko_stage {
+	DFU_GECKO_STAGE_DIGEST,
+	DFU_GECKO_STAGE_ERASE,
+	DFU_GECKO_STAGE_PROGRAM,
+	DFU_GECKO_STAGE_VERIFY,
+	DFU_GECKO_STAGE_REBOOT_WAIT,
+};
+
+/* Called at the end of each update stage with its duration and size */
+typedef void (*dfu_gecko_stage_cb_t)(enum dfu_gecko_stage stage, uint32_t usec, uint32_t bytes);
+
+/* Page and read-back buffers of an update, the lib holds no static copy */
+#define DFU_GECKO_BUF_SIZE (2 * 2048 + 1)
+typedef uint8_t *(*dfu_gecko_buf_get_t)(size_t len);
+typedef void (*dfu_gecko_buf_put_t)(uint8_t *buf);
+
 #ifdef BOOT_SLOT
 int is_bootloader_running(void);
 int erase_image_slot(int slot);
@@ -36,6 +52,15 @@ int print_gecko_slot_info(void);
 int get_current_slot(void);
 int get_unused_slot(void);
 int dfu_mcu_firmware_upgrade(int slot_to_upgrade, char *bin_file, char *sha_file);
+/* Leave the reboot that activates the new image to the caller */
+void dfu_mcu_defer_reboot(bool defer);
+void dfu_mcu_set_stage_cb(dfu_gecko_stage_cb_t cb);
+/*
+ * Where dfu_mcu_firmware_upgrade() borrows its DFU_GECKO_BUF_SIZE buffer.
+ * Required with CONFIG_DFU_GECKO_BUF_OPS, else a static buffer is used
+ * while none are set.
+ */
+void dfu_mcu_set_buf_ops(dfu_gecko_buf_get_t get, dfu_gecko_buf_put_t put);
 bool slot_is_safe_to_erase(int slot);
 #endif
 #endif
@@ -24,8 +24,10 @@
 
 #include "tmo_dfu_download.h"
 #include "dfu_murata_1sc.h"
+#include "tmo_dfu_timing.h"
 #include "tmo_shell.h"
 #include "tmo_modem.h"
+#include "tmo_xfer_buf.h"
 
 /* The Murata 1SC updates below are "delta files" for updating
  * between two FW versions. Early (Beta/Pilot) dev kits contain
@@ -89,7 +91,8 @@ modem_app_cb_t modem_app_cb;
 /* FW send variable, buffer */
 static uint32_t chunk_cnt = 0u, chunk_check = 0u, offset = 0u, fw_image_size = 0u, remainder = 0u;
 static uint8_t recv_buff_hdr[UA_HEADER_SIZE] = { 0 };
-static uint8_t recv_buff_1k [1024] = { 0 };
+/* Borrowed from the transfer pool while an update runs */
+static uint8_t *recv_buff_1k;
 
 mbedtls_sha1_context modem_sha1_ctx;
 unsigned char modem_sha1_output[DFU_SHA1_LEN];
@@ -98,6 +101,8 @@ static struct fs_file_t modemfile = {0};
 static int readbytes = 0;
 static int totalreadbytes = 0;
 static uint32_t crc32 = 0;
+static bool defer_reboot;
+static int64_t stage_start;
 
 static uint32_t crctab[] = {
 	0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc,
@@ -396,6 +401,7 @@ static int32_t dfu_modem_write_image(const struct dfu_file_t *dfu_file)
 			case MODEM_INITIAL_STATE:
 				{
 					printf("\nStage 1: Image update pre-checks (compute SHA1, crc32, etc) (~15 seconds)\n");
+					stage_start = k_uptime_get();
 
 					printf("\tChecking for %s to be present\n", dfu_file->lfile);
 					if (fs_open(&modemfile, dfu_file->lfile, FS_O_READ) != 0) {
@@ -445,12 +451,15 @@ static int32_t dfu_modem_write_image(const struct dfu_file_t *dfu_file)
 
 					/* update modem application state */
 					modem_app_cb.state = MODEM_FW_UPGRADE;
+					tmo_dfu_timing_add(DFU_MODEM, TMO_DFU_STAGE_DIGEST,
+							k_uptime_get() - stage_start, totalreadbytes);
 				}
 
 				/* no break */
 			case MODEM_FW_UPGRADE:
 				{
 					printf("\nStage 2: Write upgrade data to modem flash (~2-3 minutes)\n");
+					stage_start = k_uptime_get();
 
 					/* Reset the file pointers to begin the update */
 					fs_seek(&modemfile, 0, FS_SEEK_SET);
@@ -524,27 +533,41 @@ static int32_t dfu_modem_write_image(const struct dfu_file_t *dfu_file)
 							}
 						}
 						offset += DFU_CHUNK_SIZE;
-						memset(recv_buff_1k, 0, sizeof(recv_buff_1k));
+						memset(recv_buff_1k, 0, DFU_CHUNK_SIZE);
 						chunk_cnt++;
 					}       /* end While Loop */
+					if (modem_app_cb.state == MODEM_FW_UPGRADE_DONE) {
+						tmo_dfu_timing_add(DFU_MODEM, TMO_DFU_STAGE_MODEM_XFER,
+								k_uptime_get() - stage_start, fw_image_size);
+					}
 				}               /* End case of  */
 				break;
 
 			case MODEM_FW_UPGRADE_DONE:
 				{
 					printf("\nStage 3: Issuing INIT_FW_UPGRADE (finalizing) (~3 minutes)\n");
+					stage_start = k_uptime_get();
 					dfu_send_ioctl(AT_INIT_FW_UPGRADE, 0);
 
 					printf("\tIssuing AT_RESET_MODEM, and waiting for modem to finish updating\n");
 					dfu_send_ioctl(AT_RESET_MODEM, 0);
 
-#define MODEM_UPDATE_TIME 180
-					for (int i=0;i<MODEM_UPDATE_TIME;i++) {
+					if (defer_reboot) {
+						modemFwUpgradeDone = 1;
+						printf("\tMurata 1SC is finalizing the update (~%d seconds)\n",
+								DFU_MODEM_UPDATE_SECS);
+						fs_close (&modemfile);
+						break;
+					}
+
+					for (int i=0;i<DFU_MODEM_UPDATE_SECS;i++) {
 						printk(".");
 						k_sleep(K_SECONDS(1));
 					}
 
 					modemFwUpgradeDone = 1;
+					tmo_dfu_timing_add(DFU_MODEM, TMO_DFU_STAGE_MODEM_INSTALL,
+							k_uptime_get() - stage_start, 0);
 					printf("\n\tMurata 1SC FW upgrade completed, rebooting system...\n");
 
 					fs_close (&modemfile);
@@ -679,7 +702,19 @@ int dfu_modem_firmware_upgrade (const struct dfu_file_t *dfu_file)
 			return -1;
 	}
 
+	recv_buff_1k = tmo_xfer_buf_acquire("dfu_modem", K_SECONDS(1));
+	if (recv_buff_1k == NULL) {
+		printf("No buffer for the Murata 1SC FW update\n");
+		return -ENOMEM;
+	}
 	printf("write image to modem\n");
 	ret = dfu_modem_write_image(dfu_file);
+	tmo_xfer_buf_release(recv_buff_1k);
+	recv_buff_1k = NULL;
 	return ret;
 }
+
+void dfu_modem_defer_reboot(bool defer)
+{
+	defer_reboot = defer;
+}
@@ -7,16 +7,21 @@
 #ifndef DFU_MURATA_1SC_H
 #define DFU_MURATA_1SC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "tmo_dfu_download.h"
 
 #define DFU_MODEM_FW_VER_SIZE 32
 #define UA_HEADER_SIZE 256
+/* Time the modem needs after AT_RESET_MODEM to finish installing an image */
+#define DFU_MODEM_UPDATE_SECS 180
 
 uint32_t murata_1sc_crc32_update(uint32_t crc32, const uint8_t *data, size_t len);
 uint32_t murata_1sc_crc32_finish(uint32_t crc32, size_t len);
 
 int dfu_modem_get_version(char *dfu_murata_version_str);
 int dfu_modem_firmware_upgrade(const struct dfu_file_t *dfu_file);
+/* Return once the modem is installing instead of waiting and rebooting */
+void dfu_modem_defer_reboot(bool defer);
 
 #endif
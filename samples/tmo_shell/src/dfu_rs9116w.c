@@ -40,6 +40,8 @@
 
 #include "dfu_rs9116w.h"
 #include "tmo_dfu_download.h"
+#include "tmo_dfu_timing.h"
+#include "tmo_xfer_buf.h"
 
 struct dfu_file_t dfu_files_rs9116w[] = {
 	{
@@ -89,7 +91,7 @@ rs9116w_app_cb_t rs9116w_app_cb;
 // FW send variable , buffer
 uint32_t chunk_cnt = 0u, chunk_check = 0u, offset = 0u, fw_image_size = 0u;
 int32_t status = RSI_SUCCESS;
-uint8_t recv_buffer[RSI_CHUNK_SIZE] = { 0 }, fw_version[RSI_FW_VER_SIZE] = { 0 };
+uint8_t fw_version[RSI_FW_VER_SIZE] = { 0 };
 
 // uint8_t fw_array[4096];
 
@@ -132,21 +134,262 @@ static uint32_t get_rs9116_fw_size(char *buffer)
 	return fw->image_size;
 }
 
-static int file_read_flash(uint32_t offset)
+/* Where the update time goes, printed and saved once the image is written */
+static struct {
+	uint32_t ready_ms;	/* bootloader ready before the first chunk */
+	uint32_t read_ms;	/* file system reads */
+	uint32_t stall_ms;	/* writer waiting for the next chunk */
+	uint32_t write_ms;	/* chunk writes up to the last one */
+	uint32_t finalize_ms;	/* last chunk, the bootloader commits the image */
+	uint32_t boot_ms;	/* bootloader ready again after the update */
+} phase;
+
+static int chunk_read(uint8_t *buf)
 {
-	readbytes = fs_read(&rs9116file, recv_buffer, FS_XFER_SIZE);
+	int64_t start = k_uptime_get();
+
+	memset(buf, 0, RSI_CHUNK_SIZE);
+	readbytes = fs_read(&rs9116file, buf, FS_XFER_SIZE);
+	phase.read_ms += k_uptime_get() - start;
 	if (readbytes < 0) {
 		printf("Could not read file /tmo/rs9116_file.rps\n");
-		return -1;
+		return readbytes;
 	}
 
 	totalreadbytes += readbytes;
+	return readbytes;
+}
+
+/* Chunk buffers from the transfer pool, the second one only for prefetch */
+static uint8_t *chunk_buf[2];
+BUILD_ASSERT(RSI_CHUNK_SIZE <= TMO_XFER_BUF_SIZE);
+
+#ifdef CONFIG_TMO_RS9116_DFU_PREFETCH
+/*
+ * The reader thread fills one buffer while rsi_bl_upgrade_firmware() sends
+ * the other, so the file system read of chunk n + 1 overlaps the bootloader
+ * write of chunk n.
+ */
+#define PREFETCH_STACK_SIZE 2048
+
+static K_THREAD_STACK_DEFINE(prefetch_stack, PREFETCH_STACK_SIZE);
+static struct k_thread prefetch_thread;
+static int chunk_len[2];
+static int chunk_next_idx;
+static bool prefetch_stop;
+static K_SEM_DEFINE(chunk_free, 2, 2);
+static K_SEM_DEFINE(chunk_full, 0, 2);
+
+static void prefetch_fn(void *arg1, void *arg2, void *arg3)
+{
+	ARG_UNUSED(arg1);
+	ARG_UNUSED(arg2);
+	ARG_UNUSED(arg3);
+
+	for (int i = 0; ; i ^= 1) {
+		k_sem_take(&chunk_free, K_FOREVER);
+		if (prefetch_stop) {
+			return;
+		}
+		chunk_len[i] = chunk_read(chunk_buf[i]);
+		k_sem_give(&chunk_full);
+		if (chunk_len[i] <= 0) {
+			return;
+		}
+	}
+}
+#endif
+
+static int chunks_start(void)
+{
+	chunk_buf[0] = tmo_xfer_buf_acquire("dfu_wifi", K_SECONDS(1));
+	if (chunk_buf[0] == NULL) {
+		return -ENOMEM;
+	}
+#ifdef CONFIG_TMO_RS9116_DFU_PREFETCH
+	chunk_buf[1] = tmo_xfer_buf_acquire("dfu_wifi", K_SECONDS(1));
+	if (chunk_buf[1] == NULL) {
+		tmo_xfer_buf_release(chunk_buf[0]);
+		return -ENOMEM;
+	}
+	prefetch_stop = false;
+	chunk_next_idx = 0;
+	k_sem_init(&chunk_free, 2, 2);
+	k_sem_reset(&chunk_full);
+	k_thread_create(&prefetch_thread, prefetch_stack, K_THREAD_STACK_SIZEOF(prefetch_stack),
+			prefetch_fn, NULL, NULL, NULL, K_PRIO_PREEMPT(8), 0, K_NO_WAIT);
+	k_thread_name_set(&prefetch_thread, "rs9116_prefetch");
+#endif
+	return 0;
+}
+
+static void chunks_stop(void)
+{
+#ifdef CONFIG_TMO_RS9116_DFU_PREFETCH
+	prefetch_stop = true;
+	k_sem_give(&chunk_free);
+	k_thread_join(&prefetch_thread, K_FOREVER);
+	tmo_xfer_buf_release(chunk_buf[1]);
+#endif
+	tmo_xfer_buf_release(chunk_buf[0]);
+}
+
+/* Next chunk of the image in *buf, return its length */
+static int chunk_next(uint8_t **buf)
+{
+	int64_t start = k_uptime_get();
+	int len;
+
+#ifdef CONFIG_TMO_RS9116_DFU_PREFETCH
+	k_sem_take(&chunk_full, K_FOREVER);
+	*buf = chunk_buf[chunk_next_idx];
+	len = chunk_len[chunk_next_idx];
+	chunk_next_idx ^= 1;
+#else
+	*buf = chunk_buf[0];
+	len = chunk_read(chunk_buf[0]);
+#endif
+	phase.stall_ms += k_uptime_get() - start;
+	return len;
+}
+
+/* Hand the buffer from chunk_next() back once it has been written */
+static void chunk_done(void)
+{
+#ifdef CONFIG_TMO_RS9116_DFU_PREFETCH
+	k_sem_give(&chunk_free);
+#endif
+}
+
+/* Poll the bootloader until it reports ready or the timeout passes */
+static int wait_bootloader_ready(uint32_t *waited_ms)
+{
+	int64_t start = k_uptime_get();
+	int64_t deadline = start + CONFIG_TMO_RS9116_DFU_READY_TIMEOUT_SECS * MSEC_PER_SEC;
+	int16_t ret;
+
+	while ((ret = rsi_bl_waitfor_boardready()) != RSI_SUCCESS &&
+			k_uptime_get() < deadline) {
+		k_msleep(CONFIG_TMO_RS9116_DFU_POLL_MS);
+	}
+	*waited_ms = k_uptime_get() - start;
+	return ret == RSI_SUCCESS ? 0 : -ETIMEDOUT;
+}
+
+/*
+ * The bootloader stops answering while it commits the last chunk to flash.
+ * Only a busy poll followed by a ready one shows that the commit happened
+ * and finished; a board that is ready on the first poll, or never again,
+ * is unconfirmed and gets the fixed settle time before anything resets it.
+ *
+ * Returns 0 only for the confirmed case, which callers treat as success.
+ * -EAGAIN means the board stayed ready for the whole settle time without
+ * ever going busy, -ETIMEDOUT that it went quiet and did not come back.
+ */
+static int wait_commit_done(uint32_t *waited_ms)
+{
+	int64_t start = k_uptime_get();
+	int64_t deadline = start + CONFIG_TMO_RS9116_DFU_READY_TIMEOUT_SECS * MSEC_PER_SEC;
+	int64_t settle_until = start + DFU_RS9116W_UPDATE_SECS * MSEC_PER_SEC;
+	bool busy = false;
+	int err = -ETIMEDOUT;
+
+	while (k_uptime_get() < deadline) {
+		if (rsi_bl_waitfor_boardready() != RSI_SUCCESS) {
+			busy = true;
+		} else if (busy) {
+			err = 0;
+			break;
+		} else if (k_uptime_get() >= settle_until) {
+			/* Ready all along, polling longer would not tell more */
+			err = -EAGAIN;
+			break;
+		}
+		k_msleep(CONFIG_TMO_RS9116_DFU_POLL_MS);
+	}
+	if (err && !busy) {
+		/* The ready timeout was set below the settle time */
+		err = -EAGAIN;
+	}
+	if (err) {
+		printf("RS9116W commit %s after %d seconds\n",
+				err == -EAGAIN ? "not seen" : "timed out",
+				(int)((k_uptime_get() - start) / MSEC_PER_SEC));
+		if (settle_until > k_uptime_get()) {
+			k_sleep(K_MSEC(settle_until - k_uptime_get()));
+		}
+	}
+	*waited_ms = k_uptime_get() - start;
+	return err;
+}
+
+/* Send the image chunk by chunk, the first one carries the RPS header */
+static int write_chunks(void)
+{
+	uint8_t *chunk;
+	int64_t start;
+	uint32_t *elapsed;
+	uint8_t flags;
+	int len;
+
+	len = chunk_next(&chunk);
+	if (len <= 0) {
+		printf("file system flash read failed\n");
+		return -EIO;
+	}
+
+	fw_image_size = get_rs9116_fw_size((char *)chunk);
+
+	/* Calculate the total number of chunks */
+	chunk_check = (fw_image_size / RSI_CHUNK_SIZE);
+	if (fw_image_size % RSI_CHUNK_SIZE) {
+		chunk_check += 1;
+	}
+
+	for (chunk_cnt = 0; chunk_cnt < chunk_check; chunk_cnt++) {
+		if (chunk_cnt != 0) {
+			len = chunk_next(&chunk);
+			if (len <= 0) {
+				printf("\nfile system flash read failed at chunk %d\n", chunk_cnt);
+				return -EIO;
+			}
+		}
+		elapsed = &phase.write_ms;
+		if (chunk_cnt == 0) {
+			printf("RS9116W FW update - starts here with - 1st Chunk\n");
+			flags = RSI_START_OF_FILE;
+		} else if (chunk_cnt == (chunk_check - 1)) {
+			printf("\nfinalizing with last chunk\n");
+			flags = RSI_END_OF_FILE;
+			elapsed = &phase.finalize_ms;
+		} else {
+			flags = RSI_IN_BETWEEN_FILE;
+		}
+
+		start = k_uptime_get();
+		status = rsi_bl_upgrade_firmware(chunk, RSI_CHUNK_SIZE, flags);
+		*elapsed += k_uptime_get() - start;
+		chunk_done();
+		if (status != RSI_SUCCESS) {
+			printf("\nChunk %d RSI_ERROR: %d\n", chunk_cnt, status);
+			return -EIO;
+		}
+		printk(".");
+		offset += RSI_CHUNK_SIZE;
+	}
 	return 0;
 }
 
 uint8_t fwUpgradeDone = 0;
+static bool defer_reboot;
 int32_t dfu_wifi_write_image(void)
 {
+	rs9116w_app_cb.state = RS9116W_INITIAL_STATE;
+	fwUpgradeDone = 0;
+	chunk_cnt = 0;
+	offset = 0;
+	memset(&phase, 0, sizeof(phase));
+
 	rsi_device_deinit();
 
 	int32_t err = rsi_wlan_disconnect();
@@ -165,9 +408,9 @@ int32_t dfu_wifi_write_image(void)
 		printf("RS9116 RESET Pin ready\n");
 	}
 
-	err = rsi_bl_waitfor_boardready();
+	err = wait_bootloader_ready(&phase.ready_ms);
 	if (!err) {
-		printf("RS9116 boardready was successful %d \n", err);
+		printf("RS9116 boardready after %u ms\n", phase.ready_ms);
 	} else   {
 		printf("RS9116 boardready failed! %d\n", err);
 		// return -ENODEV;
@@ -182,6 +425,7 @@ int32_t dfu_wifi_write_image(void)
 	}
 
 	printf("\nChecking for /tmo/rs9116_file.rps to be present\n");
+	fs_file_t_init(&rs9116file);
 	if (fs_open(&rs9116file, rs9116_name, FS_O_READ) != 0) {
 		printf("The file %s is missing - please run the sample/dfu_https_download to add it\n", "/tmo/rs9116_file.rps");
 		return 1;
@@ -208,63 +452,17 @@ int32_t dfu_wifi_write_image(void)
 
 			case RS9116W_FW_UPGRADE:
 				{
-					if (file_read_flash(offset) != 0) {
-						printf("file system flash read failed\n");
-						return (-1);
+					status = chunks_start();
+					if (status == 0) {
+						status = write_chunks();
+						chunks_stop();
 					}
-
-					/* Send the first chunk to extract header */
-					fw_image_size = get_rs9116_fw_size((char *)recv_buffer);
-
-					/* Calculate the total number of chunks */
-					chunk_check = (fw_image_size / RSI_CHUNK_SIZE);
-					if (fw_image_size % RSI_CHUNK_SIZE) {
-						chunk_check += 1;
+					fs_close(&rs9116file);
+					if (status) {
+						return status;
 					}
-
-					/* Loop until all the chunks are read and written */
-					while (offset <= fw_image_size) {
-						if (chunk_cnt == chunk_check) {
-							/* printf("RSs9116 FW upgrade started\n"); */
-							// break;
-						}
-						if (chunk_cnt != 0) {
-							if (file_read_flash(offset) != 0) {
-								printf("file system flash read failed\n");
-								return (-1);
-							}
-							//printf("chunk_cnt: %d\n", chunk_cnt);
-						}
-						if (chunk_cnt == 0) {
-							printf("RS9116W FW update - starts here with - 1st Chunk\n");
-							status = rsi_bl_upgrade_firmware((uint8_t *)recv_buffer, RSI_CHUNK_SIZE, RSI_START_OF_FILE);
-							if (status != RSI_SUCCESS) {
-								printf("1st Chunk RSI_ERROR: %d\n", status);
-								return (-1);
-							}
-							printk(".");
-						} else if (chunk_cnt == (chunk_check - 1)) {
-							printf("\nplease wait for 2 minutes, finalizing with last chunk\n");
-							status = rsi_bl_upgrade_firmware((uint8_t *)recv_buffer, RSI_CHUNK_SIZE, RSI_END_OF_FILE);
-							if (status != RSI_SUCCESS) {
-								printf("last Chunk RSI_ERROR: %d\n", status);
-								break;
-							}
-							printf("\r\nRS9116W FW update success\n");
-							rs9116w_app_cb.state = RS9116W_FW_UPGRADE_DONE;
-						} else   {
-							printk(".");
-							//printf("\nRS9116W FW update - continues with in-between Chunks\n");
-							status = rsi_bl_upgrade_firmware((uint8_t *)recv_buffer, RSI_CHUNK_SIZE, RSI_IN_BETWEEN_FILE);
-							if (status != RSI_SUCCESS) {
-								printf("in-between Chunks RSI_ERROR: %d\n", status);
-								break;
-							}
-						}
-						offset += RSI_CHUNK_SIZE;
-						memset(recv_buffer, 0, sizeof(recv_buffer));
-						chunk_cnt++;
-					}       /* end While Loop */
+					printf("\r\nRS9116W FW update success\n");
+					rs9116w_app_cb.state = RS9116W_FW_UPGRADE_DONE;
 				}               /* End case of  */
 				break;
 
@@ -272,9 +470,21 @@ int32_t dfu_wifi_write_image(void)
 				{
 					fwUpgradeDone = 1;
 					printf("total bytes read       = %d bytes\n", totalreadbytes);
-					printf("Sleeping for 40 seconds to finish the update\n");
-					k_sleep(K_SECONDS(40));
-					printf("RS9116W FW update was successful - rebooting now\n");
+
+					status = wait_commit_done(&phase.boot_ms);
+					printf("RS9116W phases: ready %u ms, read %u ms, read stall %u ms, "
+							"write %u ms, finalize %u ms, boot %u ms\n",
+							phase.ready_ms, phase.read_ms, phase.stall_ms,
+							phase.write_ms, phase.finalize_ms, phase.boot_ms);
+					tmo_dfu_timing_add(DFU_9116W, TMO_DFU_STAGE_PROGRAM,
+							phase.write_ms + phase.finalize_ms, totalreadbytes);
+					tmo_dfu_timing_add(DFU_9116W, TMO_DFU_STAGE_REBOOT_WAIT,
+							phase.ready_ms + phase.boot_ms, 0);
+					if (defer_reboot) {
+						break;
+					}
+					printf("RS9116W FW update %s - rebooting now\n",
+							status ? "is unconfirmed" : "was successful");
 					k_sleep(K_SECONDS(2));
 					sys_reboot(SYS_REBOOT_COLD);
 				}
@@ -306,6 +516,11 @@ int dfu_wifi_firmware_upgrade(void)
 {
 	int ret = 0;
 	printf("*** Performing the Silabs RS9116W FW update ***\n");
-	dfu_wifi_write_image();
+	ret = dfu_wifi_write_image();
 	return ret;
 }
+
+void dfu_wifi_defer_reboot(bool defer)
+{
+	defer_reboot = defer;
+}
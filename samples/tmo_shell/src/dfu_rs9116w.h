@@ -7,10 +7,19 @@
 #ifndef DFU_RS9116W_H
 #define DFU_RS9116W_H
 
+#include <stdbool.h>
+
 #define DFU_RS9116W_FW_VER_SIZE 20
+/* Time the RS9116W needs after the last chunk when the commit is not seen */
+#define DFU_RS9116W_UPDATE_SECS 40
 
 int dfu_wifi_firmware_upgrade(void);
 int32_t dfu_wifi_write_image(void);
 int dfu_wifi_get_version(char *rsi_fw_version);
+/*
+ * Return once the image is written and committed, without rebooting. An
+ * unconfirmed commit returns an error after DFU_RS9116W_UPDATE_SECS.
+ */
+void dfu_wifi_defer_reboot(bool defer);
 
 #endif
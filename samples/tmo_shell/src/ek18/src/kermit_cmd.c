@@ -110,6 +110,8 @@ ULONG fileinfo(struct k_data *, UCHAR *, UCHAR *, int, short *, short);
 
 extern UCHAR *o_buf;                   /* Must be defined in io.c */
 extern UCHAR *i_buf;                   /* Must be defined in io.c */
+extern int zek_bufs_get(void);          /* Point them into a transfer buffer */
+extern void zek_bufs_put(void);
 extern int errno;
 
 /* Data global to this module */
@@ -318,8 +320,13 @@ int ekermit_main(int argc, char ** argv);
 #ifdef ekermit_thread
 void ekermit_entry(void *shell, void *argc, void *argv)
 {
+    if (zek_bufs_get()) {
+        shell_error(shell, "No free transfer buffer, see tmo bufs");
+        return;
+    }
     shell_print(shell, "ekermit started");
     int stat = ekermit_main(*(int*)argc, argv);
+    zek_bufs_put();
     shell_print(shell, "ekermit exited with status %d", stat);
 }
 
@@ -381,10 +388,15 @@ void ctrlc_cb(struct k_timer *timer)
 int cmd_ekermit(const struct shell* shell, int argc, char ** argv)
 {
     log_shell = shell;
+    if (zek_bufs_get()) {
+        shell_error(shell, "No free transfer buffer, see tmo bufs");
+        return -EBUSY;
+    }
     zek_ctrl_c_sent = false;
     k_timer_start(&ctrl_c_chk_timer, K_MSEC(500), K_MSEC(500));
     ekermit_main(argc, argv);
     k_timer_stop(&ctrl_c_chk_timer);
+    zek_bufs_put();
     return 0;
 }
 #endif
@@ -20,9 +20,31 @@
 
 // UCHAR o_buf[OBUFLEN+8];			/* File output buffer */
 // UCHAR i_buf[IBUFLEN+8];			/* File output buffer */
-extern uint8_t mxfer_buf[];
-UCHAR *i_buf = (UCHAR*)mxfer_buf;
-UCHAR *o_buf = (UCHAR*)&mxfer_buf[2048];
+extern uint8_t *tmo_xfer_buf_acquire(const char *owner, k_timeout_t timeout);
+extern void tmo_xfer_buf_release(uint8_t *buf);
+UCHAR *i_buf;
+UCHAR *o_buf;
+static uint8_t *zek_buf;
+
+/* Both file buffers share one shell transfer buffer while kermit runs */
+int zek_bufs_get(void)
+{
+    zek_buf = tmo_xfer_buf_acquire("kermit", K_NO_WAIT);
+    if (zek_buf == NULL) {
+        return -1;
+    }
+    i_buf = (UCHAR*)zek_buf;
+    o_buf = (UCHAR*)&zek_buf[2048];
+    return 0;
+}
+
+void zek_bufs_put(void)
+{
+    tmo_xfer_buf_release(zek_buf);
+    zek_buf = NULL;
+    i_buf = NULL;
+    o_buf = NULL;
+}
 
 bool zek_ctrl_c_sent;
 
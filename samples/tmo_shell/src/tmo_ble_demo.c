@@ -37,6 +37,7 @@
 #include "tmo_gnss.h"
 #include "tmo_smp.h"
 #include "tmo_shell.h"
+#include "tmo_link_mgr.h"
 #include "tmo_battery_ctrl.h"
 #include "board.h"
 
@@ -776,9 +777,12 @@ void ble_wifi_status_retrieve(void *a, void *b, void *c)
 	ARG_UNUSED(c);
 	while (1) {
 		k_sem_take(&wifi_status_refresh_sem, K_FOREVER);
-		struct net_if *iface = net_if_get_by_index(2); //Hardcoded for now
+		int idx = tmo_link_wifi_iface();
+		struct net_if *iface = idx > 0 ? net_if_get_by_index(idx) : NULL;
 
-		net_mgmt(NET_REQUEST_WIFI_STATUS, iface, NULL, 0);
+		if (iface) {
+			net_mgmt(NET_REQUEST_WIFI_STATUS, iface, NULL, 0);
+		}
 	}
 }
 
@@ -18,6 +18,7 @@
 #include "tmo_shell.h"
 #include "ca_certificate.h"
 #include "tmo_http_request.h"
+#include "tmo_xfer_buf.h"
 
 #define CERT_BIN_LOCATION "/tmo/certs/cert.bin"
 #define CERT_BIN_FOLDER "/tmo/certs/"
@@ -27,8 +28,9 @@
 unsigned char ca_cert[2048] = {0};
 int ca_cert_sz = 0;
 int ca_cert_idx = 0;
-extern uint8_t mxfer_buf[];
-static char *dec_buf = &mxfer_buf[2000];
+/* Cert info text at the start of a pool buffer, the decoded cert after it */
+static char *cert_buf;
+static char *dec_buf;
 static int cert_cnt, success_cnt;
 mbedtls_x509_crt ca_x509;
 
@@ -37,6 +39,23 @@ struct cert_record {
 	uint16_t cert_sz;
 };
 
+static int cert_buf_get(const char *owner)
+{
+	cert_buf = (char *)tmo_xfer_buf_acquire(owner, K_NO_WAIT);
+	if (cert_buf == NULL) {
+		return -EBUSY;
+	}
+	dec_buf = cert_buf + 2000;
+	return 0;
+}
+
+static void cert_buf_put(void)
+{
+	tmo_xfer_buf_release((uint8_t *)cert_buf);
+	cert_buf = NULL;
+	dec_buf = NULL;
+}
+
 
 int cmd_tmo_cert_load(const struct shell *shell, size_t argc, char **argv)
 {
@@ -101,9 +120,14 @@ int cmd_tmo_cert_list(const struct shell *shell, size_t argc, char **argv)
 	int idx = 0, stat;
 	char *filename = CERT_BIN_LOCATION;
 	struct fs_file_t file = {0};
+	if (cert_buf_get("cert_list")) {
+		shell_error(shell, "No free transfer buffer, see tmo bufs");
+		return -EBUSY;
+	}
 	stat = fs_open(&file, filename, FS_O_READ);
 	if (stat) {
 		shell_error(shell, "Failed to open file %s (%d)", filename, stat);
+		cert_buf_put();
 		return -EIO;
 	}
 	while (1){
@@ -112,10 +136,12 @@ int cmd_tmo_cert_list(const struct shell *shell, size_t argc, char **argv)
 		stat = fs_read(&file, &rec, sizeof(rec));
 		if (stat == 0) {
 			fs_close(&file);
+			cert_buf_put();
 			return 0;
 		} else if (stat != sizeof(rec)) {
 			shell_error(shell, "Bad entry in %s", filename);
 			fs_close(&file);
+			cert_buf_put();
 			return -EIO;
 		}
 		memcpy(cn_buf, rec.cert_cn, 64);
@@ -128,10 +154,10 @@ int cmd_tmo_cert_list(const struct shell *shell, size_t argc, char **argv)
 			fs_read(&file, dec_buf, sys_be16_to_cpu(rec.cert_sz));
 			mbedtls_x509_crt_init(&ca_x509);
 			mbedtls_x509_crt_parse_der_nocopy(&ca_x509, dec_buf, sys_be16_to_cpu(rec.cert_sz));
-			mbedtls_x509_crt_info(mxfer_buf, 2000, "", &ca_x509);
+			mbedtls_x509_crt_info(cert_buf, 2000, "", &ca_x509);
 			mbedtls_x509_crt_free(&ca_x509);
 			memset(dec_buf, 0, 3000);
-			subject_dn = strstr(mxfer_buf, "subject name");
+			subject_dn = strstr(cert_buf, "subject name");
 			subject_dn = strstr(subject_dn, ":") + 2;
 			subject_eol = strstr(subject_dn, "\n");
 			memcpy(dec_buf, subject_dn, subject_eol - subject_dn);
@@ -148,12 +174,17 @@ int cmd_tmo_cert_info(const struct shell *shell, size_t argc, char **argv)
 		shell_error(shell, "No cert loaded");
 		return -EINVAL;
 	}
-	memset(mxfer_buf, 0, 2048);
+	if (cert_buf_get("cert_info")) {
+		shell_error(shell, "No free transfer buffer, see tmo bufs");
+		return -EBUSY;
+	}
+	memset(cert_buf, 0, 2048);
 	mbedtls_x509_crt_init(&ca_x509);
 	mbedtls_x509_crt_parse_der_nocopy(&ca_x509, ca_cert, ca_cert_sz);
-	mbedtls_x509_crt_info(mxfer_buf, 2048, "  ", &ca_x509);
+	mbedtls_x509_crt_info(cert_buf, 2048, "  ", &ca_x509);
 	mbedtls_x509_crt_free(&ca_x509);
-	shell_print(shell, "Loaded cert info:\n%s", mxfer_buf);
+	shell_print(shell, "Loaded cert info:\n%s", cert_buf);
+	cert_buf_put();
 	return 0;
 }
 
@@ -277,7 +308,7 @@ int tmo_cert_dld(int devid, char *url)
 		goto exit;
 	}
 
-	http_total_received = tmo_http_download(devid, url, "/tmo/certs.tmp", NULL);
+	http_total_received = tmo_http_download(devid, url, "/tmo/certs.tmp", NULL, TMO_USAGE_CERTS);
 	
 	if (http_total_received <= 0) {
 		goto exit;
@@ -292,14 +323,22 @@ int tmo_cert_dld(int devid, char *url)
 	ssize_t read;
 	char frag_buf[64];
 
+	ret = cert_buf_get("cert_dld");
+	if (ret != 0) {
+		printf("Error: no free transfer buffer\n");
+		goto exit;
+	}
 	cert_cnt = 0;
 	success_cnt = 0;
+	buf_idx = 0;
+	memset(dec_buf, 0, 3000);
 
 	printf("\n");
 	do {
 		read = fs_read(&tmp_file, frag_buf, 64);
 		parse(&file, frag_buf, read);
 	} while (read);
+	cert_buf_put();
 
 	fs_close(&tmp_file);
 	fs_unlink("/tmo/certs.tmp");
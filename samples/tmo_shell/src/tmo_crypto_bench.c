@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <mbedtls/ccm.h>
+#include <mbedtls/chachapoly.h>
+#include <mbedtls/gcm.h>
+#include <mbedtls/sha256.h>
+
+#include "tmo_crypto_bench.h"
+
+/*
+ * Bulk TLS record crypto on the MCU, one TLS record sized block at a time.
+ * This only needs the kernel and mbedTLS, so it runs unchanged on
+ * native_sim to compare against the target.
+ */
+
+static uint8_t plain[TMO_CRYPTO_BENCH_BLOCK];
+static uint8_t cipher[TMO_CRYPTO_BENCH_BLOCK];
+static uint8_t scratch[TMO_CRYPTO_BENCH_BLOCK];
+static const uint8_t key[32] = {
+	0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+	0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4,
+};
+static const uint8_t iv[12] = {0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88};
+static uint8_t tag[16];
+
+static union {
+#if defined(MBEDTLS_GCM_C)
+	mbedtls_gcm_context gcm;
+#endif
+#if defined(MBEDTLS_CCM_C)
+	mbedtls_ccm_context ccm;
+#endif
+#if defined(MBEDTLS_CHACHAPOLY_C)
+	mbedtls_chachapoly_context chachapoly;
+#endif
+#if defined(MBEDTLS_SHA256_C)
+	mbedtls_sha256_context sha256;
+#endif
+	int none;
+} ctx;
+
+enum bench_alg {
+	BENCH_AES128_GCM,
+	BENCH_AES256_GCM,
+	BENCH_AES128_CCM,
+	BENCH_CHACHAPOLY,
+	BENCH_SHA256,
+};
+
+static int bench_op(enum bench_alg alg, bool enc)
+{
+	switch (alg) {
+#if defined(MBEDTLS_GCM_C)
+	case BENCH_AES128_GCM:
+	case BENCH_AES256_GCM:
+		return enc ? mbedtls_gcm_crypt_and_tag(&ctx.gcm, MBEDTLS_GCM_ENCRYPT, sizeof(plain),
+				iv, sizeof(iv), NULL, 0, plain, cipher, sizeof(tag), tag) :
+			mbedtls_gcm_auth_decrypt(&ctx.gcm, sizeof(cipher), iv, sizeof(iv), NULL, 0,
+				tag, sizeof(tag), cipher, scratch);
+#endif
+#if defined(MBEDTLS_CCM_C)
+	case BENCH_AES128_CCM:
+		return enc ? mbedtls_ccm_encrypt_and_tag(&ctx.ccm, sizeof(plain), iv, sizeof(iv),
+				NULL, 0, plain, cipher, tag, sizeof(tag)) :
+			mbedtls_ccm_auth_decrypt(&ctx.ccm, sizeof(cipher), iv, sizeof(iv), NULL, 0,
+				cipher, scratch, tag, sizeof(tag));
+#endif
+#if defined(MBEDTLS_CHACHAPOLY_C)
+	case BENCH_CHACHAPOLY:
+		return enc ? mbedtls_chachapoly_encrypt_and_tag(&ctx.chachapoly, sizeof(plain), iv,
+				NULL, 0, plain, cipher, tag) :
+			mbedtls_chachapoly_auth_decrypt(&ctx.chachapoly, sizeof(cipher), iv, NULL, 0,
+				tag, cipher, scratch);
+#endif
+#if defined(MBEDTLS_SHA256_C)
+	case BENCH_SHA256:
+		return mbedtls_sha256_update(&ctx.sha256, plain, sizeof(plain));
+#endif
+	default:
+		return -ENOTSUP;
+	}
+}
+
+/* Blocks per second of op, run for ms */
+static uint32_t bench_rate(enum bench_alg alg, bool enc, uint32_t ms)
+{
+	int64_t start = k_uptime_get();
+	int64_t elapsed;
+	uint32_t blocks = 0;
+
+	do {
+		if (bench_op(alg, enc)) {
+			return 0;
+		}
+		blocks++;
+		elapsed = k_uptime_get() - start;
+	} while (elapsed < ms);
+	return (uint64_t)blocks * TMO_CRYPTO_BENCH_BLOCK * MSEC_PER_SEC / 1024 / elapsed;
+}
+
+static int bench_setup(enum bench_alg alg, struct tmo_crypto_bench_result *r)
+{
+	switch (alg) {
+#if defined(MBEDTLS_GCM_C)
+	case BENCH_AES128_GCM:
+	case BENCH_AES256_GCM:
+		r->name = alg == BENCH_AES128_GCM ? "AES-128-GCM" : "AES-256-GCM";
+		r->ctx_bytes = sizeof(mbedtls_gcm_context);
+		mbedtls_gcm_init(&ctx.gcm);
+		return mbedtls_gcm_setkey(&ctx.gcm, MBEDTLS_CIPHER_ID_AES, key,
+				alg == BENCH_AES128_GCM ? 128 : 256);
+#endif
+#if defined(MBEDTLS_CCM_C)
+	case BENCH_AES128_CCM:
+		r->name = "AES-128-CCM";
+		r->ctx_bytes = sizeof(mbedtls_ccm_context);
+		mbedtls_ccm_init(&ctx.ccm);
+		return mbedtls_ccm_setkey(&ctx.ccm, MBEDTLS_CIPHER_ID_AES, key, 128);
+#endif
+#if defined(MBEDTLS_CHACHAPOLY_C)
+	case BENCH_CHACHAPOLY:
+		r->name = "CHACHA20-POLY1305";
+		r->ctx_bytes = sizeof(mbedtls_chachapoly_context);
+		mbedtls_chachapoly_init(&ctx.chachapoly);
+		return mbedtls_chachapoly_setkey(&ctx.chachapoly, key);
+#endif
+#if defined(MBEDTLS_SHA256_C)
+	case BENCH_SHA256:
+		r->name = "SHA-256";
+		r->ctx_bytes = sizeof(mbedtls_sha256_context);
+		mbedtls_sha256_init(&ctx.sha256);
+		return mbedtls_sha256_starts(&ctx.sha256, 0);
+#endif
+	default:
+		return -ENOTSUP;
+	}
+}
+
+static void bench_teardown(enum bench_alg alg)
+{
+	switch (alg) {
+#if defined(MBEDTLS_GCM_C)
+	case BENCH_AES128_GCM:
+	case BENCH_AES256_GCM:
+		mbedtls_gcm_free(&ctx.gcm);
+		break;
+#endif
+#if defined(MBEDTLS_CCM_C)
+	case BENCH_AES128_CCM:
+		mbedtls_ccm_free(&ctx.ccm);
+		break;
+#endif
+#if defined(MBEDTLS_CHACHAPOLY_C)
+	case BENCH_CHACHAPOLY:
+		mbedtls_chachapoly_free(&ctx.chachapoly);
+		break;
+#endif
+#if defined(MBEDTLS_SHA256_C)
+	case BENCH_SHA256:
+		mbedtls_sha256_free(&ctx.sha256);
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Measure the record ciphers built into mbedTLS
+ *
+ * Ciphers that are not enabled in the mbedTLS configuration are skipped.
+ *
+ * @param ms time spent on each direction of each cipher
+ * @return number of results filled in
+ */
+int tmo_crypto_bench_run(uint32_t ms, struct tmo_crypto_bench_result *res, int max)
+{
+	int n = 0;
+
+	for (int i = 0; i < sizeof(plain); i++) {
+		plain[i] = i;
+	}
+	for (enum bench_alg alg = BENCH_AES128_GCM; alg <= BENCH_SHA256 && n < max; alg++) {
+		struct tmo_crypto_bench_result *r = &res[n];
+
+		memset(r, 0, sizeof(*r));
+		if (bench_setup(alg, r)) {
+			bench_teardown(alg);
+			continue;
+		}
+		r->enc_kbps = bench_rate(alg, true, ms);
+		if (alg != BENCH_SHA256) {
+			r->dec_kbps = bench_rate(alg, false, ms);
+		}
+		bench_teardown(alg);
+		n++;
+	}
+	return n;
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_CRYPTO_BENCH_H
+#define TMO_CRYPTO_BENCH_H
+
+#include <stdint.h>
+
+#define TMO_CRYPTO_BENCH_BLOCK  1024
+#define TMO_CRYPTO_BENCH_MAX    5
+
+struct tmo_crypto_bench_result {
+	const char *name;
+	uint32_t enc_kbps;    /* KB/s; for a hash, the digest rate */
+	uint32_t dec_kbps;    /* KB/s, authenticated decrypt; 0 for a hash */
+	uint32_t ctx_bytes;   /* RAM held by the algorithm context */
+};
+
+int tmo_crypto_bench_run(uint32_t ms, struct tmo_crypto_bench_result *res, int max);
+
+#endif
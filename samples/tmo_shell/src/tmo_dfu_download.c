@@ -19,17 +19,17 @@ LOG_MODULE_REGISTER(tmo_dfu_download, LOG_LEVEL_DBG);
 
 #include "ca_certificate.h"
 #include "tmo_dfu_download.h"
+#include "tmo_dfu_timing.h"
 #include "dfu_murata_1sc.h"
 #include "dfu_rs9116w.h"
 #include "tmo_shell.h"
 #include "tmo_http_request.h"
+#include "tmo_xfer_buf.h"
 
 extern const struct dfu_file_t dfu_files_mcu[];
 extern const struct dfu_file_t dfu_files_modem[];
 extern const struct dfu_file_t dfu_files_rs9116w[];
 
-extern uint8_t mxfer_buf[];
-
 mbedtls_sha1_context sha1_ctx;
 unsigned char sha1_output[20];
 
@@ -44,6 +44,7 @@ static char user_base_url_s[MAX_BASE_URL_LEN] =
 static char dfu_auth_key[42];
 
 static int iface_s = WIFI_ID; // Default iface is wifi
+static bool mcu_compressed;
 
 char *dfu_target_str(enum dfu_tgts dfu_tgt) {
 	switch(dfu_tgt) {
@@ -59,6 +60,7 @@ int dfu_download(const struct dfu_file_t *dfu_file, enum dfu_tgts dfu_tgt)
 	int ret;
 	unsigned char sha1_output[20];
 	char url[DFU_URL_LEN] = {0};
+	int64_t start;
 
 	ret = snprintf(url, sizeof(url) - 1, "%s%s", base_url_s, dfu_file->rfile);
 	if (ret < 0) {
@@ -79,15 +81,18 @@ int dfu_download(const struct dfu_file_t *dfu_file, enum dfu_tgts dfu_tgt)
 				digicert_ca, sizeof(digicert_ca));
 	}
 #endif
+	start = k_uptime_get();
 	if (strlen(dfu_auth_key)) {
-		ret = tmo_http_download(iface_s, url, dfu_file->lfile, dfu_auth_key);
+		ret = tmo_http_download(iface_s, url, dfu_file->lfile, dfu_auth_key, TMO_USAGE_DFU);
 	} else {
-		ret = tmo_http_download(iface_s, url, dfu_file->lfile, NULL);
+		ret = tmo_http_download(iface_s, url, dfu_file->lfile, NULL, TMO_USAGE_DFU);
 	}
 	
 	if (ret < 0) {
 		return ret;
 	}
+	tmo_dfu_timing_add(dfu_tgt, TMO_DFU_STAGE_DOWNLOAD, k_uptime_get() - start, ret);
+	start = k_uptime_get();
 
 	// mbedtls_sha1_init(&sha1_ctx);
 	memset(sha1_output, 0, sizeof(sha1_output));
@@ -98,6 +103,11 @@ int dfu_download(const struct dfu_file_t *dfu_file, enum dfu_tgts dfu_tgt)
 		LOG_ERR("Could not open file %s", dfu_file->lfile);
 		return -1;
 	}
+	uint8_t *mxfer_buf = tmo_xfer_buf_acquire("dfu_digest", K_SECONDS(1));
+	if (mxfer_buf == NULL) {
+		fs_close(&file);
+		return -ENOMEM;
+	}
 
 	int readbytes = 0;
 	int totalbytes = 0;
@@ -108,6 +118,7 @@ int dfu_download(const struct dfu_file_t *dfu_file, enum dfu_tgts dfu_tgt)
 		readbytes = fs_read(&file, mxfer_buf, 4096);
 		if (readbytes < 0) {
 			LOG_ERR("Could not read file %s", dfu_file->lfile);
+			tmo_xfer_buf_release(mxfer_buf);
 			fs_close(&file);
 			return 0;
 		}
@@ -123,9 +134,11 @@ int dfu_download(const struct dfu_file_t *dfu_file, enum dfu_tgts dfu_tgt)
 			//printf("done %d\n", readbytes);
 		}
 	}
+	tmo_xfer_buf_release(mxfer_buf);
 	printf("\ntotal bytes read %d\n", totalbytes);
 
 	mbedtls_sha1_finish(&sha1_ctx, sha1_output);
+	tmo_dfu_timing_add(dfu_tgt, TMO_DFU_STAGE_DIGEST, k_uptime_get() - start, totalbytes);
 
 	/*
 	   printf("\nInFlash  SHA1: ");
@@ -171,13 +184,14 @@ void generate_mcu_filename(struct dfu_file_t *dfu_files_mcu, char *base, int slo
 		/* BIN	*/
 		sprintf(dfu_files_mcu[i].desc, "%s %d/%d", base ,i+1, total_files);
 		sprintf(dfu_files_mcu[i].lfile, "/tmo/zephyr.slot%d.bin", i-1);
-		sprintf(dfu_files_mcu[i].rfile, "%s.%s.slot%d.bin",base,version, i-1);
+		sprintf(dfu_files_mcu[i].rfile, "%s.%s.slot%d.bin%s",base,version, i-1,
+				mcu_compressed ? ".hs" : "");
 		memset(dfu_files_mcu[i].sha1, 0, DFU_SHA1_LEN);
 
-		/* SHA1 */
+		/* SHA1, always of the raw image */
 		sprintf(dfu_files_mcu[i+slots].desc, "%s %d/%d", base,(i+slots)+1, total_files);
 		sprintf(dfu_files_mcu[i+slots].lfile, "%s.sha1", dfu_files_mcu[i].lfile);
-		sprintf(dfu_files_mcu[i+slots].rfile, "%s.sha1",dfu_files_mcu[i].rfile);
+		sprintf(dfu_files_mcu[i+slots].rfile, "%s.%s.slot%d.bin.sha1",base,version, i-1);
 		memset(dfu_files_mcu[i+slots].sha1, 0, DFU_SHA1_LEN);
 	}
 }
@@ -231,8 +245,16 @@ int tmo_dfu_download(const struct shell *shell, enum dfu_tgts dfu_tgt, char *bas
 
 	int total = 0;
 	int idx = 0;
+
+	tmo_dfu_timing_reset(dfu_tgt);
 	while (strlen(dfu_files[idx].desc)) {
-		total += dfu_download(&dfu_files[idx++], dfu_tgt);
+		int ret = dfu_download(&dfu_files[idx++], dfu_tgt);
+
+		if (ret < 0) {
+			printf("\nDownload failed: %d\n", ret);
+			return ret;
+		}
+		total += ret;
 	}
 	printf("\nTotal size downloaded: %d\n", total);
 	printf("Done!\n");
@@ -272,9 +294,9 @@ const char *get_dfu_base_url()
 
 int set_dfu_iface_type(int iface)
 {
-	if (iface < 1 || iface > 2) {
+	if (iface < 0 || iface > 2) {
 		printf("error: invalid iface\n");
-		printf("use 1 for modem, 2 for wifi");
+		printf("use 0 for auto, 1 for modem, 2 for wifi");
 		return -1;
 	}
 
@@ -286,3 +308,18 @@ int get_dfu_iface_type()
 {
 	return iface_s;
 }
+
+int set_dfu_compressed(bool compressed)
+{
+	if (compressed && !IS_ENABLED(CONFIG_DFU_GECKO_HEATSHRINK)) {
+		printf("error: compressed images are not supported by this build\n");
+		return -ENOTSUP;
+	}
+	mcu_compressed = compressed;
+	return 0;
+}
+
+bool get_dfu_compressed(void)
+{
+	return mcu_compressed;
+}
@@ -36,11 +36,15 @@ enum dfu_tgts {
 	DFU_9116W
 };
 
+char *dfu_target_str(enum dfu_tgts dfu_tgt);
 int tmo_dfu_download(const struct shell *shell, enum dfu_tgts dfu_tgt, char *filename, char *version);
 int set_dfu_base_url(char *base_url);
 int set_dfu_auth_key(char *auth_key);
 const char *get_dfu_base_url(void);
 int set_dfu_iface_type(int iface);
 int get_dfu_iface_type(void);
+/* Fetch MCU slot images packed by scripts/fw_pack.py (<name>.bin.hs) */
+int set_dfu_compressed(bool compressed);
+bool get_dfu_compressed(void);
 
 #endif
@@ -0,0 +1,495 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_dfu_plan, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zephyr/kernel.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/sys/reboot.h>
+
+#include "tmo_dfu_plan.h"
+#include "tmo_dfu_timing.h"
+
+#define MANIFEST_MAX 512
+
+/*
+ * The modem goes first so its three minute install runs while the RS9116W
+ * and MCU images are written; the MCU image only becomes active on the
+ * final reboot, so it goes last.
+ */
+static const enum dfu_tgts apply_order[TMO_DFU_TARGETS] = {
+	DFU_MODEM, DFU_9116W, DFU_GECKO
+};
+
+static char manifest_buf[MANIFEST_MAX];
+static bool applied_this_boot;
+
+const char *tmo_dfu_state_str(enum tmo_dfu_state state)
+{
+	switch (state) {
+	case TMO_DFU_PLANNED: return "planned";
+	case TMO_DFU_CURRENT: return "current";
+	case TMO_DFU_DEFERRED: return "deferred";
+	case TMO_DFU_BLOCKED: return "blocked";
+	case TMO_DFU_DOWNLOADED: return "downloaded";
+	case TMO_DFU_APPLIED: return "applied";
+	default: return "failed";
+	}
+}
+
+static int target_from_name(const char *name)
+{
+	for (int tgt = DFU_GECKO; tgt <= DFU_9116W; tgt++) {
+		if (!strcasecmp(name, dfu_target_str(tgt))) {
+			return tgt;
+		}
+	}
+	return -1;
+}
+
+/* "1.2" matches "1.2" and "1.2.0" but not "11.2.0" or "1.20" */
+static bool version_match(const char *running, const char *want)
+{
+	size_t len = strlen(want);
+
+	return len && !strncmp(running, want, len) &&
+		(running[len] == '\0' || running[len] == '.');
+}
+
+static void read_running(enum dfu_tgts tgt, char *ver)
+{
+	memset(ver, 0, TMO_DFU_VERSION_LEN);
+
+	switch (tgt) {
+	case DFU_GECKO:
+#ifdef BOOT_SLOT
+		if (get_gecko_fw_version(get_current_slot(), ver, TMO_DFU_VERSION_LEN)) {
+			ver[0] = '\0';
+		}
+#endif
+		break;
+	case DFU_MODEM:
+		{
+			char modem_ver[DFU_MODEM_FW_VER_SIZE] = {0};
+
+			if (dfu_modem_get_version(modem_ver) == 0) {
+				strncpy(ver, modem_ver, TMO_DFU_VERSION_LEN - 1);
+			}
+		}
+		break;
+	case DFU_9116W:
+		{
+			char wifi_ver[DFU_RS9116W_FW_VER_SIZE] = {0};
+
+			if (dfu_wifi_get_version(wifi_ver) == 0) {
+				strncpy(ver, wifi_ver, TMO_DFU_VERSION_LEN - 1);
+			}
+		}
+		break;
+	}
+}
+
+static struct tmo_dfu_step *find_step(struct tmo_dfu_step *steps, int count, enum dfu_tgts tgt)
+{
+	for (int i = 0; i < count; i++) {
+		if (steps[i].tgt == tgt) {
+			return &steps[i];
+		}
+	}
+	return NULL;
+}
+
+static int parse_need(char *tok, struct tmo_dfu_step *step)
+{
+	char *ver = strchr(tok, ':');
+	int tgt;
+
+	if (ver == NULL || step->need_cnt == (int)ARRAY_SIZE(step->needs)) {
+		return -EINVAL;
+	}
+	*ver++ = '\0';
+	tgt = target_from_name(tok);
+	if (tgt < 0 || tgt == step->tgt || !*ver) {
+		return -EINVAL;
+	}
+	step->needs[step->need_cnt].tgt = tgt;
+	strncpy(step->needs[step->need_cnt].version, ver, TMO_DFU_VERSION_LEN - 1);
+	step->need_cnt++;
+	return 0;
+}
+
+static int parse_manifest(char *buf, struct tmo_dfu_step *steps, int *count)
+{
+	char *line_save;
+	char *line;
+	int lineno = 0;
+
+	*count = 0;
+	for (line = strtok_r(buf, "\n", &line_save); line; line = strtok_r(NULL, "\n", &line_save)) {
+		struct tmo_dfu_step step = {0};
+		char *tok_save;
+		char *tok[3];
+		char *need;
+		int tgt;
+
+		lineno++;
+		line[strcspn(line, "\r#")] = '\0';
+		tok[0] = strtok_r(line, " \t", &tok_save);
+		if (tok[0] == NULL) {
+			continue;
+		}
+		tok[1] = strtok_r(NULL, " \t", &tok_save);
+		tok[2] = strtok_r(NULL, " \t", &tok_save);
+		tgt = target_from_name(tok[0]);
+		if (tgt < 0 || tok[2] == NULL || strlen(tok[1]) >= sizeof(step.base) ||
+				strlen(tok[2]) >= sizeof(step.version)) {
+			LOG_ERR("Manifest line %d is invalid", lineno);
+			return -EINVAL;
+		}
+		if (find_step(steps, *count, tgt)) {
+			LOG_ERR("Manifest line %d repeats %s", lineno, dfu_target_str(tgt));
+			return -EINVAL;
+		}
+		step.tgt = tgt;
+		strcpy(step.base, tok[1]);
+		strcpy(step.version, tok[2]);
+		while ((need = strtok_r(NULL, " \t", &tok_save))) {
+			if (strncmp(need, "needs=", 6) || parse_need(need + 6, &step)) {
+				LOG_ERR("Manifest line %d has a bad requirement", lineno);
+				return -EINVAL;
+			}
+		}
+		steps[(*count)++] = step;
+	}
+	return 0;
+}
+
+/* Settle each step against the running versions and the rest of the plan */
+static void resolve_needs(struct tmo_dfu_step *steps, int count)
+{
+	bool changed = true;
+
+	while (changed) {
+		changed = false;
+		for (int i = 0; i < count; i++) {
+			struct tmo_dfu_step *step = &steps[i];
+			enum tmo_dfu_state state = TMO_DFU_PLANNED;
+
+			if (step->state != TMO_DFU_PLANNED && step->state != TMO_DFU_DEFERRED) {
+				continue;
+			}
+			for (int n = 0; n < step->need_cnt; n++) {
+				struct tmo_dfu_need *need = &step->needs[n];
+				struct tmo_dfu_step *dep = find_step(steps, count, need->tgt);
+				char running[TMO_DFU_VERSION_LEN];
+
+				if (dep && dep->state != TMO_DFU_CURRENT &&
+						version_match(dep->version, need->version)) {
+					if (dep->state == TMO_DFU_BLOCKED) {
+						state = TMO_DFU_BLOCKED;
+					} else if ((dep->tgt == DFU_GECKO || dep->state == TMO_DFU_DEFERRED) &&
+							state != TMO_DFU_BLOCKED) {
+						state = TMO_DFU_DEFERRED;
+					}
+					continue;
+				}
+				if (dep && dep->state == TMO_DFU_PLANNED) {
+					/* Would be replaced by a version that does not qualify */
+					state = TMO_DFU_BLOCKED;
+					continue;
+				}
+				if (dep) {
+					strcpy(running, dep->running);
+				} else {
+					read_running(need->tgt, running);
+				}
+				if (!version_match(running, need->version)) {
+					state = TMO_DFU_BLOCKED;
+				}
+			}
+			if (state != step->state) {
+				step->state = state;
+				step->err = state == TMO_DFU_BLOCKED ? -ENOENT : 0;
+				changed = true;
+			}
+		}
+	}
+}
+
+static bool waits_on(const struct tmo_dfu_step *step, struct tmo_dfu_step *steps, int count,
+		const bool *placed)
+{
+	for (int n = 0; n < step->need_cnt; n++) {
+		struct tmo_dfu_step *dep = find_step(steps, count, step->needs[n].tgt);
+
+		if (dep && !placed[dep - steps] && dep->state == TMO_DFU_PLANNED &&
+				version_match(dep->version, step->needs[n].version)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int tmo_dfu_plan_load(const char *manifest, struct tmo_dfu_plan *plan)
+{
+	static struct tmo_dfu_step steps[TMO_DFU_TARGETS];
+	bool placed[TMO_DFU_TARGETS] = {0};
+	struct fs_file_t file;
+	int count;
+	int ret;
+
+	memset(plan, 0, sizeof(*plan));
+	memset(steps, 0, sizeof(steps));
+	fs_file_t_init(&file);
+	ret = fs_open(&file, manifest, FS_O_READ);
+	if (ret) {
+		return ret;
+	}
+	ret = fs_read(&file, manifest_buf, sizeof(manifest_buf) - 1);
+	fs_close(&file);
+	if (ret < 0) {
+		return ret;
+	}
+	if (ret == sizeof(manifest_buf) - 1) {
+		return -EFBIG;
+	}
+	manifest_buf[ret] = '\0';
+
+	ret = parse_manifest(manifest_buf, steps, &count);
+	if (ret) {
+		return ret;
+	}
+
+	for (int i = 0; i < count; i++) {
+		read_running(steps[i].tgt, steps[i].running);
+		if (version_match(steps[i].running, steps[i].version)) {
+			steps[i].state = TMO_DFU_CURRENT;
+		}
+#ifndef BOOT_SLOT
+		if (steps[i].tgt == DFU_GECKO) {
+			steps[i].state = TMO_DFU_BLOCKED;
+			steps[i].err = -ENOTSUP;
+		}
+#endif
+	}
+	resolve_needs(steps, count);
+
+	/* Apply order, moving a step behind any planned step it needs */
+	while (plan->count < count) {
+		int next = -1;
+
+		for (int o = 0; o < TMO_DFU_TARGETS && next < 0; o++) {
+			for (int i = 0; i < count; i++) {
+				if (!placed[i] && steps[i].tgt == apply_order[o] &&
+						!waits_on(&steps[i], steps, count, placed)) {
+					next = i;
+					break;
+				}
+			}
+		}
+		if (next < 0) {
+			LOG_ERR("Manifest requirements form a loop");
+			return -ELOOP;
+		}
+		placed[next] = true;
+		plan->step[plan->count++] = steps[next];
+	}
+	return 0;
+}
+
+static bool need_failed(struct tmo_dfu_plan *plan, const struct tmo_dfu_step *step)
+{
+	for (int n = 0; n < step->need_cnt; n++) {
+		struct tmo_dfu_step *dep = find_step(plan->step, plan->count, step->needs[n].tgt);
+
+		if (dep && (dep->state == TMO_DFU_FAILED || dep->state == TMO_DFU_BLOCKED)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void defer_reboots(bool defer)
+{
+#ifdef BOOT_SLOT
+	dfu_mcu_defer_reboot(defer);
+#endif
+	dfu_modem_defer_reboot(defer);
+	dfu_wifi_defer_reboot(defer);
+}
+
+static int apply_step(struct tmo_dfu_step *step, int64_t *settle_until)
+{
+	int64_t settle = 0;
+	int ret;
+
+	switch (step->tgt) {
+	case DFU_GECKO:
+#ifdef BOOT_SLOT
+		{
+			char bin_file[DFU_FILE_LEN];
+			char sha_file[DFU_FILE_LEN];
+			int slot = get_unused_slot();
+
+			snprintf(bin_file, sizeof(bin_file), "/tmo/zephyr.slot%d.bin", slot);
+			snprintf(sha_file, sizeof(sha_file), "%s.sha1", bin_file);
+			ret = dfu_mcu_firmware_upgrade(slot, bin_file, sha_file);
+		}
+#else
+		ret = -ENOTSUP;
+#endif
+		break;
+	case DFU_MODEM:
+		{
+			struct dfu_file_t dfu_modem_file = {0};
+
+			sprintf(dfu_modem_file.desc, "Murata 1SC Firmware Update");
+			snprintf(dfu_modem_file.lfile, sizeof(dfu_modem_file.lfile), "/tmo/%s.ua",
+					step->base);
+			snprintf(dfu_modem_file.rfile, sizeof(dfu_modem_file.rfile), "%s.ua",
+					step->base);
+			ret = dfu_modem_firmware_upgrade(&dfu_modem_file);
+			settle = DFU_MODEM_UPDATE_SECS * MSEC_PER_SEC;
+		}
+		break;
+	case DFU_9116W:
+		/* Fails after the fixed settle time if the commit is not seen */
+		ret = dfu_wifi_firmware_upgrade();
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	if (ret == 0 && k_uptime_get() + settle > *settle_until) {
+		*settle_until = k_uptime_get() + settle;
+	}
+	return ret > 0 ? -ENOENT : ret;
+}
+
+static void save_results(const struct tmo_dfu_plan *plan)
+{
+	struct fs_file_t file;
+	char line[80];
+
+	fs_file_t_init(&file);
+	if (fs_open(&file, TMO_DFU_RESULT_FILE, FS_O_CREATE | FS_O_WRITE)) {
+		LOG_ERR("Could not save DFU results");
+		return;
+	}
+	fs_truncate(&file, 0);
+	for (int i = 0; i < plan->count; i++) {
+		const struct tmo_dfu_step *step = &plan->step[i];
+		int len = snprintf(line, sizeof(line), "%-6s %-20s %-10s %d\n",
+				dfu_target_str(step->tgt), step->version,
+				tmo_dfu_state_str(step->state), step->err);
+
+		fs_write(&file, line, MIN(len, sizeof(line) - 1));
+	}
+	fs_close(&file);
+}
+
+int tmo_dfu_plan_run(struct tmo_dfu_plan *plan)
+{
+	int64_t settle_until = k_uptime_get();
+	int64_t modem_reset_at = 0;
+	enum dfu_tgts settle_tgt = DFU_GECKO;
+	int downloaded = 0;
+	int applied = 0;
+	int failed = 0;
+
+	if (applied_this_boot) {
+		return -EALREADY;
+	}
+
+	for (int i = 0; i < plan->count; i++) {
+		struct tmo_dfu_step *step = &plan->step[i];
+		int ret;
+
+		if (step->state != TMO_DFU_PLANNED) {
+			continue;
+		}
+		ret = tmo_dfu_download(NULL, step->tgt, step->base, step->version);
+		if (ret <= 0) {
+			step->state = TMO_DFU_FAILED;
+			step->err = ret ? ret : -EIO;
+			failed++;
+			continue;
+		}
+		step->state = TMO_DFU_DOWNLOADED;
+		step->download_bytes = ret;
+		downloaded++;
+	}
+	if (failed) {
+		printf("\n%d download(s) failed, nothing was applied\n", failed);
+		save_results(plan);
+		return -EIO;
+	}
+	if (!downloaded) {
+		return 0;
+	}
+
+	defer_reboots(true);
+	for (int i = 0; i < plan->count; i++) {
+		struct tmo_dfu_step *step = &plan->step[i];
+		int64_t prev_settle = settle_until;
+
+		if (step->state != TMO_DFU_DOWNLOADED) {
+			continue;
+		}
+		if (need_failed(plan, step)) {
+			step->state = TMO_DFU_BLOCKED;
+			step->err = -ECANCELED;
+			continue;
+		}
+		printf("\nApplying %s %s\n", dfu_target_str(step->tgt), step->version);
+		step->err = apply_step(step, &settle_until);
+		if (step->err) {
+			step->state = TMO_DFU_FAILED;
+			LOG_ERR("%s update failed: %d", dfu_target_str(step->tgt), step->err);
+			continue;
+		}
+		step->state = TMO_DFU_APPLIED;
+		applied++;
+		if (settle_until != prev_settle) {
+			settle_tgt = step->tgt;
+		}
+		if (step->tgt == DFU_MODEM) {
+			modem_reset_at = k_uptime_get();
+		}
+	}
+	save_results(plan);
+
+	if (!applied) {
+		defer_reboots(false);
+		return -EIO;
+	}
+	applied_this_boot = true;
+
+	if (settle_until > k_uptime_get()) {
+		int wait_ms = (int)(settle_until - k_uptime_get());
+
+		printf("\nWaiting %d seconds for the updates to finish\n",
+				(wait_ms + MSEC_PER_SEC - 1) / MSEC_PER_SEC);
+		k_sleep(K_MSEC(wait_ms));
+		tmo_dfu_timing_add(settle_tgt, TMO_DFU_STAGE_REBOOT_WAIT, wait_ms, 0);
+	}
+	if (modem_reset_at) {
+		/* The modem installs while the other targets are written */
+		tmo_dfu_timing_add(DFU_MODEM, TMO_DFU_STAGE_MODEM_INSTALL,
+				k_uptime_get() - modem_reset_at, 0);
+	}
+	printf("\n%d target(s) updated, rebooting now\n", applied);
+	k_sleep(K_SECONDS(2));
+	sys_reboot(SYS_REBOOT_COLD);
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_DFU_PLAN_H
+#define TMO_DFU_PLAN_H
+
+#include "tmo_dfu_download.h"
+
+#define TMO_DFU_MANIFEST_FILE "/tmo/dfu_manifest.txt"
+#define TMO_DFU_RESULT_FILE   "/tmo/dfu_result.txt"
+#define TMO_DFU_TARGETS       3
+#define TMO_DFU_VERSION_LEN   32
+
+enum tmo_dfu_state {
+	TMO_DFU_PLANNED,
+	TMO_DFU_CURRENT,      /* already running the manifest version */
+	TMO_DFU_DEFERRED,     /* needs an MCU image that is only active after a reboot */
+	TMO_DFU_BLOCKED,      /* a requirement cannot be met */
+	TMO_DFU_DOWNLOADED,
+	TMO_DFU_APPLIED,
+	TMO_DFU_FAILED,
+};
+
+struct tmo_dfu_need {
+	enum dfu_tgts tgt;
+	char version[TMO_DFU_VERSION_LEN];
+};
+
+struct tmo_dfu_step {
+	enum dfu_tgts tgt;
+	char base[DFU_FILE_LEN];
+	char version[TMO_DFU_VERSION_LEN];
+	char running[TMO_DFU_VERSION_LEN];
+	struct tmo_dfu_need needs[TMO_DFU_TARGETS - 1];
+	int need_cnt;
+	enum tmo_dfu_state state;
+	int err;
+	uint32_t download_bytes;
+};
+
+/** @brief Manifest steps, in the order they are applied */
+struct tmo_dfu_plan {
+	struct tmo_dfu_step step[TMO_DFU_TARGETS];
+	int count;
+};
+
+/**
+ * @brief Read a manifest and order its targets
+ *
+ * One target per line: "<mcu|modem|wifi> <file base> <version> [needs=<target>:<version>]...".
+ * A target already running the manifest version, or a dotted extension of
+ * it, is skipped. Requirements are met by the running version or by a planned one,
+ * in which case the required target is applied first.
+ */
+int tmo_dfu_plan_load(const char *manifest, struct tmo_dfu_plan *plan);
+
+/**
+ * @brief Download every planned target, then apply them and reboot once
+ *
+ * Nothing is applied unless all downloads succeed. Returns only when no
+ * target was applied or the plan could not start.
+ */
+int tmo_dfu_plan_run(struct tmo_dfu_plan *plan);
+
+const char *tmo_dfu_state_str(enum tmo_dfu_state state);
+
+#endif
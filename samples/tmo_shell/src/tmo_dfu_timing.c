@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_dfu_timing, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/fs/fs.h>
+
+#include "tmo_dfu_timing.h"
+
+#define TIMING_FILE_MAGIC 0x44465431 /* "DFT1" */
+
+struct timing_file {
+	uint32_t magic;
+	struct tmo_dfu_stage_time stage[TMO_DFU_TIMING_TGTS][TMO_DFU_STAGE_COUNT];
+};
+
+static struct timing_file timing = { .magic = TIMING_FILE_MAGIC };
+static bool loaded;
+static K_MUTEX_DEFINE(timing_mutex);
+
+static const char *const stage_names[TMO_DFU_STAGE_COUNT] = {
+	"download", "digest", "erase", "program", "verify",
+	"modem_xfer", "modem_install", "reboot_wait",
+};
+
+const char *tmo_dfu_stage_str(enum tmo_dfu_stage stage)
+{
+	return stage < TMO_DFU_STAGE_COUNT ? stage_names[stage] : "?";
+}
+
+/* Called with timing_mutex held */
+static void timing_load(void)
+{
+	struct timing_file saved;
+	struct fs_file_t file;
+
+	loaded = true;
+	fs_file_t_init(&file);
+	if (fs_open(&file, TMO_DFU_TIMING_FILE, FS_O_READ)) {
+		return;
+	}
+	if (fs_read(&file, &saved, sizeof(saved)) == sizeof(saved) &&
+			saved.magic == TIMING_FILE_MAGIC) {
+		timing = saved;
+	}
+	fs_close(&file);
+}
+
+/* Called with timing_mutex held */
+static void timing_save(void)
+{
+	struct fs_file_t file;
+	int ret;
+
+	fs_file_t_init(&file);
+	ret = fs_open(&file, TMO_DFU_TIMING_FILE, FS_O_CREATE | FS_O_WRITE);
+	if (ret) {
+		LOG_WRN("Could not save DFU timing: %d", ret);
+		return;
+	}
+	fs_truncate(&file, 0);
+	fs_write(&file, &timing, sizeof(timing));
+	fs_close(&file);
+}
+
+void tmo_dfu_timing_reset(enum dfu_tgts tgt)
+{
+	if (tgt >= TMO_DFU_TIMING_TGTS) {
+		return;
+	}
+	k_mutex_lock(&timing_mutex, K_FOREVER);
+	if (!loaded) {
+		timing_load();
+	}
+	memset(timing.stage[tgt], 0, sizeof(timing.stage[tgt]));
+	k_mutex_unlock(&timing_mutex);
+}
+
+void tmo_dfu_timing_add(enum dfu_tgts tgt, enum tmo_dfu_stage stage, uint32_t ms, uint32_t bytes)
+{
+	if (tgt >= TMO_DFU_TIMING_TGTS || stage >= TMO_DFU_STAGE_COUNT) {
+		return;
+	}
+	k_mutex_lock(&timing_mutex, K_FOREVER);
+	if (!loaded) {
+		timing_load();
+	}
+	timing.stage[tgt][stage].ms += ms;
+	timing.stage[tgt][stage].bytes += bytes;
+	timing_save();
+	k_mutex_unlock(&timing_mutex);
+	LOG_DBG("%s %s: %u ms, %u bytes", dfu_target_str(tgt), stage_names[stage], ms, bytes);
+}
+
+int tmo_dfu_timing_get(enum dfu_tgts tgt, struct tmo_dfu_stage_time stages[TMO_DFU_STAGE_COUNT])
+{
+	if (tgt >= TMO_DFU_TIMING_TGTS) {
+		return -EINVAL;
+	}
+	k_mutex_lock(&timing_mutex, K_FOREVER);
+	if (!loaded) {
+		timing_load();
+	}
+	memcpy(stages, timing.stage[tgt], sizeof(timing.stage[tgt]));
+	k_mutex_unlock(&timing_mutex);
+	return 0;
+}
+
+#ifdef BOOT_SLOT
+static void gecko_stage(enum dfu_gecko_stage stage, uint32_t usec, uint32_t bytes)
+{
+	/*
+	 * The image digest is already timed by tmo_dfu_download for every
+	 * target, so the library's own digest check is not added again.
+	 */
+	static const enum tmo_dfu_stage map[] = {
+		[DFU_GECKO_STAGE_DIGEST] = TMO_DFU_STAGE_COUNT,
+		[DFU_GECKO_STAGE_ERASE] = TMO_DFU_STAGE_ERASE,
+		[DFU_GECKO_STAGE_PROGRAM] = TMO_DFU_STAGE_PROGRAM,
+		[DFU_GECKO_STAGE_VERIFY] = TMO_DFU_STAGE_VERIFY,
+		[DFU_GECKO_STAGE_REBOOT_WAIT] = TMO_DFU_STAGE_REBOOT_WAIT,
+	};
+
+	if (stage < ARRAY_SIZE(map) && map[stage] != TMO_DFU_STAGE_COUNT) {
+		tmo_dfu_timing_add(DFU_GECKO, map[stage], usec / USEC_PER_MSEC, bytes);
+	}
+}
+
+static int tmo_dfu_timing_init(const struct device *dev)
+{
+	ARG_UNUSED(dev);
+	dfu_mcu_set_stage_cb(gecko_stage);
+	return 0;
+}
+
+SYS_INIT(tmo_dfu_timing_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
+#endif
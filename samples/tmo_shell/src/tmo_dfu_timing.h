@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_DFU_TIMING_H
+#define TMO_DFU_TIMING_H
+
+#include <stdint.h>
+#include "tmo_dfu_download.h"
+
+#define TMO_DFU_TIMING_FILE "/tmo/dfu_timing.bin"
+#define TMO_DFU_TIMING_TGTS 3
+
+enum tmo_dfu_stage {
+	TMO_DFU_STAGE_DOWNLOAD,
+	TMO_DFU_STAGE_DIGEST,
+	TMO_DFU_STAGE_ERASE,
+	TMO_DFU_STAGE_PROGRAM,
+	TMO_DFU_STAGE_VERIFY,
+	TMO_DFU_STAGE_MODEM_XFER,
+	TMO_DFU_STAGE_MODEM_INSTALL,
+	TMO_DFU_STAGE_REBOOT_WAIT,
+	TMO_DFU_STAGE_COUNT
+};
+
+struct tmo_dfu_stage_time {
+	uint32_t ms;
+	uint32_t bytes;
+};
+
+/** @brief Clear a target's stages, called when a new download of it starts */
+void tmo_dfu_timing_reset(enum dfu_tgts tgt);
+
+/** @brief Add time and bytes to a stage and save the table to flash */
+void tmo_dfu_timing_add(enum dfu_tgts tgt, enum tmo_dfu_stage stage, uint32_t ms, uint32_t bytes);
+
+/**
+ * @brief Copy out a target's stages
+ *
+ * After a reboot the table is reloaded from flash on first use.
+ */
+int tmo_dfu_timing_get(enum dfu_tgts tgt, struct tmo_dfu_stage_time stages[TMO_DFU_STAGE_COUNT]);
+
+const char *tmo_dfu_stage_str(enum tmo_dfu_stage stage);
+
+#endif
@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_dns_cache, LOG_LEVEL_INF);
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/net/socket.h>
+
+#include "tmo_dns_cache.h"
+
+#define DNS_NAME_LEN      TMO_DNS_NAME_LEN
+#define DNS_ADDRS         CONFIG_TMO_DNS_CACHE_ADDRS
+/*
+ * Results are only held for the length of a lookup (two racing
+ * connections and one other user at a time); callers that keep an
+ * address for a whole transfer copy it with tmo_dns_resolve_addr().
+ */
+#define DNS_RESULTS       (3 * DNS_ADDRS)
+#define DNS_FILE_MAGIC    0x534e4454  /* "TDNS" */
+#define DNS_FILE_VERSION  2
+
+struct dns_entry {
+	char name[DNS_NAME_LEN];
+	uint8_t family;
+	uint8_t iface;
+	bool in_use;
+	bool negative;
+	int err;
+	/* In the order the resolver gave them */
+	uint8_t naddr;
+	struct sockaddr addr[DNS_ADDRS];
+	socklen_t addrlen[DNS_ADDRS];
+	int64_t expires;
+	int64_t last_used;
+	uint32_t hits;
+};
+
+/* What is persisted for each positive entry */
+struct dns_file_entry {
+	char name[DNS_NAME_LEN];
+	uint8_t family;
+	uint8_t iface;
+	uint8_t naddr;
+	uint8_t reserved;
+	uint16_t addrlen[DNS_ADDRS];
+	struct sockaddr addr[DNS_ADDRS];
+};
+
+struct dns_file_hdr {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t count;
+	uint8_t addrs;        /* DNS_ADDRS, the size of each entry */
+	uint8_t reserved;
+};
+
+/* Results handed to callers, released with tmo_dns_freeaddrinfo() */
+struct dns_result {
+	bool in_use;
+	struct zsock_addrinfo ai;
+	struct sockaddr addr;
+};
+
+static struct dns_entry cache[CONFIG_TMO_DNS_CACHE_SIZE];
+static struct dns_result results[DNS_RESULTS];
+static struct tmo_dns_cache_stats stats;
+static bool loaded;
+static K_MUTEX_DEFINE(dns_mutex);
+
+static struct dns_entry *find_entry(const char *host, int family, int iface)
+{
+	for (int i = 0; i < ARRAY_SIZE(cache); i++) {
+		if (cache[i].in_use && cache[i].family == family && cache[i].iface == iface &&
+				!strcmp(cache[i].name, host)) {
+			return &cache[i];
+		}
+	}
+	return NULL;
+}
+
+/* Free slot, else the expired or least recently used entry */
+static struct dns_entry *alloc_entry(void)
+{
+	struct dns_entry *victim = &cache[0];
+	int64_t now = k_uptime_get();
+
+	for (int i = 0; i < ARRAY_SIZE(cache); i++) {
+		if (!cache[i].in_use || cache[i].expires <= now) {
+			return &cache[i];
+		}
+		if (cache[i].last_used < victim->last_used) {
+			victim = &cache[i];
+		}
+	}
+	stats.evictions++;
+	return victim;
+}
+
+#if CONFIG_TMO_DNS_CACHE_PERSIST
+static void cache_load(void)
+{
+	struct fs_file_t file;
+	struct dns_file_hdr hdr;
+	struct dns_file_entry fe;
+
+	fs_file_t_init(&file);
+	if (fs_open(&file, TMO_DNS_CACHE_FILE, FS_O_READ) != 0) {
+		return;
+	}
+	if (fs_read(&file, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != DNS_FILE_MAGIC ||
+			hdr.version != DNS_FILE_VERSION || hdr.addrs != DNS_ADDRS) {
+		fs_close(&file);
+		return;
+	}
+	/* Uptime does not survive a reboot, so warm entries get a short lifetime */
+	int64_t expires = k_uptime_get() + CONFIG_TMO_DNS_CACHE_WARM_TTL_SECS * MSEC_PER_SEC;
+	for (int i = 0; i < MIN(hdr.count, ARRAY_SIZE(cache)); i++) {
+		if (fs_read(&file, &fe, sizeof(fe)) != sizeof(fe)) {
+			break;
+		}
+		struct dns_entry *e = &cache[i];
+		memset(e, 0, sizeof(*e));
+		memcpy(e->name, fe.name, sizeof(e->name));
+		e->name[sizeof(e->name) - 1] = '\0';
+		e->family = fe.family;
+		e->iface = fe.iface;
+		e->naddr = MIN(fe.naddr, DNS_ADDRS);
+		for (int j = 0; j < e->naddr; j++) {
+			e->addr[j] = fe.addr[j];
+			e->addrlen[j] = fe.addrlen[j];
+		}
+		e->expires = expires;
+		e->in_use = true;
+	}
+	fs_close(&file);
+	LOG_INF("Loaded %d cached names", MIN(hdr.count, ARRAY_SIZE(cache)));
+}
+
+static void cache_save(void)
+{
+	struct fs_file_t file;
+	struct dns_file_hdr hdr = {
+		.magic = DNS_FILE_MAGIC,
+		.version = DNS_FILE_VERSION,
+		.addrs = DNS_ADDRS,
+	};
+	struct dns_file_entry fe;
+
+	for (int i = 0; i < ARRAY_SIZE(cache); i++) {
+		hdr.count += cache[i].in_use && !cache[i].negative;
+	}
+	fs_file_t_init(&file);
+	if (fs_open(&file, TMO_DNS_CACHE_FILE, FS_O_CREATE | FS_O_WRITE) != 0) {
+		return;
+	}
+	fs_truncate(&file, 0);
+	fs_write(&file, &hdr, sizeof(hdr));
+	for (int i = 0; i < ARRAY_SIZE(cache); i++) {
+		if (!cache[i].in_use || cache[i].negative) {
+			continue;
+		}
+		memset(&fe, 0, sizeof(fe));
+		memcpy(fe.name, cache[i].name, sizeof(fe.name));
+		fe.family = cache[i].family;
+		fe.iface = cache[i].iface;
+		fe.naddr = cache[i].naddr;
+		for (int j = 0; j < cache[i].naddr; j++) {
+			fe.addrlen[j] = cache[i].addrlen[j];
+			fe.addr[j] = cache[i].addr[j];
+		}
+		fs_write(&file, &fe, sizeof(fe));
+	}
+	fs_close(&file);
+}
+#endif
+
+static struct zsock_addrinfo *make_result(const struct sockaddr *addr, socklen_t addrlen,
+		uint16_t port, int socktype)
+{
+	struct dns_result *r = NULL;
+
+	for (int i = 0; i < ARRAY_SIZE(results); i++) {
+		if (!results[i].in_use) {
+			r = &results[i];
+			break;
+		}
+	}
+	if (r == NULL) {
+		return NULL;
+	}
+	memset(r, 0, sizeof(*r));
+	r->in_use = true;
+	memcpy(&r->addr, addr, MIN(addrlen, sizeof(r->addr)));
+	if (r->addr.sa_family == AF_INET6) {
+		net_sin6(&r->addr)->sin6_port = htons(port);
+	} else {
+		net_sin(&r->addr)->sin_port = htons(port);
+	}
+	r->ai.ai_family = r->addr.sa_family;
+	r->ai.ai_socktype = socktype ? socktype : SOCK_STREAM;
+	r->ai.ai_protocol = r->ai.ai_socktype == SOCK_DGRAM ? IPPROTO_UDP : IPPROTO_TCP;
+	r->ai.ai_addr = &r->addr;
+	r->ai.ai_addrlen = addrlen;
+	return &r->ai;
+}
+
+/* Chain the results for n addresses, as many as there are free results for */
+static struct zsock_addrinfo *make_results(const struct sockaddr *addr,
+		const socklen_t *addrlen, int n, uint16_t port, int socktype)
+{
+	struct zsock_addrinfo *head = NULL;
+	struct zsock_addrinfo **tail = &head;
+
+	for (int i = 0; i < n; i++) {
+		*tail = make_result(&addr[i], addrlen[i], port, socktype);
+		if (*tail == NULL) {
+			break;
+		}
+		tail = &(*tail)->ai_next;
+	}
+	return head;
+}
+
+/* Copy up to DNS_ADDRS addresses out of a resolver answer */
+static int copy_addrs(const struct zsock_addrinfo *ai, struct sockaddr *addr,
+		socklen_t *addrlen)
+{
+	int n = 0;
+
+	for (; ai && n < DNS_ADDRS; ai = ai->ai_next) {
+		addrlen[n] = MIN(ai->ai_addrlen, sizeof(addr[n]));
+		memcpy(&addr[n], ai->ai_addr, addrlen[n]);
+		n++;
+	}
+	return n;
+}
+
+static bool service_port(const char *service, uint16_t *port)
+{
+	char *end;
+
+	if (service == NULL) {
+		*port = 0;
+		return true;
+	}
+	long val = strtol(service, &end, 10);
+	*port = val;
+	return *end == '\0' && val >= 0 && val <= UINT16_MAX;
+}
+
+/**
+ * @brief getaddrinfo() through the shared resolver cache
+ *
+ * Up to CONFIG_TMO_DNS_CACHE_ADDRS addresses are returned, chained through
+ * ai_next in the order the resolver gave them. Positive answers are kept for
+ * CONFIG_TMO_DNS_CACHE_TTL_SECS, failures for CONFIG_TMO_DNS_CACHE_NEG_TTL_SECS.
+ * The offload for iface_idx must already be initialized.
+ *
+ * @return 0 or a DNS_EAI_* error, res must be freed with tmo_dns_freeaddrinfo()
+ */
+int tmo_dns_getaddrinfo(const char *host, const char *service,
+		const struct zsock_addrinfo *hints, int iface_idx,
+		struct zsock_addrinfo **res)
+{
+	int family = hints ? hints->ai_family : AF_UNSPEC;
+	int socktype = hints ? hints->ai_socktype : 0;
+	struct zsock_addrinfo *ai = NULL;
+	struct dns_entry *e;
+	uint16_t port;
+	int ret;
+
+	*res = NULL;
+	if (!service_port(service, &port) || strlen(host) >= DNS_NAME_LEN) {
+		/* Not cacheable, resolve directly */
+		ret = zsock_getaddrinfo(host, service, hints, &ai);
+		if (ret == 0) {
+			struct sockaddr addr[DNS_ADDRS];
+			socklen_t addrlen[DNS_ADDRS];
+			int n = copy_addrs(ai, addr, addrlen);
+
+			port = ntohs(ai->ai_family == AF_INET6 ? net_sin6(ai->ai_addr)->sin6_port
+					: net_sin(ai->ai_addr)->sin_port);
+			zsock_freeaddrinfo(ai);
+			k_mutex_lock(&dns_mutex, K_FOREVER);
+			*res = make_results(addr, addrlen, n, port, socktype);
+			k_mutex_unlock(&dns_mutex);
+			ret = *res ? 0 : DNS_EAI_MEMORY;
+		}
+		return ret;
+	}
+
+	k_mutex_lock(&dns_mutex, K_FOREVER);
+#if CONFIG_TMO_DNS_CACHE_PERSIST
+	if (!loaded) {
+		loaded = true;
+		cache_load();
+	}
+#endif
+	int64_t now = k_uptime_get();
+	e = find_entry(host, family, iface_idx);
+	if (e && e->expires > now) {
+		e->last_used = now;
+		e->hits++;
+		if (e->negative) {
+			stats.neg_hits++;
+			ret = e->err;
+		} else {
+			stats.hits++;
+			*res = make_results(e->addr, e->addrlen, e->naddr, port, socktype);
+			ret = *res ? 0 : DNS_EAI_MEMORY;
+		}
+		k_mutex_unlock(&dns_mutex);
+		return ret;
+	}
+	stats.misses++;
+	k_mutex_unlock(&dns_mutex);
+
+	/* Resolve without the lock, lookups over the modem take seconds */
+	int64_t start = k_uptime_get();
+	struct sockaddr addr[DNS_ADDRS];
+	socklen_t addrlen[DNS_ADDRS];
+	int naddr = 0;
+
+	ret = zsock_getaddrinfo(host, service, hints, &ai);
+	if (ret == 0) {
+		naddr = copy_addrs(ai, addr, addrlen);
+		zsock_freeaddrinfo(ai);
+	}
+
+	k_mutex_lock(&dns_mutex, K_FOREVER);
+	stats.lookup_ms += k_uptime_get() - start;
+	now = k_uptime_get();
+	e = find_entry(host, family, iface_idx);
+	bool changed = e == NULL || e->negative != (ret != 0) ||
+		(ret == 0 && (e->naddr != naddr || memcmp(e->addr, addr, naddr * sizeof(addr[0]))));
+	if (e == NULL) {
+		e = alloc_entry();
+		memset(e, 0, sizeof(*e));
+		strcpy(e->name, host);
+		e->family = family;
+		e->iface = iface_idx;
+		e->in_use = true;
+	}
+	e->last_used = now;
+	if (ret == 0) {
+		e->negative = false;
+		e->err = 0;
+		e->naddr = naddr;
+		memcpy(e->addr, addr, naddr * sizeof(addr[0]));
+		memcpy(e->addrlen, addrlen, naddr * sizeof(addrlen[0]));
+		e->expires = now + CONFIG_TMO_DNS_CACHE_TTL_SECS * MSEC_PER_SEC;
+		*res = make_results(e->addr, e->addrlen, e->naddr, port, socktype);
+		if (*res == NULL) {
+			ret = DNS_EAI_MEMORY;
+		}
+	} else {
+		e->negative = true;
+		e->err = ret;
+		e->expires = now + CONFIG_TMO_DNS_CACHE_NEG_TTL_SECS * MSEC_PER_SEC;
+	}
+#if CONFIG_TMO_DNS_CACHE_PERSIST
+	if (changed) {
+		cache_save();
+	}
+#else
+	ARG_UNUSED(changed);
+#endif
+	k_mutex_unlock(&dns_mutex);
+	return ret;
+}
+
+void tmo_dns_freeaddrinfo(struct zsock_addrinfo *res)
+{
+	k_mutex_lock(&dns_mutex, K_FOREVER);
+	for (; res; res = res->ai_next) {
+		for (int i = 0; i < ARRAY_SIZE(results); i++) {
+			if (res == &results[i].ai) {
+				results[i].in_use = false;
+			}
+		}
+	}
+	k_mutex_unlock(&dns_mutex);
+}
+
+/**
+ * @brief Resolve host and copy out the first address
+ *
+ * For callers that keep the address for a whole transfer, so that they
+ * do not hold results from the shared pool meanwhile. ai->ai_addr is
+ * pointed at addr.
+ *
+ * @return 0, or an error as from tmo_dns_getaddrinfo()
+ */
+int tmo_dns_resolve_addr(const char *host, const char *service,
+		const struct zsock_addrinfo *hints, int iface_idx,
+		struct zsock_addrinfo *ai, struct sockaddr *addr)
+{
+	struct zsock_addrinfo *res;
+	int ret = tmo_dns_getaddrinfo(host, service, hints, iface_idx, &res);
+
+	if (ret) {
+		return ret;
+	}
+	*ai = *res;
+	ai->ai_next = NULL;
+	ai->ai_addrlen = MIN(res->ai_addrlen, sizeof(*addr));
+	memcpy(addr, res->ai_addr, ai->ai_addrlen);
+	ai->ai_addr = addr;
+	tmo_dns_freeaddrinfo(res);
+	return 0;
+}
+
+void tmo_dns_cache_flush(void)
+{
+	k_mutex_lock(&dns_mutex, K_FOREVER);
+	memset(cache, 0, sizeof(cache));
+	memset(&stats, 0, sizeof(stats));
+	loaded = true;
+#if CONFIG_TMO_DNS_CACHE_PERSIST
+	fs_unlink(TMO_DNS_CACHE_FILE);
+#endif
+	k_mutex_unlock(&dns_mutex);
+}
+
+void tmo_dns_cache_get_stats(struct tmo_dns_cache_stats *out)
+{
+	k_mutex_lock(&dns_mutex, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&dns_mutex);
+}
+
+/**
+ * @brief Describe cache slot idx
+ *
+ * @return 0, -ENOENT for an empty slot, -EINVAL past the end
+ */
+int tmo_dns_cache_get_entry(int idx, struct tmo_dns_cache_entry_info *info)
+{
+	const struct dns_entry *e;
+	int ret = 0;
+
+	if (idx < 0 || idx >= ARRAY_SIZE(cache)) {
+		return -EINVAL;
+	}
+	e = &cache[idx];
+	k_mutex_lock(&dns_mutex, K_FOREVER);
+	if (!e->in_use) {
+		ret = -ENOENT;
+		goto out;
+	}
+	strcpy(info->name, e->name);
+	info->family = e->family;
+	info->iface = e->iface;
+	info->negative = e->negative;
+	info->ttl_left = (int32_t)((e->expires - k_uptime_get()) / MSEC_PER_SEC);
+	info->hits = e->hits;
+	info->naddr = e->naddr;
+	info->addr = e->addr[0];
+out:
+	k_mutex_unlock(&dns_mutex);
+	return ret;
+}
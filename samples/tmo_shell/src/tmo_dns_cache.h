@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_DNS_CACHE_H
+#define TMO_DNS_CACHE_H
+
+#include <stdint.h>
+#include <zephyr/net/socket.h>
+
+#define TMO_DNS_CACHE_FILE "/tmo/dns_cache.bin"
+#define TMO_DNS_NAME_LEN   64
+
+struct tmo_dns_cache_stats {
+	uint32_t hits;
+	uint32_t neg_hits;
+	uint32_t misses;
+	uint32_t evictions;
+	uint32_t lookup_ms;   /* total time spent in network lookups */
+};
+
+/* A copy of one cache slot */
+struct tmo_dns_cache_entry_info {
+	char name[TMO_DNS_NAME_LEN];
+	int family;
+	int iface;
+	bool negative;
+	int32_t ttl_left;     /* secs */
+	uint32_t hits;
+	int naddr;
+	struct sockaddr addr;     /* the first of naddr */
+};
+
+int tmo_dns_getaddrinfo(const char *host, const char *service,
+		const struct zsock_addrinfo *hints, int iface_idx,
+		struct zsock_addrinfo **res);
+void tmo_dns_freeaddrinfo(struct zsock_addrinfo *res);
+int tmo_dns_resolve_addr(const char *host, const char *service,
+		const struct zsock_addrinfo *hints, int iface_idx,
+		struct zsock_addrinfo *ai, struct sockaddr *addr);
+void tmo_dns_cache_flush(void);
+void tmo_dns_cache_get_stats(struct tmo_dns_cache_stats *stats);
+int tmo_dns_cache_get_entry(int idx, struct tmo_dns_cache_entry_info *info);
+
+#endif
@@ -13,9 +13,9 @@
 
 #include "tmo_file.h"
 #include "dfu_murata_1sc.h"
+#include "tmo_xfer_buf.h"
 
 #define READ_SIZE 4096
-extern uint8_t mxfer_buf[];
 #define SHA_DIGEST_20   20
 
 int tmo_cp(const struct shell *shell, size_t argc, char **argv)
@@ -48,11 +48,18 @@ int tmo_cp(const struct shell *shell, size_t argc, char **argv)
 		return -EINVAL;
 	}
 
+	uint8_t *mxfer_buf = tmo_xfer_buf_acquire("file_cp", K_NO_WAIT);
+	if (mxfer_buf == NULL) {
+		shell_error(shell, "No free transfer buffer, see tmo bufs");
+		return -EBUSY;
+	}
+
 	struct fs_file_t zfp_src;
 	fs_file_t_init(&zfp_src);
 	ret = fs_open(&zfp_src, src, FS_O_READ);
 	if (ret) {
 		shell_error(shell, "cannot open %s", src);
+		tmo_xfer_buf_release(mxfer_buf);
 		return ret;
 	}
 
@@ -62,6 +69,7 @@ int tmo_cp(const struct shell *shell, size_t argc, char **argv)
 	if (ret) {
 		shell_error(shell, "cannot open %s", dst);
 		fs_close(&zfp_src);
+		tmo_xfer_buf_release(mxfer_buf);
 		return ret;
 	}
 
@@ -92,6 +100,7 @@ int tmo_cp(const struct shell *shell, size_t argc, char **argv)
 end:
 	fs_close(&zfp_src);
 	fs_close(&zfp_dst);
+	tmo_xfer_buf_release(mxfer_buf);
 	return ret;
 }
 
@@ -189,17 +198,26 @@ int cmd_sha1(const struct shell *shell, size_t argc, char **argv)
 
 	fs_seek(&sha1file, 0, FS_SEEK_SET);
 
+	uint8_t *mxfer_buf = tmo_xfer_buf_acquire("file_sha1", K_NO_WAIT);
+	if (mxfer_buf == NULL) {
+		shell_error(shell, "No free transfer buffer, see tmo bufs");
+		fs_close(&sha1file);
+		return -EBUSY;
+	}
+
 	int notdone = 1;
 	while (notdone)
 	{
 		readbytes = fs_read(&sha1file, mxfer_buf, UA_HEADER_SIZE);
 		if (readbytes < 0) {
 			shell_error(shell, "Could not read file %s", filename);
+			tmo_xfer_buf_release(mxfer_buf);
 			fs_close(&sha1file);
 			return -1;
 		}
 		if ((totalreadbytes == 0) && (readbytes != UA_HEADER_SIZE)) {
 			shell_error(shell, "Error reading header, read %d bytes\n", readbytes);
+			tmo_xfer_buf_release(mxfer_buf);
 			fs_close(&sha1file);
 			return -1;
 		}
@@ -216,6 +234,7 @@ int cmd_sha1(const struct shell *shell, size_t argc, char **argv)
 		}
 	}
 
+	tmo_xfer_buf_release(mxfer_buf);
 	mbedtls_sha1_finish(&tmo_sha1_ctx, tmo_sha1_output);
 	mcrc32 = murata_1sc_crc32_finish(mcrc32, totalreadbytes - UA_HEADER_SIZE);
 
@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_happy_connect, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+
+#include "tmo_shell.h"
+#include "tmo_dns_cache.h"
+#include "tmo_happy_connect.h"
+#include "tmo_tls_mem.h"
+
+/*
+ * Connection racing in the manner of Happy Eyeballs (RFC 8305). The host
+ * is resolved on each interface taking part before the race starts, and
+ * the addresses are tried alternating between the two families. Both
+ * offload drivers connect (and run the TLS handshake) synchronously, so
+ * each attempt runs in its own thread. A new attempt starts every
+ * CONFIG_TMO_HAPPY_CONNECT_DELAY_MS, or at once when one fails, and the
+ * first to connect wins. Attempts still in flight cannot be interrupted;
+ * they are marked cancelled, and close their socket and give their slot
+ * back themselves when connect returns. An attempt keeps its own copy of
+ * the host name, as it may outlive the caller's request.
+ *
+ * Races from different threads run side by side. Each has its own
+ * candidate list, and they share the pool of attempt threads.
+ */
+
+#define HE_PARALLEL   CONFIG_TMO_HAPPY_CONNECT_PARALLEL
+#define HE_RACES      CONFIG_TMO_HAPPY_CONNECT_RACES
+#define HE_PRIORITY   CONFIG_MAIN_THREAD_PRIORITY
+#define HE_IFACES     2
+#define HE_ADDRS      CONFIG_TMO_DNS_CACHE_ADDRS
+#define HE_HOST_LEN   64
+
+enum he_state {
+	HE_FREE,
+	HE_RUNNING,
+	HE_DONE,
+};
+
+struct he_candidate {
+	int iface_idx;
+	struct sockaddr addr;
+	socklen_t addrlen;
+};
+
+static struct he_race {
+	bool in_use;
+	struct k_sem done;        /* given by every attempt of this race that ends */
+	/* Resolved addresses, by interface and family (IPv4, IPv6) */
+	struct he_candidate addrs[HE_IFACES][2][HE_ADDRS];
+	uint8_t count[HE_IFACES][2];
+	uint8_t taken[HE_IFACES][2];
+	int nifaces;
+	int turn;                 /* interface whose turn it is */
+	int turn_taken;           /* addresses it has had this turn */
+} races[HE_RACES];
+
+static struct he_attempt {
+	struct k_thread thread;
+	enum he_state state;
+	bool started;             /* thread created, join it before reuse */
+	bool cancelled;
+	struct he_race *race;
+	int iface_idx;
+	int sd;
+	int err;
+	bool tls;
+	char host[HE_HOST_LEN];
+	uint32_t connect_ms;
+	struct sockaddr addr;
+	socklen_t addrlen;
+} attempts[HE_PARALLEL];
+
+static K_THREAD_STACK_ARRAY_DEFINE(he_stacks, HE_PARALLEL, CONFIG_TMO_HAPPY_CONNECT_STACK_SIZE);
+/* Protects races[] and attempts[], never held across a connect */
+static K_MUTEX_DEFINE(he_state_mutex);
+static K_SEM_DEFINE(he_race_free, HE_RACES, HE_RACES);
+
+/* An attempt slot came free, any race may be waiting for one */
+static void wake_races_locked(void)
+{
+	for (int i = 0; i < HE_RACES; i++) {
+		if (races[i].in_use) {
+			k_sem_give(&races[i].done);
+		}
+	}
+}
+
+static void attempt_thread(void *p1, void *p2, void *p3)
+{
+	struct he_attempt *a = p1;
+	int64_t start = k_uptime_get();
+	int ret = tmo_tls_connect(a->sd, &a->addr, a->addrlen, a->tls, a->host);
+
+	k_mutex_lock(&he_state_mutex, K_FOREVER);
+	a->err = ret ? -errno : 0;
+	a->connect_ms = k_uptime_get() - start;
+	if (a->cancelled || ret) {
+		zsock_close(a->sd);
+		a->sd = -1;
+	}
+	if (ret && !a->cancelled) {
+		tmo_link_report(a->iface_idx, false, 0, 0, 0);
+	}
+	if (a->cancelled) {
+		/* Its race has returned, nobody collects it */
+		a->state = HE_FREE;
+		wake_races_locked();
+	} else {
+		a->state = HE_DONE;
+		k_sem_give(&a->race->done);
+	}
+	k_mutex_unlock(&he_state_mutex);
+}
+
+/* A slot no attempt holds, NULL while other attempts hold them all */
+static struct he_attempt *free_slot(void)
+{
+	struct he_attempt *slot = NULL;
+
+	k_mutex_lock(&he_state_mutex, K_FOREVER);
+	for (int i = 0; i < HE_PARALLEL && !slot; i++) {
+		if (attempts[i].state == HE_FREE) {
+			slot = &attempts[i];
+		}
+	}
+	k_mutex_unlock(&he_state_mutex);
+	return slot;
+}
+
+static struct he_race *race_get(void)
+{
+	struct he_race *race = NULL;
+
+	k_sem_take(&he_race_free, K_FOREVER);
+	k_mutex_lock(&he_state_mutex, K_FOREVER);
+	for (int i = 0; i < HE_RACES && !race; i++) {
+		if (!races[i].in_use) {
+			race = &races[i];
+		}
+	}
+	memset(race, 0, sizeof(*race));
+	race->in_use = true;
+	k_sem_init(&race->done, 0, K_SEM_MAX_LIMIT);
+	k_mutex_unlock(&he_state_mutex);
+	return race;
+}
+
+static void race_put(struct he_race *race)
+{
+	k_mutex_lock(&he_state_mutex, K_FOREVER);
+	race->in_use = false;
+	k_mutex_unlock(&he_state_mutex);
+	k_sem_give(&he_race_free);
+}
+
+static int other_iface(int iface_idx)
+{
+	struct tmo_link_stats st;
+	int alt = (iface_idx == tmo_link_modem_iface()) ? tmo_link_wifi_iface() :
+		tmo_link_modem_iface();
+
+	if (alt <= 0 || tmo_link_get_stats(alt, &st) || !st.up) {
+		return -ENODEV;
+	}
+	return alt;
+}
+
+/* Copy out every address host resolves to for family on iface_idx */
+static int resolve(const struct tmo_happy_req *req, int iface_idx, int family,
+		struct he_candidate *out)
+{
+	struct zsock_addrinfo hints = {.ai_family = family, .ai_socktype = SOCK_STREAM};
+	struct zsock_addrinfo *res;
+	int n = 0;
+
+	if (tmo_dns_getaddrinfo(req->host, req->port, &hints, iface_idx, &res)) {
+		return 0;
+	}
+	for (struct zsock_addrinfo *ai = res; ai && n < HE_ADDRS; ai = ai->ai_next) {
+		out[n].iface_idx = iface_idx;
+		out[n].addrlen = MIN(ai->ai_addrlen, sizeof(out[n].addr));
+		memcpy(&out[n].addr, ai->ai_addr, out[n].addrlen);
+		n++;
+	}
+	tmo_dns_freeaddrinfo(res);
+	return n;
+}
+
+/* Resolve host on the requested interface, and on the next best one if allowed */
+static void resolve_all(const struct tmo_happy_req *req, struct he_race *race, int idx)
+{
+	for (int i = 0; i < HE_IFACES && idx > 0; i++) {
+		uint8_t *count = race->count[race->nifaces];
+
+		if (net_if_get_by_index(idx) != NULL && tmo_offload_init(idx) == 0) {
+			count[0] = resolve(req, idx, AF_INET, race->addrs[race->nifaces][0]);
+#if IS_ENABLED(CONFIG_NET_IPV6)
+			count[1] = resolve(req, idx, AF_INET6, race->addrs[race->nifaces][1]);
+#endif
+			race->nifaces += (count[0] + count[1]) > 0;
+		}
+		if (req->iface_idx != TMO_LINK_AUTO ||
+				!IS_ENABLED(CONFIG_TMO_HAPPY_CONNECT_CROSS_IFACE)) {
+			break;
+		}
+		idx = other_iface(idx);
+	}
+}
+
+/* The next address of one interface, alternating families starting with IPv4 */
+static const struct he_candidate *iface_next(struct he_race *race, int i)
+{
+	uint8_t *taken = race->taken[i];
+	int family = taken[0] > taken[1];
+
+	if (taken[family] >= race->count[i][family]) {
+		family = !family;
+	}
+	if (taken[family] >= race->count[i][family]) {
+		return NULL;
+	}
+	return &race->addrs[i][family][taken[family]++];
+}
+
+/*
+ * The next address to try, the requested interface first. With a second
+ * interface the two take turns, two addresses at a time, so the other
+ * link joins the race after one address of each family.
+ */
+static const struct he_candidate *next_candidate(struct he_race *race)
+{
+	for (int i = 0; i <= race->nifaces; i++) {
+		if (race->turn_taken == 2) {
+			race->turn = (race->turn + 1) % race->nifaces;
+			race->turn_taken = 0;
+		}
+		const struct he_candidate *c = iface_next(race, race->turn);
+
+		if (c) {
+			race->turn_taken++;
+			return c;
+		}
+		race->turn_taken = 2;
+	}
+	return NULL;
+}
+
+static int start_attempt(const struct tmo_happy_req *req, struct he_race *race,
+		struct he_attempt *a, const struct he_candidate *c)
+{
+	struct net_if *iface = net_if_get_by_index(c->iface_idx);
+
+	if (a->started) {
+		/* Its thread may still be returning after freeing the slot */
+		k_thread_join(&a->thread, K_FOREVER);
+	}
+	memset(a, 0, sizeof(*a));
+	a->addr = c->addr;
+	a->addrlen = c->addrlen;
+
+	struct zsock_addrinfo ai = {
+		.ai_family = c->addr.sa_family,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+		.ai_addr = &a->addr,
+		.ai_addrlen = a->addrlen,
+	};
+	a->sd = req->create(iface, &ai, req->user_data);
+	if (a->sd < 0) {
+		return a->sd;
+	}
+	a->race = race;
+	a->iface_idx = c->iface_idx;
+	a->tls = req->tls;
+	strcpy(a->host, req->host);
+	a->started = true;
+	k_mutex_lock(&he_state_mutex, K_FOREVER);
+	a->state = HE_RUNNING;
+	k_mutex_unlock(&he_state_mutex);
+	LOG_DBG("attempt on iface %d family %d", c->iface_idx, c->addr.sa_family);
+	k_thread_create(&a->thread, he_stacks[a - attempts],
+			K_THREAD_STACK_SIZEOF(he_stacks[a - attempts]),
+			attempt_thread, a, NULL, NULL, HE_PRIORITY, 0, K_NO_WAIT);
+	return 0;
+}
+
+/**
+ * @brief Connect to host, racing its addresses and optionally two links
+ *
+ * Every address the requested interface resolves to is tried, IPv4 and
+ * IPv6 in turn starting with IPv4. With TMO_LINK_AUTO and
+ * CONFIG_TMO_HAPPY_CONNECT_CROSS_IFACE the addresses of the other link
+ * join the race if the link manager has it up.
+ *
+ * @return connected socket, or the error of the last failed attempt
+ */
+int tmo_happy_connect(const struct tmo_happy_req *req, struct tmo_happy_result *result)
+{
+	const struct he_candidate *next;
+	struct he_race *race;
+	int running = 0;
+	struct he_attempt *winner = NULL;
+	int sd = -1;
+	int err = -EHOSTUNREACH;
+	int64_t start = k_uptime_get();
+	int64_t next_launch = start;
+	int idx = tmo_link_resolve(req->iface_idx, req->cls);
+
+	if (idx < 0) {
+		return idx;
+	}
+	if (strlen(req->host) >= HE_HOST_LEN) {
+		return -ENAMETOOLONG;
+	}
+	memset(result, 0, sizeof(*result));
+
+	race = race_get();
+	resolve_all(req, race, idx);
+	next = race->nifaces ? next_candidate(race) : NULL;
+	while (winner == NULL) {
+		struct he_attempt *slot = free_slot();
+
+		if (slot && next && k_uptime_get() >= next_launch) {
+			int ret = start_attempt(req, race, slot, next);
+
+			next = next_candidate(race);
+			if (ret == 0) {
+				running++;
+				result->attempts++;
+				next_launch = k_uptime_get() + CONFIG_TMO_HAPPY_CONNECT_DELAY_MS;
+			} else {
+				err = ret;
+			}
+			continue;
+		}
+		if (running == 0 && next == NULL) {
+			break;
+		}
+		/* Without a slot this waits for another attempt to give one back */
+		k_timeout_t wait = K_FOREVER;
+		if (slot && next) {
+			wait = K_MSEC(MAX(next_launch - k_uptime_get(), 0));
+		}
+		if (k_sem_take(&race->done, wait)) {
+			continue;
+		}
+
+		k_mutex_lock(&he_state_mutex, K_FOREVER);
+		for (int i = 0; i < HE_PARALLEL; i++) {
+			struct he_attempt *a = &attempts[i];
+
+			if (a->state != HE_DONE || a->race != race) {
+				continue;
+			}
+			k_thread_join(&a->thread, K_FOREVER);
+			a->started = false;
+			a->state = HE_FREE;
+			running--;
+			if (a->err == 0 && winner == NULL) {
+				winner = a;
+			} else if (a->err == 0) {
+				zsock_close(a->sd);
+			} else {
+				err = a->err;
+				/* Start the next candidate without waiting out the delay */
+				next_launch = k_uptime_get();
+			}
+			wake_races_locked();
+		}
+		if (winner) {
+			for (int i = 0; i < HE_PARALLEL; i++) {
+				if (attempts[i].state == HE_RUNNING && attempts[i].race == race) {
+					attempts[i].cancelled = true;
+				}
+			}
+			/* The slot is free, copy the result out before another race takes it */
+			result->iface_idx = winner->iface_idx;
+			result->family = winner->addr.sa_family;
+			result->connect_ms = winner->connect_ms;
+			sd = winner->sd;
+		}
+		k_mutex_unlock(&he_state_mutex);
+	}
+	race_put(race);
+	if (winner == NULL) {
+		LOG_WRN("all %d attempts to %s failed: %d", result->attempts, req->host, err);
+		return err;
+	}
+	result->elapsed_ms = k_uptime_get() - start;
+
+	LOG_INF("connected to %s on iface %d in %u ms (%d attempts)", req->host,
+			result->iface_idx, result->elapsed_ms, result->attempts);
+	return sd;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_HAPPY_CONNECT_H
+#define TMO_HAPPY_CONNECT_H
+
+#include <stdint.h>
+#include <zephyr/net/net_if.h>
+#include <zephyr/net/socket.h>
+
+#include "tmo_link_mgr.h"
+
+/* Creates and configures (TLS options etc.) an unconnected socket for ai */
+typedef int (*tmo_happy_socket_fn)(struct net_if *iface, struct zsock_addrinfo *ai,
+		void *user_data);
+
+struct tmo_happy_req {
+	const char *host;
+	const char *port;
+	int iface_idx;            /* TMO_LINK_AUTO to also race the next best link */
+	enum tmo_link_class cls;
+	tmo_happy_socket_fn create;
+	void *user_data;
+	bool tls;                 /* create makes native TLS sockets, see tmo_tls_connect() */
+};
+
+struct tmo_happy_result {
+	int iface_idx;            /* interface of the winning connection */
+	int family;
+	uint32_t connect_ms;      /* connect time of the winning attempt */
+	uint32_t elapsed_ms;      /* from the call to the first connection */
+	int attempts;
+};
+
+int tmo_happy_connect(const struct tmo_happy_req *req, struct tmo_happy_result *result);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <strings.h>
+
+#include "tmo_http_coding.h"
+
+/**
+ * @brief Map a Content-Encoding value to a coding
+ *
+ * @return the coding, TMO_HTTP_IDENTITY for anything not decoded here
+ */
+enum tmo_http_coding tmo_http_coding_parse(const char *value, size_t len)
+{
+	if ((len == 4 && strncasecmp(value, "gzip", 4) == 0) ||
+			(len == 6 && strncasecmp(value, "x-gzip", 6) == 0)) {
+		return TMO_HTTP_GZIP;
+	}
+	if (len == 7 && strncasecmp(value, "deflate", 7) == 0) {
+		return TMO_HTTP_DEFLATE;
+	}
+	return TMO_HTTP_IDENTITY;
+}
+
+const char *tmo_http_coding_name(enum tmo_http_coding coding)
+{
+	switch (coding) {
+	case TMO_HTTP_GZIP:
+		return "gzip";
+	case TMO_HTTP_DEFLATE:
+		return "deflate";
+	default:
+		return "identity";
+	}
+}
+
+/**
+ * @brief Whether a reply to a Range request continues the body received so far
+ *
+ * Range offsets count content coded bytes, so the rest of a compressed
+ * body only continues the stream being decoded if it has the same coding.
+ *
+ * @param status HTTP status of the reply
+ * @param first coding of the first response
+ * @param now coding of this reply
+ * @return 0, -ESPIPE if the server ignored the range, -EBADMSG if the
+ * coding changed
+ */
+int tmo_http_resume_check(int status, enum tmo_http_coding first, enum tmo_http_coding now)
+{
+	if (status != 206) {
+		return -ESPIPE;
+	}
+	if (now != first) {
+		return -EBADMSG;
+	}
+	return 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_HTTP_CODING_H
+#define TMO_HTTP_CODING_H
+
+#include <stddef.h>
+
+enum tmo_http_coding {
+	TMO_HTTP_IDENTITY,
+	TMO_HTTP_GZIP,
+	TMO_HTTP_DEFLATE,
+};
+
+enum tmo_http_coding tmo_http_coding_parse(const char *value, size_t len);
+const char *tmo_http_coding_name(enum tmo_http_coding coding);
+int tmo_http_resume_check(int status, enum tmo_http_coding first, enum tmo_http_coding now);
+
+#endif
@@ -5,58 +5,160 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <strings.h>
 #include <zephyr/kernel.h>
 #include <zephyr/net/socket_offload.h>
 #include "sockets_internal.h"
+#include "tmo_http_mock_socket.h"
 
-#define FAILURE_POINT 1000000
-#define DOWNLOAD_SIZE 2000000
+#define MOCK_MAX_SOCKS   2
+#define TCPIP_OVERHEAD   40
 
-const char *http_resp_header =
+/* "legacy" reproduces the original single scenario: 2 MB body that stalls at 1 MB */
+static const struct tmo_mock_profile profiles[] = {
+	{"legacy",       204800,   0,   0,  0, 0,   0,  128, 2000000, 1000000},
+	{"catm_good",    300000, 150,  30,  0, 0,  50, 1280,  512000, 0},
+	{"catm_edge",     50000, 600, 300, 10, 5, 200, 1280,  512000, 0},
+	{"wifi",       10000000,  20,   5,  1, 0,  20, 1500, 2000000, 0},
+};
+
+static const struct tmo_mock_profile *profile = &profiles[0];
+static uint32_t seed = 1;
+static uint32_t rng_state = 1;
+static struct tmo_mock_stats stats;
+
+static const char *http_resp_get =
 "HTTP/1.1 200 OK\r\nContent-Length: %d\r\nContent-Type: "
 "text/html\r\nConnection: Close\r\n\r\n";
+static const char *http_resp_range =
+"HTTP/1.1 206 Partial Content\r\nContent-Length: %d\r\nContent-Range: bytes %d-%d/%d\r\n"
+"Content-Type: text/html\r\nConnection: Close\r\n\r\n";
+static const char *http_resp_post =
+"HTTP/1.1 200 OK\r\nContent-Length: 2\r\nContent-Type: "
+"application/json\r\nConnection: Close\r\n\r\n{}";
 
-static struct {
-	bool header_sent;
-	int ptr;
-	int len;
+struct mock_sock {
+	bool in_use;
+	bool need_rtt;
+	bool reset;
+	bool is_post;
+	bool is_head;
+	char hdr[192];
+	int hdr_len;
+	int hdr_ptr;
+	int body_off;
+	int body_len;
+	int body_ptr;
 	int so_rcvtimeo;
-} sock_data;
+	uint32_t delay_us;
+};
+
+static struct mock_sock socks[MOCK_MAX_SOCKS];
+
+/* xorshift32, so a given seed and profile always replay the same run */
+static uint32_t mock_rand(void)
+{
+	uint32_t x = rng_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	rng_state = x;
+	return x;
+}
+
+static bool chance(uint16_t permille)
+{
+	return permille && (mock_rand() % 1000) < permille;
+}
+
+static void sleep_rtt(void)
+{
+	uint32_t ms = profile->rtt_ms;
+
+	if (profile->jitter_ms) {
+		ms += mock_rand() % (profile->jitter_ms + 1);
+	}
+	if (ms) {
+		k_msleep(ms);
+	}
+}
+
+/* Accumulate serialization time in usecs, sleep whole msecs */
+static void throttle(struct mock_sock *s, size_t bytes)
+{
+	if (!profile->bandwidth_bps) {
+		return;
+	}
+	s->delay_us += (uint64_t)bytes * 8 * USEC_PER_SEC / profile->bandwidth_bps;
+	if (s->delay_us >= USEC_PER_MSEC) {
+		k_msleep(s->delay_us / USEC_PER_MSEC);
+		s->delay_us %= USEC_PER_MSEC;
+	}
+}
 
 static ssize_t s_recvfrom(void *obj, void *buf, size_t len, int flags,
 		struct sockaddr *from, socklen_t *fromlen)
 {
-	char gen_buffer[128];
-	if (sock_data.ptr >= FAILURE_POINT && sock_data.so_rcvtimeo) {
-		k_msleep(sock_data.so_rcvtimeo);
-		errno = EAGAIN;
+	struct mock_sock *s = obj;
+	uint8_t *out = buf;
+
+	if (s->reset) {
+		errno = ECONNRESET;
 		return -1;
-	} else {
-		k_msleep(5);
-	}
-	if (!sock_data.header_sent) {
-		snprintk(gen_buffer, sizeof(gen_buffer), http_resp_header,
-				sock_data.len);
-		int cpl = MIN(strlen(gen_buffer + sock_data.ptr), len);
-		memcpy(buf, gen_buffer, cpl);
-		sock_data.ptr += cpl;
-		if (sock_data.ptr >= strlen(gen_buffer)) {
-			sock_data.header_sent = true;
-			sock_data.ptr = 0;
+	}
+	if (s->need_rtt) {
+		sleep_rtt();
+		s->need_rtt = false;
+	}
+	if (s->hdr_ptr >= s->hdr_len && s->body_ptr >= s->body_len) {
+		return 0;
+	}
+	if (s->hdr_ptr >= s->hdr_len) {
+		if (profile->fail_at && s->body_ptr >= profile->fail_at && s->so_rcvtimeo) {
+			k_msleep(s->so_rcvtimeo);
+			errno = EAGAIN;
+			return -1;
+		}
+		if (chance(profile->reset_permille)) {
+			stats.resets++;
+			s->reset = true;
+			errno = ECONNRESET;
+			return -1;
+		}
+		if (chance(profile->loss_permille)) {
+			stats.losses++;
+			if (s->so_rcvtimeo) {
+				k_msleep(s->so_rcvtimeo);
+				errno = EAGAIN;
+				return -1;
+			}
+			/* Without a timeout a loss only costs a retransmission */
+			k_msleep(3 * MAX(profile->rtt_ms, 1));
 		}
-		return cpl;
-		// sizeof(http_resp_header);
+	}
+
+	size_t cpl = MIN(len, profile->mtu - (profile->mtu > TCPIP_OVERHEAD ? TCPIP_OVERHEAD : 0));
+	if (cpl > 1 && chance(profile->short_read_permille)) {
+		stats.short_reads++;
+		cpl = 1 + mock_rand() % (cpl - 1);
+	}
+
+	if (s->hdr_ptr < s->hdr_len) {
+		cpl = MIN(cpl, s->hdr_len - s->hdr_ptr);
+		memcpy(out, s->hdr + s->hdr_ptr, cpl);
+		s->hdr_ptr += cpl;
 	} else {
-		memset(gen_buffer, 0, sizeof(gen_buffer));
-		snprintk(gen_buffer, sizeof(gen_buffer), "%d",
-				sock_data.ptr + (DOWNLOAD_SIZE - sock_data.len));
-		int cpl = MIN(sizeof(gen_buffer), len);
-		cpl = MIN(cpl, sock_data.len - sock_data.ptr);
-		memcpy(buf, gen_buffer, cpl);
-		sock_data.ptr += cpl;
-		return cpl;
+		cpl = MIN(cpl, s->body_len - s->body_ptr);
+		for (size_t i = 0; i < cpl; i++) {
+			out[i] = 0x20 + ((s->body_off + s->body_ptr + i) % 97);
+		}
+		s->body_ptr += cpl;
 	}
+	throttle(s, cpl);
+	stats.bytes_received += cpl;
+	return cpl;
 }
 
 const char *strncasestr(const char *big, const char *little, int mxlen)
@@ -72,26 +174,69 @@ const char *strncasestr(const char *big, const char *little, int mxlen)
 	return NULL;
 }
 
+static void set_body_range(struct mock_sock *s, int offset, bool range)
+{
+	s->body_off = MIN(offset, profile->body_size);
+	s->body_len = profile->body_size - s->body_off;
+	if (range) {
+		s->hdr_len = snprintk(s->hdr, sizeof(s->hdr), http_resp_range, s->body_len,
+				s->body_off, profile->body_size - 1, profile->body_size);
+	} else {
+		s->hdr_len = snprintk(s->hdr, sizeof(s->hdr), http_resp_get, s->body_len);
+	}
+}
+
+static void start_response(struct mock_sock *s, bool post)
+{
+	stats.requests++;
+	s->need_rtt = true;
+	s->is_post = post;
+	s->is_head = false;
+	s->hdr_ptr = 0;
+	s->body_ptr = 0;
+	if (post) {
+		s->hdr_len = snprintk(s->hdr, sizeof(s->hdr), "%s", http_resp_post);
+		s->body_off = 0;
+		s->body_len = 0;
+	} else {
+		set_body_range(s, 0, false);
+	}
+}
+
 static ssize_t s_sendto(void *obj, const void *buf, size_t len, int flags,
 		const struct sockaddr *to, socklen_t tolen)
 {
-	// strstr()
-	// strncasecmp(header, "Content-Length", sizeof("Content-Length") - 1)
-	const char *rh = strncasestr(buf, "Range: bytes=", len);
+	struct mock_sock *s = obj;
 
-	if (rh) {
-		sock_data.len =
-			DOWNLOAD_SIZE -
-			strtol(rh + sizeof("Range: bytes=") - 1, NULL, 10);
+	if (s->reset) {
+		errno = ECONNRESET;
+		return -1;
 	}
-
-	k_msleep(100);
+	/* The HTTP client writes the request in several pieces */
+	if (len >= 4 && !strncmp(buf, "GET ", 4)) {
+		start_response(s, false);
+	} else if (len >= 4 && !strncmp(buf, "HEAD", 4)) {
+		/* The GET headers, Content-Length included, but no body */
+		start_response(s, false);
+		s->is_head = true;
+		s->body_len = 0;
+	} else if (len >= 4 && (!strncmp(buf, "POST", 4) || !strncmp(buf, "PUT ", 4) ||
+				!strncmp(buf, "PATC", 4))) {
+		start_response(s, true);
+	}
+	const char *rh = strncasestr(buf, "Range: bytes=", len);
+	if (rh && !s->is_post && !s->is_head && s->hdr_ptr == 0) {
+		set_body_range(s, strtol(rh + sizeof("Range: bytes=") - 1, NULL, 10), true);
+	}
+	throttle(s, len);
+	stats.bytes_sent += len;
 	return len;
 }
 
 static int s_connect(void *obj, const struct sockaddr *addr, socklen_t addrlen)
 {
-	k_msleep(100);
+	stats.connects++;
+	sleep_rtt();
 	return 0;
 }
 
@@ -105,18 +250,26 @@ static ssize_t s_write(void *obj, const void *buffer, size_t count)
 	return s_sendto(obj, buffer, count, 0, NULL, 0);
 }
 
-static int s_close(void *obj) { return 0; }
+static int s_close(void *obj)
+{
+	struct mock_sock *s = obj;
+
+	s->in_use = false;
+	return 0;
+}
 
 static int s_setsockopt(void *obj, int level, int optname, const void *optval,
 		socklen_t optlen)
 {
+	struct mock_sock *s = obj;
+
 	if (level != SOL_SOCKET || optname != SO_RCVTIMEO ||
 			optlen != sizeof(struct timeval)) {
 		return -EINVAL;
 	}
 	const struct timeval *ptv = optval;
-	sock_data.so_rcvtimeo = ptv->tv_sec * 1000;
-	sock_data.so_rcvtimeo += ptv->tv_usec / 1000;
+	s->so_rcvtimeo = ptv->tv_sec * 1000;
+	s->so_rcvtimeo += ptv->tv_usec / 1000;
 	return 0;
 }
 
@@ -135,19 +288,74 @@ static const struct socket_op_vtable socket_fd_op_vtable = {
 
 int http_fail_unit_test_socket_create(void)
 {
+	struct mock_sock *s = NULL;
+
+	for (int i = 0; i < MOCK_MAX_SOCKS; i++) {
+		if (!socks[i].in_use) {
+			s = &socks[i];
+			break;
+		}
+	}
+	if (s == NULL) {
+		errno = ENFILE;
+		return -1;
+	}
+
 	int fd = z_reserve_fd();
 
 	if (fd < 0) {
 		return -1;
 	}
 
-	sock_data.ptr = 0;
-	sock_data.len = DOWNLOAD_SIZE;
-	sock_data.header_sent = 0;
-	sock_data.so_rcvtimeo = 0;
+	memset(s, 0, sizeof(*s));
+	s->in_use = true;
 
-	z_finalize_fd(fd, &sock_data,
-			(const struct fd_op_vtable *)&socket_fd_op_vtable);
+	z_finalize_fd(fd, s, (const struct fd_op_vtable *)&socket_fd_op_vtable);
 
 	return fd;
 }
+
+/**
+ * @brief Select a canned link profile and restart the random sequence
+ */
+int tmo_mock_set_profile(const char *name)
+{
+	for (int i = 0; i < ARRAY_SIZE(profiles); i++) {
+		if (!strcmp(name, profiles[i].name)) {
+			profile = &profiles[i];
+			rng_state = seed;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+const struct tmo_mock_profile *tmo_mock_get_profile(void)
+{
+	return profile;
+}
+
+const struct tmo_mock_profile *tmo_mock_get_profile_by_idx(int idx)
+{
+	if (idx < 0 || idx >= ARRAY_SIZE(profiles)) {
+		return NULL;
+	}
+	return &profiles[idx];
+}
+
+void tmo_mock_set_seed(uint32_t new_seed)
+{
+	/* xorshift never leaves the all-zero state */
+	seed = new_seed ? new_seed : 1;
+	rng_state = seed;
+}
+
+void tmo_mock_get_stats(struct tmo_mock_stats *out)
+{
+	*out = stats;
+}
+
+void tmo_mock_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
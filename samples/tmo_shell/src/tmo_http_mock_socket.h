@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_HTTP_MOCK_SOCKET_H
+#define TMO_HTTP_MOCK_SOCKET_H
+
+#include <stdint.h>
+
+/* Link characteristics emulated by the mock socket
+ * Probabilities are per recv() call, in 1/1000.
+ */
+struct tmo_mock_profile {
+	const char *name;
+	uint32_t bandwidth_bps;      /* 0 = unlimited */
+	uint32_t rtt_ms;
+	uint32_t jitter_ms;
+	uint16_t loss_permille;      /* stall until SO_RCVTIMEO expires */
+	uint16_t reset_permille;     /* connection reset by peer */
+	uint16_t short_read_permille;
+	uint16_t mtu;                /* largest segment returned by one recv() */
+	uint32_t body_size;          /* size of a GET response body */
+	uint32_t fail_at;            /* stall forever after this many body bytes, 0 = never */
+};
+
+struct tmo_mock_stats {
+	uint32_t connects;
+	uint32_t requests;
+	uint32_t bytes_sent;
+	uint32_t bytes_received;
+	uint32_t losses;
+	uint32_t resets;
+	uint32_t short_reads;
+};
+
+int http_fail_unit_test_socket_create(void);
+int tmo_mock_set_profile(const char *name);
+const struct tmo_mock_profile *tmo_mock_get_profile(void);
+const struct tmo_mock_profile *tmo_mock_get_profile_by_idx(int idx);
+void tmo_mock_set_seed(uint32_t seed);
+void tmo_mock_get_stats(struct tmo_mock_stats *stats);
+void tmo_mock_reset_stats(void);
+
+#endif
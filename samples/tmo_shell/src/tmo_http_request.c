@@ -15,20 +15,32 @@ LOG_MODULE_REGISTER(tmo_http_request, LOG_LEVEL_DBG);
 #include <zephyr/net/http/client.h>
 #include <zephyr/net/wifi_mgmt.h>
 #include <zephyr/fs/fs.h>
+#include <zephyr/random/rand32.h>
 
 #include "ca_certificate.h"
 #include "tmo_web_demo.h"
 #include "tmo_shell.h"
 #include "tmo_certs.h"
+#include "tmo_link_mgr.h"
+#include "tmo_dns_cache.h"
+#include "tmo_happy_connect.h"
+#include "tmo_http_coding.h"
+#include "tmo_usage.h"
+#include "tmo_http_request.h"
+#include "tmo_tls_mem.h"
+#include "tmo_xfer_buf.h"
+#if IS_ENABLED(CONFIG_TMO_HTTP_INFLATE)
+#include "tmo_inflate.h"
+#endif
+#if defined(CONFIG_TMO_HTTP_MOCK_SOCKET)
+#include "tmo_http_mock_socket.h"
+#endif
 
 #if CONFIG_MODEM
 #include <zephyr/drivers/modem/murata-1sc.h>
 #include <zephyr/posix/fcntl.h>
 #endif
 
-#define MAX_RECV_BUF_LEN 512
-static uint8_t recv_buf[MAX_RECV_BUF_LEN];
-
 #define MAX_ENDPOINT_SIZE  200
 static char endpoint[MAX_ENDPOINT_SIZE] = {0};
 
@@ -41,6 +53,8 @@ static char* suffix = "aaaaaaaa";
 
 /* Set the timeout for http requests to 10 minutes (in milliseconds) */
 #define HTTP_CLIENT_REQ_TIMEOUT (10 * 60 * 1000)
+/* How long a request waits for a free context */
+#define HTTP_CTX_WAIT_MS (60 * 1000)
 
 int get_endpoint()
 {
@@ -74,10 +88,262 @@ int get_endpoint()
 	return rc;
 }
 
+static K_SEM_DEFINE(http_retry_sem, CONFIG_TMO_HTTP_MAX_CONCURRENT_RETRIES,
+		CONFIG_TMO_HTTP_MAX_CONCURRENT_RETRIES);
+
+/**
+ * @brief Reserve one of the retry slots shared by all HTTP clients
+ *
+ * Keeps the number of requests being retried at the same time bounded so a
+ * flaky link does not turn into a retry storm.
+ */
+int tmo_http_retry_begin(k_timeout_t timeout)
+{
+	return k_sem_take(&http_retry_sem, timeout);
+}
+
+void tmo_http_retry_end(void)
+{
+	k_sem_give(&http_retry_sem);
+}
+
+/* The PRNG may not be seeded yet when the first retries run after boot */
+static uint32_t backoff_rand32(void)
+{
+#if defined(CONFIG_CSPRNG_ENABLED)
+	uint32_t r;
+
+	if (sys_csrand_get(&r, sizeof(r)) == 0) {
+		return r;
+	}
+#endif
+	return sys_rand32_get();
+}
+
+/**
+ * @brief Exponential backoff with "equal jitter" for the given attempt
+ *
+ * @return delay in milliseconds, in [d/2, d) with d = base * 2^attempt
+ */
+uint32_t tmo_http_backoff_ms(int attempt)
+{
+	uint32_t delay = CONFIG_TMO_HTTP_BACKOFF_BASE_MS;
+
+	while (attempt-- > 0 && delay < CONFIG_TMO_HTTP_BACKOFF_MAX_MS) {
+		delay *= 2;
+	}
+	delay = MIN(delay, CONFIG_TMO_HTTP_BACKOFF_MAX_MS);
+	return delay / 2 + backoff_rand32() % (delay / 2 + 1);
+}
+
+/*
+ * Everything one request needs, so that requests on different threads
+ * (the shell, telemetry, the download queue) do not share state. The
+ * parser callbacks find their context from the embedded http_request.
+ */
+struct tmo_http_ctx {
+	bool in_use;
+	enum tmo_http_kind kind;
+	int devid;
+	enum tmo_usage_tag tag;
+	int32_t timeout_ms;
+	struct http_request req;
+	/* Enough for the headers and a JSON reply, bodies go through xfer_buf */
+	uint8_t recv_buf[CONFIG_TMO_HTTP_RECV_BUF_SIZE];
+	/* Borrowed from the transfer pool by downloads and uploads */
+	uint8_t *xfer_buf;
+	char host[64];
+	char path[256];
+	char port_sz[10];
+	/* headers[0] is reserved for the Range or Upload-Offset header when resuming */
+	const char *headers[6];
+	char resume_header[32];
+	char auth_header[64];
+	bool match_hdr;
+	int http_status;
+	/* Request and response bytes, headers included, for the usage counters */
+	size_t tx_bytes;
+	size_t rx_bytes;
+	int retry_after;
+
+	/* Download sink, or upload source */
+	struct fs_file_t file;
+	struct fs_file_t *sink;
+	bool chunked;
+	int upload_offset;
+	int upload_size;
+	int total_sent;
+	/* Wire (content coded) offset, used for progress and Range resume */
+	int total_received;
+	/* Bytes written to the file, after decoding */
+	int total_written;
+	int content_length;
+	enum tmo_http_coding coding;
+	enum tmo_http_coding rsp_coding;
+	bool owns_inflater;
+	bool inflating;
+	bool resuming;
+	bool complete;
+	int err;
+};
+
+static struct tmo_http_ctx http_ctx[CONFIG_TMO_HTTP_CONTEXTS];
+/* Callers queue here for a free context */
+static K_SEM_DEFINE(http_ctx_sem, CONFIG_TMO_HTTP_CONTEXTS, CONFIG_TMO_HTTP_CONTEXTS);
+static K_MUTEX_DEFINE(http_ctx_mutex);
+#if IS_ENABLED(CONFIG_TMO_HTTP_INFLATE)
+/* There is a single inflater, the first download to file claims it */
+static atomic_t inflater_busy;
+#endif
+
+static struct tmo_http_ctx *http_ctx_get(k_timeout_t timeout)
+{
+	struct tmo_http_ctx *ctx = NULL;
+
+	if (k_sem_take(&http_ctx_sem, timeout)) {
+		return NULL;
+	}
+	k_mutex_lock(&http_ctx_mutex, K_FOREVER);
+	for (int i = 0; i < CONFIG_TMO_HTTP_CONTEXTS; i++) {
+		if (!http_ctx[i].in_use) {
+			ctx = &http_ctx[i];
+			memset(ctx, 0, sizeof(*ctx));
+			ctx->in_use = true;
+			ctx->timeout_ms = HTTP_CLIENT_REQ_TIMEOUT;
+			break;
+		}
+	}
+	k_mutex_unlock(&http_ctx_mutex);
+	return ctx;
+}
+
+static void http_ctx_put(struct tmo_http_ctx *ctx)
+{
+#if IS_ENABLED(CONFIG_TMO_HTTP_INFLATE)
+	if (ctx->owns_inflater) {
+		atomic_clear(&inflater_busy);
+	}
+#endif
+	tmo_xfer_buf_release(ctx->xfer_buf);
+	k_mutex_lock(&http_ctx_mutex, K_FOREVER);
+	ctx->in_use = false;
+	k_mutex_unlock(&http_ctx_mutex);
+	k_sem_give(&http_ctx_sem);
+}
+
+/* Point the receive side of a download or upload at a pool buffer */
+static int http_ctx_take_xfer_buf(struct tmo_http_ctx *ctx, const char *owner)
+{
+	ctx->xfer_buf = tmo_xfer_buf_acquire(owner, K_MSEC(HTTP_CTX_WAIT_MS));
+	if (ctx->xfer_buf == NULL) {
+		printf("Error: no transfer buffer free\n");
+		return -ENOMEM;
+	}
+	ctx->req.recv_buf = ctx->xfer_buf;
+	ctx->req.recv_buf_len = TMO_XFER_BUF_SIZE;
+	return 0;
+}
+
+static struct tmo_http_ctx *parser_ctx(struct http_parser *parser)
+{
+	return CONTAINER_OF(parser, struct tmo_http_ctx, req.internal.parser);
+}
+
+/* Request line, Host and the caller's headers, as http_client_req() sends them */
+static size_t http_req_hdr_len(const struct http_request *req)
+{
+	size_t len = strlen(http_method_str(req->method)) + 1 + strlen(req->url) + 1 +
+		strlen(req->protocol) + 2;
+
+	len += strlen("Host: \r\n") + strlen(req->host);
+	for (const char * const *h = req->header_fields; h && *h; h++) {
+		len += strlen(*h);
+	}
+	return len + 2;
+}
+
+/*
+ * Charge one http_client_req() to ctx->tx_bytes. It returns what it sent
+ * on success only, after a receive error the headers are counted as sent.
+ */
+static void http_ctx_count_tx(struct tmo_http_ctx *ctx, int ret)
+{
+	ctx->tx_bytes += ret > 0 ? ret : http_req_hdr_len(&ctx->req);
+}
+
+/**
+ * @brief Snapshot of the requests in flight
+ *
+ * @return number of entries filled in
+ */
+int tmo_http_get_active(struct tmo_http_status *st, int max)
+{
+	int n = 0;
+
+	k_mutex_lock(&http_ctx_mutex, K_FOREVER);
+	for (int i = 0; i < CONFIG_TMO_HTTP_CONTEXTS && n < max; i++) {
+		struct tmo_http_ctx *ctx = &http_ctx[i];
+
+		if (!ctx->in_use) {
+			continue;
+		}
+		st[n].kind = ctx->kind;
+		st[n].devid = ctx->devid;
+		strncpy(st[n].host, ctx->host, sizeof(st[n].host) - 1);
+		st[n].host[sizeof(st[n].host) - 1] = '\0';
+		st[n].transferred = ctx->kind == TMO_HTTP_UPLOAD ? ctx->total_sent :
+			ctx->total_received;
+		st[n].written = ctx->total_written;
+		st[n].content_length = ctx->content_length;
+		n++;
+	}
+	k_mutex_unlock(&http_ctx_mutex);
+	return n;
+}
+
+static int on_header_field_json(struct http_parser *parser, const char *at, size_t length)
+{
+	struct tmo_http_ctx *ctx = parser_ctx(parser);
+	static const char retry_after[] = "Retry-After";
+
+	ctx->match_hdr = (length == sizeof(retry_after) - 1) &&
+		!strncasecmp(at, retry_after, length);
+	return 0;
+}
+
+static int on_header_value_json(struct http_parser *parser, const char *at, size_t length)
+{
+	struct tmo_http_ctx *ctx = parser_ctx(parser);
+
+	if (!ctx->match_hdr) {
+		return 0;
+	}
+	/* Only the delta-seconds form is honoured, an HTTP-date falls back to backoff */
+	int secs = 0;
+	size_t i;
+	for (i = 0; i < length && at[i] >= '0' && at[i] <= '9'; i++) {
+		secs = secs * 10 + (at[i] - '0');
+	}
+	if (i > 0) {
+		ctx->retry_after = secs;
+	}
+	ctx->match_hdr = false;
+	return 0;
+}
+
+static const struct http_parser_settings json_parser_cb = {
+	.on_header_field = on_header_field_json,
+	.on_header_value = on_header_value_json,
+};
+
 static void response_cb_json(struct http_response *rsp,
 		enum http_final_call final_data, void *user_data)
 {
+	struct tmo_http_ctx *ctx = user_data;
+
+	ctx->rx_bytes += rsp->data_len;
 	if (final_data == HTTP_DATA_FINAL) {
+		ctx->http_status = rsp->http_status_code;
 		LOG_INF("Response status code: %d, %s", rsp->http_status_code, rsp->http_status);
 		if (rsp->body_found) {
 			LOG_INF("Body length: %d, Body: %s", rsp->recv_buf_len, rsp->recv_buf);
@@ -89,26 +355,93 @@ static void response_cb_json(struct http_response *rsp,
 #define HTTP_PREFIX  "http://"
 #define HTTPS_PREFIX "https://"
 
-void tmo_http_json()
+/* What a tmo_happy_socket_fn needs to set up an HTTP socket */
+struct http_sock_ctx {
+	bool tls;
+	const char *host;
+};
+
+/* tmo_happy_socket_fn for the JSON post */
+static int json_socket_create(struct net_if *iface, struct zsock_addrinfo *ai, void *user_data)
+{
+	struct http_sock_ctx *ctx = user_data;
+	int sock;
+
+#if defined(CONFIG_TMO_HTTP_MOCK_SOCKET)
+	LOG_WRN("Using mocked socket for JSON post.");
+	sock = http_fail_unit_test_socket_create();
+#else
+#if defined(CONFIG_NET_SOCKETS_SOCKOPT_TLS)
+	if (ctx->tls) {
+		
+		if (!ca_cert_sz) {
+			tls_credential_delete(CA_CERTIFICATE_TAG, TLS_CREDENTIAL_CA_CERTIFICATE);
+			tls_credential_add(CA_CERTIFICATE_TAG, TLS_CREDENTIAL_CA_CERTIFICATE,
+					entrust_g2, sizeof(entrust_g2));
+		}
+
+		sock = zsock_socket_ext(ai->ai_family, ai->ai_socktype, IPPROTO_TLS_1_2, iface);
+	} else
+#endif
+	{
+		sock = zsock_socket_ext(ai->ai_family, ai->ai_socktype, ai->ai_protocol, iface);
+	}
+#endif
+
+	if (sock < 0) {
+		printf("Error creating socket, error: %d, errno: %d\n", sock, errno);
+		return -errno;
+	}
+
+#if defined(CONFIG_NET_SOCKETS_SOCKOPT_TLS)
+	if (ctx->tls) {
+		sec_tag_t sec_tag_opt[] = {
+			CA_CERTIFICATE_TAG,
+		};
+		zsock_setsockopt(sock, SOL_TLS, TLS_SEC_TAG_LIST,
+				sec_tag_opt, sizeof(sec_tag_opt));
+
+		zsock_setsockopt(sock, SOL_TLS, TLS_HOSTNAME,
+				ctx->host, strlen(ctx->host) + 1);
+	}
+#endif
+#if CONFIG_MODEM
+	int tls_verify_val = TLS_PEER_VERIFY_NONE;
+	zsock_setsockopt(sock, SOL_TLS, TLS_PEER_VERIFY, &tls_verify_val, sizeof(tls_verify_val));
+#endif
+	return sock;
+}
+
+/**
+ * @brief POST the current JSON payload to the endpoint
+ *
+ * @param retry_after set to the Retry-After (secs) of the response, -1 if none
+ * @return 0 if the server answered with a 2xx status, -EAGAIN if it asked
+ * the client to back off (429/503), other negative values on failure
+ */
+int tmo_http_json(int *retry_after)
 {
 	int ret;
-	struct http_request req;
 	struct http_parser_url u;
-	char port_sz[10];
 	int tls = 0;
 
 	get_endpoint();
 	char *json_payload = get_json_payload_pointer();
+	*retry_after = -1;
 
 	char *server_url = endpoint;
 	printf("server_url: %s\npayload:\n%s\n", server_url, json_payload);
 
-	const char *json_request_header[] = {
+	static const char *json_request_header[] = {
 		"Content-Type: application/json\r\n",
 		NULL
 	};
 
-	memset(&req, 0, sizeof(req));
+	struct tmo_http_ctx *ctx = http_ctx_get(K_MSEC(HTTP_CTX_WAIT_MS));
+	if (ctx == NULL) {
+		return -EBUSY;
+	}
+	struct http_request *req = &ctx->req;
 
 	http_parser_url_init(&u);
 	http_parser_parse_url(server_url, strlen(server_url), 0, &u);
@@ -128,143 +461,232 @@ void tmo_http_json()
 		port = 80;
 	} else {
 		printf("Unsupported schema\n");
-		return;
+		http_ctx_put(ctx);
+		return -EINVAL;
 	}
-	snprintf(port_sz, sizeof(port_sz), "%d", port);
+	snprintf(ctx->port_sz, sizeof(ctx->port_sz), "%d", port);
 
-	char path[256], host[64];
-	memset(path, 0, 256);
 	if (u.field_set & (1 << UF_PATH)) {
-		memcpy(path, server_url + u.field_data[UF_PATH].off, u.field_data[UF_PATH].len);
+		memcpy(ctx->path, server_url + u.field_data[UF_PATH].off,
+				MIN(u.field_data[UF_PATH].len, sizeof(ctx->path) - 1));
 	} else {
-		path[0] = '/';
-	}
-	memset(host, 0, 64);
-	memcpy(host, server_url + u.field_data[UF_HOST].off, u.field_data[UF_HOST].len);
-
-	req.method = HTTP_POST;
-	req.url = path;
-	req.host = host;
-	req.protocol = "HTTP/1.1";
-	req.payload = json_payload;
-	req.payload_len = strlen(req.payload);
-	req.header_fields = json_request_header;
-	req.response = response_cb_json;
-	req.recv_buf = recv_buf;
-	req.recv_buf_len = sizeof(recv_buf);
-
-	static struct zsock_addrinfo hints;
-	struct zsock_addrinfo *res;
-
-	ret = tmo_offload_init(get_json_iface_type());
-	if (ret != 0) {
-		printf("Could not init device, ret = %d\n", ret);
-		return;
+		ctx->path[0] = '/';
 	}
+	memcpy(ctx->host, server_url + u.field_data[UF_HOST].off,
+			MIN(u.field_data[UF_HOST].len, sizeof(ctx->host) - 1));
 
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	ret = zsock_getaddrinfo(host, port_sz, &hints, &res);
+	ctx->kind = TMO_HTTP_JSON;
+	ctx->tag = TMO_USAGE_TELEMETRY;
+	ctx->retry_after = -1;
+	req->method = HTTP_POST;
+	req->url = ctx->path;
+	req->host = ctx->host;
+	req->protocol = "HTTP/1.1";
+	req->payload = json_payload;
+	req->payload_len = strlen(req->payload);
+	req->header_fields = json_request_header;
+	req->response = response_cb_json;
+	req->http_cb = &json_parser_cb;
+	req->recv_buf = ctx->recv_buf;
+	req->recv_buf_len = sizeof(ctx->recv_buf);
+
+	ctx->devid = tmo_link_resolve(get_json_iface_type(), TMO_LINK_TELEMETRY);
+	if (ctx->devid < 0) {
+		printf("Error: no usable interface\n");
+		http_ctx_put(ctx);
+		return ctx->devid;
+	}
+	ret = tmo_usage_check(ctx->devid, ctx->tag);
 	if (ret) {
-		printf("Failed to resolve host %s\n", host);
-		return;
+		http_ctx_put(ctx);
+		return ret;
 	}
 
-	int idx = get_json_iface_type();
-	struct net_if *iface = net_if_get_by_index(idx);
-	if (iface == NULL) {
-		printf("Interface type %d not found", idx);
-		zsock_freeaddrinfo(res);
-		return;
-	}
+	struct http_sock_ctx sctx = {.tls = tls, .host = ctx->host};
+	struct tmo_happy_req hreq = {
+		.host = ctx->host,
+		.port = ctx->port_sz,
+		.iface_idx = get_json_iface_type(),
+		.cls = TMO_LINK_TELEMETRY,
+		.create = json_socket_create,
+		.user_data = &sctx,
+	};
+	struct tmo_happy_result hres;
 
-	int sock;
+	int sock = tmo_happy_connect(&hreq, &hres);
+	if (sock < 0) {
+		printf("Error connecting socket, error: %d\n", sock);
+		http_ctx_put(ctx);
+		return sock;
+	}
+	ctx->devid = hres.iface_idx;
+	uint32_t connect_ms = hres.connect_ms;
 
-#if defined(CONFIG_NET_SOCKETS_SOCKOPT_TLS)
-	if (tls) {
-		
-		if (!ca_cert_sz) {
-			tls_credential_delete(CA_CERTIFICATE_TAG, TLS_CREDENTIAL_CA_CERTIFICATE);
-			tls_credential_add(CA_CERTIFICATE_TAG, TLS_CREDENTIAL_CA_CERTIFICATE,
-					entrust_g2, sizeof(entrust_g2));
+	printf("Sending request...\n");
+	int64_t start = k_uptime_get();
+	ret = http_client_req(sock, req, ctx->timeout_ms, ctx);
+	printf("http_client_req returned %d\n", ret);
+	/* A server side refusal says nothing about the link itself */
+	tmo_link_report(ctx->devid, ret >= 0, connect_ms, ret > 0 ? ret : 0,
+			k_uptime_get() - start);
+	http_ctx_count_tx(ctx, ret);
+	tmo_usage_add(ctx->devid, ctx->tag, ctx->tx_bytes, ctx->rx_bytes);
+	if (ret >= 0) {
+		if (ctx->http_status >= 200 && ctx->http_status < 300) {
+			ret = 0;
+		} else if (ctx->http_status == 429 || ctx->http_status == 503) {
+			ret = -EAGAIN;
+		} else {
+			ret = -EIO;
 		}
+	}
+	*retry_after = ctx->retry_after;
+	zsock_close(sock);
+	http_ctx_put(ctx);
+	return ret;
+}
 
-		sock = zsock_socket_ext(res->ai_family, res->ai_socktype, IPPROTO_TLS_1_2, iface);
-	} else
-#endif
-	{
-		sock = zsock_socket_ext(res->ai_family, res->ai_socktype, res->ai_protocol, iface);
+static void response_cb_download(struct http_response *rsp,
+		enum http_final_call final_data, void *user_data)
+{
+	struct tmo_http_ctx *ctx = user_data;
+
+	ctx->rx_bytes += rsp->data_len;
+	if (rsp->http_status_code < 200 && rsp->http_status_code > 299) {
+		printf("\nHTTP Status %d: %s\n", rsp->http_status_code, rsp->http_status);
 	}
 
-	if (sock < 0) {
-		printf("Error creating socket, error: %d, errno: %d\n", sock, errno);
-		zsock_freeaddrinfo(res);
-		return;
+	if (!ctx->content_length) {
+		if (rsp->content_length) {
+			ctx->content_length = rsp->content_length;
+			printf("\nExpecting %d bytes%s\n", ctx->content_length,
+					ctx->coding != TMO_HTTP_IDENTITY ? " (compressed)" : "");
+		}
 	}
+}
 
-#if defined(CONFIG_NET_SOCKETS_SOCKOPT_TLS)
-	if (tls) {
-		sec_tag_t sec_tag_opt[] = {
-			CA_CERTIFICATE_TAG,
-		};
-		zsock_setsockopt(sock, SOL_TLS, TLS_SEC_TAG_LIST,
-				sec_tag_opt, sizeof(sec_tag_opt));
+static int download_on_header_field(struct http_parser *parser, const char *at, size_t length)
+{
+	struct tmo_http_ctx *ctx = parser_ctx(parser);
 
-		zsock_setsockopt(sock, SOL_TLS, TLS_HOSTNAME,
-				host, strlen(host) + 1);
+	ctx->match_hdr = length == strlen("Content-Encoding") &&
+		strncasecmp(at, "Content-Encoding", length) == 0;
+	return 0;
+}
+
+static int download_on_header_value(struct http_parser *parser, const char *at, size_t length)
+{
+	struct tmo_http_ctx *ctx = parser_ctx(parser);
+
+	if (!ctx->match_hdr) {
+		return 0;
 	}
-#endif
-#if CONFIG_MODEM
-	int tls_verify_val = TLS_PEER_VERIFY_NONE;
-	zsock_setsockopt(sock, SOL_TLS, TLS_PEER_VERIFY, &tls_verify_val, sizeof(tls_verify_val));
-#endif
-	//Now connect the socket
-	ret = zsock_connect(sock, res->ai_addr, res->ai_addrlen);
+	ctx->rsp_coding = tmo_http_coding_parse(at, length);
+	return 0;
+}
 
-	if (ret < 0) {
-		printf("Error connecting socket, error: %d, errno: %d\n", ret, errno);
-	} else {
-		printf("Sending request...\n");
-		ret = http_client_req(sock, &req, HTTP_CLIENT_REQ_TIMEOUT, NULL);
-		printf("http_client_req returned %d\n", ret);
+static int download_on_headers_complete(struct http_parser *parser)
+{
+	struct tmo_http_ctx *ctx = parser_ctx(parser);
+
+	if (!ctx->resuming) {
+		ctx->coding = ctx->rsp_coding;
+		return 0;
 	}
-	zsock_freeaddrinfo(res);
-	zsock_close(sock);
+	ctx->err = tmo_http_resume_check(parser->status_code, ctx->coding, ctx->rsp_coding);
+	if (ctx->err == -ESPIPE) {
+		printf("\nServer ignored range request (status %d)\n", parser->status_code);
+	} else if (ctx->err) {
+		printf("\nContent coding changed on resume (%s, was %s)\n",
+				tmo_http_coding_name(ctx->rsp_coding), tmo_http_coding_name(ctx->coding));
+	}
+	return 0;
 }
 
-static int http_total_received = 0;
-static int http_total_written = 0;
-static int http_content_length = 0;
-static void response_cb_download(struct http_response *rsp,
-		enum http_final_call final_data, void *user_data)
+#if IS_ENABLED(CONFIG_TMO_HTTP_INFLATE)
+static int download_inflate_out(const uint8_t *buf, size_t len, void *user_data)
 {
-	struct fs_file_t *file = user_data;
+	struct tmo_http_ctx *ctx = user_data;
+	int ret = fs_write(ctx->sink, buf, len);
 
-	if (rsp->http_status_code < 200 && rsp->http_status_code > 299) {
-		printf("\nHTTP Status %d: %s\n", rsp->http_status_code, rsp->http_status);
+	if (ret < 0) {
+		return ret;
 	}
+	ctx->total_written += ret;
+	return (size_t)ret == len ? 0 : -ENOSPC;
+}
 
-	if (!http_content_length) {
-		if (rsp->content_length) {
-			http_content_length = rsp->content_length;
-			printf("\nExpecting %d bytes\n", http_content_length);
+static int download_inflate(struct tmo_http_ctx *ctx, const char *at, size_t length)
+{
+	if (!ctx->inflating) {
+		int ret = tmo_inflate_start(ctx->coding == TMO_HTTP_GZIP ? TMO_INFLATE_GZIP :
+				TMO_INFLATE_DEFLATE, download_inflate_out, ctx);
+
+		if (ret) {
+			return ret;
 		}
+		ctx->inflating = true;
 	}
-	if (rsp->body_found) {
-		http_total_received += rsp->body_frag_len;
-		if (file) {
-			int ret = fs_write(file, rsp->body_frag_start, rsp->body_frag_len);
-			if (ret > 0) {
-				http_total_written += ret;
-			}
+	return tmo_inflate_feed((const uint8_t *)at, length);
+}
+#endif
+
+static int download_on_body(struct http_parser *parser, const char *at, size_t length)
+{
+	struct tmo_http_ctx *ctx = parser_ctx(parser);
+	int ret = 0;
+
+	if (ctx->err) {
+		return 0;
+	}
+	ctx->total_received += length;
+#if IS_ENABLED(CONFIG_TMO_HTTP_INFLATE)
+	if (ctx->sink && ctx->coding != TMO_HTTP_IDENTITY && ctx->owns_inflater) {
+		ret = download_inflate(ctx, at, length);
+	} else
+#endif
+	if (ctx->sink) {
+		ret = fs_write(ctx->sink, at, length);
+		if (ret > 0) {
+			ctx->total_written += ret;
 		}
-		printf(".");
 	}
+	if (ret < 0) {
+		printf("\nError writing download: %d\n", ret);
+		ctx->err = ret;
+	}
+	printf(".");
+	return 0;
+}
+
+static int download_on_message_complete(struct http_parser *parser)
+{
+	parser_ctx(parser)->complete = true;
+	return 0;
+}
+
+static const struct http_parser_settings download_parser_cb = {
+	.on_header_field = download_on_header_field,
+	.on_header_value = download_on_header_value,
+	.on_headers_complete = download_on_headers_complete,
+	.on_body = download_on_body,
+	.on_message_complete = download_on_message_complete,
+};
+
+/* More of the body is expected, by length or by chunked framing */
+static bool download_incomplete(struct tmo_http_ctx *ctx)
+{
+	if (ctx->err) {
+		return false;
+	}
+	if (ctx->content_length) {
+		return ctx->content_length > ctx->total_received;
+	}
+	return (ctx->req.internal.parser.flags & F_CHUNKED) && !ctx->complete;
 }
 
 #define HTTP_PREFIX  "http://"
 #define HTTPS_PREFIX "https://"
-extern uint8_t mxfer_buf[];
 
 #ifndef CONFIG_TMO_HTTP_MOCK_SOCKET
 int create_http_socket(bool tls, char* host, struct addrinfo *res, struct net_if *iface)
@@ -311,7 +733,6 @@ int create_http_socket(bool tls, char* host, struct addrinfo *res, struct net_if
 	return sock;
 }
 #else
-extern int http_fail_unit_test_socket_create(void);
 int create_http_socket(bool tls, char* host, struct addrinfo *res, struct net_if *iface)
 {
 	LOG_WRN("Using mocked socket for download.");
@@ -326,38 +747,130 @@ int create_http_socket(bool tls, char* host, struct addrinfo *res, struct net_if
 }
 #endif
 
+/* tmo_happy_socket_fn for downloads */
+static int download_socket_create(struct net_if *iface, struct zsock_addrinfo *ai,
+		void *user_data)
+{
+	struct http_sock_ctx *ctx = user_data;
+
+	return create_http_socket(ctx->tls, (char *)ctx->host, ai, iface);
+}
 
-int tmo_http_download(int devid, char url[], char filename[], char *auth_key)
+/* Move an automatically routed download to the next best link */
+static void download_failover(struct tmo_http_ctx *ctx, bool *user_trust)
 {
-	static struct addrinfo hints;
-	struct addrinfo *res = NULL;
-	int sock = -1;
-	struct http_request req;
-	struct http_parser_url u;
-	char port_sz[10];
-	int tls = 0;
-	int ret = -1;
-	struct fs_file_t file = {0};
-	char *auth_header = NULL;
-	char auth_header_buf[64];
+	int next = tmo_link_failover(ctx->devid, TMO_LINK_BULK);
 
-	if (auth_key){
-		snprintf(auth_header_buf, sizeof(auth_header_buf) - 1, "Authorization: Basic %s", auth_key);
-		auth_header = auth_header_buf;
+	if (next == ctx->devid || tmo_offload_init(next) != 0 ||
+			net_if_get_by_index(next) == NULL) {
+		return;
+	}
+	printf("\nSwitching download from iface %d to %d\n", ctx->devid, next);
+	ctx->devid = next;
+	/* The Murata user-trust profile does not apply to other links */
+	*user_trust = false;
+}
+
+#if defined(CONFIG_NET_SOCKETS_SOCKOPT_TLS) && defined(CONFIG_MODEM)
+/*
+ * The Murata modem checks certificates against its own profiles, so TLS
+ * over it connects to the first address without racing. If the default
+ * profile fails the user-trust profile is tried, and kept for retries.
+ */
+static int download_connect_murata(struct tmo_http_ctx *ctx, bool *user_trust)
+{
+	struct zsock_addrinfo hints = {.ai_socktype = SOCK_STREAM};
+	struct zsock_addrinfo ai;
+	struct net_if *iface = net_if_get_by_index(ctx->devid);
+	struct sockaddr addr;
+	int profile = 255;
+	int sock;
+	int ret;
+
+	if (tmo_dns_resolve_addr(ctx->host, ctx->port_sz, &hints, ctx->devid, &ai, &addr)) {
+		printf("Failed to resolve host %s\n", ctx->host);
+		return -EINVAL;
+	}
+	sock = create_http_socket(true, ctx->host, &ai, iface);
+	if (sock < 0) {
+		return sock;
 	}
-	
+	if (!*user_trust) {
+		struct murata_tls_profile_params pparams = {0};
+
+		pparams.profile_id_num = 255;
+		pparams.ca_path = ".";
+		fcntl(sock, CREATE_CERT_PROFILE, &pparams);
+		if (zsock_connect(sock, ai.ai_addr, ai.ai_addrlen) == 0) {
+			return sock;
+		}
+		zsock_close(sock);
+		sock = create_http_socket(true, ctx->host, &ai, iface);
+		if (sock < 0) {
+			return sock;
+		}
+		*user_trust = true;
+	}
+	zsock_setsockopt(sock, SOL_TLS, TLS_MURATA_USE_PROFILE, &profile, sizeof(profile));
+	ret = zsock_connect(sock, ai.ai_addr, ai.ai_addrlen);
+	if (ret < 0) {
+		ret = -errno;
+		zsock_close(sock);
+		tmo_link_report(ctx->devid, false, 0, 0, 0);
+		return ret;
+	}
+	return sock;
+}
+#endif
 
-	const char *headers[] = {
-		auth_header, NULL
+/*
+ * Connect a download, racing the addresses of iface_idx, and of the next
+ * best link too for TMO_LINK_AUTO. Retries come here as well, so that a
+ * reconnect races again instead of reusing a stale address. ctx->devid
+ * is set to the interface that won.
+ */
+static int download_connect(struct tmo_http_ctx *ctx, int tls, int iface_idx,
+		bool *user_trust)
+{
+#if defined(CONFIG_NET_SOCKETS_SOCKOPT_TLS) && defined(CONFIG_MODEM)
+	if (ctx->devid == MODEM_ID && tls) {
+		return download_connect_murata(ctx, user_trust);
+	}
+#endif
+	struct http_sock_ctx sctx = {.tls = tls, .host = ctx->host};
+	struct tmo_happy_req hreq = {
+		.host = ctx->host,
+		.port = ctx->port_sz,
+		.iface_idx = iface_idx,
+		.cls = TMO_LINK_BULK,
+		.create = download_socket_create,
+		.user_data = &sctx,
+		.tls = tls && IS_ENABLED(CONFIG_TMO_SHELL_USE_MBED),
 	};
+	struct tmo_happy_result hres;
+	int sock = tmo_happy_connect(&hreq, &hres);
 
-	memset(&req, 0, sizeof(req));
+	if (sock >= 0 && hres.iface_idx != ctx->devid) {
+		printf("Connected over iface %d\n", hres.iface_idx);
+		ctx->devid = hres.iface_idx;
+	}
+	return sock;
+}
+
+/**
+ * @brief Split url into the host, port and path of ctx
+ *
+ * @return 1 for https, 0 for http, -EINVAL for other schemes
+ */
+static int http_ctx_parse_url(struct tmo_http_ctx *ctx, const char *url)
+{
+	struct http_parser_url u;
+	int tls = 0;
+	int port;
 
 	http_parser_url_init(&u);
 	http_parser_parse_url(url, strlen(url), 0, &u);
 
-	int port;
-
 	if (u.port != 0) {
 		port = u.port;
 	}
@@ -374,177 +887,635 @@ int tmo_http_download(int devid, char url[], char filename[], char *auth_key)
 		return -EINVAL;
 	}
 
-	memset(port_sz, 0, sizeof(port_sz));
-	snprintf(port_sz, sizeof(port_sz), "%d", port);
-	req.method = HTTP_GET;
-	char path[256], host[64];
-	memset(path, 0, 256);
+	snprintf(ctx->port_sz, sizeof(ctx->port_sz), "%d", port);
 	if (u.field_set & (1 << UF_PATH)) {
-		memcpy(path, url + u.field_data[UF_PATH].off, u.field_data[UF_PATH].len +
-				(u.field_set & (1 << UF_QUERY) ? u.field_data[UF_QUERY].len + 1 : 0));
+		memcpy(ctx->path, url + u.field_data[UF_PATH].off,
+				MIN(u.field_data[UF_PATH].len + (u.field_set & (1 << UF_QUERY) ?
+				u.field_data[UF_QUERY].len + 1 : 0), sizeof(ctx->path) - 1));
 	} else {
-		path[0] = '/';
+		ctx->path[0] = '/';
 	}
-	memset(host, 0, 64);
-	memcpy(host, url + u.field_data[UF_HOST].off, u.field_data[UF_HOST].len);
+	memcpy(ctx->host, url + u.field_data[UF_HOST].off,
+			MIN(u.field_data[UF_HOST].len, sizeof(ctx->host) - 1));
+	return tls;
+}
 
-	req.url = path;
-	req.host = host;
-	req.protocol = "HTTP/1.1";
-	req.header_fields = headers;
-	req.response = response_cb_download;
-	req.recv_buf = mxfer_buf;
-	req.recv_buf_len = 4096;
+/**
+ * @brief Download url, to filename if given, resuming on failure
+ *
+ * Blocks until a request context is free, so any thread may call this.
+ *
+ * @return bytes received (decoded bytes written for a compressed body),
+ * or a negative error
+ */
+int tmo_http_download(int devid, const char url[], const char filename[], char *auth_key,
+		enum tmo_usage_tag tag)
+{
+	bool user_trust = false;
+	int sock = -1;
+	int tls;
+	int ret = -1;
+	int nhdr = 1;
 
-	ret = tmo_offload_init(devid);
-	if (ret != 0) {
-		printf("Error: could not init device %d", devid);
+	struct tmo_http_ctx *ctx = http_ctx_get(K_MSEC(HTTP_CTX_WAIT_MS));
+	if (ctx == NULL) {
+		printf("Error: all %d HTTP contexts busy\n", CONFIG_TMO_HTTP_CONTEXTS);
+		return -EBUSY;
 	}
+	struct http_request *req = &ctx->req;
 
-	// hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	ret = zsock_getaddrinfo(host, port_sz, &hints, &res);
+	ctx->kind = TMO_HTTP_DOWNLOAD;
+	ctx->tag = tag;
+#if IS_ENABLED(CONFIG_TMO_HTTP_INFLATE)
+	if (filename && atomic_cas(&inflater_busy, 0, 1)) {
+		ctx->owns_inflater = true;
+		ctx->headers[nhdr++] = "Accept-Encoding: gzip, deflate\r\n";
+	}
+#endif
+	if (auth_key){
+		snprintf(ctx->auth_header, sizeof(ctx->auth_header) - 1, "Authorization: Basic %s", auth_key);
+		ctx->headers[nhdr++] = ctx->auth_header;
+	}
+
+	tls = http_ctx_parse_url(ctx, url);
+	if (tls < 0) {
+		http_ctx_put(ctx);
+		return tls;
+	}
+	req->method = HTTP_GET;
+	req->url = ctx->path;
+	req->host = ctx->host;
+	req->protocol = "HTTP/1.1";
+	req->header_fields = &ctx->headers[1];
+	req->response = response_cb_download;
+	req->http_cb = &download_parser_cb;
+	ret = http_ctx_take_xfer_buf(ctx, "http_get");
 	if (ret) {
-		printf("Failed to resolve host %s\n", host);
-		return -EINVAL;
+		http_ctx_put(ctx);
+		return ret;
 	}
 
-	struct net_if *iface = net_if_get_by_index(devid);
-	if (iface == NULL) {
-		printf("Error: interface %d not found", devid);
-		return -EINVAL;
+	bool auto_link = devid == TMO_LINK_AUTO;
+	devid = tmo_link_resolve(devid, TMO_LINK_BULK);
+	if (devid < 0) {
+		printf("Error: no usable interface\n");
+		http_ctx_put(ctx);
+		return devid;
+	}
+	ctx->devid = devid;
+	ret = tmo_offload_init(devid);
+	if (ret != 0) {
+		printf("Error: could not init device %d", devid);
 	}
 
-	sock = create_http_socket(tls, host, res, iface);
+	sock = download_connect(ctx, tls, auto_link ? TMO_LINK_AUTO : devid, &user_trust);
 	if (sock < 0) {
-		printf("Error creating socket, ret = %d, errno = %d", sock, errno);
+		printf("Error connecting, ret = %d, errno = %d", sock, errno);
+		ret = sock;
 		goto exit;
 	}
-	// struct ifreq ifreq = {0};
-	// strcpy(ifreq.ifr_name, iface->if_dev->dev->name);
-	// ret = zsock_setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE,
-	// 			   &ifreq, sizeof(ifreq));
-#if defined(CONFIG_NET_SOCKETS_SOCKOPT_TLS) && defined(CONFIG_MODEM)
-	bool user_trust = false;
-	int profile;
-	if (devid == MODEM_ID && tls) {
-		struct murata_tls_profile_params pparams = {0};
-		pparams.profile_id_num = 255;
-		pparams.ca_path = ".";
-		fcntl(sock, CREATE_CERT_PROFILE, &pparams);
-		ret = zsock_connect(sock, res->ai_addr, res->ai_addrlen);
-		if (ret == -1) {
-			zsock_close(sock);
-			sock = create_http_socket(tls, host, res, iface);
-			profile = 255;
-			zsock_setsockopt(sock, SOL_TLS, TLS_MURATA_USE_PROFILE, &profile, sizeof(profile));
-			ret = zsock_connect(sock, res->ai_addr, res->ai_addrlen);
-			user_trust = true;
-		}
-	} else {
-		ret = zsock_connect(sock, res->ai_addr, res->ai_addrlen);
-	}
-
-#else 
-	ret = zsock_connect(sock, res->ai_addr, res->ai_addrlen);
-#endif
-	// //Now create the socket
-	// ret = zsock_connect(sock, res->ai_addr, res->ai_addrlen);
-	if (ret < 0) {
-		printf("Error connecting, ret = %d, errno = %d", ret, errno);
+	devid = ctx->devid;
+	/* Charge the quota of the link that won the race */
+	ret = tmo_usage_check(devid, tag);
+	if (ret) {
+		printf("Error: iface %d over data quota\n", devid);
 		goto exit;
 	}
 
-	http_total_received = 0;
-	http_total_written = 0;
-	http_content_length = 0;
 	int fail_count = 0;
+	int64_t start = k_uptime_get();
 
 	if (filename) {
 		// Assume fs is already mounted
 
 		printf("Opening file %s\n", filename);
-		ret = fs_open(&file, filename, FS_O_CREATE | FS_O_WRITE);
+		fs_file_t_init(&ctx->file);
+		ret = fs_open(&ctx->file, filename, FS_O_CREATE | FS_O_WRITE);
 		if (ret != 0) {
 			printf("Error: could not open file %s\n", filename);
 			goto exit;
 		}
+		ctx->sink = &ctx->file;
 
-		ret = fs_truncate(&file, 0);
+		ret = fs_truncate(ctx->sink, 0);
 		if (ret != 0) {
 			printf("Could not truncate file %s\n", filename);
 			goto exit;
 		}
-		errno = 0;
-		ret = http_client_req(sock, &req, HTTP_CLIENT_REQ_TIMEOUT, &file);
-		while (http_content_length && http_content_length > http_total_received && fail_count < 5) {
-			fail_count++;
-			printf("\nTransfer failure detected, reinitializing transfer... (%d/5) (%d < %d)\n", fail_count, http_total_received, http_content_length);
+	}
+	errno = 0;
+	ret = http_client_req(sock, req, ctx->timeout_ms, ctx);
+	http_ctx_count_tx(ctx, ret);
+	while (download_incomplete(ctx) && fail_count < 5) {
+		fail_count++;
+		printf("\nTransfer failure detected, reinitializing transfer... (%d/5) (%d < %d)\n", fail_count, ctx->total_received, ctx->content_length);
+		if (sock >= 0) {
 			zsock_close(sock);
-			sock = create_http_socket(tls, host, res, iface);
-			if (user_trust)
-				zsock_setsockopt(sock, SOL_TLS, TLS_MURATA_USE_PROFILE, &profile, sizeof(profile));
-			errno = 0;
-			k_msleep(2000);
-			zsock_connect(sock, res->ai_addr, res->ai_addrlen);
-			char *headers[] = {
-				NULL, auth_header, NULL
-			};
-			char range_header[32] = {0};
-			snprintk(range_header, sizeof(range_header), "Range: bytes=%d-\r\n", http_total_received);
-			headers[0] = range_header;
-			req.header_fields = (const char**)headers;
-			// req.header_fields
-			http_client_req(sock, &req, HTTP_CLIENT_REQ_TIMEOUT, &file);
-		}
-		if (http_total_received == http_total_written) {
-			printf("\nReceived:%d, Wrote: %d\n", http_total_received, http_total_written);
-		} else {
-			printf("\nReceived:%d, Wrote: %d\n", http_total_received, http_total_written);
+			sock = -1;
 		}
-	} else {
+		/* Bytes so far belong to the link they went over */
+		tmo_usage_add(devid, tag, ctx->tx_bytes, ctx->rx_bytes);
+		ctx->tx_bytes = 0;
+		ctx->rx_bytes = 0;
+		if (auto_link) {
+			download_failover(ctx, &user_trust);
+		}
+		/* Back off without a retry slot, it only bounds retries on the wire */
+		k_msleep(tmo_http_backoff_ms(fail_count));
+		tmo_http_retry_begin(K_FOREVER);
 		errno = 0;
-		ret = http_client_req(sock, &req, HTTP_CLIENT_REQ_TIMEOUT, NULL);
-		while (http_content_length && http_content_length > http_total_received && fail_count < 5) {
-			fail_count++;
-			printf("\nTransfer failure detected, reinitializing transfer... (%d/5) (%d < %d)\n", fail_count, http_total_received, http_content_length);
-			zsock_close(sock);
-			sock = create_http_socket(tls, host, res, iface);
-			if (user_trust)
-				zsock_setsockopt(sock, SOL_TLS, TLS_MURATA_USE_PROFILE, &profile, sizeof(profile));
-			errno = 0;
-			k_msleep(2000);
-			zsock_connect(sock, res->ai_addr, res->ai_addrlen);
-			char *headers[] = {
-				NULL, auth_header, NULL
-			};
-			char range_header[32] = {0};
-			snprintk(range_header, sizeof(range_header), "Range: bytes=%d-\r\n", http_total_received);
-			headers[0] = range_header;
-			req.header_fields = (const char**)headers;
-			// req.header_fields
-			http_client_req(sock, &req, HTTP_CLIENT_REQ_TIMEOUT, &file);
-		}
-		printf("\n\nReceived:%d\n", http_total_received);
-	}
-	if (fail_count == 5 && http_total_received != http_content_length) {
+		sock = download_connect(ctx, tls, ctx->devid, &user_trust);
+		devid = ctx->devid;
+		ret = sock >= 0 ? tmo_usage_check(devid, tag) : 0;
+		if (ret) {
+			printf("Error: iface %d over data quota\n", devid);
+			ctx->err = ret;
+			tmo_http_retry_end();
+			break;
+		}
+		if (sock < 0) {
+			tmo_http_retry_end();
+			continue;
+		}
+		/* Offsets are in the content coded stream, which the inflater continues */
+		snprintk(ctx->resume_header, sizeof(ctx->resume_header), "Range: bytes=%d-\r\n", ctx->total_received);
+		ctx->headers[0] = ctx->resume_header;
+		req->header_fields = ctx->headers;
+		ctx->rsp_coding = TMO_HTTP_IDENTITY;
+		ctx->resuming = true;
+		http_ctx_count_tx(ctx, http_client_req(sock, req, ctx->timeout_ms, ctx));
+		tmo_http_retry_end();
+	}
+#if IS_ENABLED(CONFIG_TMO_HTTP_INFLATE)
+	if (ctx->inflating) {
+		int err = tmo_inflate_finish();
+
+		if (err && !ctx->err) {
+			ctx->err = err;
+		}
+	}
+#endif
+	if (filename) {
+		printf("\nReceived:%d %s, Wrote: %d\n", ctx->total_received,
+				tmo_http_coding_name(ctx->coding), ctx->total_written);
+	} else {
+		printf("\n\nReceived:%d\n", ctx->total_received);
+	}
+	tmo_link_report(devid, !ctx->err && !download_incomplete(ctx),
+			0, ctx->total_received, k_uptime_get() - start);
+	tmo_usage_add(devid, tag, ctx->tx_bytes, ctx->rx_bytes);
+	if (ctx->err) {
+		printf("Error: download failed: %d\n", ctx->err);
+		ret = ctx->err;
+		goto exit;
+	}
+	if (fail_count == 5 && download_incomplete(ctx)) {
 		printf("Error: Exceded maximum number of attempts for download\n");
 		ret = -EAGAIN;
 		goto exit;
 	}
 exit:
-	if (res) {
-		freeaddrinfo(res);
-	}
-	if (filename) {
-		fs_close(&file);
+	if (ctx->sink) {
+		fs_close(ctx->sink);
 	}
 	if (sock >= 0) {
 		zsock_close(sock);
 	}
-	if (ret < 0) {
+	if (ret >= 0) {
+		ret = ctx->inflating ? ctx->total_written : ctx->total_received;
+	}
+	http_ctx_put(ctx);
+	return ret;
+}
+
+static void response_cb_upload(struct http_response *rsp,
+		enum http_final_call final_data, void *user_data)
+{
+	struct tmo_http_ctx *ctx = user_data;
+
+	ctx->rx_bytes += rsp->data_len;
+	if (final_data == HTTP_DATA_FINAL) {
+		ctx->http_status = rsp->http_status_code;
+	}
+}
+
+static int upload_on_header_field(struct http_parser *parser, const char *at, size_t length)
+{
+	struct tmo_http_ctx *ctx = parser_ctx(parser);
+
+	ctx->match_hdr = length == strlen("Upload-Offset") &&
+		strncasecmp(at, "Upload-Offset", length) == 0;
+	return 0;
+}
+
+static int upload_on_header_value(struct http_parser *parser, const char *at, size_t length)
+{
+	struct tmo_http_ctx *ctx = parser_ctx(parser);
+	int offset = 0;
+	size_t i;
+
+	if (!ctx->match_hdr) {
+		return 0;
+	}
+	for (i = 0; i < length && at[i] >= '0' && at[i] <= '9'; i++) {
+		offset = offset * 10 + (at[i] - '0');
+	}
+	if (i > 0) {
+		ctx->upload_offset = offset;
+	}
+	ctx->match_hdr = false;
+	return 0;
+}
+
+static const struct http_parser_settings upload_parser_cb = {
+	.on_header_field = upload_on_header_field,
+	.on_header_value = upload_on_header_value,
+};
+
+static int upload_send_all(int sock, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len) {
+		ssize_t ret = zsock_send(sock, p, len, 0);
+
+		if (ret < 0) {
+			return -errno;
+		}
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/*
+ * http_payload_cb_t streaming the file from upload_offset. The receive
+ * buffer is idle until the body has been sent, so it doubles as the read
+ * buffer.
+ */
+static int upload_payload_cb(int sock, struct http_request *req, void *user_data)
+{
+	struct tmo_http_ctx *ctx = user_data;
+	int offset = ctx->upload_offset;
+	int ret;
+
+	ret = fs_seek(&ctx->file, offset, FS_SEEK_SET);
+	if (ret) {
 		return ret;
-	} else {
-		return http_total_received;
 	}
+	while (ctx->chunked || offset < ctx->upload_size) {
+		size_t len = ctx->req.recv_buf_len;
+		ssize_t n;
+
+		if (!ctx->chunked) {
+			len = MIN(len, ctx->upload_size - offset);
+		}
+		n = fs_read(&ctx->file, ctx->req.recv_buf, len);
+		if (n < 0) {
+			return n;
+		} else if (n == 0) {
+			if (!ctx->chunked) {
+				/* The file shrank under us */
+				return -EIO;
+			}
+			break;
+		}
+		if (ctx->chunked) {
+			char chunk_hdr[12];
+
+			snprintk(chunk_hdr, sizeof(chunk_hdr), "%x\r\n", (unsigned int)n);
+			ret = upload_send_all(sock, chunk_hdr, strlen(chunk_hdr));
+		}
+		if (ret == 0) {
+			ret = upload_send_all(sock, ctx->req.recv_buf, n);
+		}
+		if (ret == 0 && ctx->chunked) {
+			ret = upload_send_all(sock, "\r\n", 2);
+		}
+		if (ret) {
+			return ret;
+		}
+		offset += n;
+		ctx->total_sent += n;
+		printf(".");
+	}
+	if (ctx->chunked) {
+		ret = upload_send_all(sock, "0\r\n\r\n", 5);
+		if (ret) {
+			return ret;
+		}
+	}
+	return offset - ctx->upload_offset;
+}
+
+static int upload_probe_headers_complete(struct http_parser *parser)
+{
+	struct tmo_http_ctx *ctx = parser_ctx(parser);
+
+	ctx->http_status = parser->status_code;
+	/* Tell the parser no body follows, whatever Content-Length says */
+	return 1;
+}
+
+static const struct http_parser_settings upload_probe_cb = {
+	.on_header_field = upload_on_header_field,
+	.on_header_value = upload_on_header_value,
+	.on_headers_complete = upload_probe_headers_complete,
+};
+
+/*
+ * Ask a tus style server how much of the upload it already has. The HEAD
+ * reply carries the Content-Length of a body that is never sent, and
+ * http_client_req() would wait for it, so the request is written and its
+ * headers parsed here, each read bounded by the socket receive timeout.
+ * The caller closes the socket afterwards.
+ */
+static int upload_query_offset(struct tmo_http_ctx *ctx, int sock)
+{
+	struct http_parser *parser = &ctx->req.internal.parser;
+	char *buf = (char *)ctx->req.recv_buf;
+	int ret;
+
+	ret = snprintk(buf, ctx->req.recv_buf_len,
+			"HEAD %s HTTP/1.1\r\nHost: %s\r\nTus-Resumable: 1.0.0\r\n\r\n",
+			ctx->path, ctx->host);
+	ctx->tx_bytes += ret;
+	ret = upload_send_all(sock, buf, ret);
+	if (ret) {
+		return ret;
+	}
+
+	ctx->upload_offset = -1;
+	ctx->http_status = 0;
+	http_parser_init(parser, HTTP_RESPONSE);
+	while (ctx->http_status == 0) {
+		ssize_t n = zsock_recv(sock, buf, ctx->req.recv_buf_len, 0);
+
+		if (n < 0) {
+			return errno == EAGAIN ? -ETIMEDOUT : -errno;
+		} else if (n == 0) {
+			return -ECONNRESET;
+		}
+		ctx->rx_bytes += n;
+		http_parser_execute(parser, &upload_probe_cb, buf, n);
+		if (ctx->http_status == 0 && HTTP_PARSER_ERRNO(parser) != HPE_OK) {
+			return -EBADMSG;
+		}
+	}
+	if (ctx->http_status < 200 || ctx->http_status > 299 || ctx->upload_offset < 0) {
+		return -ENOTSUP;
+	}
+	/* A chunked upload may have grown past the size seen at the start */
+	return ctx->chunked ? ctx->upload_offset : MIN(ctx->upload_offset, ctx->upload_size);
+}
+
+static int upload_connect(int tls, struct tmo_http_ctx *ctx, struct zsock_addrinfo *res,
+		struct net_if *iface)
+{
+	int sock = create_http_socket(tls, ctx->host, res, iface);
+
+	if (sock < 0) {
+		return sock;
+	}
+	if (tmo_tls_connect(sock, res->ai_addr, res->ai_addrlen,
+			tls && IS_ENABLED(CONFIG_TMO_SHELL_USE_MBED), ctx->host) < 0) {
+		int err = -errno;
+
+		zsock_close(sock);
+		return err;
+	}
+	return sock;
+}
+
+/**
+ * @brief Upload a file, resuming after a failure
+ *
+ * The body is sent with PUT, with a Content-Length taken from the file
+ * size, or with chunked encoding so a file still being written goes out
+ * up to its end. After a failure the upload offset is asked for with HEAD
+ * (tus resumable upload protocol, Upload-Offset), and the rest is sent
+ * with PATCH. Servers without it get the whole file again.
+ *
+ * @return 0 on success, negative error otherwise
+ */
+int tmo_http_upload(int devid, const char url[], const char path[], bool chunked,
+		struct tmo_http_upload_stats *stats)
+{
+	struct zsock_addrinfo hints = {.ai_socktype = SOCK_STREAM};
+	struct zsock_addrinfo ai;
+	struct sockaddr addr;
+	struct fs_dirent entry;
+	struct net_if *iface;
+	int sock = -1;
+	int tls;
+	int ret;
+
+	memset(stats, 0, sizeof(*stats));
+	ret = fs_stat(path, &entry);
+	if (ret) {
+		printf("Error: could not stat %s: %d\n", path, ret);
+		return ret;
+	}
+
+	struct tmo_http_ctx *ctx = http_ctx_get(K_MSEC(HTTP_CTX_WAIT_MS));
+	if (ctx == NULL) {
+		return -EBUSY;
+	}
+	struct http_request *req = &ctx->req;
+
+	ctx->kind = TMO_HTTP_UPLOAD;
+	ctx->tag = TMO_USAGE_HTTP;
+	ctx->chunked = chunked;
+	ctx->upload_size = entry.size;
+	ctx->content_length = chunked ? 0 : entry.size;
+	tls = http_ctx_parse_url(ctx, url);
+	if (tls < 0) {
+		http_ctx_put(ctx);
+		return tls;
+	}
+	req->url = ctx->path;
+	req->host = ctx->host;
+	req->protocol = "HTTP/1.1";
+	req->response = response_cb_upload;
+	req->http_cb = &upload_parser_cb;
+	ret = http_ctx_take_xfer_buf(ctx, "http_put");
+	if (ret) {
+		http_ctx_put(ctx);
+		return ret;
+	}
+
+	devid = tmo_link_resolve(devid, TMO_LINK_BULK);
+	if (devid < 0 || tmo_offload_init(devid) != 0) {
+		printf("Error: no usable interface\n");
+		http_ctx_put(ctx);
+		return -ENODEV;
+	}
+	ctx->devid = devid;
+	ret = tmo_usage_check(devid, ctx->tag);
+	if (ret) {
+		printf("Error: iface %d over data quota\n", devid);
+		http_ctx_put(ctx);
+		return ret;
+	}
+	iface = net_if_get_by_index(devid);
+	ret = tmo_dns_resolve_addr(ctx->host, ctx->port_sz, &hints, devid, &ai, &addr);
+	if (ret || iface == NULL) {
+		printf("Failed to resolve host %s\n", ctx->host);
+		http_ctx_put(ctx);
+		return -EINVAL;
+	}
+
+	fs_file_t_init(&ctx->file);
+	ret = fs_open(&ctx->file, path, FS_O_READ);
+	if (ret) {
+		printf("Error: could not open file %s\n", path);
+		goto exit;
+	}
+	ctx->sink = &ctx->file;
+
+	int64_t start = k_uptime_get();
+
+	for (int attempt = 0; attempt < 5; attempt++) {
+		if (attempt) {
+			printf("\nUpload failure detected, resuming... (%d/5)\n", attempt);
+			k_msleep(tmo_http_backoff_ms(attempt));
+			tmo_http_retry_begin(K_FOREVER);
+			stats->resumes++;
+		}
+		sock = upload_connect(tls, ctx, &ai, iface);
+		ret = sock < 0 ? sock : 0;
+		ctx->upload_offset = 0;
+		if (ret == 0 && attempt) {
+			ret = upload_query_offset(ctx, sock);
+			zsock_close(sock);
+			sock = -1;
+			if (ret >= 0 || ret == -ENOTSUP) {
+				ctx->upload_offset = MAX(ret, 0);
+				sock = upload_connect(tls, ctx, &ai, iface);
+				ret = sock < 0 ? sock : 0;
+			}
+			printf("Resuming at offset %d\n", ctx->upload_offset);
+		}
+		if (ret == 0) {
+			int sent = ctx->total_sent;
+			int nhdr = 1;
+
+			if (ctx->upload_offset) {
+				snprintk(ctx->resume_header, sizeof(ctx->resume_header),
+						"Upload-Offset: %d\r\n", ctx->upload_offset);
+				ctx->headers[nhdr++] = ctx->resume_header;
+				ctx->headers[nhdr++] = "Tus-Resumable: 1.0.0\r\n";
+				ctx->headers[nhdr++] = "Content-Type: application/offset+octet-stream\r\n";
+			} else {
+				ctx->headers[nhdr++] = "Content-Type: application/octet-stream\r\n";
+			}
+			if (chunked) {
+				ctx->headers[nhdr++] = "Transfer-Encoding: chunked\r\n";
+			}
+			ctx->headers[nhdr] = NULL;
+			req->header_fields = &ctx->headers[1];
+			req->method = ctx->upload_offset ? HTTP_PATCH : HTTP_PUT;
+			req->payload_cb = upload_payload_cb;
+			req->payload_len = chunked ? 0 : ctx->upload_size - ctx->upload_offset;
+			ctx->http_status = 0;
+			ret = http_client_req(sock, req, ctx->timeout_ms, ctx);
+			http_ctx_count_tx(ctx, ret);
+			if (ret <= 0) {
+				/* Body bytes that went out before the failure */
+				ctx->tx_bytes += ctx->total_sent - sent;
+			}
+		}
+		if (sock >= 0) {
+			zsock_close(sock);
+			sock = -1;
+		}
+		if (attempt) {
+			tmo_http_retry_end();
+		}
+		if (ret >= 0) {
+			if (ctx->http_status >= 200 && ctx->http_status < 300) {
+				ret = 0;
+				break;
+			}
+			printf("\nHTTP Status %d\n", ctx->http_status);
+			ret = -EIO;
+			/* Only a server error is worth another try */
+			if (ctx->http_status < 500) {
+				break;
+			}
+		}
+	}
+	stats->size = ctx->upload_size;
+	stats->bytes = ctx->total_sent;
+	stats->elapsed_ms = k_uptime_get() - start;
+	tmo_link_report(devid, ret == 0, 0, ctx->total_sent, stats->elapsed_ms);
+	tmo_usage_add(devid, ctx->tag, ctx->tx_bytes, ctx->rx_bytes);
+exit:
+	if (ctx->sink) {
+		fs_close(ctx->sink);
+	}
+	http_ctx_put(ctx);
+	return ret;
 }
+
+#if IS_ENABLED(CONFIG_TMO_HTTP_WORKER)
+struct http_job {
+	int id;
+	int devid;
+	enum tmo_usage_tag tag;
+	char url[TMO_HTTP_URL_MAX];
+	char filename[TMO_HTTP_FILENAME_MAX];
+};
+
+static K_MSGQ_DEFINE(http_job_q, sizeof(struct http_job), CONFIG_TMO_HTTP_QUEUE_DEPTH, 4);
+static atomic_t http_job_id;
+
+/**
+ * @brief Queue a download to run on the HTTP worker thread
+ *
+ * @return job id, -ENOBUFS if the queue is full
+ */
+int tmo_http_download_async(int devid, const char *url, const char *filename,
+		enum tmo_usage_tag tag)
+{
+	struct http_job job = {
+		.devid = devid,
+		.tag = tag,
+	};
+
+	if (strlen(url) >= sizeof(job.url) ||
+			(filename && strlen(filename) >= sizeof(job.filename))) {
+		return -ENAMETOOLONG;
+	}
+	strcpy(job.url, url);
+	if (filename) {
+		strcpy(job.filename, filename);
+	}
+	job.id = atomic_inc(&http_job_id) + 1;
+	if (k_msgq_put(&http_job_q, &job, K_NO_WAIT)) {
+		return -ENOBUFS;
+	}
+	return job.id;
+}
+
+static void http_worker(void *p1, void *p2, void *p3)
+{
+	struct http_job job;
+
+	while (true) {
+		k_msgq_get(&http_job_q, &job, K_FOREVER);
+		LOG_INF("job %d: downloading %s", job.id, job.url);
+		int ret = tmo_http_download(job.devid, job.url,
+				job.filename[0] ? job.filename : NULL, NULL, job.tag);
+		if (ret < 0) {
+			LOG_ERR("job %d failed: %d", job.id, ret);
+		} else {
+			LOG_INF("job %d done, %d bytes", job.id, ret);
+		}
+	}
+}
+
+K_THREAD_DEFINE(tmo_http_worker_tid, CONFIG_TMO_HTTP_WORKER_STACK_SIZE,
+		http_worker, NULL, NULL, NULL,
+		CONFIG_MAIN_THREAD_PRIORITY, 0, 0);
+#endif
@@ -7,7 +7,47 @@
 #ifndef TMO_HTTP_REQUEST_H
 #define TMO_HTTP_REQUEST_H
 
-void tmo_http_json();
-int tmo_http_download(int devid, char url[], const char filename[], char *auth_key);
+#include <zephyr/kernel.h>
+#include "tmo_usage.h"
+
+#define TMO_HTTP_URL_MAX       256
+#define TMO_HTTP_FILENAME_MAX  64
+
+enum tmo_http_kind {
+	TMO_HTTP_JSON,
+	TMO_HTTP_DOWNLOAD,
+	TMO_HTTP_UPLOAD,
+};
+
+/* One request in flight, see tmo_http_get_active() */
+struct tmo_http_status {
+	enum tmo_http_kind kind;
+	int devid;
+	char host[64];
+	int transferred;     /* body bytes received, or sent for an upload */
+	int written;
+	int content_length;
+};
+
+struct tmo_http_upload_stats {
+	uint32_t size;
+	uint32_t bytes;       /* body bytes sent, including any sent again */
+	uint32_t elapsed_ms;
+	int resumes;
+};
+
+int tmo_http_json(int *retry_after);
+int tmo_http_retry_begin(k_timeout_t timeout);
+void tmo_http_retry_end(void);
+uint32_t tmo_http_backoff_ms(int attempt);
+int tmo_http_download(int devid, const char url[], const char filename[], char *auth_key,
+		enum tmo_usage_tag tag);
+#if IS_ENABLED(CONFIG_TMO_HTTP_WORKER)
+int tmo_http_download_async(int devid, const char *url, const char *filename,
+		enum tmo_usage_tag tag);
+#endif
+int tmo_http_upload(int devid, const char url[], const char path[], bool chunked,
+		struct tmo_http_upload_stats *stats);
+int tmo_http_get_active(struct tmo_http_status *st, int max);
 
 #endif
@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_inflate, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/crc.h>
+
+#include "tmo_inflate.h"
+
+/*
+ * Streaming gzip/zlib/deflate (RFC 1950-1952) decoder.
+ *
+ * The decoder pulls its input bit by bit, which keeps it small, so it
+ * runs in its own thread and tmo_inflate_feed() blocks until the thread
+ * has consumed the caller's buffer. Input can arrive in fragments of
+ * any size and is never copied.
+ *
+ * Output goes through a ring of CONFIG_TMO_HTTP_INFLATE_WINDOW bytes. That
+ * ring is also the history for back references, so a stream compressed
+ * with a larger window than this fails with -E2BIG.
+ */
+
+#define WINDOW_SIZE          CONFIG_TMO_HTTP_INFLATE_WINDOW
+#define FLUSH_SIZE           MIN(1024, WINDOW_SIZE)
+#define INFLATE_STACK_SIZE   2048
+#define INFLATE_PRIORITY     CONFIG_MAIN_THREAD_PRIORITY
+
+BUILD_ASSERT((WINDOW_SIZE & (WINDOW_SIZE - 1)) == 0, "inflate window must be a power of 2");
+
+struct huff {
+	uint16_t counts[16];     /* codes of each length */
+	uint16_t symbols[288];   /* symbols ordered by code */
+};
+
+static const uint16_t length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_bits[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_bits[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/* Order code length code lengths are sent in */
+static const uint8_t clc_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static struct {
+	/* Input, lent by tmo_inflate_feed() until in_done is given */
+	const uint8_t *in;
+	size_t in_len;
+	bool in_eof;
+	bool running;
+	bool finished;
+	int err;
+	enum tmo_inflate_fmt fmt;
+	bool zlib;
+	uint32_t bitbuf;
+	int bitcnt;
+	uint32_t out_pos;
+	uint32_t flushed;
+	uint32_t crc;
+	uint32_t adler;
+	tmo_inflate_out_fn out;
+	void *user_data;
+	struct huff lit;
+	struct huff dist;
+	uint8_t lengths[288 + 32];
+} inf;
+
+static uint8_t window[WINDOW_SIZE];
+static K_SEM_DEFINE(in_ready, 0, 1);
+static K_SEM_DEFINE(in_done, 0, 1);
+static K_THREAD_STACK_DEFINE(inflate_stack, INFLATE_STACK_SIZE);
+static struct k_thread inflate_thread;
+
+static void fail(int err)
+{
+	if (inf.err == 0) {
+		inf.err = err;
+	}
+}
+
+static uint8_t next_byte(void)
+{
+	while (inf.in_len == 0) {
+		if (inf.in_eof) {
+			fail(-EPIPE);
+			return 0;
+		}
+		/* Hand the buffer back and wait for more */
+		k_sem_give(&in_done);
+		k_sem_take(&in_ready, K_FOREVER);
+	}
+	inf.in_len--;
+	return *inf.in++;
+}
+
+static uint32_t getbits(int n)
+{
+	uint32_t v;
+
+	while (inf.bitcnt < n) {
+		inf.bitbuf |= (uint32_t)next_byte() << inf.bitcnt;
+		inf.bitcnt += 8;
+	}
+	v = inf.bitbuf & ((1UL << n) - 1);
+	inf.bitbuf >>= n;
+	inf.bitcnt -= n;
+	return v;
+}
+
+static void align(void)
+{
+	getbits(inf.bitcnt & 7);
+}
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t *p, size_t len)
+{
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+
+	while (len) {
+		/* Largest run before the sums can overflow */
+		size_t n = MIN(len, 5552);
+
+		len -= n;
+		while (n--) {
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+static void flush(void)
+{
+	uint32_t len = inf.out_pos - inf.flushed;
+	const uint8_t *p = &window[inf.flushed & (WINDOW_SIZE - 1)];
+	int ret;
+
+	if (len == 0 || inf.err) {
+		return;
+	}
+	/* flushed is FLUSH_SIZE aligned until the end, so this never wraps */
+	if (inf.zlib) {
+		inf.adler = adler32_update(inf.adler, p, len);
+	} else {
+		inf.crc = crc32_ieee_update(inf.crc, p, len);
+	}
+	ret = inf.out(p, len, inf.user_data);
+	if (ret < 0) {
+		fail(ret);
+	}
+	inf.flushed = inf.out_pos;
+}
+
+static void put_byte(uint8_t b)
+{
+	window[inf.out_pos & (WINDOW_SIZE - 1)] = b;
+	if ((++inf.out_pos & (FLUSH_SIZE - 1)) == 0) {
+		flush();
+	}
+}
+
+static void build(struct huff *h, const uint8_t *lengths, int n)
+{
+	uint16_t offs[16];
+	int sum = 0;
+
+	memset(h->counts, 0, sizeof(h->counts));
+	for (int i = 0; i < n; i++) {
+		h->counts[lengths[i]]++;
+	}
+	h->counts[0] = 0;
+	for (int i = 0; i < 16; i++) {
+		offs[i] = sum;
+		sum += h->counts[i];
+	}
+	for (int i = 0; i < n; i++) {
+		if (lengths[i]) {
+			h->symbols[offs[lengths[i]]++] = i;
+		}
+	}
+}
+
+/* Canonical Huffman decode, one bit at a time */
+static int decode_sym(const struct huff *h)
+{
+	int sum = 0;
+	int cur = 0;
+	int len = 0;
+
+	do {
+		cur = 2 * cur + getbits(1);
+		if (++len > 15) {
+			fail(-EBADMSG);
+			return 0;
+		}
+		sum += h->counts[len];
+		cur -= h->counts[len];
+	} while (cur >= 0);
+	return h->symbols[sum + cur];
+}
+
+static void build_fixed(void)
+{
+	int i;
+
+	for (i = 0; i < 144; i++) {
+		inf.lengths[i] = 8;
+	}
+	for (; i < 256; i++) {
+		inf.lengths[i] = 9;
+	}
+	for (; i < 280; i++) {
+		inf.lengths[i] = 7;
+	}
+	for (; i < 288; i++) {
+		inf.lengths[i] = 8;
+	}
+	build(&inf.lit, inf.lengths, 288);
+	memset(inf.lengths, 5, 30);
+	build(&inf.dist, inf.lengths, 30);
+}
+
+static void build_dynamic(void)
+{
+	int hlit = getbits(5) + 257;
+	int hdist = getbits(5) + 1;
+	int hclen = getbits(4) + 4;
+	int n = 0;
+
+	if (hlit > 286 || hdist > 30) {
+		fail(-EBADMSG);
+		return;
+	}
+	memset(inf.lengths, 0, 19);
+	for (int i = 0; i < hclen; i++) {
+		inf.lengths[clc_order[i]] = getbits(3);
+	}
+	/* The code length code goes in lit until the real tables are built */
+	build(&inf.lit, inf.lengths, 19);
+	while (n < hlit + hdist && !inf.err) {
+		int sym = decode_sym(&inf.lit);
+		int rep;
+		uint8_t prev = 0;
+
+		if (sym < 16) {
+			inf.lengths[n++] = sym;
+			continue;
+		} else if (sym == 16) {
+			if (n == 0) {
+				fail(-EBADMSG);
+				return;
+			}
+			prev = inf.lengths[n - 1];
+			rep = 3 + getbits(2);
+		} else if (sym == 17) {
+			rep = 3 + getbits(3);
+		} else {
+			rep = 11 + getbits(7);
+		}
+		if (n + rep > hlit + hdist) {
+			fail(-EBADMSG);
+			return;
+		}
+		while (rep--) {
+			inf.lengths[n++] = prev;
+		}
+	}
+	if (inf.lengths[256] == 0) {
+		fail(-EBADMSG);
+		return;
+	}
+	build(&inf.lit, inf.lengths, hlit);
+	build(&inf.dist, inf.lengths + hlit, hdist);
+}
+
+static void inflate_stored(void)
+{
+	uint32_t len;
+
+	align();
+	len = getbits(16);
+	if (len != (~getbits(16) & 0xffff)) {
+		fail(-EBADMSG);
+		return;
+	}
+	while (len-- && !inf.err) {
+		put_byte(getbits(8));
+	}
+}
+
+static void inflate_codes(void)
+{
+	while (!inf.err) {
+		int sym = decode_sym(&inf.lit);
+
+		if (sym < 256) {
+			put_byte(sym);
+			continue;
+		} else if (sym == 256) {
+			return;
+		}
+		sym -= 257;
+		if (sym >= 29) {
+			fail(-EBADMSG);
+			return;
+		}
+		int len = length_base[sym] + getbits(length_bits[sym]);
+		int dsym = decode_sym(&inf.dist);
+		if (dsym >= 30) {
+			fail(-EBADMSG);
+			return;
+		}
+		uint32_t dist = dist_base[dsym] + getbits(dist_bits[dsym]);
+		if (dist > inf.out_pos) {
+			fail(-EBADMSG);
+			return;
+		} else if (dist > WINDOW_SIZE) {
+			fail(-E2BIG);
+			return;
+		}
+		while (len--) {
+			put_byte(window[(inf.out_pos - dist) & (WINDOW_SIZE - 1)]);
+		}
+	}
+}
+
+static void parse_header(void)
+{
+	if (inf.fmt == TMO_INFLATE_GZIP) {
+		if (getbits(8) != 0x1f || getbits(8) != 0x8b || getbits(8) != 8) {
+			fail(-EBADMSG);
+			return;
+		}
+		uint8_t flg = getbits(8);
+
+		getbits(16);   /* MTIME */
+		getbits(16);
+		getbits(16);   /* XFL, OS */
+		if (flg & 0x04) {
+			for (uint32_t xlen = getbits(16); xlen && !inf.err; xlen--) {
+				getbits(8);
+			}
+		}
+		if (flg & 0x08) {
+			while (getbits(8)) {
+				/* FNAME */
+			}
+		}
+		if (flg & 0x10) {
+			while (getbits(8)) {
+				/* FCOMMENT */
+			}
+		}
+		if (flg & 0x02) {
+			getbits(16);
+		}
+		return;
+	}
+
+	uint8_t cmf = getbits(8);
+	uint8_t flg = getbits(8);
+
+	if ((cmf & 0x0f) == 8 && ((cmf << 8) | flg) % 31 == 0) {
+		if (flg & 0x20) {
+			/* Preset dictionaries are not used over HTTP */
+			fail(-ENOTSUP);
+		}
+		inf.zlib = true;
+	} else {
+		/* Raw deflate, push the two bytes back */
+		inf.bitbuf = cmf | (flg << 8);
+		inf.bitcnt = 16;
+	}
+}
+
+static void check_trailer(void)
+{
+	if (inf.fmt == TMO_INFLATE_GZIP) {
+		uint32_t crc, isize;
+
+		align();
+		crc = getbits(16);
+		crc |= getbits(16) << 16;
+		isize = getbits(16);
+		isize |= getbits(16) << 16;
+		if (!inf.err && (crc != inf.crc || isize != inf.out_pos)) {
+			fail(-EBADMSG);
+		}
+	} else if (inf.zlib) {
+		uint32_t adler = 0;
+
+		align();
+		for (int i = 0; i < 4; i++) {
+			adler = (adler << 8) | getbits(8);
+		}
+		if (!inf.err && adler != inf.adler) {
+			fail(-EBADMSG);
+		}
+	}
+}
+
+static void inflate_main(void *p1, void *p2, void *p3)
+{
+	bool final = false;
+
+	k_sem_take(&in_ready, K_FOREVER);
+	parse_header();
+	while (!final && !inf.err) {
+		final = getbits(1);
+		switch (getbits(2)) {
+		case 0:
+			inflate_stored();
+			break;
+		case 1:
+			build_fixed();
+			inflate_codes();
+			break;
+		case 2:
+			build_dynamic();
+			inflate_codes();
+			break;
+		default:
+			fail(-EBADMSG);
+		}
+	}
+	flush();
+	if (!inf.err) {
+		check_trailer();
+	}
+	if (inf.err) {
+		LOG_ERR("inflate failed at output offset %u: %d", inf.out_pos, inf.err);
+	}
+	/* Anything fed from now on is ignored */
+	inf.finished = true;
+	k_sem_give(&in_done);
+}
+
+/**
+ * @brief Start decoding a compressed stream
+ *
+ * @param out called with decompressed data, from the decoder thread
+ * @return 0, or -EBUSY if a stream is already being decoded
+ */
+int tmo_inflate_start(enum tmo_inflate_fmt fmt, tmo_inflate_out_fn out, void *user_data)
+{
+	if (inf.running) {
+		return -EBUSY;
+	}
+	memset(&inf, 0, sizeof(inf));
+	inf.fmt = fmt;
+	inf.out = out;
+	inf.user_data = user_data;
+	inf.adler = 1;
+	inf.running = true;
+	k_sem_reset(&in_ready);
+	k_sem_reset(&in_done);
+	k_thread_create(&inflate_thread, inflate_stack, K_THREAD_STACK_SIZEOF(inflate_stack),
+			inflate_main, NULL, NULL, NULL, INFLATE_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&inflate_thread, "tmo_inflate");
+	return 0;
+}
+
+/**
+ * @brief Decode the next piece of the compressed stream
+ *
+ * Returns once all of buf has been consumed and the output it produced
+ * has been passed on, except for the last partial FLUSH_SIZE block.
+ *
+ * @return 0, or the decoder error
+ */
+int tmo_inflate_feed(const uint8_t *buf, size_t len)
+{
+	if (!inf.running) {
+		return -EINVAL;
+	}
+	if (inf.finished || len == 0) {
+		return inf.err;
+	}
+	inf.in = buf;
+	inf.in_len = len;
+	k_sem_give(&in_ready);
+	k_sem_take(&in_done, K_FOREVER);
+	return inf.err;
+}
+
+/**
+ * @brief End the input and wait for the decoder
+ *
+ * @return 0 if a complete, checksum verified stream was decoded, -EPIPE
+ * if the input ended early, else the decoder error
+ */
+int tmo_inflate_finish(void)
+{
+	if (!inf.running) {
+		return -EINVAL;
+	}
+	if (!inf.finished) {
+		inf.in_eof = true;
+		k_sem_give(&in_ready);
+		k_sem_take(&in_done, K_FOREVER);
+	}
+	k_thread_join(&inflate_thread, K_FOREVER);
+	inf.running = false;
+	return inf.err;
+}
+
+uint32_t tmo_inflate_total_out(void)
+{
+	return inf.out_pos;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_INFLATE_H
+#define TMO_INFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum tmo_inflate_fmt {
+	TMO_INFLATE_GZIP,
+	/* zlib wrapped, or raw deflate as some servers send for "deflate" */
+	TMO_INFLATE_DEFLATE,
+};
+
+/* Receives decompressed data in order, returns <0 to abort */
+typedef int (*tmo_inflate_out_fn)(const uint8_t *buf, size_t len, void *user_data);
+
+int tmo_inflate_start(enum tmo_inflate_fmt fmt, tmo_inflate_out_fn out, void *user_data);
+int tmo_inflate_feed(const uint8_t *buf, size_t len);
+int tmo_inflate_finish(void);
+uint32_t tmo_inflate_total_out(void);
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_link_mgr, LOG_LEVEL_INF);
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/net/net_if.h>
+
+#include "tmo_shell.h"
+#include "tmo_link_mgr.h"
+
+/* EWMA weight of a new sample is 1/2^EWMA_SHIFT */
+#define EWMA_SHIFT 2
+#define EWMA(avg, sample) ((avg) + (((int64_t)(sample) - (int64_t)(avg)) >> EWMA_SHIFT))
+
+/* Priors used until an interface has been measured */
+#define MODEM_PRIOR_RTT_MS   300
+#define MODEM_PRIOR_BPS      300000
+#define WIFI_PRIOR_RTT_MS    50
+#define WIFI_PRIOR_BPS       5000000
+
+static const struct {
+	const char *name;
+	uint32_t ref_bytes;     /* typical transfer of this class */
+	uint32_t time_weight;
+	uint32_t energy_weight;
+} link_classes[TMO_LINK_CLASS_COUNT] = {
+	[TMO_LINK_TELEMETRY] = {"telemetry", 400, 1, 4},
+	[TMO_LINK_BULK]      = {"bulk", 65536, 4, 1},
+	[TMO_LINK_CONTROL]   = {"control", 128, 4, 0},
+};
+
+static struct tmo_link_stats links[TMO_LINK_MAX_IFACES + 1];
+static int current[TMO_LINK_CLASS_COUNT];
+static bool discovered;
+static K_MUTEX_DEFINE(link_mutex);
+
+/* The RS9116W driver owns the Wi-Fi interface, every other one is the modem */
+static bool iface_is_wifi(struct net_if *iface)
+{
+	const struct device *wifi = DEVICE_DT_GET_ANY(silabs_rs9116w);
+
+	return wifi != NULL && net_if_get_device(iface) == wifi;
+}
+
+static void discover_iface(struct net_if *iface, void *user_data)
+{
+	int idx = net_if_get_by_iface(iface);
+	struct tmo_link_stats *st;
+
+	if (idx <= 0 || idx > TMO_LINK_MAX_IFACES) {
+		return;
+	}
+	st = &links[idx];
+	st->present = true;
+	st->is_wifi = iface_is_wifi(iface);
+	if (st->is_wifi) {
+		st->rtt_ms = WIFI_PRIOR_RTT_MS;
+		st->throughput_bps = WIFI_PRIOR_BPS;
+		st->energy_nj_per_byte = CONFIG_TMO_LINK_WIFI_NJ_PER_BYTE;
+		/* Usable only once associated, see tmo_link_set_up() */
+	} else {
+		st->rtt_ms = MODEM_PRIOR_RTT_MS;
+		st->throughput_bps = MODEM_PRIOR_BPS;
+		st->energy_nj_per_byte = CONFIG_TMO_LINK_MODEM_NJ_PER_BYTE;
+		st->up = true;
+	}
+}
+
+void tmo_link_init(void)
+{
+	k_mutex_lock(&link_mutex, K_FOREVER);
+	if (!discovered) {
+		net_if_foreach(discover_iface, NULL);
+		discovered = true;
+	}
+	k_mutex_unlock(&link_mutex);
+}
+
+static struct tmo_link_stats *get_link(int iface_idx)
+{
+	if (iface_idx <= 0 || iface_idx > TMO_LINK_MAX_IFACES || !links[iface_idx].present) {
+		return NULL;
+	}
+	return &links[iface_idx];
+}
+
+void tmo_link_set_up(int iface_idx, bool up)
+{
+	tmo_link_init();
+	k_mutex_lock(&link_mutex, K_FOREVER);
+	struct tmo_link_stats *st = get_link(iface_idx);
+	if (st && st->up != up) {
+		st->up = up;
+		LOG_INF("iface %d %s", iface_idx, up ? "up" : "down");
+	}
+	k_mutex_unlock(&link_mutex);
+}
+
+/**
+ * @brief Record the outcome of a request on an interface
+ *
+ * @param iface_idx interface the request used
+ * @param ok whether it succeeded
+ * @param rtt_ms connect or round-trip time, 0 if not measured
+ * @param bytes payload bytes transferred
+ * @param duration_ms time spent transferring them, 0 if not measured
+ */
+void tmo_link_report(int iface_idx, bool ok, uint32_t rtt_ms, size_t bytes, uint32_t duration_ms)
+{
+	tmo_link_init();
+	k_mutex_lock(&link_mutex, K_FOREVER);
+	struct tmo_link_stats *st = get_link(iface_idx);
+	if (st == NULL) {
+		k_mutex_unlock(&link_mutex);
+		return;
+	}
+	st->samples++;
+	st->fail_permille = EWMA(st->fail_permille, ok ? 0 : 1000);
+	if (!ok) {
+		st->failures++;
+		st->last_fail_ms = k_uptime_get();
+	}
+	if (ok && rtt_ms) {
+		st->rtt_ms = EWMA(st->rtt_ms, rtt_ms);
+	}
+	/* Tiny transfers measure latency, not throughput */
+	if (ok && duration_ms && bytes >= CONFIG_TMO_LINK_MIN_THROUGHPUT_BYTES) {
+		st->throughput_bps = EWMA(st->throughput_bps, (uint64_t)bytes * 8000 / duration_ms);
+	}
+	k_mutex_unlock(&link_mutex);
+}
+
+/**
+ * @brief Cost of sending a typical request of the given class over a link
+ *
+ * Lower is better. Combines expected transfer time (RTT plus serialization
+ * at the measured throughput) and radio energy, weighted per class, and
+ * scales the result up with the recent failure rate.
+ *
+ * @param now_ms current uptime, for the holdoff after a failure
+ */
+uint32_t tmo_link_cost(const struct tmo_link_stats *st, enum tmo_link_class cls, int64_t now_ms)
+{
+	uint64_t bytes = link_classes[cls].ref_bytes;
+	uint64_t time_ms = st->rtt_ms + bytes * 8000 / MAX(st->throughput_bps, 1);
+	uint64_t energy_uj = bytes * st->energy_nj_per_byte / 1000;
+	uint64_t cost = link_classes[cls].time_weight * time_ms +
+		link_classes[cls].energy_weight * energy_uj;
+
+	cost = cost * (1000 + 3 * st->fail_permille) / 1000;
+	if (st->last_fail_ms &&
+			now_ms - st->last_fail_ms < CONFIG_TMO_LINK_FAIL_HOLDOFF_SECS * MSEC_PER_SEC) {
+		cost *= 4;
+	}
+	return (uint32_t)MIN(cost, UINT32_MAX);
+}
+
+/**
+ * @brief Choose the link for a request class
+ *
+ * Takes the cheapest usable link, but stays on the current one unless the
+ * cheapest is at least CONFIG_TMO_LINK_HYSTERESIS_PERCENT cheaper.
+ *
+ * @param links stats indexed by interface, TMO_LINK_MAX_IFACES + 1 entries
+ * @param usable bit n set when interface n may be used
+ * @param cur interface the class uses now, 0 if none
+ * @param now_ms current uptime
+ * @return interface index, -ENETDOWN if none is usable
+ */
+int tmo_link_choose(const struct tmo_link_stats *links, uint32_t usable,
+		enum tmo_link_class cls, int cur, int64_t now_ms)
+{
+	int best = -ENETDOWN;
+	uint32_t best_cost = UINT32_MAX;
+
+	for (int i = 1; i <= TMO_LINK_MAX_IFACES; i++) {
+		if (!(usable & BIT(i))) {
+			continue;
+		}
+		uint32_t cost = tmo_link_cost(&links[i], cls, now_ms);
+		if (best < 0 || cost < best_cost) {
+			best = i;
+			best_cost = cost;
+		}
+	}
+	if (best < 0 || cur == best || cur <= 0 || cur > TMO_LINK_MAX_IFACES ||
+			!(usable & BIT(cur))) {
+		return best;
+	}
+
+	uint32_t cur_cost = tmo_link_cost(&links[cur], cls, now_ms);
+	/* Hysteresis: only move when the new link is clearly better */
+	if ((uint64_t)best_cost * 100 >
+			(uint64_t)cur_cost * (100 - CONFIG_TMO_LINK_HYSTERESIS_PERCENT)) {
+		return cur;
+	}
+	return best;
+}
+
+static bool link_usable(int idx)
+{
+	struct tmo_link_stats *st = get_link(idx);
+
+	return st && st->up && net_if_is_up(net_if_get_by_index(idx));
+}
+
+static int select_locked(enum tmo_link_class cls, int exclude, bool commit)
+{
+	uint32_t usable = 0;
+	int cur = current[cls];
+	int best;
+
+	for (int i = 1; i <= TMO_LINK_MAX_IFACES; i++) {
+		if (i != exclude && link_usable(i)) {
+			usable |= BIT(i);
+		}
+	}
+	best = tmo_link_choose(links, usable, cls, cur, k_uptime_get());
+	if (best < 0 || !commit || best == cur) {
+		return best;
+	}
+	if (usable & BIT(cur)) {
+		LOG_INF("%s: iface %d -> iface %d", link_classes[cls].name, cur, best);
+	} else {
+		LOG_INF("%s: using iface %d", link_classes[cls].name, best);
+	}
+	current[cls] = best;
+	return best;
+}
+
+/**
+ * @brief Pick the interface for a request class
+ *
+ * @return interface index, -ENETDOWN if no link is usable
+ */
+int tmo_link_select(enum tmo_link_class cls)
+{
+	int ret;
+
+	if (cls >= TMO_LINK_CLASS_COUNT) {
+		return -EINVAL;
+	}
+	tmo_link_init();
+	k_mutex_lock(&link_mutex, K_FOREVER);
+	ret = select_locked(cls, 0, true);
+	k_mutex_unlock(&link_mutex);
+	return ret;
+}
+
+/**
+ * @brief Interface tmo_link_select() would pick now, without switching to it
+ */
+int tmo_link_peek(enum tmo_link_class cls)
+{
+	int ret;
+
+	if (cls >= TMO_LINK_CLASS_COUNT) {
+		return -EINVAL;
+	}
+	tmo_link_init();
+	k_mutex_lock(&link_mutex, K_FOREVER);
+	ret = select_locked(cls, 0, false);
+	k_mutex_unlock(&link_mutex);
+	return ret;
+}
+
+/**
+ * @brief Map a caller supplied interface to the one to use
+ *
+ * Explicit interface indexes are honoured as-is, TMO_LINK_AUTO is resolved
+ * by the link manager.
+ */
+int tmo_link_resolve(int iface_idx, enum tmo_link_class cls)
+{
+	if (iface_idx != TMO_LINK_AUTO) {
+		return iface_idx;
+	}
+	return tmo_link_select(cls);
+}
+
+/**
+ * @brief Record a failure and pick another link for the rest of a session
+ *
+ * @return new interface index, or failed_idx if it is the only one usable
+ */
+int tmo_link_failover(int failed_idx, enum tmo_link_class cls)
+{
+	int ret;
+
+	tmo_link_report(failed_idx, false, 0, 0, 0);
+	k_mutex_lock(&link_mutex, K_FOREVER);
+	ret = select_locked(cls, failed_idx, true);
+	if (ret < 0) {
+		ret = failed_idx;
+	} else {
+		LOG_INF("%s: failover from iface %d to %d", link_classes[cls].name,
+				failed_idx, ret);
+	}
+	k_mutex_unlock(&link_mutex);
+	return ret;
+}
+
+static int find_iface(bool wifi)
+{
+	tmo_link_init();
+	for (int i = 1; i <= TMO_LINK_MAX_IFACES; i++) {
+		if (links[i].present && links[i].is_wifi == wifi) {
+			return i;
+		}
+	}
+	return -ENODEV;
+}
+
+int tmo_link_wifi_iface(void)
+{
+	return find_iface(true);
+}
+
+int tmo_link_modem_iface(void)
+{
+	return find_iface(false);
+}
+
+int tmo_link_get_stats(int iface_idx, struct tmo_link_stats *st)
+{
+	tmo_link_init();
+	k_mutex_lock(&link_mutex, K_FOREVER);
+	struct tmo_link_stats *link = get_link(iface_idx);
+	if (link) {
+		*st = *link;
+	}
+	k_mutex_unlock(&link_mutex);
+	return link ? 0 : -ENODEV;
+}
+
+int tmo_link_get_current(enum tmo_link_class cls)
+{
+	return cls < TMO_LINK_CLASS_COUNT ? current[cls] : -EINVAL;
+}
+
+const char *tmo_link_class_name(enum tmo_link_class cls)
+{
+	return cls < TMO_LINK_CLASS_COUNT ? link_classes[cls].name : NULL;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_LINK_MGR_H
+#define TMO_LINK_MGR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Pass as iface/devid to let the link manager pick the interface */
+#define TMO_LINK_AUTO        0
+#define TMO_LINK_MAX_IFACES  4
+
+enum tmo_link_class {
+	TMO_LINK_TELEMETRY,
+	TMO_LINK_BULK,
+	TMO_LINK_CONTROL,
+	TMO_LINK_CLASS_COUNT
+};
+
+struct tmo_link_stats {
+	bool present;
+	bool up;
+	bool is_wifi;
+	uint32_t rtt_ms;          /* EWMA of connect/round-trip time */
+	uint32_t throughput_bps;  /* EWMA of transfer throughput */
+	uint32_t fail_permille;   /* EWMA of request failure rate */
+	uint32_t energy_nj_per_byte;
+	uint32_t samples;
+	uint32_t failures;
+	int64_t last_fail_ms;
+};
+
+void tmo_link_init(void);
+void tmo_link_set_up(int iface_idx, bool up);
+void tmo_link_report(int iface_idx, bool ok, uint32_t rtt_ms, size_t bytes, uint32_t duration_ms);
+int tmo_link_select(enum tmo_link_class cls);
+int tmo_link_peek(enum tmo_link_class cls);
+int tmo_link_resolve(int iface_idx, enum tmo_link_class cls);
+int tmo_link_failover(int failed_idx, enum tmo_link_class cls);
+int tmo_link_wifi_iface(void);
+int tmo_link_modem_iface(void);
+uint32_t tmo_link_cost(const struct tmo_link_stats *st, enum tmo_link_class cls, int64_t now_ms);
+int tmo_link_choose(const struct tmo_link_stats *links, uint32_t usable,
+		enum tmo_link_class cls, int cur, int64_t now_ms);
+int tmo_link_get_stats(int iface_idx, struct tmo_link_stats *st);
+int tmo_link_get_current(enum tmo_link_class cls);
+const char *tmo_link_class_name(enum tmo_link_class cls);
+
+#endif
@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/posix/unistd.h>
+#include <getopt.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/sys/byteorder.h>
+#include "tmo_shell.h"
+#include "tmo_perf.h"
+#include "tmo_dns_cache.h"
+#include "tmo_usage.h"
+#include "tmo_xfer_buf.h"
+
+/*
+ * iperf2 compatible throughput test. The peer is a stock iperf2 server
+ * ("iperf -s [-u]") for send tests, or client ("iperf -c <dev> [-u]") for
+ * receive tests. Data is sent raw over TCP; UDP datagrams carry the iperf2
+ * datagram header so the server can count loss and reorder, and the final
+ * server report is parsed when the server returns one.
+ */
+
+#define PERF_DEFAULT_PORT     5001
+#define PERF_DEFAULT_SECS     10
+#define PERF_DEFAULT_TCP_LEN  1024
+#define PERF_DEFAULT_UDP_LEN  1024
+#define PERF_DEFAULT_UDP_BPS  1000000
+#define PERF_BUF_SIZE         4096
+#define PERF_MAX_STREAMS      CONFIG_NET_SOCKETS_POLL_MAX
+#define PERF_FIN_RETRIES      10
+#define PERF_IDLE_TIMEOUT_MS  10000
+
+/* Held from the transfer pool for the length of a test */
+static uint8_t *perf_buf;
+
+/* iperf2 UDP datagram header, network byte order */
+struct perf_udp_hdr {
+	int32_t id;
+	uint32_t tv_sec;
+	uint32_t tv_usec;
+};
+
+/* iperf2 UDP server report, follows the datagram header of the FIN ack */
+struct perf_server_hdr {
+	int32_t flags;
+	int32_t total_len1;
+	int32_t total_len2;
+	int32_t stop_sec;
+	int32_t stop_usec;
+	int32_t error_cnt;
+	int32_t outorder_cnt;
+	int32_t datagrams;
+	int32_t jitter1;
+	int32_t jitter2;
+};
+
+struct perf_cfg {
+	int iface;
+	bool udp;
+	bool recv;
+	int secs;
+	int len;
+	int streams;
+	uint32_t rate_bps;
+	uint16_t port;
+	const char *host;
+};
+
+struct perf_stream {
+	int sd;
+	bool done;
+	uint64_t bytes;
+	uint32_t interval_bytes;
+	uint32_t packets;
+	uint32_t errors;
+	uint32_t lost;
+	uint32_t outorder;
+	int32_t next_id;
+};
+
+static struct perf_stream streams[PERF_MAX_STREAMS];
+
+static inline void print_usage(const struct shell *shell)
+{
+	shell_print(shell, "usage: tmo perf [-u] [-r] [-t secs] [-l len] [-P streams] [-b bps] "
+			"[-p port] iface [host]");
+	shell_print(shell, "  -u udp, -r receive (host not needed), -b udp send rate");
+}
+
+static uint32_t kbps(uint64_t bytes, int64_t ms)
+{
+	return ms > 0 ? (uint32_t)(bytes * 8 / ms) : 0;
+}
+
+static void print_interval(const struct shell *shell, struct perf_cfg *cfg, int64_t from_ms,
+		int64_t to_ms)
+{
+	uint32_t sum = 0;
+
+	for (int i = 0; i < cfg->streams; i++) {
+		if (streams[i].sd < 0) {
+			continue;
+		}
+		sum += streams[i].interval_bytes;
+		if (cfg->streams > 1) {
+			shell_print(shell, "[%3d] %3d-%3d sec %7u KBytes %7u Kbits/sec", i,
+					(int)(from_ms / 1000), (int)(to_ms / 1000),
+					streams[i].interval_bytes / 1024,
+					kbps(streams[i].interval_bytes, to_ms - from_ms));
+		}
+		streams[i].interval_bytes = 0;
+	}
+	shell_print(shell, "[%s] %3d-%3d sec %7u KBytes %7u Kbits/sec",
+			cfg->streams > 1 ? "SUM" : "  0", (int)(from_ms / 1000), (int)(to_ms / 1000),
+			sum / 1024,
+			kbps(sum, to_ms - from_ms));
+}
+
+static void print_summary(const struct shell *shell, struct perf_cfg *cfg, int64_t ms)
+{
+	uint64_t bytes = 0;
+	uint32_t packets = 0, errors = 0, lost = 0, outorder = 0;
+
+	for (int i = 0; i < cfg->streams; i++) {
+		bytes += streams[i].bytes;
+		packets += streams[i].packets;
+		errors += streams[i].errors;
+		lost += streams[i].lost;
+		outorder += streams[i].outorder;
+	}
+	shell_print(shell, "- - - - - - - - - - - - - - - - - - - - - - - - -");
+	shell_print(shell, "[SUM] 0-%d.%03d sec %u KBytes %u Kbits/sec",
+			(int)(ms / 1000), (int)(ms % 1000), (uint32_t)(bytes / 1024), kbps(bytes, ms));
+	if (cfg->udp) {
+		shell_print(shell, "      %u datagrams, %u lost (%u%%), %u out of order",
+				packets, lost, packets + lost ? 100 * lost / (packets + lost) : 0,
+				outorder);
+	}
+	shell_print(shell, "      %u send/recv errors", errors);
+}
+
+static void close_streams(struct perf_cfg *cfg)
+{
+	for (int i = 0; i < cfg->streams; i++) {
+		if (streams[i].sd >= 0) {
+			zsock_close(streams[i].sd);
+			streams[i].sd = -1;
+		}
+	}
+}
+
+static void fill_udp_hdr(uint8_t *buf, int32_t id)
+{
+	struct perf_udp_hdr *hdr = (struct perf_udp_hdr *)buf;
+	int64_t now = k_uptime_get();
+
+	hdr->id = sys_cpu_to_be32(id);
+	hdr->tv_sec = sys_cpu_to_be32((uint32_t)(now / 1000));
+	hdr->tv_usec = sys_cpu_to_be32((uint32_t)(now % 1000) * 1000);
+}
+
+/* Send the UDP FIN until the server acknowledges it with its report */
+static void udp_finish(const struct shell *shell, struct perf_cfg *cfg, struct perf_stream *st)
+{
+	struct timeval tv = { .tv_sec = 0, .tv_usec = 250000 };
+	uint8_t *buf = perf_buf;
+	int len = MAX(cfg->len, (int)sizeof(struct perf_udp_hdr));
+
+	zsock_setsockopt(st->sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	for (int i = 0; i < PERF_FIN_RETRIES; i++) {
+		fill_udp_hdr(buf, -st->next_id);
+		zsock_send(st->sd, buf, len, 0);
+		int ret = zsock_recv(st->sd, buf, PERF_BUF_SIZE, 0);
+		if (ret >= (int)(sizeof(struct perf_udp_hdr) + sizeof(struct perf_server_hdr))) {
+			struct perf_server_hdr *srv =
+				(struct perf_server_hdr *)(buf + sizeof(struct perf_udp_hdr));
+			st->lost = sys_be32_to_cpu(srv->error_cnt);
+			st->outorder = sys_be32_to_cpu(srv->outorder_cnt);
+			shell_print(shell, "Server report: %d datagrams, %u lost, jitter %d.%03d ms",
+					sys_be32_to_cpu(srv->datagrams), st->lost,
+					sys_be32_to_cpu(srv->jitter1) * 1000 +
+					sys_be32_to_cpu(srv->jitter2) / 1000,
+					sys_be32_to_cpu(srv->jitter2) % 1000);
+			return;
+		}
+	}
+	shell_warn(shell, "No server report received");
+}
+
+static int perf_send(const struct shell *shell, struct perf_cfg *cfg)
+{
+	struct zsock_addrinfo hints = {0};
+	struct zsock_addrinfo ai;
+	struct sockaddr addr;
+	struct zsock_pollfd fds[PERF_MAX_STREAMS];
+	char port_sz[8];
+	int ret = 0;
+
+	snprintf(port_sz, sizeof(port_sz), "%d", cfg->port);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = cfg->udp ? SOCK_DGRAM : SOCK_STREAM;
+	if (tmo_dns_resolve_addr(cfg->host, port_sz, &hints, cfg->iface, &ai, &addr)) {
+		shell_error(shell, "Cannot resolve %s", cfg->host);
+		return -EHOSTUNREACH;
+	}
+
+	struct net_if *iface = net_if_get_by_index(cfg->iface);
+	for (int i = 0; i < cfg->streams; i++) {
+		streams[i].sd = zsock_socket_ext(AF_INET, hints.ai_socktype,
+				cfg->udp ? IPPROTO_UDP : IPPROTO_TCP, iface);
+		if (streams[i].sd < 0) {
+			shell_error(shell, "Could not create socket, errno %d", errno);
+			ret = -errno;
+			goto out;
+		}
+		if (zsock_connect(streams[i].sd, ai.ai_addr, ai.ai_addrlen) < 0) {
+			shell_error(shell, "Could not connect stream %d, errno %d", i, errno);
+			ret = -errno;
+			goto out;
+		}
+		fds[i].fd = streams[i].sd;
+		fds[i].events = ZSOCK_POLLOUT;
+	}
+	shell_print(shell, "Client connecting to %s, %s port %d, %d stream(s), %d byte buffers",
+			cfg->host, cfg->udp ? "UDP" : "TCP", cfg->port, cfg->streams, cfg->len);
+
+	gen_payload(perf_buf, cfg->len);
+	int64_t start = k_uptime_get();
+	int64_t end = start + cfg->secs * MSEC_PER_SEC;
+	int64_t last_report = start;
+	/* UDP is paced to the requested aggregate rate */
+	uint64_t sent_total = 0;
+
+	while (k_uptime_get() < end) {
+		int64_t now = k_uptime_get();
+
+		if (now - last_report >= MSEC_PER_SEC) {
+			print_interval(shell, cfg, last_report - start, now - start);
+			last_report = now;
+		}
+		if (cfg->udp && cfg->rate_bps &&
+				sent_total * 8 * MSEC_PER_SEC > (uint64_t)cfg->rate_bps * (now - start)) {
+			k_msleep(1);
+			continue;
+		}
+		int n = zsock_poll(fds, cfg->streams, 100);
+		if (n <= 0) {
+			continue;
+		}
+		for (int i = 0; i < cfg->streams; i++) {
+			struct perf_stream *st = &streams[i];
+
+			if (!(fds[i].revents & ZSOCK_POLLOUT)) {
+				if (fds[i].revents & (ZSOCK_POLLERR | ZSOCK_POLLHUP)) {
+					st->errors++;
+				}
+				continue;
+			}
+			if (cfg->udp) {
+				fill_udp_hdr(perf_buf, st->next_id++);
+			}
+			ret = zsock_send(st->sd, perf_buf, cfg->len, 0);
+			if (ret < 0) {
+				st->errors++;
+				if (errno != EAGAIN && !cfg->udp) {
+					shell_error(shell, "Stream %d send failed, errno %d", i, errno);
+					ret = -errno;
+					goto out;
+				}
+				continue;
+			}
+			st->bytes += ret;
+			st->interval_bytes += ret;
+			st->packets++;
+			sent_total += ret;
+		}
+	}
+	if (last_report < end) {
+		print_interval(shell, cfg, last_report - start, k_uptime_get() - start);
+	}
+	int64_t elapsed = k_uptime_get() - start;
+	if (cfg->udp) {
+		for (int i = 0; i < cfg->streams; i++) {
+			udp_finish(shell, cfg, &streams[i]);
+		}
+	}
+	print_summary(shell, cfg, elapsed);
+	ret = 0;
+out:
+	close_streams(cfg);
+	return ret;
+}
+
+/* Track loss and reorder from the iperf2 datagram ids */
+static void udp_account(struct perf_stream *st, int32_t id)
+{
+	if (id >= st->next_id) {
+		st->lost += id - st->next_id;
+		st->next_id = id + 1;
+	} else {
+		st->outorder++;
+		if (st->lost) {
+			st->lost--;
+		}
+	}
+}
+
+static void udp_send_report(struct perf_stream *st, struct sockaddr *from, socklen_t fromlen,
+		int64_t elapsed)
+{
+	uint8_t *buf = perf_buf;
+	struct perf_server_hdr *srv = (struct perf_server_hdr *)(buf + sizeof(struct perf_udp_hdr));
+
+	memset(buf, 0, sizeof(struct perf_udp_hdr) + sizeof(*srv));
+	fill_udp_hdr(buf, -st->next_id);
+	srv->flags = sys_cpu_to_be32(0x80000000);
+	srv->total_len1 = sys_cpu_to_be32((uint32_t)(st->bytes >> 32));
+	srv->total_len2 = sys_cpu_to_be32((uint32_t)st->bytes);
+	srv->stop_sec = sys_cpu_to_be32((uint32_t)(elapsed / 1000));
+	srv->stop_usec = sys_cpu_to_be32((uint32_t)(elapsed % 1000) * 1000);
+	srv->error_cnt = sys_cpu_to_be32(st->lost);
+	srv->outorder_cnt = sys_cpu_to_be32(st->outorder);
+	srv->datagrams = sys_cpu_to_be32(st->next_id);
+	zsock_sendto(st->sd, buf, sizeof(struct perf_udp_hdr) + sizeof(*srv), 0, from, fromlen);
+}
+
+static int perf_recv(const struct shell *shell, struct perf_cfg *cfg)
+{
+	struct sockaddr_in addr = {0};
+	struct zsock_pollfd fds[PERF_MAX_STREAMS + 1];
+	struct net_if *iface = net_if_get_by_index(cfg->iface);
+	int lsd;
+	int nfds = 1;
+	int accepted = 0;
+	int ret = 0;
+
+	lsd = zsock_socket_ext(AF_INET, cfg->udp ? SOCK_DGRAM : SOCK_STREAM,
+			cfg->udp ? IPPROTO_UDP : IPPROTO_TCP, iface);
+	if (lsd < 0) {
+		shell_error(shell, "Could not create socket, errno %d", errno);
+		return -errno;
+	}
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(cfg->port);
+	if (zsock_bind(lsd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			(!cfg->udp && zsock_listen(lsd, cfg->streams) < 0)) {
+		shell_error(shell, "Could not listen on port %d, errno %d", cfg->port, errno);
+		zsock_close(lsd);
+		return -errno;
+	}
+	shell_print(shell, "Server listening on %s port %d", cfg->udp ? "UDP" : "TCP", cfg->port);
+
+	fds[0].fd = lsd;
+	fds[0].events = ZSOCK_POLLIN;
+	if (cfg->udp) {
+		/* All datagrams arrive on the bound socket */
+		streams[0].sd = lsd;
+		cfg->streams = 1;
+	}
+
+	int64_t start = 0;
+	int64_t last_report = 0;
+	int64_t last_rx = k_uptime_get();
+	bool finished = false;
+
+	while (!finished) {
+		int64_t now = k_uptime_get();
+
+		if (now - last_rx > PERF_IDLE_TIMEOUT_MS + (start ? 0 : cfg->secs * MSEC_PER_SEC)) {
+			shell_warn(shell, "Idle timeout");
+			break;
+		}
+		if (start && now - last_report >= MSEC_PER_SEC) {
+			print_interval(shell, cfg, last_report - start, now - start);
+			last_report = now;
+		}
+		if (zsock_poll(fds, nfds, 100) <= 0) {
+			continue;
+		}
+		if (!cfg->udp && (fds[0].revents & ZSOCK_POLLIN) && accepted < cfg->streams) {
+			int sd = zsock_accept(lsd, NULL, NULL);
+			if (sd >= 0) {
+				streams[accepted].sd = sd;
+				fds[nfds].fd = sd;
+				fds[nfds].events = ZSOCK_POLLIN;
+				nfds++;
+				accepted++;
+				shell_print(shell, "[%3d] connected", accepted - 1);
+				if (!start) {
+					start = last_report = k_uptime_get();
+				}
+			}
+		}
+		for (int i = cfg->udp ? 0 : 1; i < nfds; i++) {
+			struct perf_stream *st = &streams[cfg->udp ? 0 : i - 1];
+			struct sockaddr from;
+			socklen_t fromlen = sizeof(from);
+
+			if (!(fds[i].revents & (ZSOCK_POLLIN | ZSOCK_POLLHUP)) || st->done) {
+				continue;
+			}
+			ret = zsock_recvfrom(st->sd, perf_buf, PERF_BUF_SIZE, 0, &from, &fromlen);
+			if (ret < 0) {
+				st->errors++;
+				continue;
+			}
+			last_rx = k_uptime_get();
+			if (ret == 0) {
+				st->done = true;
+				finished = true;
+				for (int j = 0; j < accepted; j++) {
+					finished &= streams[j].done;
+				}
+				continue;
+			}
+			if (!start) {
+				start = last_report = last_rx;
+			}
+			st->bytes += ret;
+			st->interval_bytes += ret;
+			st->packets++;
+			if (cfg->udp && ret >= (int)sizeof(struct perf_udp_hdr)) {
+				int32_t id = sys_be32_to_cpu(((struct perf_udp_hdr *)perf_buf)->id);
+				if (id < 0) {
+					/* FIN, the datagram itself is not payload */
+					st->bytes -= ret;
+					st->packets--;
+					udp_send_report(st, &from, fromlen, last_rx - start);
+					finished = true;
+					continue;
+				}
+				udp_account(st, id);
+			}
+		}
+	}
+	if (start) {
+		print_summary(shell, cfg, last_rx - start);
+	}
+	if (cfg->udp) {
+		streams[0].sd = -1;
+	}
+	close_streams(cfg);
+	zsock_close(lsd);
+	return 0;
+}
+
+int cmd_perf(const struct shell *shell, size_t argc, char **argv)
+{
+	struct perf_cfg cfg = {
+		.secs = PERF_DEFAULT_SECS,
+		.len = 0,
+		.streams = 1,
+		.rate_bps = PERF_DEFAULT_UDP_BPS,
+		.port = PERF_DEFAULT_PORT,
+	};
+	int c;
+	int npos;
+
+	while ((c = getopt(argc, argv, "hurt:l:P:b:p:")) != -1) {
+		switch (c) {
+		case 'u':
+			cfg.udp = true;
+			break;
+		case 'r':
+			cfg.recv = true;
+			break;
+		case 't':
+			cfg.secs = strtol(optarg, NULL, 10);
+			break;
+		case 'l':
+			cfg.len = strtol(optarg, NULL, 10);
+			break;
+		case 'P':
+			cfg.streams = strtol(optarg, NULL, 10);
+			break;
+		case 'b':
+			cfg.rate_bps = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			cfg.port = strtol(optarg, NULL, 10);
+			break;
+		case 'h':
+		default:
+			print_usage(shell);
+			return c == 'h' ? 0 : -EINVAL;
+		}
+	}
+	npos = argc - optind;
+	if (npos < (cfg.recv ? 1 : 2)) {
+		print_usage(shell);
+		return -EINVAL;
+	}
+	cfg.iface = strtol(argv[optind], NULL, 10);
+	cfg.host = cfg.recv ? NULL : argv[optind + 1];
+	if (cfg.len == 0) {
+		cfg.len = cfg.udp ? PERF_DEFAULT_UDP_LEN : PERF_DEFAULT_TCP_LEN;
+	}
+	if (cfg.len < (cfg.udp ? (int)sizeof(struct perf_udp_hdr) : 1) || cfg.len > PERF_BUF_SIZE) {
+		shell_error(shell, "Buffer length must be %d..%d bytes",
+				cfg.udp ? (int)sizeof(struct perf_udp_hdr) : 1, PERF_BUF_SIZE);
+		return -EINVAL;
+	}
+	if (cfg.streams < 1 || cfg.streams > PERF_MAX_STREAMS) {
+		shell_error(shell, "Streams must be 1..%d", PERF_MAX_STREAMS);
+		return -EINVAL;
+	}
+	if (cfg.secs < 1) {
+		shell_error(shell, "Invalid duration %d", cfg.secs);
+		return -EINVAL;
+	}
+	if (net_if_get_by_index(cfg.iface) == NULL || tmo_offload_init(cfg.iface)) {
+		shell_error(shell, "Interface %d not found", cfg.iface);
+		return -EINVAL;
+	}
+	if (tmo_usage_check(cfg.iface, TMO_USAGE_PERF)) {
+		shell_error(shell, "Interface %d is over its data quota", cfg.iface);
+		return -EDQUOT;
+	}
+
+	perf_buf = tmo_xfer_buf_acquire("perf", K_NO_WAIT);
+	if (perf_buf == NULL) {
+		shell_error(shell, "No free transfer buffer, see tmo bufs");
+		return -EBUSY;
+	}
+
+	memset(streams, 0, sizeof(streams));
+	for (int i = 0; i < PERF_MAX_STREAMS; i++) {
+		streams[i].sd = -1;
+	}
+	int ret = cfg.recv ? perf_recv(shell, &cfg) : perf_send(shell, &cfg);
+	tmo_xfer_buf_release(perf_buf);
+	perf_buf = NULL;
+	uint64_t bytes = 0;
+
+	for (int i = 0; i < cfg.streams; i++) {
+		bytes += streams[i].bytes;
+	}
+	tmo_usage_add(cfg.iface, TMO_USAGE_PERF, cfg.recv ? 0 : bytes, cfg.recv ? bytes : 0);
+	return ret;
+}
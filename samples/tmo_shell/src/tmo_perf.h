@@ -0,0 +1,13 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_PERF_H
+#define TMO_PERF_H
+#include <zephyr/shell/shell.h>
+
+int cmd_perf(const struct shell *shell, size_t argc, char **argv);
+
+#endif
@@ -12,6 +12,8 @@
 #include <zephyr/net/socket.h>
 #include "tmo_shell.h"
 #include "tmo_ping.h"
+#include "tmo_dns_cache.h"
+#include "tmo_usage.h"
 
 int ping_rxd;
 char host_addr[NET_IPV6_ADDR_LEN];
@@ -19,11 +21,15 @@ char host_addr[NET_IPV6_ADDR_LEN];
 K_SEM_DEFINE(ping_sem, 0, 1);
 
 const static struct shell* sh;
+/* Probes from tmo_ping_probe() are not printed */
+static bool ping_quiet;
 void ping_cb(uint32_t ms)
 {
 	
 	// shell_print("Request %d ");
-    shell_print(sh, "Reply from %s; time = %dms", host_addr, ms);
+    if (!ping_quiet) {
+        shell_print(sh, "Reply from %s; time = %dms", host_addr, ms);
+    }
     ping_rxd++;
 	k_sem_give(&ping_sem);
 }
@@ -80,6 +86,11 @@ int cmd_ping(const struct shell *shell, size_t argc, char **argv)
         print_usage(shell);
         goto exit;
     }
+    if (tmo_usage_check(if_idx, TMO_USAGE_PING)) {
+        shell_error(shell, "iface %d is over its data quota", if_idx);
+        ret = -EDQUOT;
+        goto exit;
+    }
     struct net_if* iface = net_if_get_by_index(if_idx);
     struct sockaddr dst;
     char *host = argv[argc - 1];
@@ -91,13 +102,13 @@ int cmd_ping(const struct shell *shell, size_t argc, char **argv)
     {
         tmo_offload_init(if_idx);
         struct zsock_addrinfo *res;
-        if (zsock_getaddrinfo(host, "1", NULL, &res)){
+        if (tmo_dns_getaddrinfo(host, "1", NULL, if_idx, &res)){
             shell_error(shell, "Cannot resolve %s: Unknown host", host);
             print_usage(shell);
             goto exit;
         }
         memcpy(&dst, res->ai_addr, sizeof(struct sockaddr));
-        zsock_freeaddrinfo(res);
+        tmo_dns_freeaddrinfo(res);
     }
     net_addr_ntop(dst.sa_family,
          ((dst.sa_family == AF_INET) ? (void*)&net_sin(&dst)->sin_addr : (void*)&net_sin6(&dst)->sin6_addr),
@@ -117,8 +128,33 @@ int cmd_ping(const struct shell *shell, size_t argc, char **argv)
     }
     shell_print(shell, "%d packets transmitted, %d packets received, %.1d%% packet loss",
          ping_cnt, ping_rxd, (100 * (ping_cnt - ping_rxd)) / ping_cnt);
+    tmo_usage_add(if_idx, TMO_USAGE_PING, ping_cnt * sz, ping_rxd * sz);
     exit:
     k_sem_give(&ping_sem);
     net_ping_cb_unregister(&ping_handler);
     return ret;
 }
+
+/**
+ * @brief Send one echo request and wait for its reply
+ *
+ * @param size ICMP payload size
+ * @return 0 if a reply arrived, -ETIMEDOUT, or the net_ping() error
+ */
+int tmo_ping_probe(struct net_if *iface, struct sockaddr *dst, uint16_t size,
+		uint32_t timeout_ms)
+{
+	int ret;
+
+	net_ping_cb_register(&ping_handler);
+	ping_quiet = true;
+	k_sem_reset(&ping_sem);
+	ret = net_ping(iface, dst, size);
+	if (ret == 0 && k_sem_take(&ping_sem, K_MSEC(timeout_ms))) {
+		ret = -ETIMEDOUT;
+	}
+	ping_quiet = false;
+	net_ping_cb_unregister(&ping_handler);
+	tmo_usage_add(net_if_get_by_iface(iface), TMO_USAGE_PING, size, ret == 0 ? size : 0);
+	return ret;
+}
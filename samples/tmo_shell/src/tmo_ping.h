@@ -7,7 +7,10 @@
 #ifndef TMO_PING_H
 #define TMO_PING_H
 #include <zephyr/shell/shell.h>
+#include <zephyr/net/net_if.h>
 
 int cmd_ping(const struct shell *shell, size_t argc, char **argv);
+int tmo_ping_probe(struct net_if *iface, struct sockaddr *dst, uint16_t size,
+		uint32_t timeout_ms);
 
 #endif
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_pmtu, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/net_if.h>
+
+#include "tmo_pmtu.h"
+#include "tmo_link_mgr.h"
+#if CONFIG_PING
+#include "tmo_ping.h"
+#endif
+
+#define IPV4_HDR_LEN  20
+#define IPV6_HDR_LEN  40
+#define ICMP_HDR_LEN  8
+#define TCP_HDR_LEN   20
+#define UDP_HDR_LEN   8
+
+/* Smallest MTU each family must carry without fragmenting */
+#define IPV4_MIN_MTU  576
+#define IPV6_MIN_MTU  1280
+#define PMTU_MAX      1500
+/* Stop searching once the bracket is this narrow */
+#define PMTU_RESOLUTION 8
+#define PMTU_PROBE_TRIES 2
+
+static struct {
+	uint16_t mtu;
+	int64_t probed_at;
+} pmtu[TMO_LINK_MAX_IFACES + 1];
+static K_MUTEX_DEFINE(pmtu_mutex);
+
+static uint16_t if_mtu(int iface_idx)
+{
+	struct net_if *iface = net_if_get_by_index(iface_idx);
+
+	return iface ? net_if_get_mtu(iface) : 0;
+}
+
+/**
+ * @brief Path MTU of an interface
+ *
+ * The last probe result if there is one, else the MTU the interface
+ * reports, else CONFIG_TMO_PMTU_DEFAULT.
+ */
+uint16_t tmo_pmtu_get(int iface_idx)
+{
+	uint16_t mtu = 0;
+
+	if (iface_idx > 0 && iface_idx <= TMO_LINK_MAX_IFACES) {
+		mtu = pmtu[iface_idx].mtu;
+	}
+	if (mtu == 0) {
+		mtu = if_mtu(iface_idx);
+	}
+	return mtu ? MIN(mtu, PMTU_MAX) : CONFIG_TMO_PMTU_DEFAULT;
+}
+
+/**
+ * @brief Largest write that goes out as one unfragmented IP packet
+ *
+ * For TLS/DTLS sockets this also removes the record overhead, so that a
+ * record never spans more than one segment.
+ */
+uint16_t tmo_pmtu_payload(int iface_idx, bool v6, bool dgram, bool tls)
+{
+	int room = tmo_pmtu_get(iface_idx);
+
+	room -= v6 ? IPV6_HDR_LEN : IPV4_HDR_LEN;
+	room -= dgram ? UDP_HDR_LEN : TCP_HDR_LEN;
+	if (tls) {
+		room -= dgram ? TMO_PMTU_DTLS_OVERHEAD : TMO_PMTU_TLS_OVERHEAD;
+	}
+	return MAX(room, 1);
+}
+
+int tmo_pmtu_get_info(int iface_idx, struct tmo_pmtu_info *info)
+{
+	if (iface_idx <= 0 || iface_idx > TMO_LINK_MAX_IFACES ||
+			!net_if_get_by_index(iface_idx)) {
+		return -EINVAL;
+	}
+	k_mutex_lock(&pmtu_mutex, K_FOREVER);
+	info->mtu = tmo_pmtu_get(iface_idx);
+	info->if_mtu = if_mtu(iface_idx);
+	info->probed = pmtu[iface_idx].mtu != 0;
+	info->probe_age = info->probed ?
+		(k_uptime_get() - pmtu[iface_idx].probed_at) / MSEC_PER_SEC : 0;
+	k_mutex_unlock(&pmtu_mutex);
+	return 0;
+}
+
+#if CONFIG_PING
+static bool probe_size(struct net_if *iface, const struct sockaddr *dst, int mtu)
+{
+	int hdr = (dst->sa_family == AF_INET6 ? IPV6_HDR_LEN : IPV4_HDR_LEN) + ICMP_HDR_LEN;
+
+	for (int i = 0; i < PMTU_PROBE_TRIES; i++) {
+		if (tmo_ping_probe(iface, (struct sockaddr *)dst, mtu - hdr,
+					CONFIG_TMO_PMTU_PROBE_TIMEOUT_MS) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Probe the path MTU towards dst
+ *
+ * Binary search with echo requests of full packet size, in the manner of
+ * packetization layer PMTUD (RFC 8899): a lost probe is only taken as too
+ * big, no ICMP "too big" message is needed. The result is kept for the
+ * interface and used by tmo_pmtu_get().
+ *
+ * @return the path MTU, or -EHOSTUNREACH if not even the minimum MTU
+ * got a reply
+ */
+int tmo_pmtu_probe(int iface_idx, const struct sockaddr *dst)
+{
+	struct net_if *iface = net_if_get_by_index(iface_idx);
+	int lo = dst->sa_family == AF_INET6 ? IPV6_MIN_MTU : IPV4_MIN_MTU;
+	int hi = if_mtu(iface_idx) ? MIN(if_mtu(iface_idx), PMTU_MAX) : PMTU_MAX;
+
+	if (!iface || iface_idx > TMO_LINK_MAX_IFACES) {
+		return -EINVAL;
+	}
+	if (!probe_size(iface, dst, lo)) {
+		return -EHOSTUNREACH;
+	}
+	if (probe_size(iface, dst, hi)) {
+		lo = hi;
+	}
+	while (hi - lo > PMTU_RESOLUTION) {
+		int mid = (lo + hi) / 2;
+
+		if (probe_size(iface, dst, mid)) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	k_mutex_lock(&pmtu_mutex, K_FOREVER);
+	pmtu[iface_idx].mtu = lo;
+	pmtu[iface_idx].probed_at = k_uptime_get();
+	k_mutex_unlock(&pmtu_mutex);
+	LOG_INF("iface %d path MTU %d", iface_idx, lo);
+	return lo;
+}
+#else
+int tmo_pmtu_probe(int iface_idx, const struct sockaddr *dst)
+{
+	return -ENOTSUP;
+}
+#endif
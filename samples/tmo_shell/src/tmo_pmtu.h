@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_PMTU_H
+#define TMO_PMTU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/net/socket.h>
+
+/* TLS 1.2 AEAD record: 5 header + 8 explicit nonce + 16 tag */
+#define TMO_PMTU_TLS_OVERHEAD  29
+/* DTLS 1.2 adds an 8 byte epoch/sequence to the record header */
+#define TMO_PMTU_DTLS_OVERHEAD 37
+
+struct tmo_pmtu_info {
+	uint16_t mtu;         /* path MTU in use */
+	uint16_t if_mtu;      /* MTU reported by the interface, 0 if unknown */
+	bool probed;
+	uint32_t probe_age;   /* secs since the last probe */
+};
+
+uint16_t tmo_pmtu_get(int iface_idx);
+uint16_t tmo_pmtu_payload(int iface_idx, bool v6, bool dgram, bool tls);
+int tmo_pmtu_probe(int iface_idx, const struct sockaddr *dst);
+int tmo_pmtu_get_info(int iface_idx, struct tmo_pmtu_info *info);
+
+#endif
@@ -42,11 +42,26 @@ typedef int sec_tag_t;
 #endif
 
 #include "tmo_http_request.h"
+#include "tmo_tls_mem.h"
+#include "tmo_tls_bench.h"
+#include "tmo_crypto_bench.h"
 #include "tmo_buzzer.h"
 #include "tmo_gnss.h"
 #include "tmo_web_demo.h"
+#include "tmo_telemetry_sched.h"
+#include "tmo_link_mgr.h"
+#include "tmo_dns_cache.h"
+#include "tmo_udp_batch.h"
+#include "tmo_pmtu.h"
+#include "tmo_sock_file.h"
+#include "tmo_usage.h"
+#if CONFIG_TMO_HTTP_MOCK_SOCKET
+#include "tmo_http_mock_socket.h"
+#endif
 #include "tmo_wifi.h"
 #include "tmo_dfu_download.h"
+#include "tmo_dfu_plan.h"
+#include "tmo_dfu_timing.h"
 #include "tmo_file.h"
 #include "tmo_certs.h"
 #include "tmo_adc.h"
@@ -64,6 +79,11 @@ typedef int sec_tag_t;
 #if CONFIG_PING
 #include "tmo_ping.h"
 #endif
+#include "tmo_perf.h"
+#include "tmo_xfer_buf.h"
+#if CONFIG_TMO_SOCK_REACTOR
+#include "tmo_sock_reactor.h"
+#endif
 
 #if CONFIG_PM_DEVICE
 #include "tmo_pm.h"
@@ -109,8 +129,10 @@ const struct shell *shell = NULL;
 
 #define READ_4K   4096
 #define XFER_SIZE 5000
-uint8_t mxfer_buf[XFER_SIZE+1];
+BUILD_ASSERT(XFER_SIZE + 1 <= TMO_XFER_BUF_SIZE);
 int max_fragment = 1000;
+/* Size writes to each socket's path MTU instead of max_fragment */
+static bool frag_auto = true;
 int num_ifaces = 0;
 bool board_has_gnss = false;
 
@@ -122,6 +144,92 @@ int process_cli_cmd_modem_edrx(const struct shell *shell, size_t argc, char **ar
 int process_cli_cmd_modem_edrx_ptw(const struct shell *shell, size_t argc, char **argv, int sd);
 
 struct sock_rec_s socks[MAX_SOCK_REC] = {0};
+/* socks[] index + 1 of each tracked socket, by descriptor */
+static uint8_t sock_by_fd[CONFIG_POSIX_MAX_FDS];
+
+static int sock_add(const struct shell *shell, int sd, struct net_if *iface, uint8_t flags)
+{
+	if (sd < 0 || sd >= ARRAY_SIZE(sock_by_fd)) {
+		shell_error(shell, "Socket %d out of range, not tracked", sd);
+		return -EINVAL;
+	}
+	for (int i = 0; i < MAX_SOCK_REC; i++) {
+		if (!(socks[i].flags & BIT(sock_open))) {
+			memset(&socks[i], 0, sizeof(socks[i]));
+			socks[i].dev = iface;
+			socks[i].sd = sd;
+			socks[i].flags = flags | BIT(sock_open);
+			socks[i].stats.created = k_uptime_get();
+			sock_by_fd[sd] = i + 1;
+			return i;
+		}
+	}
+	shell_error(shell, "Socket table full, socket %d not tracked", sd);
+	return -ENOMEM;
+}
+
+static int sock_find(int sd)
+{
+	if (sd < 0 || sd >= ARRAY_SIZE(sock_by_fd) || sock_by_fd[sd] == 0) {
+		return -ENOENT;
+	}
+	int idx = sock_by_fd[sd] - 1;
+	if (socks[idx].sd != sd || !(socks[idx].flags & BIT(sock_open))) {
+		return -ENOENT;
+	}
+	return idx;
+}
+
+static void sock_remove(int idx)
+{
+	sock_by_fd[socks[idx].sd] = 0;
+	socks[idx].flags &= ~BIT(sock_open);
+}
+
+/* Count a send or receive result against the socket's statistics */
+static void sock_account(int sd, ssize_t ret, bool tx)
+{
+	int idx = sock_find(sd);
+
+	if (idx < 0) {
+		return;
+	}
+	struct sock_stats_s *st = &socks[idx].stats;
+	if (ret > 0 && tx) {
+		st->bytes_tx += ret;
+		st->pkts_tx++;
+		tmo_usage_add(net_if_get_by_iface(socks[idx].dev), TMO_USAGE_SHELL, ret, 0);
+	} else if (ret > 0) {
+		st->bytes_rx += ret;
+		st->pkts_rx++;
+		tmo_usage_add(net_if_get_by_iface(socks[idx].dev), TMO_USAGE_SHELL, 0, ret);
+	} else if (ret < 0 && errno != EAGAIN) {
+		st->errors++;
+	}
+}
+
+/* Largest write to a socket that avoids IP fragmentation and split records */
+static int sock_fragment(int idx)
+{
+	uint8_t flags = socks[idx].flags;
+
+	if (!frag_auto) {
+		return max_fragment;
+	}
+	return tmo_pmtu_payload(net_if_get_by_iface(socks[idx].dev),
+			flags & BIT(sock_v6),
+			flags & (BIT(sock_udp) | BIT(sock_dtls)),
+			flags & (BIT(sock_tls) | BIT(sock_dtls)));
+}
+
+static ssize_t sock_sendto_acct(int sd, const void *buf, size_t len, int flags,
+		const struct sockaddr *to, socklen_t tolen)
+{
+	ssize_t ret = zsock_sendto(sd, buf, len, flags, to, tolen);
+
+	sock_account(sd, ret, true);
+	return ret;
+}
 
 #if defined(CONFIG_NET_SOCKETS_ENABLE_DTLS)
 // int udp_cert_dtls(const struct shell *shell, size_t argc, char **argv);
@@ -183,15 +291,7 @@ int tcp_create_core(const struct shell *shell, size_t argc, char **argv, int fam
 		return 0;
 	}
 	shell_print(shell, "Created socket %d", sd);
-	for (int i = 0; i < MAX_SOCK_REC; i++) {
-		if (!(socks[i].flags & BIT(sock_open))) {
-			socks[i].dev = iface;
-			socks[i].sd = sd;
-			socks[i].flags = (BIT(sock_tcp) | BIT(sock_open)
-					| ((family == AF_INET ? 0 : BIT(sock_v6))));
-			break;
-		}
-	}
+	sock_add(shell, sd, iface, BIT(sock_tcp) | (family == AF_INET ? 0 : BIT(sock_v6)));
 	return 0;
 }
 
@@ -231,16 +331,7 @@ int tcp_create_tls_core(const struct shell *shell, size_t argc, char **argv, int
 
 	shell_info(shell, "Created socket %d", sd);
 
-	for (int i = 0; i < MAX_SOCK_REC; i++) {
-		if (!(socks[i].flags & BIT(sock_open))) {
-			socks[i].dev = iface;
-			socks[i].sd = sd;
-			socks[i].flags = (BIT(sock_tls) | BIT(sock_open)
-					| ((family == AF_INET ? 0 : BIT(sock_v6))));
-			idx = i;	//for later tls socket
-			break;
-		}
-	}
+	idx = sock_add(shell, sd, iface, BIT(sock_tls) | (family == AF_INET ? 0 : BIT(sock_v6)));
 
 	sec_tag_t sec_tag_list[] = {
 		CLIENT_CERTIFICATE_TAG,
@@ -263,7 +354,9 @@ int tcp_create_tls_core(const struct shell *shell, size_t argc, char **argv, int
 			ret = -errno;
 		}
 	}
-	socks[idx].flags |= BIT(sock_tls);
+	if (idx >= 0) {
+		socks[idx].flags |= BIT(sock_tls);
+	}
 
 #if CONFIG_MODEM
 	int tls_verify_val = TLS_PEER_VERIFY_NONE;
@@ -310,15 +403,7 @@ int udp_create_core(const struct shell *shell, size_t argc, char **argv, int fam
 		return 0;
 	}
 	shell_print(shell, "Created socket %d", sd);
-	for (int i = 0; i < MAX_SOCK_REC; i++) {
-		if (!(socks[i].flags & BIT(sock_open))) {
-			socks[i].dev = iface;
-			socks[i].sd = sd;
-			socks[i].flags = (BIT(sock_udp) | BIT(sock_open)
-					| ((family == AF_INET ? 0 : BIT(sock_v6))));
-			break;
-		}
-	}
+	sock_add(shell, sd, iface, BIT(sock_udp) | (family == AF_INET ? 0 : BIT(sock_v6)));
 	return 0;
 }
 
@@ -385,16 +470,7 @@ int udp_create_dtls_core(const struct shell *shell, size_t argc, char **argv, in
 		return 0;
 	}
 	shell_print(shell, "Created socket %d", sd);
-	for (int i = 0; i < MAX_SOCK_REC; i++) {
-		if (!(socks[i].flags & BIT(sock_open))) {
-			socks[i].dev = iface;
-			socks[i].sd = sd;
-			socks[i].flags = (BIT(sock_dtls) | BIT(sock_open)
-					| ((family == AF_INET ? 0 : BIT(sock_v6))));
-			idx = i;
-			break;
-		}
-	}
+	idx = sock_add(shell, sd, iface, BIT(sock_dtls) | (family == AF_INET ? 0 : BIT(sock_v6)));
 	sec_tag_t sec_tag_list[] = {
 		CLIENT_CERTIFICATE_TAG,
 		CLIENT_KEY_TAG,
@@ -417,7 +493,9 @@ int udp_create_dtls_core(const struct shell *shell, size_t argc, char **argv, in
 			ret = -errno;
 			}
 	}
-	socks[idx].flags |= BIT(sock_dtls);
+	if (idx >= 0) {
+		socks[idx].flags |= BIT(sock_dtls);
+	}
 
 	return ret;
 }
@@ -554,6 +632,60 @@ int udp_create_dtlsv6(const struct shell *shell, size_t argc, char **argv)
 
 int sock_cmd_parent_bm;
 
+#if CONFIG_TMO_SOCK_REACTOR
+static void sock_reactor_attach(const struct shell *shell, int sock_idx)
+{
+	int ret = tmo_sock_reactor_attach(socks[sock_idx].sd, socks[sock_idx].dev,
+			socks[sock_idx].flags & (BIT(sock_udp) | BIT(sock_dtls)));
+	if (ret < 0) {
+		shell_warn(shell, "No receive ring left, socket %d is read directly",
+				socks[sock_idx].sd);
+	}
+}
+#endif
+
+static bool sock_is_reactor(int sd)
+{
+#if CONFIG_TMO_SOCK_REACTOR
+	return tmo_sock_reactor_attached(sd);
+#else
+	return false;
+#endif
+}
+
+/**
+ * Receive from a shell socket, from its reactor ring if it has one.
+ * Waits up to timeout_ms for data, fails with EAGAIN when none arrived.
+ */
+static ssize_t sock_recv_wait(int sd, void *buf, size_t len, struct sockaddr *from,
+		socklen_t *fromlen, int timeout_ms)
+{
+#if CONFIG_TMO_SOCK_REACTOR
+	if (sock_is_reactor(sd)) {
+		ssize_t ret = tmo_sock_reactor_recv(sd, buf, len, from, fromlen, NULL,
+				K_MSEC(timeout_ms));
+		sock_account(sd, ret, false);
+		return ret;
+	}
+#endif
+	int64_t deadline = k_uptime_get() + timeout_ms;
+
+	while (true) {
+		ssize_t ret = zsock_recvfrom(sd, buf, len, ZSOCK_MSG_DONTWAIT, from, fromlen);
+		int64_t left = deadline - k_uptime_get();
+
+		if (ret >= 0 || errno != EAGAIN || left <= 0) {
+			sock_account(sd, ret, false);
+			return ret;
+		}
+		struct zsock_pollfd pfd = {.fd = sd, .events = ZSOCK_POLLIN};
+		if (zsock_poll(&pfd, 1, left) < 0) {
+			sock_account(sd, -1, false);
+			return -1;
+		}
+	}
+}
+
 int sock_connect(const struct shell *shell, size_t argc, char **argv)
 {
 	if (argc < 4){
@@ -564,15 +696,11 @@ int sock_connect(const struct shell *shell, size_t argc, char **argv)
 	int ret;
 	char *host;
 	struct sockaddr target;
+	int64_t connect_start;
 	int sd = strtol(argv[1], NULL, 10);
 	char *port_st = argv[3];
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
-			break;
-		}
-	}
-	if (sock_idx == MAX_SOCK_REC){
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
@@ -623,7 +751,7 @@ int sock_connect(const struct shell *shell, size_t argc, char **argv)
 			shell_error(shell, "Could not init device");
 			return ret;
 		}
-		ret = zsock_getaddrinfo(host, port_st, &hints, &res);
+		ret = tmo_dns_getaddrinfo(host, port_st, &hints, devid, &res);
 		if (ret != 0) {
 			shell_error(shell, "Unable to resolve address (%s), quitting", host);
 			return ret;
@@ -646,8 +774,9 @@ int sock_connect(const struct shell *shell, size_t argc, char **argv)
 					host, strlen(host));
 		}
 
+		connect_start = k_uptime_get();
 		ret = zsock_connect(sd, res->ai_addr, res->ai_addrlen);
-		zsock_freeaddrinfo(res);
+		tmo_dns_freeaddrinfo(res);
 	} else {
 		if (target.sa_family != ai_family) {
 			shell_error(shell, "Socket %d is a %s socket, got %s address",
@@ -668,16 +797,22 @@ int sock_connect(const struct shell *shell, size_t argc, char **argv)
 			}
 #endif
 		}
+		connect_start = k_uptime_get();
 		ret = zsock_connect(sd, &target,
 				target.sa_family == AF_INET6 ? sizeof(struct sockaddr_in6)
 				: sizeof(struct sockaddr_in));
 	}
 
 	if (ret == -1) {
+		socks[sock_idx].stats.errors++;
 		shell_error(shell, "Connection failed, errno = %d", errno);
 		return ret;
 	}
+	socks[sock_idx].stats.rtt_ms = k_uptime_get() - connect_start;
 	socks[sock_idx].flags |= BIT(sock_connected);
+#if CONFIG_TMO_SOCK_REACTOR
+	sock_reactor_attach(shell, sock_idx);
+#endif
 	shell_print(shell, "Connected socket %d", sd);
 	return 0;
 }
@@ -690,13 +825,8 @@ int sock_bind(const struct shell *shell, size_t argc, char **argv)
 		return -EINVAL;
 	}
 	int sd = strtol(argv[1], NULL, 10);
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
-			break;
-		}
-	}
-	if (sock_idx == MAX_SOCK_REC){
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
@@ -711,6 +841,9 @@ int sock_bind(const struct shell *shell, size_t argc, char **argv)
 		return 0;
 	}
 	socks[sock_idx].flags |= BIT(sock_bound);
+#if CONFIG_TMO_SOCK_REACTOR
+	sock_reactor_attach(shell, sock_idx);
+#endif
 	return 0;
 }
 
@@ -723,13 +856,8 @@ int sock_send(const struct shell *shell, size_t argc, char **argv)
 	}
 
 	int sd = strtol(argv[1], NULL, 10);
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
-			break;
-		}
-	}
-	if (sock_idx == MAX_SOCK_REC){
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
@@ -737,7 +865,7 @@ int sock_send(const struct shell *shell, size_t argc, char **argv)
 		shell_warn(shell, "Warning: Socket %d is a %s socket",
 				sd, (socks[sock_idx].flags & (BIT(sock_udp) | BIT(sock_dtls))) ? "UDP": "TCP");
 	}
-	int stat = zsock_send(sd, argv[2], strlen(argv[2]), 0);
+	int stat = sock_sendto_acct(sd, argv[2], strlen(argv[2]), 0, NULL, 0);
 	if (stat == -1) {
 		shell_error(shell, "Send failed, errno = %d", errno);
 		return -EINVAL;
@@ -754,13 +882,8 @@ int sock_sendto(const struct shell *shell, size_t argc, char **argv)
 	}
 
 	int sd = strtol(argv[1], NULL, 10);
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
-			break;
-		}
-	}
-	if (sock_idx == MAX_SOCK_REC){
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
@@ -815,22 +938,39 @@ int sock_sendto(const struct shell *shell, size_t argc, char **argv)
 			shell_error(shell, "Could not init device");
 			return ret;
 		}
-		ret = zsock_getaddrinfo(host, port_st, &hints, &res);
+		ret = tmo_dns_getaddrinfo(host, port_st, &hints, devid, &res);
 		if (ret != 0) {
 			shell_error(shell, "Unable to resolve address (%s), quitting", host);
 			return ret;
 		}
 		dump_addrinfo(shell, res);
 		memcpy(&target, res->ai_addr, res->ai_addrlen);
-		zsock_freeaddrinfo(res);
+		tmo_dns_freeaddrinfo(res);
 	}
-	int stat = zsock_sendto(sd, argv[4], strlen(argv[4]), 0, &target, ai_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+	int stat = sock_sendto_acct(sd, argv[4], strlen(argv[4]), 0, &target, ai_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
 	if (stat == -1) {
 		shell_error(shell, "Send failed, errno = %d", errno);
 	}
+#if CONFIG_TMO_SOCK_REACTOR
+	else {
+		/* The first sendto() implicitly binds, replies can now arrive */
+		sock_reactor_attach(shell, sock_idx);
+	}
+#endif
 	return 0;
 }
 
+/* Borrow a transfer buffer for the length of one shell command */
+static uint8_t *shell_xfer_buf(const struct shell *shell, const char *owner)
+{
+	uint8_t *buf = tmo_xfer_buf_acquire(owner, K_NO_WAIT);
+
+	if (buf == NULL) {
+		shell_error(shell, "No free transfer buffer, see tmo bufs");
+	}
+	return buf;
+}
+
 /**
  * send auto-generated bulk data
  */
@@ -843,13 +983,8 @@ int sock_sendb(const struct shell *shell, size_t argc, char **argv)
 	}
 
 	int sd = strtol(argv[1], NULL, 10);
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
-			break;
-		}
-	}
-	if (sock_idx == MAX_SOCK_REC){
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
@@ -859,13 +994,19 @@ int sock_sendb(const struct shell *shell, size_t argc, char **argv)
 	}
 	int sendsize = strtol(argv[2], NULL, 10);
 	sendsize = MIN(sendsize, XFER_SIZE);
+	int fragment = sock_fragment(sock_idx);
+	uint8_t *mxfer_buf = shell_xfer_buf(shell, "sendb");
+	if (mxfer_buf == NULL) {
+		return -EBUSY;
+	}
 
 	gen_payload(mxfer_buf, sendsize);
 	mxfer_buf[sendsize] = 0;
 	int total = 0;
 	int stat = 0;
 	while (total < sendsize || sendsize == 0) {
-		stat = zsock_send(sd, mxfer_buf + total, MIN(sendsize - total, max_fragment), 0);
+		stat = sock_sendto_acct(sd, mxfer_buf + total, MIN(sendsize - total, fragment), 0,
+				NULL, 0);
 		if (stat == -1) {
 			if (errno == EMSGSIZE) {
 				shell_warn(shell, "Note: EMSGSIZE (errno=%d) may be cause by a fragment being larger than network MTU.", EMSGSIZE);
@@ -875,16 +1016,25 @@ int sock_sendb(const struct shell *shell, size_t argc, char **argv)
 		}
 		total += stat;
 	}
+	tmo_xfer_buf_release(mxfer_buf);
 	shell_info(shell, "sent %d", total);
 	return (stat < 0) ? stat : total;
 }
 
 int sock_mxfragment(const struct shell *shell, size_t argc, char **argv)
 {
-	if (argc > 1) {
+	if (argc > 1 && !strcmp(argv[1], "auto")) {
+		frag_auto = true;
+	} else if (argc > 1) {
 		max_fragment = MAX(1, MIN(1500, strtol(argv[1], NULL, 10)));
+		frag_auto = false;
+	}
+	if (frag_auto) {
+		shell_print(shell, "Max xfer fragment size follows path MTU "
+				"(%d bytes on receive)", max_fragment);
+	} else {
+		shell_print(shell, "Max xfer fragment size set to %d bytes", max_fragment);
 	}
-	shell_print(shell, "Max xfer fragment size set to %d bytes", max_fragment);
 	return 0;
 }
 
@@ -932,13 +1082,8 @@ int sock_recvb(const struct shell *shell, size_t argc, char **argv)
 	}
 
 	int sd = strtol(argv[1], NULL, 10);
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
-			break;
-		}
-	}
-	if (sock_idx == MAX_SOCK_REC){
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
@@ -948,24 +1093,28 @@ int sock_recvb(const struct shell *shell, size_t argc, char **argv)
 	}
 	int recvsize = strtol(argv[2], NULL, 10);
 	recvsize = MIN(recvsize, XFER_SIZE);
+	uint8_t *mxfer_buf = shell_xfer_buf(shell, "recvb");
+	if (mxfer_buf == NULL) {
+		return -EBUSY;
+	}
 
 	memset(mxfer_buf, 0, recvsize+1);
 	int total = 0;
 	int stat = 0;
-	bool again = true;
+	int wait_ms = 0;
 	while (total < recvsize || recvsize == 0) {
-		stat = zsock_recv(sd, mxfer_buf + total, MIN(recvsize - total, max_fragment), ZSOCK_MSG_DONTWAIT);
+		stat = sock_recv_wait(sd, mxfer_buf + total, MIN(recvsize - total, max_fragment),
+				NULL, NULL, wait_ms);
 		if (stat == -1) {
 			if ((total == 0) || (errno != EAGAIN)) {
 				shell_error(shell, "recv failed, errno = %d", errno);
-			} else if (total < recvsize && again) {
-				k_msleep(500);
-				again = false;
+			} else if (total < recvsize && wait_ms == 0) {
+				wait_ms = 500;
 				continue;
 			}
 			break;
 		}
-		again = true;
+		wait_ms = 0;
 		total += stat;
 	}
 	shell_info(shell, "received %d", total);
@@ -973,24 +1122,307 @@ int sock_recvb(const struct shell *shell, size_t argc, char **argv)
 	if (total > 0) {
 		cmp_payload(shell, mxfer_buf, total);
 	}
+	tmo_xfer_buf_release(mxfer_buf);
 	return (stat < 0) ? stat : total;
 }
 
-int sock_rcv(const struct shell *shell, size_t argc, char **argv)
+#define STREAM_PATTERN_PERIOD   97
+#define STREAM_IDLE_TIMEOUT_MS  10000
+#define STREAM_PROGRESS_MS      10000
+
+static int stream_sock_lookup(const struct shell *shell, int sd)
 {
-	if (argc < 2){
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
+		shell_error(shell, "Socket %d not found", sd);
+		return -EINVAL;
+	}
+	if (!(socks[sock_idx].flags & sock_cmd_parent_bm)) {
+		shell_warn(shell, "Warning: Socket %d is a %s socket",
+				sd, (socks[sock_idx].flags & (BIT(sock_udp) | BIT(sock_dtls))) ? "UDP": "TCP");
+	}
+	return sock_idx;
+}
+
+static uint32_t stream_kbps(uint64_t bytes, int64_t ms)
+{
+	return (uint32_t)(bytes * 8 / MAX(ms, 1));
+}
+
+/**
+ * send an auto-generated stream of any length
+ *
+ * The pattern repeats every 97 bytes, so the buffer is filled once and each
+ * chunk is sent from the offset matching its absolute stream position.
+ */
+int sock_sendbs(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc < 3){
 		shell_error(shell, "Missing required arguments");
 		shell_help(shell);
 		return -EINVAL;
 	}
-	int sd = (int)strtol(argv[1], NULL, 10);
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
+
+	int sd = strtol(argv[1], NULL, 10);
+	int sock_idx = stream_sock_lookup(shell, sd);
+	if (sock_idx < 0) {
+		return -EINVAL;
+	}
+	uint64_t sendsize = strtoull(argv[2], NULL, 10);
+	int timeout = (argc > 3) ? strtol(argv[3], NULL, 10) : STREAM_IDLE_TIMEOUT_MS;
+
+	if (sendsize == 0) {
+		shell_error(shell, "Size must be greater than 0");
+		return -EINVAL;
+	}
+	int fragment = sock_fragment(sock_idx);
+	uint8_t *mxfer_buf = shell_xfer_buf(shell, "sendbs");
+	if (mxfer_buf == NULL) {
+		return -EBUSY;
+	}
+	gen_payload(mxfer_buf, MIN(XFER_SIZE, fragment + STREAM_PATTERN_PERIOD));
+
+	struct zsock_pollfd pfd = {.fd = sd, .events = ZSOCK_POLLOUT};
+	uint64_t total = 0;
+	int stat = 0;
+	int64_t start = k_uptime_get();
+	int64_t progress = start;
+
+	while (total < sendsize) {
+		stat = zsock_poll(&pfd, 1, timeout);
+		if (stat == 0) {
+			shell_error(shell, "send stalled for %d ms", timeout);
+			stat = -ETIMEDOUT;
+			break;
+		} else if (stat < 0 || (pfd.revents & (ZSOCK_POLLERR | ZSOCK_POLLHUP | ZSOCK_POLLNVAL))) {
+			shell_error(shell, "poll failed, errno = %d, revents = 0x%x", errno, pfd.revents);
+			stat = -EIO;
+			break;
+		}
+		stat = sock_sendto_acct(sd, mxfer_buf + (total % STREAM_PATTERN_PERIOD),
+				MIN(sendsize - total, fragment), ZSOCK_MSG_DONTWAIT, NULL, 0);
+		if (stat == -1) {
+			if (errno == EAGAIN) {
+				continue;
+			}
+			if (errno == EMSGSIZE) {
+				shell_warn(shell, "Note: EMSGSIZE (errno=%d) may be cause by a fragment being larger than network MTU.", EMSGSIZE);
+			}
+			shell_error(shell, "send failed at offset %llu, errno = %d", total, errno);
+			stat = -errno;
 			break;
 		}
+		total += stat;
+		if (k_uptime_get() - progress >= STREAM_PROGRESS_MS) {
+			progress = k_uptime_get();
+			shell_print(shell, "sent %llu bytes, %u kbps", total,
+					stream_kbps(total, progress - start));
+		}
+	}
+	int64_t elapsed = k_uptime_get() - start;
+
+	tmo_xfer_buf_release(mxfer_buf);
+	shell_info(shell, "sent %llu bytes in %lld ms, %u kbps", total, elapsed,
+			stream_kbps(total, elapsed));
+	return (stat < 0) ? stat : 0;
+}
+
+/**
+ * recv a stream of any length, verifying the pattern as it arrives
+ *
+ * A size of 0 receives until the peer closes or the socket stays idle for
+ * the timeout.
+ */
+int sock_recvbs(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc < 3){
+		shell_error(shell, "Missing required arguments");
+		shell_help(shell);
+		return -EINVAL;
+	}
+
+	int sd = strtol(argv[1], NULL, 10);
+	if (stream_sock_lookup(shell, sd) < 0) {
+		return -EINVAL;
+	}
+	uint64_t recvsize = strtoull(argv[2], NULL, 10);
+	int timeout = (argc > 3) ? strtol(argv[3], NULL, 10) : STREAM_IDLE_TIMEOUT_MS;
+
+	uint64_t total = 0;
+	uint64_t mismatch_os = 0;
+	uint32_t mismatches = 0;
+	uint8_t phase = 0;
+	int stat = 0;
+	uint8_t *mxfer_buf = shell_xfer_buf(shell, "recvbs");
+	if (mxfer_buf == NULL) {
+		return -EBUSY;
+	}
+	int64_t start = k_uptime_get();
+	int64_t progress = start;
+
+	while (total < recvsize || recvsize == 0) {
+		int len = max_fragment;
+		if (recvsize) {
+			len = MIN(recvsize - total, len);
+		}
+		stat = sock_recv_wait(sd, mxfer_buf, len, NULL, NULL, timeout);
+		if (stat == -1) {
+			if (errno == EAGAIN) {
+				if (recvsize) {
+					shell_error(shell, "no data for %d ms", timeout);
+				}
+				stat = recvsize ? -ETIMEDOUT : 0;
+				break;
+			}
+			shell_error(shell, "recv failed at offset %llu, errno = %d", total, errno);
+			stat = -errno;
+			break;
+		} else if (stat == 0) {
+			if (recvsize) {
+				shell_warn(shell, "peer closed the connection");
+			}
+			break;
+		}
+		for (int i = 0; i < stat; i++) {
+			if (mxfer_buf[i] != 0x20 + phase) {
+				if (mismatches++ == 0) {
+					mismatch_os = total + i;
+					shell_error(shell, "buffer mismatch: offset %llu = 0x%x, should be 0x%x",
+							mismatch_os, mxfer_buf[i], 0x20 + phase);
+				}
+			}
+			if (++phase == STREAM_PATTERN_PERIOD) {
+				phase = 0;
+			}
+		}
+		total += stat;
+		if (k_uptime_get() - progress >= STREAM_PROGRESS_MS) {
+			progress = k_uptime_get();
+			shell_print(shell, "received %llu bytes, %u kbps, %u mismatched", total,
+					stream_kbps(total, progress - start), mismatches);
+		}
+	}
+	int64_t elapsed = k_uptime_get() - start;
+
+	tmo_xfer_buf_release(mxfer_buf);
+	shell_info(shell, "received %llu bytes in %lld ms, %u kbps", total, elapsed,
+			stream_kbps(total, elapsed));
+	if (mismatches) {
+		shell_error(shell, "%u bytes mismatched, first at offset %llu", mismatches, mismatch_os);
+	} else if (total > 0) {
+		shell_info(shell, "stream matched send pattern");
+	}
+	if (stat < 0) {
+		return stat;
+	}
+	return mismatches ? -EBADMSG : 0;
+}
+
+/* tmo_sock_xfer_fn sending a whole buffer in socket-sized fragments */
+static ssize_t sock_send_all(int sd, void *buf, size_t len, int timeout_ms)
+{
+	struct zsock_pollfd pfd = {.fd = sd, .events = ZSOCK_POLLOUT};
+	int idx = sock_find(sd);
+	int fragment = (idx < 0) ? max_fragment : sock_fragment(idx);
+	size_t total = 0;
+
+	while (total < len) {
+		int ret = zsock_poll(&pfd, 1, timeout_ms);
+		if (ret == 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		} else if (ret < 0) {
+			return -1;
+		}
+		ret = sock_sendto_acct(sd, (uint8_t *)buf + total, MIN(len - total, fragment),
+				ZSOCK_MSG_DONTWAIT, NULL, 0);
+		if (ret < 0 && errno != EAGAIN) {
+			return -1;
+		}
+		total += MAX(ret, 0);
+	}
+	return total;
+}
+
+static ssize_t sock_recv_some(int sd, void *buf, size_t len, int timeout_ms)
+{
+	return sock_recv_wait(sd, buf, len, NULL, NULL, timeout_ms);
+}
+
+static void sock_file_report(const struct shell *shell, const char *verb,
+		const struct tmo_sock_file_stats *st)
+{
+	shell_info(shell, "%s %llu bytes in %u ms, %u kbps", verb, st->bytes, st->elapsed_ms,
+			stream_kbps(st->bytes, st->elapsed_ms));
+	shell_print(shell, "stalled on file system %u ms, on network %u ms",
+			st->fs_stall_ms, st->net_stall_ms);
+}
+
+/**
+ * stream a file to a socket
+ */
+int sock_sendfile(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_sock_file_stats st;
+
+	if (argc < 3){
+		shell_error(shell, "Missing required arguments");
+		shell_help(shell);
+		return -EINVAL;
+	}
+
+	int sd = strtol(argv[1], NULL, 10);
+	if (stream_sock_lookup(shell, sd) < 0) {
+		return -EINVAL;
+	}
+	int timeout = (argc > 3) ? strtol(argv[3], NULL, 10) : STREAM_IDLE_TIMEOUT_MS;
+
+	int ret = tmo_sock_sendfile(sd, argv[2], sock_send_all, timeout, &st);
+	sock_file_report(shell, "sent", &st);
+	if (ret) {
+		shell_error(shell, "sendfile failed: %d", ret);
+	}
+	return ret;
+}
+
+/**
+ * stream data from a socket into a file
+ */
+int sock_recvfile(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_sock_file_stats st;
+
+	if (argc < 4){
+		shell_error(shell, "Missing required arguments");
+		shell_help(shell);
+		return -EINVAL;
+	}
+
+	int sd = strtol(argv[1], NULL, 10);
+	if (stream_sock_lookup(shell, sd) < 0) {
+		return -EINVAL;
+	}
+	uint64_t len = strtoull(argv[3], NULL, 10);
+	int timeout = (argc > 4) ? strtol(argv[4], NULL, 10) : STREAM_IDLE_TIMEOUT_MS;
+
+	int ret = tmo_sock_recvfile(sd, argv[2], len, sock_recv_some, timeout, &st);
+	sock_file_report(shell, "received", &st);
+	if (ret) {
+		shell_error(shell, "recvfile failed: %d", ret);
+	}
+	return ret;
+}
+
+int sock_rcv(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc < 2){
+		shell_error(shell, "Missing required arguments");
+		shell_help(shell);
+		return -EINVAL;
 	}
-	if (sock_idx == MAX_SOCK_REC){
+	int sd = (int)strtol(argv[1], NULL, 10);
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
@@ -999,19 +1431,31 @@ int sock_rcv(const struct shell *shell, size_t argc, char **argv)
 				sd, (socks[sock_idx].flags & (BIT(sock_udp) | BIT(sock_dtls))) ? "UDP": "TCP");
 	}
 	int stat = 0;
-	memset(mxfer_buf, 0, XFER_SIZE);
-	stat = zsock_recv(sd, mxfer_buf, XFER_SIZE, ZSOCK_MSG_DONTWAIT);
+	uint8_t *mxfer_buf = shell_xfer_buf(shell, "recv");
+	if (mxfer_buf == NULL) {
+		return -EBUSY;
+	}
+	memset(mxfer_buf, 0, XFER_SIZE + 1);
+	stat = sock_recv_wait(sd, mxfer_buf, XFER_SIZE, NULL, NULL, 0);
 	if (stat > 0){
 		shell_print(shell, "RECEIVED:\n%s ", (char*)mxfer_buf);
 	} else if (stat == -1 && errno == EWOULDBLOCK) {
 		shell_print(shell, "No data available!");
+		tmo_xfer_buf_release(mxfer_buf);
 		return stat;
 	}
-	while (stat == XFER_SIZE) {
+	/* A receive ring hands out at most one frame per call */
+	while (stat == XFER_SIZE || (stat > 0 && sock_is_reactor(sd))) {
 		memset(mxfer_buf,0,XFER_SIZE);
-		stat = zsock_recv(sd, mxfer_buf, XFER_SIZE, ZSOCK_MSG_DONTWAIT);
-		shell_print(shell, "%s", (char*)mxfer_buf);
+		stat = sock_recv_wait(sd, mxfer_buf, XFER_SIZE, NULL, NULL, 0);
+		if (stat > 0) {
+			shell_print(shell, "%s", (char*)mxfer_buf);
+		} else if (stat == -1 && errno == EWOULDBLOCK) {
+			tmo_xfer_buf_release(mxfer_buf);
+			return 0;
+		}
 	}
+	tmo_xfer_buf_release(mxfer_buf);
 	if (stat == -1) {
 		shell_error(shell, "Receive failed, errno = %d", errno);
 	} else if (stat == 0) {
@@ -1028,24 +1472,23 @@ int sock_rcvfrom(const struct shell *shell, size_t argc, char **argv)
 		return -EINVAL;
 	}
 	int sd = (int)strtol(argv[1], NULL, 10);
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
-			break;
-		}
-	}
-	if (sock_idx == MAX_SOCK_REC){
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
 	struct sockaddr target;
-	int addrLen;
+	socklen_t addrLen;
 	int stat = 0;
 	int ai_family = (socks[sock_idx].flags & BIT(sock_v6)) ? AF_INET6 : AF_INET;
 	addrLen = (ai_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
-	memset(mxfer_buf, 0, XFER_SIZE);
+	uint8_t *mxfer_buf = shell_xfer_buf(shell, "recvfrom");
+	if (mxfer_buf == NULL) {
+		return -EBUSY;
+	}
+	memset(mxfer_buf, 0, XFER_SIZE + 1);
 	char addrbuf[NET_IPV6_ADDR_LEN];
-	stat = zsock_recvfrom(sd, mxfer_buf, XFER_SIZE, ZSOCK_MSG_DONTWAIT, (struct sockaddr*)&target, &addrLen);
+	stat = sock_recv_wait(sd, mxfer_buf, XFER_SIZE, &target, &addrLen, 0);
 #if IS_ENABLED(CONFIG_NET_IPV6)
 	void *addr = (ai_family == AF_INET6) ? (void*)&net_sin6(&target)->sin6_addr : (void*)&net_sin(&target)->sin_addr;
 	uint16_t port = ntohs((ai_family == AF_INET6) ? net_sin6(&target)->sin6_port : net_sin(&target)->sin_port);
@@ -1058,13 +1501,15 @@ int sock_rcvfrom(const struct shell *shell, size_t argc, char **argv)
 		shell_print(shell, "RECEIVED from %s:%d:\n%s ",  addrbuf, port, (char*)mxfer_buf);
 	}  else if (stat == -1 && errno == EWOULDBLOCK) {
 		shell_print(shell, "No data available!");
+		tmo_xfer_buf_release(mxfer_buf);
 		return stat;
 	}
 	while (stat == XFER_SIZE) {
 		memset(mxfer_buf,0,XFER_SIZE);
-		stat = zsock_recv(sd, mxfer_buf, XFER_SIZE, ZSOCK_MSG_DONTWAIT);
+		stat = sock_recv_wait(sd, mxfer_buf, XFER_SIZE, NULL, NULL, 0);
 		shell_print(shell, "%s", (char*)mxfer_buf);
 	}
+	tmo_xfer_buf_release(mxfer_buf);
 	if (stat == -1) {
 		shell_error(shell, "Receive failed, errno = %d", errno);
 	}
@@ -1079,13 +1524,8 @@ int sock_close(const struct shell *shell, size_t argc, char **argv)
 		return -EINVAL;
 	}
 	int sd = strtol(argv[1], NULL, 10);
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
-			break;
-		}
-	}
-	if (sock_idx == MAX_SOCK_REC) {
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
@@ -1093,12 +1533,15 @@ int sock_close(const struct shell *shell, size_t argc, char **argv)
 		shell_warn(shell, "Warning: Socket %d is a %s socket",
 				sd, (socks[sock_idx].flags & (BIT(sock_udp) | BIT(sock_dtls)) ? "UDP": "TCP"));
 	}
+#if CONFIG_TMO_SOCK_REACTOR
+	tmo_sock_reactor_detach(sd);
+#endif
 	int stat = zsock_close(sd);
 	if (stat < 0) {
 		shell_error(shell, "Close failed, errno = %d", errno);
 		return stat;
 	}
-	socks[sock_idx].flags &= ~BIT(sock_open);
+	sock_remove(sock_idx);
 	return stat;
 }
 
@@ -1115,13 +1558,8 @@ int sock_sendsms(const struct shell *shell, size_t argc, char **argv)
 	}
 
 	int sd = strtol(argv[1], NULL, 10);
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
-			break;
-		}
-	}
-	if (sock_idx == MAX_SOCK_REC){
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
@@ -1151,13 +1589,8 @@ int sock_recvsms(const struct shell *shell, size_t argc, char **argv)
 	int sd = strtol(argv[1], NULL, 10);
 
 	int wait = strtol(argv[2], NULL, 10);
-	int sock_idx;
-	for (sock_idx = 0; sock_idx < MAX_SOCK_REC; sock_idx++) {
-		if (socks[sock_idx].sd == sd && socks[sock_idx].flags & BIT(sock_open)) {
-			break;
-		}
-	}
-	if (sock_idx == MAX_SOCK_REC){
+	int sock_idx = sock_find(sd);
+	if (sock_idx < 0) {
 		shell_error(shell, "Socket %d not found", sd);
 		return -EINVAL;
 	}
@@ -1205,6 +1638,25 @@ int cmd_list_socks(const struct shell *shell, size_t argc, char **argv)
 					(socks[i].flags & BIT(sock_bound)) ? "BOUND" : "",
 					(socks[i].flags & BIT(sock_v6)) ? "V6" : ""
 				   );
+			struct sock_stats_s *st = &socks[i].stats;
+			shell_print(shell, "   age=%us connect=%ums tx=%llu bytes/%u pkts "
+					"rx=%llu bytes/%u pkts errors=%u",
+					(uint32_t)((k_uptime_get() - st->created) / MSEC_PER_SEC),
+					st->rtt_ms, st->bytes_tx, st->pkts_tx,
+					st->bytes_rx, st->pkts_rx, st->errors);
+			shell_print(shell, "   mtu=%u fragment=%d%s",
+					tmo_pmtu_get(net_if_get_by_iface(iface)),
+					sock_fragment(i), frag_auto ? " (auto)" : "");
+#if CONFIG_TMO_SOCK_REACTOR
+			struct tmo_sock_reactor_stats rst;
+			if (tmo_sock_reactor_get_stats(socks[i].sd, &rst) == 0) {
+				shell_print(shell, "   rx ring: frames=%u bytes=%u queued=%u full=%u "
+						"latency avg=%ums max=%ums%s",
+						rst.frames, rst.bytes, rst.queued, rst.ring_full,
+						rst.avg_latency_ms, rst.max_latency_ms,
+						rst.eof ? " EOF" : (rst.err ? " ERROR" : ""));
+			}
+#endif
 		}
 	}
 	return 0;
@@ -1327,6 +1779,30 @@ int tcp_recvb(const struct shell *shell, size_t argc, char **argv)
 	return sock_recvb(shell, argc, argv);
 }
 
+int tcp_sendbs(const struct shell *shell, size_t argc, char **argv)
+{
+	sock_cmd_parent_bm = BIT(sock_tcp) | BIT(sock_tls);
+	return sock_sendbs(shell, argc, argv);
+}
+
+int tcp_recvbs(const struct shell *shell, size_t argc, char **argv)
+{
+	sock_cmd_parent_bm = BIT(sock_tcp) | BIT(sock_tls);
+	return sock_recvbs(shell, argc, argv);
+}
+
+int tcp_sendfile(const struct shell *shell, size_t argc, char **argv)
+{
+	sock_cmd_parent_bm = BIT(sock_tcp) | BIT(sock_tls);
+	return sock_sendfile(shell, argc, argv);
+}
+
+int tcp_recvfile(const struct shell *shell, size_t argc, char **argv)
+{
+	sock_cmd_parent_bm = BIT(sock_tcp) | BIT(sock_tls);
+	return sock_recvfile(shell, argc, argv);
+}
+
 int tcp_close(const struct shell *shell, size_t argc, char **argv)
 {
 	sock_cmd_parent_bm = BIT(sock_tcp) | BIT(sock_tls);
@@ -1342,6 +1818,9 @@ SHELL_STATIC_SUBCMD_SET_CREATE(tmo_tcp_sub,
 #endif
 		SHELL_CMD(recv, NULL, "<socket>", tcp_rcv),
 		SHELL_CMD(recvb, NULL,  "<socket> <size>", tcp_recvb),
+		SHELL_CMD(recvbs, NULL,  "<socket> <size, 0 = until idle> [idle timeout ms]", tcp_recvbs),
+		SHELL_CMD(recvfile, NULL,  "<socket> <file> <size, 0 = until idle> [idle timeout ms]",
+			tcp_recvfile),
 #if CONFIG_MODEM
 		SHELL_CMD(recvsms, NULL, "<socket> <wait time (seconds)>", sock_recvsms),
 #endif /* CONFIG_MODEM */
@@ -1353,10 +1832,12 @@ SHELL_STATIC_SUBCMD_SET_CREATE(tmo_tcp_sub,
 #endif
 		SHELL_CMD(send, NULL, "<socket> <payload>", tcp_send),
 		SHELL_CMD(sendb, NULL,  "<socket> <size>", tcp_sendb),
+		SHELL_CMD(sendbs, NULL,  "<socket> <size> [stall timeout ms]", tcp_sendbs),
+		SHELL_CMD(sendfile, NULL,  "<socket> <file> [stall timeout ms]", tcp_sendfile),
 #if CONFIG_MODEM
 		SHELL_CMD(sendsms, NULL, "<socket> <phone number> <message>", sock_sendsms),
 #endif /* CONFIG_MODEM */
-		SHELL_CMD(xfersz, NULL,  "[size]", sock_mxfragment),
+		SHELL_CMD(xfersz, NULL,  "[size|auto]", sock_mxfragment),
 		SHELL_SUBCMD_SET_END
 		);
 
@@ -1390,6 +1871,160 @@ int udp_recvb(const struct shell *shell, size_t argc, char **argv)
 	return sock_recvb(shell, argc, argv);
 }
 
+int udp_sendbs(const struct shell *shell, size_t argc, char **argv)
+{
+	sock_cmd_parent_bm = BIT(sock_udp) | BIT(sock_dtls);
+	return sock_sendbs(shell, argc, argv);
+}
+
+int udp_recvbs(const struct shell *shell, size_t argc, char **argv)
+{
+	sock_cmd_parent_bm = BIT(sock_udp) | BIT(sock_dtls);
+	return sock_recvbs(shell, argc, argv);
+}
+
+/**
+ * send count datagrams in batches and report the packet rate
+ */
+int udp_sendmmsg(const struct shell *shell, size_t argc, char **argv)
+{
+	sock_cmd_parent_bm = BIT(sock_udp) | BIT(sock_dtls);
+	if (argc < 4){
+		shell_error(shell, "Missing required arguments");
+		shell_help(shell);
+		return -EINVAL;
+	}
+
+	int sd = strtol(argv[1], NULL, 10);
+	int sock_idx = stream_sock_lookup(shell, sd);
+	if (sock_idx < 0) {
+		return -EINVAL;
+	}
+	int count = strtol(argv[2], NULL, 10);
+	int size = MIN(strtol(argv[3], NULL, 10), sock_fragment(sock_idx));
+	int batch = (argc > 4) ? strtol(argv[4], NULL, 10) : TMO_UDP_BATCH_MAX;
+	batch = CLAMP(batch, 1, TMO_UDP_BATCH_MAX);
+	if (count <= 0 || size <= 0) {
+		shell_error(shell, "Count and size must be greater than 0");
+		return -EINVAL;
+	}
+
+	struct tmo_dgram msgs[TMO_UDP_BATCH_MAX] = {0};
+	uint8_t *mxfer_buf = shell_xfer_buf(shell, "sendmmsg");
+	if (mxfer_buf == NULL) {
+		return -EBUSY;
+	}
+	gen_payload(mxfer_buf, size);
+	for (int i = 0; i < batch; i++) {
+		msgs[i].buf = mxfer_buf;
+		msgs[i].len = size;
+	}
+
+	struct zsock_pollfd pfd = {.fd = sd, .events = ZSOCK_POLLOUT};
+	int sent = 0;
+	int calls = 0;
+	int ret = 0;
+	int64_t start = k_uptime_get();
+
+	while (sent < count) {
+		ret = tmo_udp_sendmmsg(sd, msgs, MIN(batch, count - sent), ZSOCK_MSG_DONTWAIT);
+		calls++;
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != ENOBUFS) {
+				shell_error(shell, "send failed after %d datagrams, errno = %d", sent, errno);
+				sock_account(sd, -1, true);
+				break;
+			}
+			/* Offload buffers full, wait for room */
+			if (zsock_poll(&pfd, 1, STREAM_IDLE_TIMEOUT_MS) <= 0) {
+				shell_error(shell, "send stalled after %d datagrams", sent);
+				ret = -ETIMEDOUT;
+				break;
+			}
+			continue;
+		}
+		for (int i = 0; i < ret; i++) {
+			sock_account(sd, msgs[i].xfer, true);
+		}
+		sent += ret;
+	}
+	int64_t elapsed = MAX(k_uptime_get() - start, 1);
+
+	tmo_xfer_buf_release(mxfer_buf);
+	shell_info(shell, "sent %d datagrams of %d bytes in %lld ms (%d calls): %u pps, %u kbps",
+			sent, size, elapsed, calls, (uint32_t)(sent * 1000LL / elapsed),
+			stream_kbps((uint64_t)sent * size, elapsed));
+	return (ret < 0) ? ret : 0;
+}
+
+/**
+ * receive up to count datagrams in batches and report the packet rate
+ */
+int udp_recvmmsg(const struct shell *shell, size_t argc, char **argv)
+{
+	sock_cmd_parent_bm = BIT(sock_udp) | BIT(sock_dtls);
+	if (argc < 3){
+		shell_error(shell, "Missing required arguments");
+		shell_help(shell);
+		return -EINVAL;
+	}
+
+	int sd = strtol(argv[1], NULL, 10);
+	if (stream_sock_lookup(shell, sd) < 0) {
+		return -EINVAL;
+	}
+	int count = strtol(argv[2], NULL, 10);
+	int timeout = (argc > 3) ? strtol(argv[3], NULL, 10) : STREAM_IDLE_TIMEOUT_MS;
+	/* Carve the transfer buffer into one xfersz slot per datagram */
+	int batch = MIN(TMO_UDP_BATCH_MAX, XFER_SIZE / max_fragment);
+	struct tmo_dgram msgs[TMO_UDP_BATCH_MAX] = {0};
+	uint8_t *mxfer_buf = shell_xfer_buf(shell, "recvmmsg");
+	if (mxfer_buf == NULL) {
+		return -EBUSY;
+	}
+
+	for (int i = 0; i < batch; i++) {
+		msgs[i].buf = mxfer_buf + i * max_fragment;
+		msgs[i].len = max_fragment;
+	}
+
+	int got = 0;
+	int calls = 0;
+	int max_batch = 0;
+	uint64_t bytes = 0;
+	int64_t start = 0;
+	int64_t last = 0;
+
+	while (got < count) {
+		int ret = tmo_udp_recvmmsg(sd, msgs, MIN(batch, count - got), timeout);
+		if (ret < 0) {
+			if (errno != EAGAIN) {
+				shell_error(shell, "recv failed after %d datagrams, errno = %d", got, errno);
+				sock_account(sd, -1, false);
+			}
+			break;
+		}
+		/* Time from the first datagram, not from the command */
+		last = k_uptime_get();
+		if (calls++ == 0) {
+			start = last;
+		}
+		for (int i = 0; i < ret; i++) {
+			bytes += msgs[i].xfer;
+			sock_account(sd, msgs[i].xfer, false);
+		}
+		max_batch = MAX(max_batch, ret);
+		got += ret;
+	}
+	int64_t elapsed = MAX(last - start, 1);
+
+	tmo_xfer_buf_release(mxfer_buf);
+	shell_info(shell, "received %d datagrams, %llu bytes in %lld ms (%d calls, max batch %d): "
+			"%u pps, %u kbps", got, bytes, elapsed, calls, max_batch,
+			(uint32_t)(got * 1000LL / elapsed), stream_kbps(bytes, elapsed));
+	return 0;
+}
+
 int udp_close(const struct shell *shell, size_t argc, char **argv)
 {
 	sock_cmd_parent_bm = BIT(sock_udp) | BIT(sock_dtls);
@@ -1419,17 +2054,21 @@ SHELL_STATIC_SUBCMD_SET_CREATE(tmo_udp_sub,
 #endif
 		SHELL_CMD(recv, NULL, "<socket>", udp_rcv),
 		SHELL_CMD(recvb, NULL,  "<socket> <size>", udp_recvb),
+		SHELL_CMD(recvbs, NULL,  "<socket> <size, 0 = until idle> [idle timeout ms]", udp_recvbs),
 		SHELL_CMD(recvfrom, NULL, "<socket> <ip> <port>", sock_rcvfrom),
+		SHELL_CMD(recvmmsg, NULL, "<socket> <count> [timeout ms]", udp_recvmmsg),
 #if CONFIG_MODEM
 		SHELL_CMD(recvsms, NULL, "<socket> <wait time (seconds)>", sock_recvsms),
 #endif /* CONFIG_MODEM */
 		SHELL_CMD(send, NULL, "<socket> <payload>", udp_send),
 		SHELL_CMD(sendb, NULL,  "<socket> <size>", udp_sendb),
+		SHELL_CMD(sendbs, NULL,  "<socket> <size> [stall timeout ms]", udp_sendbs),
+		SHELL_CMD(sendmmsg, NULL,  "<socket> <count> <size> [batch]", udp_sendmmsg),
 #if CONFIG_MODEM
 		SHELL_CMD(sendsms, NULL, "<socket> <phone number> <message>", sock_sendsms),
 #endif /* CONFIG_MODEM */
 		SHELL_CMD(sendto, NULL,  "<socket> <ip> <port> <payload>", sock_sendto),
-		SHELL_CMD(xfersz, NULL,  "<size>", sock_mxfragment),
+		SHELL_CMD(xfersz, NULL,  "[size|auto]", sock_mxfragment),
 		SHELL_SUBCMD_SET_END
 		);
 
@@ -1451,11 +2090,55 @@ void dump_addrinfo(const struct shell *shell, const struct addrinfo *ai)
 			ntohs(((struct sockaddr_in *)ai->ai_addr)->sin_port), (char*)mxfer);
 }
 
+static int cmd_dns_cache(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_dns_cache_stats st;
+	struct tmo_dns_cache_entry_info info;
+	char addrbuf[NET_IPV6_ADDR_LEN + 4];
+
+	if (argc > 2 && !strcmp(argv[2], "flush")) {
+		tmo_dns_cache_flush();
+		shell_print(shell, "DNS cache flushed");
+		return 0;
+	}
+	tmo_dns_cache_get_stats(&st);
+	shell_print(shell, "hits %u, negative hits %u, misses %u, evictions %u, lookup time %u ms",
+			st.hits, st.neg_hits, st.misses, st.evictions, st.lookup_ms);
+	for (int i = 0; ; i++) {
+		int ret = tmo_dns_cache_get_entry(i, &info);
+		if (ret == -EINVAL) {
+			break;
+		} else if (ret) {
+			continue;
+		}
+		if (info.negative) {
+			strcpy(addrbuf, "<unresolved>");
+		} else {
+			net_addr_ntop(info.addr.sa_family, info.addr.sa_family == AF_INET6 ?
+					(void *)&net_sin6(&info.addr)->sin6_addr :
+					(void *)&net_sin(&info.addr)->sin_addr,
+					addrbuf, sizeof(addrbuf));
+		}
+		if (info.naddr > 1) {
+			snprintf(addrbuf + strlen(addrbuf), sizeof(addrbuf) - strlen(addrbuf),
+					" +%d", info.naddr - 1);
+		}
+		shell_print(shell, "%-32s iface %d %s %-20s ttl %ds hits %u", info.name, info.iface,
+				info.family == AF_INET6 ? "v6" : (info.family == AF_INET ? "v4" : "  "),
+				addrbuf, MAX(info.ttl_left, 0), info.hits);
+	}
+	return 0;
+}
+
 int cmd_dnslookup(const struct shell *shell, size_t argc, char **argv)
 {
+	if (argc > 1 && !strcmp(argv[1], "cache")) {
+		return cmd_dns_cache(shell, argc, argv);
+	}
 	if (argc < 3){
 		shell_error(shell, "Missing required argument");
 		shell_print(shell, "Usage: tmo dns <devid> <hostname> [service]\n"
+				"       tmo dns cache [flush]\n"
 				"       devid: 1 for modem, 2 for wifi\n");
 		return -EINVAL;
 	}
@@ -1481,12 +2164,6 @@ int cmd_dnslookup(const struct shell *shell, size_t argc, char **argv)
 	ai = res;
 
 	while (ai) {
-		memset(mxfer_buf, 0, 128);
-		if (ai->ai_family == AF_INET6){
-			zsock_inet_ntop(ai->ai_family, &net_sin6(ai->ai_addr)->sin6_addr, mxfer_buf, 128);
-		} else {
-			zsock_inet_ntop(ai->ai_family, &net_sin(ai->ai_addr)->sin_addr, mxfer_buf, 128);
-		}
 		dump_addrinfo(shell, ai);
 		ai = ai->ai_next;
 	}
@@ -1494,14 +2171,72 @@ int cmd_dnslookup(const struct shell *shell, size_t argc, char **argv)
 	return 0;
 }
 
+static int http_list(const struct shell *shell)
+{
+	struct tmo_http_status st[4];
+	int n = tmo_http_get_active(st, ARRAY_SIZE(st));
+
+	if (n == 0) {
+		shell_print(shell, "No HTTP requests in flight");
+	}
+	for (int i = 0; i < n; i++) {
+		static const char *const kinds[] = {"post", "download", "upload"};
+
+		shell_print(shell, "%-8s iface %d  %s  %d/%d bytes, %d written",
+				kinds[st[i].kind], st[i].devid, st[i].host,
+				st[i].transferred, st[i].content_length, st[i].written);
+	}
+	return 0;
+}
+
+static int http_upload(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_http_upload_stats st;
+	bool chunked = false;
+	int ret;
+
+	if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+		chunked = true;
+		argc--;
+		argv++;
+	}
+	if (argc != 4) {
+		shell_error(shell, "Usage: tmo http upload [-c] <iface> <URL> <file>");
+		return -EINVAL;
+	}
+	ret = tmo_http_upload(strtol(argv[1], NULL, 10), argv[2], argv[3], chunked, &st);
+	if (ret < 0) {
+		shell_error(shell, "Upload failed: %d", ret);
+	}
+	shell_print(shell, "\nSent %u of %u bytes in %u ms (%u kbps), %d resumes", st.bytes,
+			st.size, st.elapsed_ms, stream_kbps(st.bytes, st.elapsed_ms), st.resumes);
+	return ret;
+}
+
 int cmd_http(const struct shell *shell, size_t argc, char **argv)
 {
 	int ret = -1;
+	bool background = false;
 
+	if (argc == 2 && strcmp(argv[1], "-l") == 0) {
+		return http_list(shell);
+	}
+	if (argc > 1 && strcmp(argv[1], "upload") == 0) {
+		return http_upload(shell, argc - 1, argv + 1);
+	}
+	if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+		background = true;
+		argc--;
+		argv++;
+	}
 	if ((argc < 3) || (argc > 4)) {
 		shell_error(shell, "Missing required argument");
-		shell_print(shell, "Usage: tmo http <devid> <URL> <file (optional)>\n"
-				"       devid: 1 for modem, 2 for wifi\n");
+		shell_print(shell, "Usage: tmo http [-b] <devid> <URL> <file (optional)>\n"
+				"       tmo http upload [-c] <devid> <URL> <file>\n"
+				"       tmo http -l\n"
+				"       devid: 1 for modem, 2 for wifi\n"
+				"       -b: download in the background, -l: list requests\n"
+				"       -c: upload with chunked encoding\n");
 		shell_help(shell);
 		return -EINVAL;
 	}
@@ -1526,7 +2261,22 @@ digicert_ca, sizeof(digicert_ca));
 #endif
 */
 	int devid = strtol(argv[1], NULL, 10);
-	ret = tmo_http_download(devid, argv[2], (argc == 4) ? argv[3] : NULL, NULL);
+	if (background) {
+#if IS_ENABLED(CONFIG_TMO_HTTP_WORKER)
+		ret = tmo_http_download_async(devid, argv[2], (argc == 4) ? argv[3] : NULL,
+				TMO_USAGE_HTTP);
+		if (ret < 0) {
+			shell_error(shell, "Could not queue download: %d", ret);
+			return ret;
+		}
+		shell_print(shell, "Queued as job %d", ret);
+		return 0;
+#else
+		shell_error(shell, "Background downloads need CONFIG_TMO_HTTP_WORKER");
+		return -ENOTSUP;
+#endif
+	}
+	ret = tmo_http_download(devid, argv[2], (argc == 4) ? argv[3] : NULL, NULL, TMO_USAGE_HTTP);
 	if (ret < 0) {
 		shell_error(shell, "tmo_http_download returned %d", ret);
 	}
@@ -1740,6 +2490,9 @@ int cmd_dfu_print_settings(const struct shell *shell, size_t argc, char **argv)
 	int iface = get_dfu_iface_type();
 
 	switch (iface) {
+		case TMO_LINK_AUTO:
+			strncpy(iface_name, "auto", sizeof(iface_name));
+			break;
 		case 1:
 			strncpy(iface_name, "modem", sizeof(iface_name));
 			break;
@@ -1752,9 +2505,20 @@ int cmd_dfu_print_settings(const struct shell *shell, size_t argc, char **argv)
 	}
 	printf("Interface: %d (%s)\n", get_dfu_iface_type(), iface_name);
 	printf("Base URL: %s\n", get_dfu_base_url());
+	printf("Compressed MCU images: %s\n", get_dfu_compressed() ? "yes" : "no");
 	return 0;
 }
 
+int cmd_dfu_compressed(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc != 2) {
+		shell_error(shell, "incorrect parameters");
+		shell_print(shell, "Usage: tmo dfu compressed <0|1>");
+		return -EINVAL;
+	}
+	return set_dfu_compressed(strtol(argv[1], NULL, 10) != 0);
+}
+
 int cmd_dfu_set_iface(const struct shell *shell, size_t argc, char **argv)
 {
 	if (argc < 2){
@@ -2049,12 +2813,6 @@ int cmd_dfu_update(const struct shell *shell, size_t argc, char **argv)
 				else {
 					shell_print(shell, "The FW update for SiLabs RS9116W is complete!");
 				}
-
-				shell_print(shell, "Sleeping 40 seconds before system reboot...");
-				k_sleep(K_SECONDS(40));
-
-				shell_print(shell, "Rebooting...");
-				sys_reboot(SYS_REBOOT_WARM);
 			}
 			break;
 
@@ -2065,6 +2823,125 @@ int cmd_dfu_update(const struct shell *shell, size_t argc, char **argv)
 	return 0;
 }
 
+/* Kept off the shell stack, the downloads need it */
+static struct tmo_dfu_plan dfu_plan;
+
+static void dfu_print_plan(const struct shell *shell, const struct tmo_dfu_plan *plan)
+{
+	shell_print(shell, "#  %-6s %-20s %-26s %s", "target", "version", "running", "state");
+	for (int i = 0; i < plan->count; i++) {
+		const struct tmo_dfu_step *step = &plan->step[i];
+
+		shell_print(shell, "%d  %-6s %-20s %-26s %s", i + 1, dfu_target_str(step->tgt),
+				step->version, step->running[0] ? step->running : "?",
+				tmo_dfu_state_str(step->state));
+		for (int n = 0; n < step->need_cnt; n++) {
+			shell_print(shell, "   needs %s %s", dfu_target_str(step->needs[n].tgt),
+					step->needs[n].version);
+		}
+	}
+}
+
+static int cmd_dfu_plan(const struct shell *shell, size_t argc, char **argv)
+{
+	const char *manifest = argc > 1 ? argv[1] : TMO_DFU_MANIFEST_FILE;
+	int ret = tmo_dfu_plan_load(manifest, &dfu_plan);
+
+	if (ret) {
+		shell_error(shell, "Could not plan from %s: %d", manifest, ret);
+		return ret;
+	}
+	dfu_print_plan(shell, &dfu_plan);
+	return 0;
+}
+
+static int cmd_dfu_run(const struct shell *shell, size_t argc, char **argv)
+{
+	const char *manifest = argc > 1 ? argv[1] : TMO_DFU_MANIFEST_FILE;
+	int ret = tmo_dfu_plan_load(manifest, &dfu_plan);
+
+	if (ret) {
+		shell_error(shell, "Could not plan from %s: %d", manifest, ret);
+		return ret;
+	}
+	dfu_print_plan(shell, &dfu_plan);
+
+	ret = tmo_dfu_plan_run(&dfu_plan);
+	if (ret == -EALREADY) {
+		shell_error(shell, "Updates were already applied, reboot first");
+	} else if (ret) {
+		dfu_print_plan(shell, &dfu_plan);
+		shell_error(shell, "DFU run failed: %d", ret);
+	} else {
+		shell_print(shell, "Nothing to update");
+	}
+	return ret;
+}
+
+static int cmd_dfu_result(const struct shell *shell, size_t argc, char **argv)
+{
+	struct fs_file_t file;
+	char buf[128];
+	int len;
+
+	fs_file_t_init(&file);
+	if (fs_open(&file, TMO_DFU_RESULT_FILE, FS_O_READ)) {
+		shell_print(shell, "No DFU run recorded");
+		return 0;
+	}
+	while ((len = fs_read(&file, buf, sizeof(buf) - 1)) > 0) {
+		buf[len] = '\0';
+		shell_fprintf(shell, SHELL_NORMAL, "%s", buf);
+	}
+	fs_close(&file);
+	return 0;
+}
+
+static int cmd_dfu_timing(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_dfu_stage_time stages[TMO_DFU_STAGE_COUNT];
+	bool json = argc > 1 && !strcmp(argv[1], "json");
+	bool first = true;
+
+	if (argc > 1 && !json) {
+		shell_print(shell, "Usage: tmo dfu timing [json]");
+		return -EINVAL;
+	}
+	if (json) {
+		shell_fprintf(shell, SHELL_NORMAL, "{\"dfu_timing\":[");
+	} else {
+		shell_print(shell, "%-6s %-14s %10s %10s %8s", "target", "stage", "ms", "bytes", "kbps");
+	}
+	for (int tgt = DFU_GECKO; tgt <= DFU_9116W; tgt++) {
+		tmo_dfu_timing_get(tgt, stages);
+		for (int st = 0; st < TMO_DFU_STAGE_COUNT; st++) {
+			uint32_t kbps;
+
+			if (!stages[st].ms && !stages[st].bytes) {
+				continue;
+			}
+			kbps = stages[st].bytes ? stream_kbps(stages[st].bytes, stages[st].ms) : 0;
+			if (json) {
+				shell_fprintf(shell, SHELL_NORMAL,
+						"%s{\"target\":\"%s\",\"stage\":\"%s\",\"ms\":%u,"
+						"\"bytes\":%u,\"kbps\":%u}", first ? "" : ",",
+						dfu_target_str(tgt), tmo_dfu_stage_str(st),
+						stages[st].ms, stages[st].bytes, kbps);
+			} else {
+				shell_print(shell, "%-6s %-14s %10u %10u %8u", dfu_target_str(tgt),
+						tmo_dfu_stage_str(st), stages[st].ms, stages[st].bytes, kbps);
+			}
+			first = false;
+		}
+	}
+	if (json) {
+		shell_print(shell, "]}");
+	} else if (first) {
+		shell_print(shell, "No DFU timing recorded");
+	}
+	return 0;
+}
+
 int cmd_charging_status(const struct shell *shell, size_t argc, char **argv)
 {
 	int status;
@@ -2419,6 +3296,115 @@ int cmd_json_print_settings (const struct shell *shell, size_t argc, char **argv
 			ws.transmit_interval);
 	printf("Base URL: '%s'\n", get_json_base_url());
 	printf("Path: '%s'\n", get_json_path());
+	printf("Sparse: %s\nHeartbeat: %u secs\n",
+			get_telemetry_sparse() ? "ENABLED":"DISABLED",
+			get_telemetry_heartbeat());
+	for (int i = 0; i < TELEM_FIELD_COUNT; i++) {
+		struct telemetry_policy pol;
+		get_telemetry_policy(i, &pol);
+		printf("  %-20s deadband %g min %u max %u%s\n", telemetry_field_name(i),
+				pol.deadband, pol.min_interval, pol.max_interval,
+				pol.on_change ? " on-change" : "");
+	}
+	struct telemetry_sched_status st;
+	tmo_telemetry_sched_get_status(&st);
+	printf("Adaptive interval: %s\n", st.enabled ? "ENABLED":"DISABLED");
+	if (st.enabled) {
+		printf("  current %u secs (min %u, max %u), stationary %u, battery %d%%\n",
+				st.interval, st.min_interval, st.max_interval,
+				st.stationary_ticks, st.battery_percent);
+	}
+	if (st.backoff_level) {
+		printf("Backoff: %u secs (attempt %u)\n", st.backoff_secs, st.backoff_level);
+	}
+	if (st.geofence_set) {
+		printf("  geofence %.6lf,%.6lf radius %u m (%s)\n", st.fence_lat, st.fence_lon,
+				st.fence_radius_m, st.inside_geofence ? "inside" : "outside");
+	}
+	return 0;
+}
+
+int cmd_json_adaptive(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc < 2 || (strcmp(argv[1], "on") && strcmp(argv[1], "off"))) {
+		shell_error(shell, "Usage: tmo json adaptive <on|off>");
+		return -EINVAL;
+	}
+	tmo_telemetry_sched_enable(!strcmp(argv[1], "on"));
+	return 0;
+}
+
+int cmd_json_geofence(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc == 2 && !strcmp(argv[1], "clear")) {
+		tmo_telemetry_sched_clear_geofence();
+		return 0;
+	}
+	if (argc != 4) {
+		shell_error(shell, "Usage: tmo json geofence <lat> <lon> <radius_m> | clear");
+		return -EINVAL;
+	}
+	int ret = tmo_telemetry_sched_set_geofence(strtod(argv[1], NULL), strtod(argv[2], NULL),
+			strtoul(argv[3], NULL, 10));
+	if (ret) {
+		shell_error(shell, "Invalid geofence");
+	}
+	return ret;
+}
+
+int cmd_json_policy(const struct shell *shell, size_t argc, char **argv)
+{
+	struct telemetry_policy pol;
+
+	if (argc < 3) {
+		shell_error(shell, "Missing required arguments");
+		shell_print(shell, "Usage: tmo json policy <field> <deadband|change> "
+				"[min_secs] [max_secs]");
+		return -EINVAL;
+	}
+	int field = telemetry_field_from_name(argv[1]);
+	if (field < 0) {
+		shell_error(shell, "Unknown field %s", argv[1]);
+		return -EINVAL;
+	}
+	get_telemetry_policy(field, &pol);
+	if (!strcmp(argv[2], "change")) {
+		pol.on_change = true;
+	} else {
+		pol.on_change = false;
+		pol.deadband = strtod(argv[2], NULL);
+	}
+	if (argc > 3) {
+		pol.min_interval = strtoul(argv[3], NULL, 10);
+	}
+	if (argc > 4) {
+		pol.max_interval = strtoul(argv[4], NULL, 10);
+	}
+	int ret = set_telemetry_policy(field, &pol);
+	if (ret) {
+		shell_error(shell, "Invalid policy");
+	}
+	return ret;
+}
+
+int cmd_json_heartbeat(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc < 2) {
+		shell_error(shell, "Missing required arguments");
+		shell_help(shell);
+		return -EINVAL;
+	}
+	set_telemetry_heartbeat(strtoul(argv[1], NULL, 10));
+	return 0;
+}
+
+int cmd_json_sparse(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc < 2 || (strcmp(argv[1], "on") && strcmp(argv[1], "off"))) {
+		shell_error(shell, "Usage: tmo json sparse <on|off>");
+		return -EINVAL;
+	}
+	set_telemetry_sparse(!strcmp(argv[1], "on"));
 	return 0;
 }
 
@@ -2440,6 +3426,91 @@ int cmd_json_path(const struct shell *shell, size_t argc, char **argv)
 	return set_json_path(argv[1]);
 }
 
+int cmd_link_show(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_link_stats st;
+	int64_t now = k_uptime_get();
+
+	shell_print(shell, "%-5s %-5s %-4s %8s %10s %6s %7s %8s", "iface", "type", "up",
+			"rtt(ms)", "tput(bps)", "fail%", "samples", "nJ/byte");
+	for (int i = 1; i <= TMO_LINK_MAX_IFACES; i++) {
+		if (tmo_link_get_stats(i, &st)) {
+			continue;
+		}
+		shell_print(shell, "%-5d %-5s %-4s %8u %10u %6u %7u %8u", i,
+				st.is_wifi ? "wifi" : "modem", st.up ? "yes" : "no",
+				st.rtt_ms, st.throughput_bps, st.fail_permille / 10,
+				st.samples, st.energy_nj_per_byte);
+		for (int c = 0; c < TMO_LINK_CLASS_COUNT; c++) {
+			shell_print(shell, "      cost %-10s %u", tmo_link_class_name(c),
+					tmo_link_cost(&st, c, now));
+		}
+	}
+	for (int c = 0; c < TMO_LINK_CLASS_COUNT; c++) {
+		shell_print(shell, "%-10s -> iface %d (now %d)", tmo_link_class_name(c),
+				tmo_link_peek(c), tmo_link_get_current(c));
+	}
+	return 0;
+}
+
+int cmd_link_set(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc != 3 || (strcmp(argv[2], "up") && strcmp(argv[2], "down"))) {
+		shell_error(shell, "Usage: tmo link set <iface> <up|down>");
+		return -EINVAL;
+	}
+	tmo_link_set_up(strtol(argv[1], NULL, 10), !strcmp(argv[2], "up"));
+	return 0;
+}
+
+int cmd_link_mtu(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_pmtu_info info;
+	struct zsock_addrinfo *res;
+
+	if (argc < 2) {
+		shell_error(shell, "Usage: tmo link mtu <iface> [host to probe]");
+		return -EINVAL;
+	}
+	int idx = strtol(argv[1], NULL, 10);
+	if (tmo_pmtu_get_info(idx, &info)) {
+		shell_error(shell, "Unknown iface %d", idx);
+		return -EINVAL;
+	}
+	if (argc > 2) {
+		if (tmo_dns_getaddrinfo(argv[2], "1", NULL, idx, &res)) {
+			shell_error(shell, "Could not resolve %s", argv[2]);
+			return -EINVAL;
+		}
+		shell_print(shell, "Probing path MTU to %s...", argv[2]);
+		int ret = tmo_pmtu_probe(idx, res->ai_addr);
+		tmo_dns_freeaddrinfo(res);
+		if (ret < 0) {
+			shell_error(shell, "Probe failed: %d", ret);
+			return ret;
+		}
+		tmo_pmtu_get_info(idx, &info);
+	}
+	shell_print(shell, "iface %d: path mtu=%u iface mtu=%u %s", idx, info.mtu, info.if_mtu,
+			info.probed ? "probed" : "(not probed)");
+	if (info.probed) {
+		shell_print(shell, "probed %us ago", info.probe_age);
+	}
+	shell_print(shell, "IPv4 fragment: tcp=%u tls=%u udp=%u dtls=%u",
+			tmo_pmtu_payload(idx, false, false, false),
+			tmo_pmtu_payload(idx, false, false, true),
+			tmo_pmtu_payload(idx, false, true, false),
+			tmo_pmtu_payload(idx, false, true, true));
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(tmo_link_sub,
+		SHELL_CMD(mtu, NULL, "Show or probe path MTU <iface> [host to probe]", cmd_link_mtu),
+		SHELL_CMD(set, NULL, "Mark a link up or down <iface> <up|down>", cmd_link_set),
+		SHELL_CMD(show, NULL, "Show link scores and selection", cmd_link_show),
+		SHELL_SUBCMD_SET_END
+		);
+
 /* LITTLEFS */
 #ifdef CONFIG_FILE_SYSTEM_LITTLEFS
 #include <zephyr/fs/littlefs.h>
@@ -2501,14 +3572,19 @@ int cmd_play_tone(const struct shell *shell, size_t argc, char **argv)
 }
 
 SHELL_STATIC_SUBCMD_SET_CREATE(tmo_json_sub,
+		SHELL_CMD(adaptive, NULL, "Adapt interval to motion/battery <on|off>", cmd_json_adaptive),
 		SHELL_CMD(base_url, NULL, "Set JSON base URL", cmd_json_base_url),
 		SHELL_CMD(disable, NULL, "Disable JSON transmission", cmd_json_transmit_disable),
 		SHELL_CMD(enable, NULL, "Enable JSON transmission", cmd_json_transmit_enable),
-		SHELL_CMD(iface, NULL, "Set JSON iface", cmd_json_set_iface),
+		SHELL_CMD(geofence, NULL, "Set geofence <lat> <lon> <radius_m> | clear", cmd_json_geofence),
+		SHELL_CMD(heartbeat, NULL, "Set full-state heartbeat interval (secs)", cmd_json_heartbeat),
+		SHELL_CMD(iface, NULL, "Set JSON iface (0 = auto)", cmd_json_set_iface),
 		SHELL_CMD(interval, NULL, "Set transmit interval (secs)", cmd_json_transmit_interval),
 		SHELL_CMD(path, NULL, "Set JSON path part of URL", cmd_json_path),
 		SHELL_CMD(payload, NULL, "Print JSON data", cmd_json_print_payload),
+		SHELL_CMD(policy, NULL, "Set field reporting policy", cmd_json_policy),
 		SHELL_CMD(settings, NULL, "Print JSON settings", cmd_json_print_settings),
+		SHELL_CMD(sparse, NULL, "Only transmit changed fields <on|off>", cmd_json_sparse),
 		SHELL_SUBCMD_SET_END
 		);
 
@@ -2520,8 +3596,65 @@ SHELL_STATIC_SUBCMD_SET_CREATE(tmo_mfg_sub,
 		SHELL_SUBCMD_SET_END
 		);
 
+#if CONFIG_TMO_HTTP_MOCK_SOCKET
+int cmd_netem_show(const struct shell *shell, size_t argc, char **argv)
+{
+	const struct tmo_mock_profile *cur = tmo_mock_get_profile();
+	const struct tmo_mock_profile *p;
+	struct tmo_mock_stats st;
+
+	shell_print(shell, "  %-10s %9s %5s %6s %5s %6s %6s %5s %8s", "profile", "bps", "rtt",
+			"jitter", "loss", "reset", "short", "mtu", "body");
+	for (int i = 0; (p = tmo_mock_get_profile_by_idx(i)) != NULL; i++) {
+		shell_print(shell, "%c %-10s %9u %5u %6u %5u %6u %6u %5u %8u", p == cur ? '*' : ' ',
+				p->name, p->bandwidth_bps, p->rtt_ms, p->jitter_ms, p->loss_permille,
+				p->reset_permille, p->short_read_permille, p->mtu, p->body_size);
+	}
+	tmo_mock_get_stats(&st);
+	shell_print(shell, "connects %u, requests %u, sent %u, received %u",
+			st.connects, st.requests, st.bytes_sent, st.bytes_received);
+	shell_print(shell, "losses %u, resets %u, short reads %u",
+			st.losses, st.resets, st.short_reads);
+	return 0;
+}
+
+int cmd_netem_profile(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc != 2) {
+		shell_error(shell, "Usage: tmo test netem profile <name>");
+		return -EINVAL;
+	}
+	if (tmo_mock_set_profile(argv[1])) {
+		shell_error(shell, "Unknown profile %s", argv[1]);
+		return -EINVAL;
+	}
+	tmo_mock_reset_stats();
+	return 0;
+}
+
+int cmd_netem_seed(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc != 2) {
+		shell_error(shell, "Usage: tmo test netem seed <n>");
+		return -EINVAL;
+	}
+	tmo_mock_set_seed(strtoul(argv[1], NULL, 0));
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(tmo_netem_sub,
+		SHELL_CMD(profile, NULL, "Select mock link profile", cmd_netem_profile),
+		SHELL_CMD(seed, NULL, "Seed the mock link's random events", cmd_netem_seed),
+		SHELL_CMD(show, NULL, "Show mock link profiles and counters", cmd_netem_show),
+		SHELL_SUBCMD_SET_END
+		);
+#endif
+
 SHELL_STATIC_SUBCMD_SET_CREATE(tmo_test_sub,
 		SHELL_CMD(mfg, &tmo_mfg_sub, "Manufacturing", NULL),
+#if CONFIG_TMO_HTTP_MOCK_SOCKET
+		SHELL_CMD(netem, &tmo_netem_sub, "HTTP mock link emulation", NULL),
+#endif
 		SHELL_CMD(qa, NULL, "Quality Assurance (TBD)", cmd_qa_test),
 		SHELL_SUBCMD_SET_END
 		);
@@ -2529,9 +3662,14 @@ SHELL_STATIC_SUBCMD_SET_CREATE(tmo_test_sub,
 SHELL_STATIC_SUBCMD_SET_CREATE(tmo_dfu_sub,
 		SHELL_CMD(auth_key, NULL, "Set FW download auth key", cmd_dfu_auth_key),
 		SHELL_CMD(base_url, NULL, "Set FW download base URL", cmd_dfu_base_url),
+		SHELL_CMD(compressed, NULL, "Download compressed MCU images (0/1)", cmd_dfu_compressed),
 		SHELL_CMD(download, NULL, "Download FW", cmd_dfu_download),
-		SHELL_CMD(iface, NULL, "Set FW download iface", cmd_dfu_set_iface),
+		SHELL_CMD(iface, NULL, "Set FW download iface (0 = auto)", cmd_dfu_set_iface),
+		SHELL_CMD(plan, NULL, "Show the update plan for a manifest", cmd_dfu_plan),
+		SHELL_CMD(result, NULL, "Print the results of the last DFU run", cmd_dfu_result),
+		SHELL_CMD(run, NULL, "Download and apply a manifest, then reboot once", cmd_dfu_run),
 		SHELL_CMD(settings, NULL, "Print DFU settings", cmd_dfu_print_settings),
+		SHELL_CMD(timing, NULL, "Print per-stage DFU timing [json]", cmd_dfu_timing),
 		SHELL_CMD(update, NULL, "Update FW", cmd_dfu_update),
 		SHELL_CMD(version, NULL, "Get current FW version", cmd_dfu_get_version),
 		SHELL_SUBCMD_SET_END
@@ -2689,12 +3827,231 @@ SHELL_STATIC_SUBCMD_SET_CREATE(tmo_file_sub,
 		SHELL_SUBCMD_SET_END
 		);
 
+int cmd_usage_show(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_usage_counter cnt;
+	struct tmo_usage_quota q;
+
+	for (int i = 1; i <= TMO_LINK_MAX_IFACES; i++) {
+		struct net_if *iface = net_if_get_by_index(i);
+		uint64_t total = 0;
+
+		if (iface == NULL) {
+			continue;
+		}
+		shell_print(shell, "iface %d (%s):", i, iface->if_dev->dev->name);
+		shell_print(shell, "  %-10s %12s %12s", "tag", "tx bytes", "rx bytes");
+		for (int t = 0; t < TMO_USAGE_TAG_COUNT; t++) {
+			tmo_usage_get(i, t, &cnt);
+			total += cnt.tx + cnt.rx;
+			if (cnt.tx || cnt.rx) {
+				shell_print(shell, "  %-10s %12llu %12llu", tmo_usage_tag_name(t),
+						cnt.tx, cnt.rx);
+			}
+		}
+		tmo_usage_get_quota(i, &q);
+		shell_print(shell, "  total %llu KB, soft quota %u KB, hard quota %u KB",
+				total / 1024, q.soft_kb, q.hard_kb);
+	}
+	return 0;
+}
+
+int cmd_usage_quota(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc != 4) {
+		shell_error(shell, "Usage: tmo usage quota <iface> <soft KB> <hard KB>, 0 = none");
+		return -EINVAL;
+	}
+	struct tmo_usage_quota q = {
+		.soft_kb = strtoul(argv[2], NULL, 10),
+		.hard_kb = strtoul(argv[3], NULL, 10),
+	};
+	int ret = tmo_usage_set_quota(strtol(argv[1], NULL, 10), &q);
+	if (ret) {
+		shell_error(shell, "Could not set quota: %d", ret);
+	}
+	return ret;
+}
+
+int cmd_usage_reset(const struct shell *shell, size_t argc, char **argv)
+{
+	int idx = (argc > 1) ? strtol(argv[1], NULL, 10) : TMO_LINK_AUTO;
+
+	tmo_usage_reset(idx);
+	shell_print(shell, "Usage counters cleared");
+	return 0;
+}
+
+int cmd_usage_save(const struct shell *shell, size_t argc, char **argv)
+{
+	int ret = tmo_usage_save();
+	if (ret) {
+		shell_error(shell, "Could not save %s: %d", TMO_USAGE_FILE, ret);
+	}
+	return ret;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(tmo_usage_sub,
+		SHELL_CMD(quota, NULL, "Set quotas <iface> <soft KB> <hard KB>", cmd_usage_quota),
+		SHELL_CMD(reset, NULL, "Clear counters [iface]", cmd_usage_reset),
+		SHELL_CMD(save, NULL, "Write counters to flash now", cmd_usage_save),
+		SHELL_CMD(show, NULL, "Show data usage per iface and subsystem", cmd_usage_show),
+		SHELL_SUBCMD_SET_END
+		);
+
+#if defined(CONFIG_NET_SOCKETS_SOCKOPT_TLS)
+#if CONFIG_MBEDTLS
+int cmd_tls_bench_crypto(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_crypto_bench_result res[TMO_CRYPTO_BENCH_MAX];
+	uint32_t ms = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+	int n;
+
+	shell_print(shell, "Running each cipher for %u ms per direction...", ms);
+	n = tmo_crypto_bench_run(ms, res, ARRAY_SIZE(res));
+	shell_print(shell, "%-18s %9s %9s %9s", "cipher", "enc KB/s", "dec KB/s", "ctx bytes");
+	for (int i = 0; i < n; i++) {
+		shell_print(shell, "%-18s %9u %9u %9u", res[i].name, res[i].enc_kbps,
+				res[i].dec_kbps, res[i].ctx_bytes);
+	}
+	return 0;
+}
+#endif
+
+static void tls_bench_print(const struct shell *shell, const char *path,
+		const struct tmo_tls_bench_req *req, const struct tmo_tls_bench_result *res)
+{
+	shell_print(shell, "%-8s %5d %3d/%-3d %6u %6u/%u/%u %#6x %8u", path, req->iface_idx,
+			res->ok, req->count, res->tcp_ms, res->tls_min_ms, res->tls_avg_ms,
+			res->tls_max_ms, res->suite, res->ram_peak);
+	if (res->failed) {
+		shell_warn(shell, "%d %s handshakes failed, last error %d", res->failed, path,
+				res->last_err);
+	}
+}
+
+int cmd_tls_bench_handshake(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_tls_bench_req req = {0};
+	struct tmo_tls_bench_result res;
+
+	if (argc < 3) {
+		shell_error(shell, "Usage: tmo tls bench handshake <iface> <host> [port] [count] "
+				"[suite,...]");
+		return -EINVAL;
+	}
+	req.iface_idx = strtol(argv[1], NULL, 10);
+	req.host = argv[2];
+	req.port = argc > 3 ? argv[3] : "443";
+	req.count = argc > 4 ? strtol(argv[4], NULL, 10) : 5;
+	if (argc > 5) {
+		char *p = argv[5];
+
+		for (int i = 0; i < TMO_TLS_BENCH_MAX_SUITES - 1 && *p; i++) {
+			req.suites[i] = strtol(p, &p, 16);
+			if (*p == ',') {
+				p++;
+			}
+		}
+	}
+
+	shell_print(shell, "%-8s %5s %7s %6s %14s %6s %8s", "path", "iface", "ok", "tcp ms",
+			"tls min/avg/max", "suite", "ram peak");
+	tmo_tls_bench_handshake(&req, &res);
+	tls_bench_print(shell, "offload", &req, &res);
+#if IS_ENABLED(CONFIG_TMO_SHELL_USE_MBED)
+	req.native = true;
+	tmo_tls_bench_handshake(&req, &res);
+	tls_bench_print(shell, "native", &req, &res);
+#endif
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(tmo_tls_bench_sub,
+#if CONFIG_MBEDTLS
+		SHELL_CMD(crypto, NULL, "Bulk cipher throughput on the MCU [ms]", cmd_tls_bench_crypto),
+#endif
+		SHELL_CMD(handshake, NULL, "Time handshakes per path "
+			"<iface> <host> [port] [count] [suite,...]", cmd_tls_bench_handshake),
+		SHELL_SUBCMD_SET_END
+		);
+
+#if CONFIG_TMO_TLS_MEM
+int cmd_tls_mem(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_tls_mem_stats st;
+	struct tmo_tls_mem_conn conns[CONFIG_TMO_TLS_MEM_CONNS];
+	uint32_t avail;
+	int n;
+
+	tmo_tls_mem_get_stats(&st);
+	shell_print(shell, "TLS arena: %u bytes, %u in use, peak %u", st.arena, st.used, st.peak);
+	shell_print(shell, "Allocations: %u, failed: %u (last %u bytes)", st.allocs, st.fails,
+			st.last_fail_size);
+	avail = st.arena - st.used;
+	avail = avail > st.reserved ? avail - st.reserved : 0;
+	shell_print(shell, "Handshake needs %u bytes, %u reserved, room for %u more now",
+			st.handshake_need, st.reserved,
+			st.handshake_need ? avail / st.handshake_need : 0);
+
+	n = tmo_tls_mem_get_conns(conns, ARRAY_SIZE(conns));
+	if (n == 0) {
+		return 0;
+	}
+	shell_print(shell, "\n  id  %-15s  sd  state      live   peak  hs peak  hs ms", "peer");
+	for (int i = 0; i < n; i++) {
+		struct tmo_tls_mem_conn *c = &conns[i];
+
+		shell_print(shell, "%4u  %-15s %3d  %-8s %6u %6u  %7u  %5u", c->id, c->label, c->sd,
+				c->handshaking ? "handshake" : !c->ok ? "failed" :
+				c->open ? "open" : "closed",
+				c->live, c->peak, c->handshake_peak, c->handshake_ms);
+	}
+	return 0;
+}
+
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(tmo_tls_sub,
+		SHELL_CMD(bench, &tmo_tls_bench_sub, "Offloaded vs native TLS benchmarks", NULL),
+#if CONFIG_TMO_TLS_MEM
+		SHELL_CMD(mem, NULL, "TLS arena usage per connection", cmd_tls_mem),
+#endif
+		SHELL_SUBCMD_SET_END
+		);
+#endif
+
+int cmd_xfer_bufs(const struct shell *shell, size_t argc, char **argv)
+{
+	struct tmo_xfer_buf_stats st;
+	struct tmo_xfer_buf_owner owners[CONFIG_TMO_XFER_BUF_COUNT];
+	int n;
+
+	tmo_xfer_buf_get_stats(&st);
+	shell_print(shell, "Transfer buffers: %u of %u bytes, %u in use, peak %u", st.count,
+			st.size, st.in_use, st.peak);
+	shell_print(shell, "Acquires: %u, waited: %u, failed: %u (last %s)", st.acquires, st.waits,
+			st.fails, st.fail_owner ? st.fail_owner : "-");
+
+	n = tmo_xfer_buf_get_owners(owners, ARRAY_SIZE(owners));
+	shell_print(shell, "\nbuf  %-12s %-12s  held ms  max ms   uses", "owner", "last owner");
+	for (int i = 0; i < n; i++) {
+		struct tmo_xfer_buf_owner *o = &owners[i];
+
+		shell_print(shell, "%3d  %-12s %-12s %8u %7u %6u", i, o->owner ? o->owner : "-",
+				o->last_owner ? o->last_owner : "-", o->held_ms, o->max_held_ms,
+				o->uses);
+	}
+	return 0;
+}
+
 SHELL_STATIC_SUBCMD_SET_CREATE(sub_tmo,
 		SHELL_CMD(battery, &tmo_battery_sub, "Battery and charger status", NULL),
 		SHELL_CMD(ble, &tmo_ble_sub, "BLE test commands", NULL),
 #ifdef BOOT_SLOT
 		SHELL_CMD(bootloader, &tmo_bootloader_sub, "Bootloader status", NULL),
 #endif
+		SHELL_CMD(bufs, NULL, "Shared transfer buffer owners and peak use", cmd_xfer_bufs),
 		SHELL_CMD(buzzer, &tmo_buzzer_sub, "Buzzer tests", NULL),
 #if defined(CONFIG_NET_SOCKETS_SOCKOPT_TLS)
 		SHELL_CMD(certs, &certs_sub, "CA cert commands", NULL),
@@ -2703,17 +4060,19 @@ SHELL_STATIC_SUBCMD_SET_CREATE(sub_tmo,
 		SHELL_CMD(dns, NULL, "Perform dns lookup", cmd_dnslookup),
 		SHELL_CMD(file, &tmo_file_sub, "File commands", NULL),
 		SHELL_CMD(gnssversion, NULL, "Get GNSS chip version", cmd_gnss_version),
-		SHELL_CMD(http, NULL, "Get http URL", cmd_http),
+		SHELL_CMD(http, NULL, "Get or upload http URL", cmd_http),
 		SHELL_CMD(hwid, NULL, "Read the HWID divider voltage", cmd_hwid),
 		SHELL_CMD(ifaces, NULL, "List network interfaces", cmd_list_ifaces),
 		SHELL_CMD(json, &tmo_json_sub, "JSON data options", NULL),
 #if CONFIG_TMO_SHELL_BUILD_EK
 		SHELL_CMD(kermit, NULL, "Embedded kermit", cmd_ekermit),
 #endif
+		SHELL_CMD(link, &tmo_link_sub, "Uplink selection status", NULL),
 		SHELL_CMD(location, NULL, "Get latitude and longitude", cmd_gnss),
 #if CONFIG_MODEM
 		SHELL_CMD(modem, NULL, "Modem status and control", &cmd_modem),
 #endif
+		SHELL_CMD(perf, NULL, "iperf2 compatible throughput test", cmd_perf),
 #if CONFIG_PING
 		SHELL_CMD(ping, NULL, "ICMP Ping", cmd_ping),
 #endif
@@ -2727,7 +4086,11 @@ SHELL_STATIC_SUBCMD_SET_CREATE(sub_tmo,
 #endif
 		SHELL_CMD(tcp, &tmo_tcp_sub, "Send/recv TCP packets", NULL),
 		SHELL_CMD(test, &tmo_test_sub, "Run automated tests", NULL),
+#if defined(CONFIG_NET_SOCKETS_SOCKOPT_TLS)
+		SHELL_CMD(tls, &tmo_tls_sub, "TLS diagnostics and benchmarks", NULL),
+#endif
 		SHELL_CMD(udp, &tmo_udp_sub, "Send/recv UDP packets", NULL),
+		SHELL_CMD(usage, &tmo_usage_sub, "Data usage and quotas", NULL),
 		SHELL_CMD(version, NULL, "Print version details", cmd_version),
 #ifdef CONFIG_WIFI
 		SHELL_CMD(wifi, &tmo_wifi_commands, "WiFi status and control", NULL),
@@ -37,10 +37,21 @@ typedef enum {
 	WIFI_ID,
 } devId_type;
 
+struct sock_stats_s {
+	uint64_t bytes_tx;
+	uint64_t bytes_rx;
+	uint32_t pkts_tx;
+	uint32_t pkts_rx;
+	uint32_t errors;
+	uint32_t rtt_ms;	/* last connect time */
+	int64_t created;	/* uptime in msecs */
+};
+
 struct sock_rec_s {
 	int sd;
 	uint8_t flags;
 	struct net_if *dev;
+	struct sock_stats_s stats;
 };
 
 static inline void gen_payload(uint8_t *buf, int len)
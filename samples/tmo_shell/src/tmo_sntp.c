@@ -4,6 +4,8 @@
 #include <zephyr/sys/timeutil.h>
 #include "tmo_shell.h"
 #include "tmo_sntp.h"
+#include "tmo_dns_cache.h"
+#include "tmo_usage.h"
 #include <stdio.h>
 
 #include <zephyr/logging/log.h>
@@ -18,7 +20,7 @@ LOG_MODULE_REGISTER(sntp_client, LOG_LEVEL_DBG);
 #include <string.h>
 
 
-static int resolve_dns(const char *host, char *ip_str, int *ipVer)
+static int resolve_dns(const char *host, int iface_idx, char *ip_str, int *ipVer)
 {
     struct addrinfo hints;
     struct addrinfo *res;
@@ -31,7 +33,7 @@ static int resolve_dns(const char *host, char *ip_str, int *ipVer)
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags |= AI_CANONNAME;
 
-    errcode = getaddrinfo (host, NULL, &hints, &res);
+    errcode = tmo_dns_getaddrinfo(host, NULL, &hints, iface_idx, &res);
     if (errcode != 0)
     {
         printf ("[sntp] getaddrinfo\n");
@@ -62,7 +64,7 @@ static int resolve_dns(const char *host, char *ip_str, int *ipVer)
 	memcpy(ip_str, addrstr, strlen(addrstr));
 	*ipVer = res->ai_family == PF_INET6 ? 6 : 4;
 	printf ("[sntp] IPv%d address: %s\n", *ipVer,ip_str);
-	freeaddrinfo(res);
+	tmo_dns_freeaddrinfo(res);
     return 0;
 }
 
@@ -154,7 +156,7 @@ int tmo_update_time(const struct shell *shell, char *host, int iface_idx)
 #ifdef DEBUG
         shell_print(shell, "dns");
 #endif
-		resolve_dns(host, ip_addr, &ipVer);
+		resolve_dns(host, iface_idx, ip_addr, &ipVer);
     }
 
 	struct sockaddr_in sin;
@@ -190,6 +192,7 @@ int tmo_update_time(const struct shell *shell, char *host, int iface_idx)
 		}
 		total += stat;
 	}
+	tmo_usage_add(iface_idx, TMO_USAGE_SNTP, sizeof(ntp_packet), total);
 	if (total == -1 && errno == EWOULDBLOCK) {
 		shell_print(shell, "No data available!");
 		zsock_close(sd);
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_sock_file, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/kernel.h>
+
+#include "tmo_sock_file.h"
+#include "tmo_xfer_buf.h"
+
+/*
+ * File <-> socket pipeline. The two halves of a pool buffer are used as a
+ * double buffer: a worker thread does the file system side while the
+ * calling shell thread does the network side, so a flash erase and a
+ * radio stall overlap instead of adding up. Time each side spends
+ * blocked on the other is reported as that side's stall.
+ */
+
+#define SOCK_FILE_CHUNK       CONFIG_TMO_SOCK_FILE_CHUNK
+#define SOCK_FILE_STACK_SIZE  2048
+#define SOCK_FILE_PRIORITY    CONFIG_MAIN_THREAD_PRIORITY
+
+BUILD_ASSERT(2 * SOCK_FILE_CHUNK <= TMO_XFER_BUF_SIZE);
+
+static struct {
+	struct fs_file_t file;
+	uint8_t *buf[2];
+	size_t len[2];          /* 0 marks the end of the transfer */
+	struct k_sem free;      /* buffers the producer may fill */
+	struct k_sem full;      /* buffers the consumer may drain */
+	bool to_net;
+	bool abort;
+	int fs_err;
+	uint32_t net_stall_ms;
+} pipe;
+
+static K_THREAD_STACK_DEFINE(fs_stack, SOCK_FILE_STACK_SIZE);
+static struct k_thread fs_thread;
+/* One transfer at a time, it owns the worker */
+static K_MUTEX_DEFINE(sock_file_mutex);
+
+static uint32_t sem_wait(struct k_sem *sem)
+{
+	int64_t start = k_uptime_get();
+
+	k_sem_take(sem, K_FOREVER);
+	return k_uptime_get() - start;
+}
+
+static void fs_side(void *p1, void *p2, void *p3)
+{
+	for (int i = 0;; i ^= 1) {
+		int ret;
+
+		if (pipe.to_net) {
+			pipe.net_stall_ms += sem_wait(&pipe.free);
+			if (pipe.abort) {
+				return;
+			}
+			ret = fs_read(&pipe.file, pipe.buf[i], SOCK_FILE_CHUNK);
+			if (ret < 0) {
+				pipe.fs_err = ret;
+			}
+			pipe.len[i] = MAX(ret, 0);
+			k_sem_give(&pipe.full);
+			if (ret <= 0) {
+				return;
+			}
+		} else {
+			pipe.net_stall_ms += sem_wait(&pipe.full);
+			if (pipe.len[i] == 0) {
+				return;
+			}
+			/* After an error keep draining so the network side never blocks */
+			if (pipe.fs_err == 0) {
+				ret = fs_write(&pipe.file, pipe.buf[i], pipe.len[i]);
+				if (ret != pipe.len[i]) {
+					pipe.fs_err = ret < 0 ? ret : -ENOSPC;
+				}
+			}
+			k_sem_give(&pipe.free);
+		}
+	}
+}
+
+static int pipe_start(const char *path, bool to_net)
+{
+	int ret;
+
+	k_mutex_lock(&sock_file_mutex, K_FOREVER);
+	memset(&pipe, 0, sizeof(pipe));
+	pipe.buf[0] = tmo_xfer_buf_acquire(to_net ? "sendfile" : "recvfile", K_NO_WAIT);
+	if (pipe.buf[0] == NULL) {
+		k_mutex_unlock(&sock_file_mutex);
+		return -EBUSY;
+	}
+	pipe.buf[1] = pipe.buf[0] + SOCK_FILE_CHUNK;
+	pipe.to_net = to_net;
+	k_sem_init(&pipe.free, 2, 2);
+	k_sem_init(&pipe.full, 0, 2);
+	fs_file_t_init(&pipe.file);
+	ret = fs_open(&pipe.file, path, to_net ? FS_O_READ : (FS_O_CREATE | FS_O_WRITE));
+	if (ret == 0 && !to_net) {
+		ret = fs_truncate(&pipe.file, 0);
+		if (ret) {
+			fs_close(&pipe.file);
+		}
+	}
+	if (ret) {
+		LOG_ERR("Could not open %s: %d", path, ret);
+		tmo_xfer_buf_release(pipe.buf[0]);
+		k_mutex_unlock(&sock_file_mutex);
+		return ret;
+	}
+	k_thread_create(&fs_thread, fs_stack, K_THREAD_STACK_SIZEOF(fs_stack),
+			fs_side, NULL, NULL, NULL, SOCK_FILE_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&fs_thread, "tmo_sock_file");
+	return 0;
+}
+
+static int pipe_finish(int ret, int64_t start, struct tmo_sock_file_stats *st)
+{
+	k_thread_join(&fs_thread, K_FOREVER);
+	fs_close(&pipe.file);
+	tmo_xfer_buf_release(pipe.buf[0]);
+	st->net_stall_ms = pipe.net_stall_ms;
+	st->elapsed_ms = k_uptime_get() - start;
+	if (ret == 0) {
+		ret = pipe.fs_err;
+	}
+	k_mutex_unlock(&sock_file_mutex);
+	return ret;
+}
+
+/**
+ * @brief Send a whole file over a socket
+ *
+ * @return 0 on success, else a negative errno from either side
+ */
+int tmo_sock_sendfile(int sd, const char *path, tmo_sock_xfer_fn send_fn, int timeout_ms,
+		struct tmo_sock_file_stats *st)
+{
+	int64_t start = k_uptime_get();
+	int ret;
+
+	memset(st, 0, sizeof(*st));
+	ret = pipe_start(path, true);
+	if (ret) {
+		return ret;
+	}
+	for (int i = 0;; i ^= 1) {
+		st->fs_stall_ms += sem_wait(&pipe.full);
+		if (pipe.len[i] == 0) {
+			break;
+		}
+		if (send_fn(sd, pipe.buf[i], pipe.len[i], timeout_ms) < 0) {
+			ret = -errno;
+			pipe.abort = true;
+			k_sem_give(&pipe.free);
+			break;
+		}
+		st->bytes += pipe.len[i];
+		k_sem_give(&pipe.free);
+	}
+	return pipe_finish(ret, start, st);
+}
+
+/**
+ * @brief Write data received on a socket to a file
+ *
+ * @param len bytes to receive, 0 to receive until the peer closes or
+ * nothing arrives for timeout_ms
+ * @return 0 on success, else a negative errno from either side
+ */
+int tmo_sock_recvfile(int sd, const char *path, uint64_t len, tmo_sock_xfer_fn recv_fn,
+		int timeout_ms, struct tmo_sock_file_stats *st)
+{
+	int64_t start = k_uptime_get();
+	bool done = false;
+	int ret;
+
+	memset(st, 0, sizeof(*st));
+	ret = pipe_start(path, false);
+	if (ret) {
+		return ret;
+	}
+	for (int i = 0;; i ^= 1) {
+		size_t got = 0;
+
+		st->fs_stall_ms += sem_wait(&pipe.free);
+		done |= ret || pipe.fs_err || (len && st->bytes >= len);
+		while (!done && got < SOCK_FILE_CHUNK) {
+			size_t want = len ? MIN(SOCK_FILE_CHUNK - got, len - st->bytes - got) :
+				SOCK_FILE_CHUNK - got;
+			ssize_t r = recv_fn(sd, pipe.buf[i] + got, want, timeout_ms);
+
+			if (r > 0) {
+				got += r;
+				done = len && st->bytes + got >= len;
+				continue;
+			}
+			/* Close or idle ends an open ended transfer */
+			if (len && r == 0) {
+				ret = -ECONNRESET;
+			} else if (len && r < 0) {
+				ret = -errno;
+			} else if (r < 0 && errno != EAGAIN) {
+				ret = -errno;
+			}
+			done = true;
+		}
+		pipe.len[i] = got;
+		st->bytes += got;
+		k_sem_give(&pipe.full);
+		if (got == 0) {
+			break;
+		}
+	}
+	return pipe_finish(ret, start, st);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_SOCK_FILE_H
+#define TMO_SOCK_FILE_H
+
+#include <stdint.h>
+#include <zephyr/net/socket.h>
+
+struct tmo_sock_file_stats {
+	uint64_t bytes;
+	uint32_t elapsed_ms;
+	uint32_t fs_stall_ms;   /* network side waiting on the file system */
+	uint32_t net_stall_ms;  /* file system side waiting on the network */
+};
+
+/*
+ * Moves len bytes, waiting at most timeout_ms. Like zsock_send/recv:
+ * returns the bytes moved, 0 on close (receive only), -1 with errno set.
+ * A send function must send the whole buffer.
+ */
+typedef ssize_t (*tmo_sock_xfer_fn)(int sd, void *buf, size_t len, int timeout_ms);
+
+int tmo_sock_sendfile(int sd, const char *path, tmo_sock_xfer_fn send_fn, int timeout_ms,
+		struct tmo_sock_file_stats *st);
+int tmo_sock_recvfile(int sd, const char *path, uint64_t len, tmo_sock_xfer_fn recv_fn,
+		int timeout_ms, struct tmo_sock_file_stats *st);
+
+#endif
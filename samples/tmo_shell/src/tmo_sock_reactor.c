@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_sock_reactor, LOG_LEVEL_INF);
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/sys/ring_buffer.h>
+
+#include "tmo_sock_reactor.h"
+
+#define REACTOR_CHUNK          1500
+/* Poll timeout when several interfaces have to be polled in turn */
+#define REACTOR_MULTI_POLL_MS  10
+#define REACTOR_MIN_STREAM_RX  64
+#define EWMA_SHIFT             3
+
+/* Every ring entry is a frame header followed by len payload bytes */
+struct frame_hdr {
+	uint16_t len;
+	uint16_t addrlen;
+	uint32_t rx_ms;
+	struct sockaddr from;
+};
+
+struct reactor_slot {
+	int sd;
+	bool in_use;
+	bool dgram;
+	bool closing;
+	bool pending;   /* not yet polled in the current cycle */
+	bool eof;
+	int err;
+	struct net_if *iface;
+	struct ring_buf ring;
+	uint8_t ring_data[CONFIG_TMO_SOCK_REACTOR_RING_SIZE];
+	struct k_sem data_sem;
+	struct frame_hdr cur;   /* frame being consumed */
+	uint16_t cur_left;
+	struct tmo_sock_reactor_stats stats;
+};
+
+static struct reactor_slot slots[CONFIG_TMO_SOCK_REACTOR_SOCKS];
+static uint8_t rx_chunk[REACTOR_CHUNK];
+static uint32_t reactor_cycle;
+static K_MUTEX_DEFINE(reactor_mutex);
+static K_CONDVAR_DEFINE(reactor_cycle_cv);
+static K_SEM_DEFINE(reactor_wake, 0, 1);
+
+static struct reactor_slot *find_slot(int sd)
+{
+	for (int i = 0; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].in_use && slots[i].sd == sd) {
+			return &slots[i];
+		}
+	}
+	return NULL;
+}
+
+/* Only poll for input that is guaranteed to fit, leave the rest in the driver */
+static size_t rx_room(struct reactor_slot *slot)
+{
+	uint32_t space = ring_buf_space_get(&slot->ring);
+
+	if (space <= sizeof(struct frame_hdr)) {
+		return 0;
+	}
+	space = MIN(space - sizeof(struct frame_hdr), REACTOR_CHUNK);
+	if (space < (slot->dgram ? REACTOR_CHUNK : REACTOR_MIN_STREAM_RX)) {
+		return 0;
+	}
+	return space;
+}
+
+static bool wants_poll(struct reactor_slot *slot)
+{
+	if (!slot->in_use || slot->closing || slot->eof || slot->err) {
+		return false;
+	}
+	if (rx_room(slot) == 0) {
+		slot->stats.ring_full++;
+		return false;
+	}
+	return true;
+}
+
+static void drain_slot(struct reactor_slot *slot, int revents)
+{
+	struct frame_hdr hdr = {0};
+	socklen_t addrlen = sizeof(hdr.from);
+	ssize_t ret;
+
+	if (!(revents & ZSOCK_POLLIN)) {
+		k_mutex_lock(&reactor_mutex, K_FOREVER);
+		if (revents & ZSOCK_POLLHUP) {
+			slot->eof = true;
+		} else {
+			slot->err = EIO;
+		}
+		k_mutex_unlock(&reactor_mutex);
+		k_sem_give(&slot->data_sem);
+		return;
+	}
+
+	k_mutex_lock(&reactor_mutex, K_FOREVER);
+	size_t room = rx_room(slot);
+	k_mutex_unlock(&reactor_mutex);
+	if (room == 0) {
+		return;
+	}
+
+	ret = zsock_recvfrom(slot->sd, rx_chunk, room, ZSOCK_MSG_DONTWAIT,
+			slot->dgram ? &hdr.from : NULL, slot->dgram ? &addrlen : NULL);
+	if (ret < 0 && errno == EAGAIN) {
+		return;
+	}
+
+	k_mutex_lock(&reactor_mutex, K_FOREVER);
+	if (ret > 0) {
+		hdr.len = ret;
+		hdr.addrlen = slot->dgram ? addrlen : 0;
+		hdr.rx_ms = k_uptime_get_32();
+		ring_buf_put(&slot->ring, (uint8_t *)&hdr, sizeof(hdr));
+		ring_buf_put(&slot->ring, rx_chunk, ret);
+		slot->stats.frames++;
+		slot->stats.bytes += ret;
+	} else if (ret == 0) {
+		slot->eof = true;
+	} else {
+		slot->err = errno;
+		LOG_WRN("socket %d recv failed, errno = %d", slot->sd, errno);
+	}
+	k_mutex_unlock(&reactor_mutex);
+	k_sem_give(&slot->data_sem);
+}
+
+/* Collect up to POLL_MAX pending sockets on the same interface, offloaded
+ * sockets of different drivers cannot share a poll call.
+ */
+static int build_batch(struct zsock_pollfd *fds, struct reactor_slot **batch, bool *more)
+{
+	struct net_if *iface = NULL;
+	int n = 0;
+
+	*more = false;
+	k_mutex_lock(&reactor_mutex, K_FOREVER);
+	for (int i = 0; i < ARRAY_SIZE(slots); i++) {
+		struct reactor_slot *slot = &slots[i];
+
+		if (!slot->pending || slot->closing) {
+			continue;
+		}
+		if (n == CONFIG_NET_SOCKETS_POLL_MAX || (iface && slot->iface != iface)) {
+			*more = true;
+			continue;
+		}
+		iface = slot->iface;
+		slot->pending = false;
+		fds[n].fd = slot->sd;
+		fds[n].events = ZSOCK_POLLIN;
+		fds[n].revents = 0;
+		batch[n++] = slot;
+	}
+	k_mutex_unlock(&reactor_mutex);
+	return n;
+}
+
+static void reactor_thread(void *a, void *b, void *c)
+{
+	struct zsock_pollfd fds[CONFIG_NET_SOCKETS_POLL_MAX];
+	struct reactor_slot *batch[CONFIG_NET_SOCKETS_POLL_MAX];
+
+	while (true) {
+		bool any_open = false;
+		bool polled = false;
+		bool more;
+		int n;
+
+		k_mutex_lock(&reactor_mutex, K_FOREVER);
+		for (int i = 0; i < ARRAY_SIZE(slots); i++) {
+			slots[i].pending = wants_poll(&slots[i]);
+			any_open |= slots[i].in_use;
+		}
+		k_mutex_unlock(&reactor_mutex);
+
+		bool first = true;
+		while ((n = build_batch(fds, batch, &more)) > 0) {
+			int timeout = (more || !first) ? REACTOR_MULTI_POLL_MS
+				: CONFIG_TMO_SOCK_REACTOR_POLL_MS;
+			int ret = zsock_poll(fds, n, timeout);
+
+			first = false;
+			polled = true;
+			if (ret < 0) {
+				LOG_WRN("poll failed, errno = %d", errno);
+				k_msleep(REACTOR_MULTI_POLL_MS);
+				continue;
+			}
+			for (int i = 0; ret > 0 && i < n; i++) {
+				if (fds[i].revents) {
+					drain_slot(batch[i], fds[i].revents);
+				}
+			}
+		}
+
+		k_mutex_lock(&reactor_mutex, K_FOREVER);
+		reactor_cycle++;
+		k_condvar_broadcast(&reactor_cycle_cv);
+		k_mutex_unlock(&reactor_mutex);
+
+		if (!polled) {
+			/* Nothing to poll: wait for an attach or for ring space */
+			k_sem_take(&reactor_wake, any_open ?
+					K_MSEC(CONFIG_TMO_SOCK_REACTOR_POLL_MS) : K_FOREVER);
+		}
+	}
+}
+
+#define TMO_SOCK_REACTOR_STACK_SIZE 1536
+#define TMO_SOCK_REACTOR_PRIORITY   CONFIG_MAIN_THREAD_PRIORITY
+
+K_THREAD_DEFINE(tmo_sock_reactor_tid, TMO_SOCK_REACTOR_STACK_SIZE,
+		reactor_thread, NULL, NULL, NULL,
+		TMO_SOCK_REACTOR_PRIORITY, 0, 0);
+
+/**
+ * @brief Start draining a socket into a receive ring
+ *
+ * @param sd connected or bound socket
+ * @param iface interface the socket was created on
+ * @param dgram true to keep datagram boundaries and source addresses
+ * @return 0 on success, -ENOMEM if all rings are in use
+ */
+int tmo_sock_reactor_attach(int sd, struct net_if *iface, bool dgram)
+{
+	struct reactor_slot *slot = NULL;
+
+	k_mutex_lock(&reactor_mutex, K_FOREVER);
+	if (find_slot(sd)) {
+		k_mutex_unlock(&reactor_mutex);
+		return 0;
+	}
+	for (int i = 0; i < ARRAY_SIZE(slots); i++) {
+		if (!slots[i].in_use) {
+			slot = &slots[i];
+			break;
+		}
+	}
+	if (slot == NULL) {
+		k_mutex_unlock(&reactor_mutex);
+		return -ENOMEM;
+	}
+	memset(slot, 0, offsetof(struct reactor_slot, ring));
+	ring_buf_init(&slot->ring, sizeof(slot->ring_data), slot->ring_data);
+	k_sem_init(&slot->data_sem, 0, 1);
+	slot->cur_left = 0;
+	memset(&slot->stats, 0, sizeof(slot->stats));
+	slot->stats.sd = sd;
+	slot->sd = sd;
+	slot->iface = iface;
+	slot->dgram = dgram;
+	slot->in_use = true;
+	k_mutex_unlock(&reactor_mutex);
+	k_sem_give(&reactor_wake);
+	LOG_DBG("socket %d attached", sd);
+	return 0;
+}
+
+/**
+ * @brief Stop draining a socket, must be called before it is closed
+ *
+ * Waits for the reactor to finish any poll that may still reference it.
+ */
+void tmo_sock_reactor_detach(int sd)
+{
+	k_mutex_lock(&reactor_mutex, K_FOREVER);
+	struct reactor_slot *slot = find_slot(sd);
+	if (slot == NULL) {
+		k_mutex_unlock(&reactor_mutex);
+		return;
+	}
+	slot->closing = true;
+	uint32_t cycle = reactor_cycle;
+	k_sem_give(&reactor_wake);
+	while (reactor_cycle == cycle) {
+		k_condvar_wait(&reactor_cycle_cv, &reactor_mutex, K_FOREVER);
+	}
+	slot->in_use = false;
+	k_mutex_unlock(&reactor_mutex);
+	/* Wake a consumer still blocked on the ring */
+	k_sem_give(&slot->data_sem);
+}
+
+bool tmo_sock_reactor_attached(int sd)
+{
+	k_mutex_lock(&reactor_mutex, K_FOREVER);
+	bool ret = find_slot(sd) != NULL;
+	k_mutex_unlock(&reactor_mutex);
+	return ret;
+}
+
+static void update_latency(struct reactor_slot *slot, uint32_t rx_ms)
+{
+	uint32_t lat = k_uptime_get_32() - rx_ms;
+	struct tmo_sock_reactor_stats *st = &slot->stats;
+
+	st->max_latency_ms = MAX(st->max_latency_ms, lat);
+	st->avg_latency_ms += ((int32_t)lat - (int32_t)st->avg_latency_ms) >> EWMA_SHIFT;
+}
+
+/**
+ * @brief Consume data the reactor received on a socket
+ *
+ * Stream sockets may consume a frame in several calls; datagrams are
+ * truncated to len like recvfrom().
+ *
+ * @param rx_ms if not NULL, set to the uptime at which the data arrived
+ * @return bytes copied, 0 once the peer closed and the ring is empty,
+ * -1 with errno set on error or timeout (EAGAIN)
+ */
+ssize_t tmo_sock_reactor_recv(int sd, void *buf, size_t len, struct sockaddr *from,
+		socklen_t *fromlen, uint32_t *rx_ms, k_timeout_t timeout)
+{
+	struct reactor_slot *slot;
+
+	while (true) {
+		k_mutex_lock(&reactor_mutex, K_FOREVER);
+		slot = find_slot(sd);
+		if (slot == NULL) {
+			k_mutex_unlock(&reactor_mutex);
+			errno = EBADF;
+			return -1;
+		}
+		if (slot->cur_left == 0 && !ring_buf_is_empty(&slot->ring)) {
+			ring_buf_get(&slot->ring, (uint8_t *)&slot->cur, sizeof(slot->cur));
+			slot->cur_left = slot->cur.len;
+			update_latency(slot, slot->cur.rx_ms);
+		}
+		if (slot->cur_left) {
+			size_t n = MIN(len, slot->cur_left);
+
+			ring_buf_get(&slot->ring, buf, n);
+			slot->cur_left -= n;
+			if (slot->dgram && slot->cur_left) {
+				ring_buf_get(&slot->ring, NULL, slot->cur_left);
+				slot->cur_left = 0;
+			}
+			if (from && fromlen) {
+				memcpy(from, &slot->cur.from, MIN(*fromlen, slot->cur.addrlen));
+				*fromlen = slot->cur.addrlen;
+			}
+			if (rx_ms) {
+				*rx_ms = slot->cur.rx_ms;
+			}
+			k_mutex_unlock(&reactor_mutex);
+			k_sem_give(&reactor_wake);
+			return n;
+		}
+		if (slot->eof) {
+			k_mutex_unlock(&reactor_mutex);
+			return 0;
+		}
+		if (slot->err) {
+			errno = slot->err;
+			k_mutex_unlock(&reactor_mutex);
+			return -1;
+		}
+		k_mutex_unlock(&reactor_mutex);
+		if (k_sem_take(&slot->data_sem, timeout) != 0) {
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+}
+
+int tmo_sock_reactor_get_stats(int sd, struct tmo_sock_reactor_stats *st)
+{
+	k_mutex_lock(&reactor_mutex, K_FOREVER);
+	struct reactor_slot *slot = find_slot(sd);
+	if (slot) {
+		*st = slot->stats;
+		st->queued = ring_buf_size_get(&slot->ring);
+		st->eof = slot->eof;
+		st->err = slot->err;
+	}
+	k_mutex_unlock(&reactor_mutex);
+	return slot ? 0 : -ENOENT;
+}
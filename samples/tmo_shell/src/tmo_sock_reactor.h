@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_SOCK_REACTOR_H
+#define TMO_SOCK_REACTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+
+struct tmo_sock_reactor_stats {
+	int sd;
+	uint32_t frames;
+	uint32_t bytes;
+	uint32_t queued;          /* bytes waiting in the ring */
+	uint32_t ring_full;       /* poll cycles skipped because the ring was full */
+	uint32_t avg_latency_ms;  /* EWMA of arrival to consumption */
+	uint32_t max_latency_ms;
+	int err;
+	bool eof;
+};
+
+int tmo_sock_reactor_attach(int sd, struct net_if *iface, bool dgram);
+void tmo_sock_reactor_detach(int sd);
+bool tmo_sock_reactor_attached(int sd);
+ssize_t tmo_sock_reactor_recv(int sd, void *buf, size_t len, struct sockaddr *from,
+		socklen_t *fromlen, uint32_t *rx_ms, k_timeout_t timeout);
+int tmo_sock_reactor_get_stats(int sd, struct tmo_sock_reactor_stats *st);
+
+#endif
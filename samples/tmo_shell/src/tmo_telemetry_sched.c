@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_telemetry_sched, LOG_LEVEL_INF);
+
+#include <stdio.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/random/rand32.h>
+
+#include "tmo_adc.h"
+#include "tmo_gnss.h"
+#include "tmo_battery_ctrl.h"
+#include "tmo_web_demo.h"
+#include "tmo_telemetry_sched.h"
+
+#define PI_F                 3.14159265358979
+#define METERS_PER_DEG_LAT   111320.0
+#define MOTION_THRESHOLD     (CONFIG_TMO_TELEMETRY_MOTION_THRESHOLD_MG * SENSOR_G / 1000000000.0)
+
+static struct telemetry_sched_status sched = {
+	.enabled = IS_ENABLED(CONFIG_TMO_TELEMETRY_ADAPTIVE),
+	.min_interval = TRANSMIT_INTERVAL_SECS_WEB,
+	.max_interval = CONFIG_TMO_TELEMETRY_MAX_INTERVAL_SECS,
+	.battery_percent = -1,
+};
+
+static K_SEM_DEFINE(sched_wake_sem, 0, 1);
+static atomic_t motion_pending;
+/* Uptime before which no retry may go out, 0 without a backoff */
+static int64_t backoff_until;
+static double last_acc[3];
+static bool last_acc_valid;
+
+#if DT_NODE_EXISTS(DT_NODELABEL(lis2dw12)) && defined(CONFIG_LIS2DW12_TRIGGER)
+static struct sensor_trigger motion_trig;
+
+static void motion_trigger_handler(const struct device *dev, const struct sensor_trigger *trig)
+{
+	ARG_UNUSED(dev);
+	ARG_UNUSED(trig);
+	tmo_telemetry_sched_motion();
+}
+#endif
+
+/**
+ * @brief Arm the LIS2DW12 tap/threshold interrupts, if the driver supports them
+ *
+ * Without triggers, motion is detected by comparing accelerometer samples
+ * taken at each transmit interval.
+ */
+void tmo_telemetry_sched_init(void)
+{
+	sched.interval = sched.min_interval;
+#if DT_NODE_EXISTS(DT_NODELABEL(lis2dw12)) && defined(CONFIG_LIS2DW12_TRIGGER)
+	const struct device *acc = DEVICE_DT_GET(DT_NODELABEL(lis2dw12));
+	int rc;
+
+	if (!device_is_ready(acc)) {
+		LOG_WRN("Accelerometer not ready, using sampled motion detection");
+		return;
+	}
+	motion_trig.chan = SENSOR_CHAN_ACCEL_XYZ;
+#if defined(CONFIG_LIS2DW12_TAP)
+	motion_trig.type = SENSOR_TRIG_TAP;
+	rc = sensor_trigger_set(acc, &motion_trig, motion_trigger_handler);
+	if (rc != 0) {
+		LOG_WRN("Failed to set tap trigger: %d", rc);
+	}
+#endif
+#if defined(CONFIG_LIS2DW12_THRESHOLD)
+	motion_trig.type = SENSOR_TRIG_THRESHOLD;
+	rc = sensor_trigger_set(acc, &motion_trig, motion_trigger_handler);
+	if (rc != 0) {
+		LOG_WRN("Failed to set threshold trigger: %d", rc);
+	}
+#endif
+#endif
+}
+
+/**
+ * @brief Signal motion; shortens the current interval and wakes the notifier
+ */
+void tmo_telemetry_sched_motion(void)
+{
+	atomic_set(&motion_pending, 1);
+	if (sched.enabled) {
+		k_sem_give(&sched_wake_sem);
+	}
+}
+
+/**
+ * @brief Sleep until the next transmission is due or motion is signalled
+ *
+ * Motion only cuts the adaptive interval short. The wait never ends
+ * before the minimum interval, nor before a backoff or a server
+ * Retry-After has run out.
+ *
+ * @return 0 on timeout, 1 if woken early
+ */
+int tmo_telemetry_sched_wait(unsigned int secs)
+{
+	int64_t start = k_uptime_get();
+	int woken = k_sem_take(&sched_wake_sem, K_SECONDS(secs)) == 0;
+	int64_t earliest = backoff_until;
+
+	if (woken) {
+		/* Never transmit faster than the minimum interval, however busy the sensor is */
+		earliest = MAX(earliest, start + (int64_t)sched.min_interval * MSEC_PER_SEC);
+	}
+	int64_t now = k_uptime_get();
+	if (now < earliest) {
+		k_sleep(K_MSEC(earliest - now));
+	}
+	return woken;
+}
+
+void tmo_telemetry_sched_enable(bool enable)
+{
+	sched.enabled = enable;
+	sched.interval = sched.min_interval;
+	sched.stationary_ticks = 0;
+	LOG_INF("Adaptive interval %s", enable ? "enabled" : "disabled");
+}
+
+int tmo_telemetry_sched_set_geofence(double lat, double lon, unsigned int radius_m)
+{
+	if (lat < -90 || lat > 90 || lon < -180 || lon > 180 || radius_m == 0) {
+		return -EINVAL;
+	}
+	sched.fence_lat = lat;
+	sched.fence_lon = lon;
+	sched.fence_radius_m = radius_m;
+	sched.inside_geofence = true;
+	sched.geofence_set = true;
+	return 0;
+}
+
+void tmo_telemetry_sched_clear_geofence(void)
+{
+	sched.geofence_set = false;
+}
+
+void tmo_telemetry_sched_get_status(struct telemetry_sched_status *status)
+{
+	*status = sched;
+}
+
+/* Short series is accurate to well under 1% up to +-75 degrees latitude,
+ * which is plenty for a geofence radius check.
+ */
+static double cos_approx(double deg)
+{
+	double x = deg * PI_F / 180.0;
+	double x2 = x * x;
+
+	return 1.0 - x2 / 2 + x2 * x2 / 24 - x2 * x2 * x2 / 720;
+}
+
+static bool sampled_motion(void)
+{
+	struct sensor_value acc[3];
+	double cur[3];
+	bool moved = false;
+
+	if (read_accelerometer(acc) != 0) {
+		return false;
+	}
+	for (int i = 0; i < 3; i++) {
+		cur[i] = sensor_value_to_double(&acc[i]);
+		if (last_acc_valid) {
+			double delta = cur[i] - last_acc[i];
+			if (delta > MOTION_THRESHOLD || delta < -MOTION_THRESHOLD) {
+				moved = true;
+			}
+		}
+		last_acc[i] = cur[i];
+	}
+	last_acc_valid = true;
+	return moved;
+}
+
+static bool geofence_exited(void)
+{
+	if (!sched.geofence_set || !gnss_values.fix_valid) {
+		return false;
+	}
+	double dy = (gnss_values.lat - sched.fence_lat) * METERS_PER_DEG_LAT;
+	double dx = (gnss_values.lon - sched.fence_lon) * METERS_PER_DEG_LAT *
+		cos_approx(sched.fence_lat);
+	double r = sched.fence_radius_m;
+	bool inside = (dx * dx + dy * dy) <= r * r;
+	bool exited = sched.inside_geofence && !inside;
+
+	sched.inside_geofence = inside;
+	return exited;
+}
+
+static int battery_percent(void)
+{
+	uint8_t charging = 0, vbus = 0, attached = 0, fault = 0;
+
+	get_battery_charging_status(&charging, &vbus, &attached, &fault);
+	if (!attached || (vbus && charging)) {
+		return -1;
+	}
+	return (int)get_remaining_capacity((float)read_battery_voltage() / 1000);
+}
+
+/* Motion or a geofence exit drops the interval to the minimum; every quiet
+ * interval doubles it up to the maximum. Low battery raises the floor.
+ */
+static unsigned int adaptive_interval(unsigned int base_interval)
+{
+	const char *reason;
+
+	sched.max_interval = MAX(CONFIG_TMO_TELEMETRY_MAX_INTERVAL_SECS, base_interval);
+
+	bool trig_motion = atomic_set(&motion_pending, 0);
+	bool sw_motion = sampled_motion();
+	bool fence_exit = geofence_exited();
+	unsigned int prev = sched.interval;
+
+	if (trig_motion || sw_motion || fence_exit) {
+		sched.interval = sched.min_interval;
+		sched.stationary_ticks = 0;
+		reason = fence_exit ? "geofence exit" : trig_motion ? "motion trigger" : "motion sampled";
+	} else {
+		sched.stationary_ticks++;
+		sched.interval = MIN(MAX(prev, 1) * 2, sched.max_interval);
+		reason = "stationary";
+	}
+
+	sched.battery_percent = battery_percent();
+	if (sched.battery_percent >= 0 &&
+			sched.battery_percent < CONFIG_TMO_TELEMETRY_BATT_CRITICAL_PERCENT) {
+		sched.interval = MAX(sched.interval, CONFIG_TMO_TELEMETRY_BATT_CRITICAL_INTERVAL_SECS);
+		reason = "battery critical";
+	} else if (sched.battery_percent >= 0 &&
+			sched.battery_percent < CONFIG_TMO_TELEMETRY_BATT_LOW_PERCENT) {
+		sched.interval = MAX(sched.interval, CONFIG_TMO_TELEMETRY_BATT_LOW_INTERVAL_SECS);
+		reason = "battery low";
+	}
+
+	LOG_INF("interval %u -> %u secs (%s, stationary %u, battery %d%%, fence %s)",
+			prev, sched.interval, reason, sched.stationary_ticks,
+			sched.battery_percent,
+			!sched.geofence_set ? "none" : sched.inside_geofence ? "inside" : "outside");
+	return sched.interval;
+}
+
+/*
+ * The start delay is drawn at boot, before the PRNG may have been seeded,
+ * and devices that boot together must still pick different delays.
+ */
+static uint32_t sched_rand32(void)
+{
+#if defined(CONFIG_CSPRNG_ENABLED)
+	uint32_t r;
+
+	if (sys_csrand_get(&r, sizeof(r)) == 0) {
+		return r;
+	}
+#endif
+	return sys_rand32_get();
+}
+
+/* Spread the fleet: +-CONFIG_TMO_TELEMETRY_JITTER_PERCENT around the interval */
+static unsigned int apply_jitter(unsigned int secs)
+{
+	uint32_t span = secs * CONFIG_TMO_TELEMETRY_JITTER_PERCENT / 100;
+
+	if (span == 0) {
+		return secs;
+	}
+	return secs - span + sched_rand32() % (2 * span + 1);
+}
+
+/**
+ * @brief Random delay before the first transmission after boot
+ *
+ * Devices that power up together (outage, cell-site restart) would
+ * otherwise report in lockstep forever.
+ */
+unsigned int tmo_telemetry_sched_start_delay(void)
+{
+	unsigned int delay = sched_rand32() % (CONFIG_TMO_TELEMETRY_START_SPREAD_SECS + 1);
+
+	LOG_INF("start delay %u secs", delay);
+	return delay;
+}
+
+/**
+ * @brief Feed back the outcome of a transmission
+ *
+ * @param ret result of tmo_http_json()
+ * @param retry_after server supplied Retry-After in secs, <0 if none
+ */
+void tmo_telemetry_sched_result(int ret, int retry_after)
+{
+	if (ret == 0) {
+		if (sched.backoff_level) {
+			LOG_INF("backoff cleared after %u attempts", sched.backoff_level);
+		}
+		sched.backoff_level = 0;
+		sched.backoff_secs = 0;
+		backoff_until = 0;
+		return;
+	}
+
+	unsigned int backoff = MAX(sched.min_interval, 1);
+	for (unsigned int i = 0; i < sched.backoff_level &&
+			backoff < CONFIG_TMO_TELEMETRY_BACKOFF_MAX_SECS; i++) {
+		backoff *= 2;
+	}
+	backoff = MIN(backoff, CONFIG_TMO_TELEMETRY_BACKOFF_MAX_SECS);
+	if (retry_after >= 0) {
+		backoff = MAX(backoff, (unsigned int)retry_after);
+	}
+	sched.backoff_level++;
+	sched.backoff_secs = backoff;
+	backoff_until = k_uptime_get() + (int64_t)backoff * MSEC_PER_SEC;
+	LOG_INF("backoff %u secs (attempt %u, ret %d, retry-after %d)",
+			backoff, sched.backoff_level, ret, retry_after);
+}
+
+/**
+ * @brief Whether the next transmission is a retry of a failed one
+ */
+bool tmo_telemetry_sched_retrying(void)
+{
+	return sched.backoff_level != 0;
+}
+
+/**
+ * @brief Compute the interval until the next telemetry transmission
+ *
+ * @param base_interval configured transmit interval
+ * @return seconds to wait
+ */
+unsigned int tmo_telemetry_sched_next(unsigned int base_interval)
+{
+	unsigned int interval = base_interval;
+
+	sched.min_interval = base_interval;
+	if (sched.enabled) {
+		interval = adaptive_interval(base_interval);
+	}
+	if (sched.backoff_secs > interval) {
+		interval = sched.backoff_secs;
+	}
+	return apply_jitter(interval);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_TELEMETRY_SCHED_H
+#define TMO_TELEMETRY_SCHED_H
+
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+
+struct telemetry_sched_status {
+	bool enabled;
+	unsigned int interval;
+	unsigned int min_interval;
+	unsigned int max_interval;
+	unsigned int stationary_ticks;
+	int battery_percent;
+	bool geofence_set;
+	bool inside_geofence;
+	double fence_lat;
+	double fence_lon;
+	unsigned int fence_radius_m;
+	unsigned int backoff_level;
+	unsigned int backoff_secs;
+};
+
+void tmo_telemetry_sched_init(void);
+unsigned int tmo_telemetry_sched_next(unsigned int base_interval);
+int tmo_telemetry_sched_wait(unsigned int secs);
+void tmo_telemetry_sched_motion(void);
+unsigned int tmo_telemetry_sched_start_delay(void);
+void tmo_telemetry_sched_result(int ret, int retry_after);
+bool tmo_telemetry_sched_retrying(void);
+void tmo_telemetry_sched_enable(bool enable);
+int tmo_telemetry_sched_set_geofence(double lat, double lon, unsigned int radius_m);
+void tmo_telemetry_sched_clear_geofence(void);
+void tmo_telemetry_sched_get_status(struct telemetry_sched_status *status);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_tls_bench, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/net/tls_credentials.h>
+
+#include "ca_certificate.h"
+#include "tmo_shell.h"
+#include "tmo_dns_cache.h"
+#include "tmo_tls_mem.h"
+#include "tmo_tls_bench.h"
+
+static int bench_socket(const struct tmo_tls_bench_req *req, struct zsock_addrinfo *ai,
+		struct net_if *iface, bool tls)
+{
+	int sd;
+
+	if (!tls) {
+		return zsock_socket_ext(ai->ai_family, SOCK_STREAM, IPPROTO_TCP, iface);
+	}
+#if IS_ENABLED(CONFIG_TMO_SHELL_USE_MBED)
+	if (req->native) {
+		int tls_native = 1;
+		struct ifreq ifreq = {0};
+
+		sd = zsock_socket(ai->ai_family, SOCK_STREAM, IPPROTO_TLS_1_2);
+		if (sd < 0) {
+			return sd;
+		}
+		zsock_setsockopt(sd, SOL_TLS, TLS_NATIVE, &tls_native, sizeof(tls_native));
+		strcpy(ifreq.ifr_name, iface->if_dev->dev->name);
+		zsock_setsockopt(sd, SOL_SOCKET, SO_BINDTODEVICE, &ifreq, sizeof(ifreq));
+	} else
+#endif
+	{
+		sd = zsock_socket_ext(ai->ai_family, SOCK_STREAM, IPPROTO_TLS_1_2, iface);
+		if (sd < 0) {
+			return sd;
+		}
+#if CONFIG_MODEM
+		int verify = TLS_PEER_VERIFY_NONE;
+
+		zsock_setsockopt(sd, SOL_TLS, TLS_PEER_VERIFY, &verify, sizeof(verify));
+#endif
+	}
+
+	sec_tag_t sec_tag_opt[] = {
+		CA_CERTIFICATE_TAG,
+	};
+	zsock_setsockopt(sd, SOL_TLS, TLS_SEC_TAG_LIST, sec_tag_opt, sizeof(sec_tag_opt));
+	zsock_setsockopt(sd, SOL_TLS, TLS_HOSTNAME, req->host, strlen(req->host) + 1);
+
+	int nsuites = 0;
+
+	while (nsuites < TMO_TLS_BENCH_MAX_SUITES && req->suites[nsuites]) {
+		nsuites++;
+	}
+	if (nsuites && zsock_setsockopt(sd, SOL_TLS, TLS_CIPHERSUITE_LIST, req->suites,
+				nsuites * sizeof(int))) {
+		LOG_WRN("cipher suite selection not supported on this path");
+	}
+	return sd;
+}
+
+/* Time one connect, -errno on failure */
+static int bench_connect(const struct tmo_tls_bench_req *req, struct zsock_addrinfo *ai,
+		struct net_if *iface, bool tls, int *suite)
+{
+	int64_t start = k_uptime_get();
+	int sd = bench_socket(req, ai, iface, tls);
+	int ret;
+
+	if (sd < 0) {
+		return -errno;
+	}
+	ret = tmo_tls_connect(sd, ai->ai_addr, ai->ai_addrlen, tls && req->native, "bench");
+	if (ret == 0) {
+		ret = k_uptime_get() - start;
+		if (tls) {
+			socklen_t len = sizeof(*suite);
+
+			if (zsock_getsockopt(sd, SOL_TLS, TLS_CIPHERSUITE_USED, suite, &len)) {
+				*suite = -1;
+			}
+		}
+	} else {
+		ret = -errno;
+	}
+	zsock_close(sd);
+	return ret;
+}
+
+/**
+ * @brief Time repeated handshakes with host on one path and interface
+ *
+ * Each TLS connect is paired with a plain TCP connect to the same
+ * address, so the handshake cost can be told apart from the network
+ * round trips. Sessions are not resumed; every handshake is a full one.
+ */
+int tmo_tls_bench_handshake(const struct tmo_tls_bench_req *req,
+		struct tmo_tls_bench_result *res)
+{
+	struct zsock_addrinfo hints = {.ai_socktype = SOCK_STREAM};
+	struct zsock_addrinfo ai;
+	struct sockaddr addr;
+	struct net_if *iface = net_if_get_by_index(req->iface_idx);
+	uint32_t tcp_total = 0;
+	uint32_t tls_total = 0;
+	int tcp_ok = 0;
+	int ret;
+
+	memset(res, 0, sizeof(*res));
+	res->suite = -1;
+	res->tls_min_ms = UINT32_MAX;
+#if !IS_ENABLED(CONFIG_TMO_SHELL_USE_MBED)
+	if (req->native) {
+		return -ENOTSUP;
+	}
+#endif
+	if (iface == NULL || tmo_offload_init(req->iface_idx)) {
+		return -ENODEV;
+	}
+	ret = tmo_dns_resolve_addr(req->host, req->port, &hints, req->iface_idx, &ai, &addr);
+	if (ret) {
+		return -EHOSTUNREACH;
+	}
+
+	for (int i = 0; i < req->count; i++) {
+		ret = bench_connect(req, &ai, iface, false, NULL);
+		if (ret >= 0) {
+			tcp_total += ret;
+			tcp_ok++;
+		}
+		ret = bench_connect(req, &ai, iface, true, &res->suite);
+		if (ret < 0) {
+			res->failed++;
+			res->last_err = ret;
+			continue;
+		}
+		res->ok++;
+		tls_total += ret;
+		res->tls_min_ms = MIN(res->tls_min_ms, ret);
+		res->tls_max_ms = MAX(res->tls_max_ms, ret);
+#if IS_ENABLED(CONFIG_TMO_TLS_MEM)
+		struct tmo_tls_mem_conn conn;
+
+		if (req->native && tmo_tls_mem_get_conns(&conn, 1) == 1) {
+			res->ram_peak = MAX(res->ram_peak, conn.handshake_peak);
+		}
+#endif
+	}
+
+	if (tcp_ok) {
+		res->tcp_ms = tcp_total / tcp_ok;
+	}
+	if (res->ok) {
+		res->tls_avg_ms = tls_total / res->ok;
+	} else {
+		res->tls_min_ms = 0;
+	}
+	return res->ok ? 0 : res->last_err;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_TLS_BENCH_H
+#define TMO_TLS_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TMO_TLS_BENCH_MAX_SUITES 4
+
+struct tmo_tls_bench_req {
+	int iface_idx;
+	const char *host;
+	const char *port;
+	bool native;          /* mbedTLS on the MCU, else offloaded to the iface */
+	int count;
+	int suites[TMO_TLS_BENCH_MAX_SUITES];   /* IANA ids to offer, 0 terminated */
+};
+
+struct tmo_tls_bench_result {
+	int ok;
+	int failed;
+	int last_err;
+	uint32_t tcp_ms;      /* average plain TCP connect, the network share */
+	uint32_t tls_min_ms;
+	uint32_t tls_avg_ms;  /* TCP connect plus handshake */
+	uint32_t tls_max_ms;
+	int suite;            /* negotiated, -1 if the stack does not say */
+	uint32_t ram_peak;    /* MCU arena bytes per handshake, 0 when offloaded */
+};
+
+int tmo_tls_bench_handshake(const struct tmo_tls_bench_req *req,
+		struct tmo_tls_bench_result *res);
+
+#endif
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_tls_mem, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <mbedtls/platform.h>
+
+#include "tmo_tls_mem.h"
+
+/*
+ * mbedTLS allocations come from a dedicated k_heap instead of the
+ * mbedTLS heap. Every block carries a small header naming the
+ * connection it was allocated for, so it is charged back correctly
+ * when the socket is closed on another thread.
+ *
+ * A connection owns the allocations made by its thread between
+ * tmo_tls_connect() and the end of the handshake. That covers the
+ * record buffers and all handshake state. Anything allocated later,
+ * such as a renegotiation, is counted in the arena totals only.
+ *
+ * A handshake is admitted by reserving handshake_need bytes when it
+ * starts, so handshakes started together on different threads cannot
+ * all count the same free space. Its own allocations draw the
+ * reservation down until the handshake ends and releases the rest.
+ */
+
+#define TLS_MEM_MAGIC  0x7e15
+
+struct tls_mem_hdr {
+	uint32_t size;
+	int16_t conn;
+	uint16_t magic;
+};
+
+K_HEAP_DEFINE(tls_heap, CONFIG_TMO_TLS_HEAP_SIZE);
+
+static struct k_spinlock lock;
+static struct tmo_tls_mem_stats stats;
+static struct tmo_tls_mem_conn conns[CONFIG_TMO_TLS_MEM_CONNS];
+/* Thread a connection is handshaking on */
+static k_tid_t conn_thread[CONFIG_TMO_TLS_MEM_CONNS];
+/* Arena set aside for a connection while it handshakes */
+static uint32_t conn_reserve[CONFIG_TMO_TLS_MEM_CONNS];
+static uint32_t conn_seq;
+/* The mbedTLS heap allocator in use before the arena was installed */
+static void (*heap_free)(void *ptr);
+
+static int current_conn_locked(void)
+{
+	k_tid_t self = k_current_get();
+
+	for (int i = 0; i < CONFIG_TMO_TLS_MEM_CONNS; i++) {
+		if (conn_thread[i] == self) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Reserved arena not yet taken up by the handshakes it was reserved for */
+static uint32_t reserved_locked(void)
+{
+	uint32_t reserved = 0;
+
+	for (int i = 0; i < CONFIG_TMO_TLS_MEM_CONNS; i++) {
+		if (conn_reserve[i] > conns[i].live) {
+			reserved += conn_reserve[i] - conns[i].live;
+		}
+	}
+	return reserved;
+}
+
+static void *tls_calloc(size_t n, size_t size)
+{
+	struct tls_mem_hdr *h;
+	k_spinlock_key_t key;
+	size_t len;
+	int conn;
+
+	if (size && n > (UINT32_MAX - sizeof(*h)) / size) {
+		return NULL;
+	}
+	len = n * size;
+	h = k_heap_alloc(&tls_heap, len + sizeof(*h), K_NO_WAIT);
+
+	key = k_spin_lock(&lock);
+	conn = current_conn_locked();
+	if (h == NULL) {
+		stats.fails++;
+		stats.last_fail_size = len;
+		k_spin_unlock(&lock, key);
+		LOG_ERR("TLS arena exhausted: %u bytes for %s, %u of %u in use", (uint32_t)len,
+				conn >= 0 ? conns[conn].label : "?", stats.used, stats.arena);
+		return NULL;
+	}
+	h->size = len;
+	h->conn = conn;
+	h->magic = TLS_MEM_MAGIC;
+	stats.allocs++;
+	stats.used += len;
+	stats.peak = MAX(stats.peak, stats.used);
+	if (conn >= 0) {
+		conns[conn].live += len;
+		conns[conn].peak = MAX(conns[conn].peak, conns[conn].live);
+	}
+	k_spin_unlock(&lock, key);
+
+	memset(h + 1, 0, len);
+	return h + 1;
+}
+
+static void tls_free(void *ptr)
+{
+	struct tls_mem_hdr *h = (struct tls_mem_hdr *)ptr - 1;
+	uint8_t *start = tls_heap.heap.init_mem;
+	k_spinlock_key_t key;
+
+	if (ptr == NULL) {
+		return;
+	}
+	if ((uint8_t *)ptr < start || (uint8_t *)ptr >= start + tls_heap.heap.init_bytes) {
+		/* From the mbedTLS heap, before the arena was installed */
+		heap_free(ptr);
+		return;
+	}
+	if (h->magic != TLS_MEM_MAGIC) {
+		LOG_ERR("free of %p, not a TLS arena block", ptr);
+		return;
+	}
+
+	key = k_spin_lock(&lock);
+	stats.used -= h->size;
+	if (h->conn >= 0) {
+		struct tmo_tls_mem_conn *c = &conns[h->conn];
+
+		c->live -= h->size;
+		if (c->live == 0 && !c->handshaking) {
+			c->open = false;
+		}
+	}
+	h->magic = 0;
+	k_spin_unlock(&lock, key);
+
+	k_heap_free(&tls_heap, h);
+}
+
+/*
+ * Reserve handshake_need bytes and claim the least recently used closed
+ * slot for a handshake
+ *
+ * @return the slot, -ENOMEM if the arena cannot take another handshake
+ * now, -ENFILE if every slot is still open
+ */
+static int conn_begin(int sd, const char *label)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	uint32_t avail = stats.arena - stats.used;
+	uint32_t reserved = reserved_locked();
+	int slot = -1;
+
+	avail = avail > reserved ? avail - reserved : 0;
+	if (avail < stats.handshake_need) {
+		k_spin_unlock(&lock, key);
+		LOG_ERR("TLS arena has %u bytes unreserved, a handshake needs %u, refusing %s",
+				avail, stats.handshake_need, label);
+		return -ENOMEM;
+	}
+	for (int i = 0; i < CONFIG_TMO_TLS_MEM_CONNS; i++) {
+		if (!conns[i].open && (slot < 0 || conns[i].id < conns[slot].id)) {
+			slot = i;
+		}
+	}
+	if (slot >= 0) {
+		struct tmo_tls_mem_conn *c = &conns[slot];
+
+		memset(c, 0, sizeof(*c));
+		c->id = ++conn_seq;
+		strncpy(c->label, label ? label : "", sizeof(c->label) - 1);
+		c->sd = sd;
+		c->open = true;
+		c->handshaking = true;
+		conn_thread[slot] = k_current_get();
+		conn_reserve[slot] = stats.handshake_need;
+	}
+	k_spin_unlock(&lock, key);
+	if (slot < 0) {
+		LOG_ERR("All %d TLS connections open, refusing %s", CONFIG_TMO_TLS_MEM_CONNS,
+				label);
+		return -ENFILE;
+	}
+	return slot;
+}
+
+/* Release the reservation of a finished handshake */
+static void conn_end(int slot, bool ok, uint32_t ms)
+{
+	k_spinlock_key_t key;
+	struct tmo_tls_mem_conn *c = &conns[slot];
+
+	key = k_spin_lock(&lock);
+	conn_thread[slot] = NULL;
+	conn_reserve[slot] = 0;
+	c->handshaking = false;
+	c->ok = ok;
+	c->handshake_ms = ms;
+	c->handshake_peak = c->peak;
+	if (ok) {
+		stats.handshake_need = MAX(stats.handshake_need, c->handshake_peak);
+	}
+	if (c->live == 0) {
+		c->open = false;
+	}
+	k_spin_unlock(&lock, key);
+}
+
+/**
+ * @brief connect() that accounts a native TLS handshake to the arena
+ *
+ * A handshake that could not fit in the arena, next to the handshakes
+ * already running, is refused up front with ENOMEM rather than failing
+ * halfway through for want of a buffer.
+ *
+ * @param tls the socket does a native (mbedTLS) handshake in connect
+ * @param label shown by "tmo tls mem"
+ * @return as zsock_connect()
+ */
+int tmo_tls_connect(int sd, const struct sockaddr *addr, socklen_t addrlen, bool tls,
+		const char *label)
+{
+	int64_t start;
+	int slot;
+	int ret;
+
+	if (!tls) {
+		return zsock_connect(sd, addr, addrlen);
+	}
+	slot = conn_begin(sd, label);
+	if (slot < 0) {
+		errno = -slot;
+		return -1;
+	}
+	start = k_uptime_get();
+	ret = zsock_connect(sd, addr, addrlen);
+	conn_end(slot, ret == 0, k_uptime_get() - start);
+	return ret;
+}
+
+void tmo_tls_mem_get_stats(struct tmo_tls_mem_stats *st)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	*st = stats;
+	st->reserved = reserved_locked();
+	k_spin_unlock(&lock, key);
+}
+
+/**
+ * @brief Copy out the tracked connections, newest first
+ *
+ * @return number of entries filled in
+ */
+int tmo_tls_mem_get_conns(struct tmo_tls_mem_conn *out, int max)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	uint32_t below = UINT32_MAX;
+	int n = 0;
+
+	while (n < max) {
+		int next = -1;
+
+		for (int i = 0; i < CONFIG_TMO_TLS_MEM_CONNS; i++) {
+			if (conns[i].id && conns[i].id < below &&
+					(next < 0 || conns[i].id > conns[next].id)) {
+				next = i;
+			}
+		}
+		if (next < 0) {
+			break;
+		}
+		out[n++] = conns[next];
+		below = conns[next].id;
+	}
+	k_spin_unlock(&lock, key);
+	return n;
+}
+
+/* After the mbedTLS init, which points mbedTLS at its own heap */
+static int tmo_tls_mem_init(const struct device *dev)
+{
+	ARG_UNUSED(dev);
+
+	stats.arena = CONFIG_TMO_TLS_HEAP_SIZE;
+	stats.handshake_need = CONFIG_TMO_TLS_MEM_HANDSHAKE_EST;
+	heap_free = mbedtls_free;
+	return mbedtls_platform_set_calloc_free(tls_calloc, tls_free);
+}
+
+SYS_INIT(tmo_tls_mem_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_TLS_MEM_H
+#define TMO_TLS_MEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/net/socket.h>
+
+struct tmo_tls_mem_stats {
+	uint32_t arena;
+	uint32_t used;
+	uint32_t peak;
+	uint32_t allocs;
+	uint32_t fails;
+	uint32_t last_fail_size;
+	uint32_t handshake_need;  /* what the next handshake is expected to take */
+	uint32_t reserved;        /* held back for handshakes in progress */
+};
+
+/* One TLS connection, kept after it closes until the slot is reused */
+struct tmo_tls_mem_conn {
+	uint32_t id;
+	char label[16];
+	int sd;
+	bool open;
+	bool handshaking;
+	bool ok;
+	uint32_t live;            /* bytes held now */
+	uint32_t peak;            /* most held at once, over the connection */
+	uint32_t handshake_peak;  /* most held at once, up to the end of the handshake */
+	uint32_t handshake_ms;
+};
+
+#if IS_ENABLED(CONFIG_TMO_TLS_MEM)
+int tmo_tls_connect(int sd, const struct sockaddr *addr, socklen_t addrlen, bool tls,
+		const char *label);
+void tmo_tls_mem_get_stats(struct tmo_tls_mem_stats *st);
+int tmo_tls_mem_get_conns(struct tmo_tls_mem_conn *conns, int max);
+#else
+static inline int tmo_tls_connect(int sd, const struct sockaddr *addr, socklen_t addrlen,
+		bool tls, const char *label)
+{
+	return zsock_connect(sd, addr, addrlen);
+}
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+
+#include "tmo_udp_batch.h"
+#if CONFIG_TMO_SOCK_REACTOR
+#include "tmo_sock_reactor.h"
+#endif
+
+/*
+ * Neither offload driver implements a multi-datagram operation, so batches
+ * are looped here. Callers still pay one shell command and one poll per
+ * batch instead of per datagram, and a driver level batch call can be
+ * dropped in below without changing them.
+ */
+
+/**
+ * @brief Send a batch of datagrams
+ *
+ * Stops at the first datagram that cannot be sent, like sendmmsg().
+ *
+ * @return number of datagrams sent, -1 with errno set if none was
+ */
+int tmo_udp_sendmmsg(int sd, struct tmo_dgram *msgs, int count, int flags)
+{
+	int sent;
+
+	for (sent = 0; sent < count; sent++) {
+		struct tmo_dgram *m = &msgs[sent];
+		ssize_t ret;
+
+		if (m->addrlen) {
+			ret = zsock_sendto(sd, m->buf, m->len, flags, &m->addr, m->addrlen);
+		} else {
+			ret = zsock_send(sd, m->buf, m->len, flags);
+		}
+		if (ret < 0) {
+			break;
+		}
+		m->xfer = ret;
+	}
+	return (sent == 0 && count > 0) ? -1 : sent;
+}
+
+static ssize_t recv_one(int sd, struct tmo_dgram *m, int timeout_ms)
+{
+	m->addrlen = sizeof(m->addr);
+#if CONFIG_TMO_SOCK_REACTOR
+	if (tmo_sock_reactor_attached(sd)) {
+		return tmo_sock_reactor_recv(sd, m->buf, m->len, &m->addr, &m->addrlen, NULL,
+				K_MSEC(timeout_ms));
+	}
+#endif
+	if (timeout_ms > 0) {
+		struct zsock_pollfd pfd = {.fd = sd, .events = ZSOCK_POLLIN};
+		int ret = zsock_poll(&pfd, 1, timeout_ms);
+
+		if (ret <= 0) {
+			if (ret == 0) {
+				errno = EAGAIN;
+			}
+			return -1;
+		}
+	}
+	return zsock_recvfrom(sd, m->buf, m->len, ZSOCK_MSG_DONTWAIT, &m->addr, &m->addrlen);
+}
+
+/**
+ * @brief Receive a batch of datagrams
+ *
+ * Waits up to timeout_ms for the first datagram, then takes whatever else
+ * is already queued, like recvmmsg() with MSG_WAITFORONE.
+ *
+ * @return number of datagrams received, -1 with errno set if none was
+ */
+int tmo_udp_recvmmsg(int sd, struct tmo_dgram *msgs, int count, int timeout_ms)
+{
+	int got;
+
+	for (got = 0; got < count; got++) {
+		ssize_t ret = recv_one(sd, &msgs[got], got ? 0 : timeout_ms);
+
+		if (ret < 0) {
+			break;
+		}
+		msgs[got].xfer = ret;
+	}
+	return (got == 0 && count > 0) ? -1 : got;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_UDP_BATCH_H
+#define TMO_UDP_BATCH_H
+
+#include <stddef.h>
+#include <zephyr/net/socket.h>
+
+#define TMO_UDP_BATCH_MAX 16
+
+/* One datagram of a batch, modelled on struct mmsghdr */
+struct tmo_dgram {
+	void *buf;
+	size_t len;           /* bytes to send, or buffer size on receive */
+	size_t xfer;          /* bytes sent or received */
+	struct sockaddr addr; /* destination or source, unused if addrlen is 0 */
+	socklen_t addrlen;
+};
+
+int tmo_udp_sendmmsg(int sd, struct tmo_dgram *msgs, int count, int flags);
+int tmo_udp_recvmmsg(int sd, struct tmo_dgram *msgs, int count, int timeout_ms);
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_usage, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/kernel.h>
+
+#include "tmo_link_mgr.h"
+#include "tmo_usage.h"
+
+/*
+ * Counts application payload bytes. IP, TCP and TLS overhead is not
+ * visible above the offload drivers, so carrier counts will be higher.
+ */
+
+#define USAGE_FILE_MAGIC    0x47535554  /* "TUSG" */
+#define USAGE_FILE_VERSION  1
+
+/* Which quota stops a tag */
+enum usage_prio {
+	USAGE_BACKGROUND,   /* deferred at the soft quota */
+	USAGE_NORMAL,       /* deferred at the hard quota */
+	USAGE_CRITICAL,     /* never deferred */
+};
+
+static const struct {
+	const char *name;
+	enum usage_prio prio;
+} tags[TMO_USAGE_TAG_COUNT] = {
+	[TMO_USAGE_SHELL]     = {"shell", USAGE_BACKGROUND},
+	[TMO_USAGE_TELEMETRY] = {"telemetry", USAGE_NORMAL},
+	[TMO_USAGE_DFU]       = {"dfu", USAGE_NORMAL},
+	[TMO_USAGE_CERTS]     = {"certs", USAGE_CRITICAL},
+	[TMO_USAGE_SNTP]      = {"sntp", USAGE_CRITICAL},
+	[TMO_USAGE_PING]      = {"ping", USAGE_BACKGROUND},
+	[TMO_USAGE_PERF]      = {"perf", USAGE_BACKGROUND},
+	[TMO_USAGE_HTTP]      = {"http", USAGE_BACKGROUND},
+};
+
+/* Persisted as-is after the header */
+struct usage_data {
+	struct tmo_usage_counter cnt[TMO_LINK_MAX_IFACES + 1][TMO_USAGE_TAG_COUNT];
+	struct tmo_usage_quota quota[TMO_LINK_MAX_IFACES + 1];
+};
+
+struct usage_file_hdr {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t ifaces;
+	uint8_t tags;
+	uint8_t reserved;
+};
+
+static struct usage_data usage;
+static bool loaded;
+static bool dirty;
+static int64_t last_save;
+static K_MUTEX_DEFINE(usage_mutex);
+
+/* Counters are only written once the file has been read, else a save
+ * before the file system is mounted would wipe them
+ */
+static void usage_load(void)
+{
+	struct fs_file_t file;
+	struct fs_statvfs st;
+	struct usage_file_hdr hdr;
+	int ret;
+
+	fs_file_t_init(&file);
+	ret = fs_open(&file, TMO_USAGE_FILE, FS_O_READ);
+	if (ret == -ENOENT) {
+		/* Also what an unmounted file system answers, only trust a mounted one */
+		if (fs_statvfs(TMO_USAGE_MNT, &st) == 0) {
+			loaded = true;
+		}
+		return;
+	} else if (ret) {
+		return;
+	}
+	loaded = true;
+	if (fs_read(&file, &hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == USAGE_FILE_MAGIC &&
+			hdr.version == USAGE_FILE_VERSION &&
+			hdr.ifaces == TMO_LINK_MAX_IFACES + 1 && hdr.tags == TMO_USAGE_TAG_COUNT) {
+		struct usage_data saved;
+
+		if (fs_read(&file, &saved, sizeof(saved)) == sizeof(saved)) {
+			/* Keep what was counted before the file could be read */
+			for (int i = 0; i <= TMO_LINK_MAX_IFACES; i++) {
+				for (int t = 0; t < TMO_USAGE_TAG_COUNT; t++) {
+					usage.cnt[i][t].tx += saved.cnt[i][t].tx;
+					usage.cnt[i][t].rx += saved.cnt[i][t].rx;
+				}
+				usage.quota[i] = saved.quota[i];
+			}
+		}
+	}
+	fs_close(&file);
+}
+
+static int usage_save_locked(void)
+{
+	struct fs_file_t file;
+	struct usage_file_hdr hdr = {
+		.magic = USAGE_FILE_MAGIC,
+		.version = USAGE_FILE_VERSION,
+		.ifaces = TMO_LINK_MAX_IFACES + 1,
+		.tags = TMO_USAGE_TAG_COUNT,
+	};
+	int ret;
+
+	if (!loaded) {
+		usage_load();
+		if (!loaded) {
+			return -EAGAIN;
+		}
+	}
+	fs_file_t_init(&file);
+	ret = fs_open(&file, TMO_USAGE_FILE, FS_O_CREATE | FS_O_WRITE);
+	if (ret) {
+		return ret;
+	}
+	fs_truncate(&file, 0);
+	fs_write(&file, &hdr, sizeof(hdr));
+	ret = fs_write(&file, &usage, sizeof(usage));
+	fs_close(&file);
+	if (ret != sizeof(usage)) {
+		return ret < 0 ? ret : -ENOSPC;
+	}
+	dirty = false;
+	last_save = k_uptime_get();
+	return 0;
+}
+
+static bool valid(int iface_idx, int tag)
+{
+	return iface_idx > 0 && iface_idx <= TMO_LINK_MAX_IFACES &&
+		tag >= 0 && tag < TMO_USAGE_TAG_COUNT;
+}
+
+static uint64_t iface_total_locked(int iface_idx)
+{
+	uint64_t total = 0;
+
+	for (int t = 0; t < TMO_USAGE_TAG_COUNT; t++) {
+		total += usage.cnt[iface_idx][t].tx + usage.cnt[iface_idx][t].rx;
+	}
+	return total;
+}
+
+/**
+ * @brief Charge a transfer to an interface and subsystem
+ *
+ * Counters are saved at most every CONFIG_TMO_USAGE_SAVE_SECS from here,
+ * to bound flash wear.
+ */
+void tmo_usage_add(int iface_idx, enum tmo_usage_tag tag, size_t tx, size_t rx)
+{
+	if (!valid(iface_idx, tag) || (tx == 0 && rx == 0)) {
+		return;
+	}
+	k_mutex_lock(&usage_mutex, K_FOREVER);
+	if (!loaded) {
+		usage_load();
+	}
+	usage.cnt[iface_idx][tag].tx += tx;
+	usage.cnt[iface_idx][tag].rx += rx;
+	dirty = true;
+	if (k_uptime_get() - last_save >= CONFIG_TMO_USAGE_SAVE_SECS * MSEC_PER_SEC) {
+		usage_save_locked();
+	}
+	k_mutex_unlock(&usage_mutex);
+}
+
+/**
+ * @brief Check whether a subsystem may use an interface
+ *
+ * @return 0 if allowed, -EDQUOT if the transfer should be deferred
+ */
+int tmo_usage_check(int iface_idx, enum tmo_usage_tag tag)
+{
+	int ret = 0;
+
+	if (!valid(iface_idx, tag) || tags[tag].prio == USAGE_CRITICAL) {
+		return 0;
+	}
+	k_mutex_lock(&usage_mutex, K_FOREVER);
+	if (!loaded) {
+		usage_load();
+	}
+	struct tmo_usage_quota *q = &usage.quota[iface_idx];
+	uint64_t kb = iface_total_locked(iface_idx) / 1024;
+
+	if (q->hard_kb && kb >= q->hard_kb) {
+		ret = -EDQUOT;
+	} else if (q->soft_kb && kb >= q->soft_kb && tags[tag].prio == USAGE_BACKGROUND) {
+		ret = -EDQUOT;
+	}
+	k_mutex_unlock(&usage_mutex);
+	if (ret) {
+		LOG_WRN("iface %d over quota, deferring %s traffic", iface_idx, tags[tag].name);
+	}
+	return ret;
+}
+
+int tmo_usage_get(int iface_idx, enum tmo_usage_tag tag, struct tmo_usage_counter *cnt)
+{
+	if (!valid(iface_idx, tag)) {
+		return -EINVAL;
+	}
+	k_mutex_lock(&usage_mutex, K_FOREVER);
+	if (!loaded) {
+		usage_load();
+	}
+	*cnt = usage.cnt[iface_idx][tag];
+	k_mutex_unlock(&usage_mutex);
+	return 0;
+}
+
+int tmo_usage_get_quota(int iface_idx, struct tmo_usage_quota *quota)
+{
+	if (!valid(iface_idx, 0)) {
+		return -EINVAL;
+	}
+	k_mutex_lock(&usage_mutex, K_FOREVER);
+	if (!loaded) {
+		usage_load();
+	}
+	*quota = usage.quota[iface_idx];
+	k_mutex_unlock(&usage_mutex);
+	return 0;
+}
+
+int tmo_usage_set_quota(int iface_idx, const struct tmo_usage_quota *quota)
+{
+	int ret;
+
+	if (!valid(iface_idx, 0)) {
+		return -EINVAL;
+	}
+	k_mutex_lock(&usage_mutex, K_FOREVER);
+	if (!loaded) {
+		usage_load();
+	}
+	usage.quota[iface_idx] = *quota;
+	ret = usage_save_locked();
+	k_mutex_unlock(&usage_mutex);
+	return ret;
+}
+
+/**
+ * @brief Start a new billing period
+ *
+ * @param iface_idx interface to clear, TMO_LINK_AUTO for all. Quotas are kept.
+ */
+void tmo_usage_reset(int iface_idx)
+{
+	k_mutex_lock(&usage_mutex, K_FOREVER);
+	if (!loaded) {
+		usage_load();
+	}
+	for (int i = 1; i <= TMO_LINK_MAX_IFACES; i++) {
+		if (iface_idx == TMO_LINK_AUTO || iface_idx == i) {
+			memset(usage.cnt[i], 0, sizeof(usage.cnt[i]));
+		}
+	}
+	usage_save_locked();
+	k_mutex_unlock(&usage_mutex);
+}
+
+int tmo_usage_save(void)
+{
+	int ret;
+
+	k_mutex_lock(&usage_mutex, K_FOREVER);
+	ret = usage_save_locked();
+	k_mutex_unlock(&usage_mutex);
+	return ret;
+}
+
+const char *tmo_usage_tag_name(enum tmo_usage_tag tag)
+{
+	return tag < TMO_USAGE_TAG_COUNT ? tags[tag].name : "?";
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_USAGE_H
+#define TMO_USAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TMO_USAGE_MNT  "/tmo"
+#define TMO_USAGE_FILE TMO_USAGE_MNT "/usage.bin"
+
+/* Subsystem a transfer is charged to */
+enum tmo_usage_tag {
+	TMO_USAGE_SHELL,
+	TMO_USAGE_TELEMETRY,
+	TMO_USAGE_DFU,
+	TMO_USAGE_CERTS,
+	TMO_USAGE_SNTP,
+	TMO_USAGE_PING,
+	TMO_USAGE_PERF,
+	TMO_USAGE_HTTP,
+	TMO_USAGE_TAG_COUNT
+};
+
+struct tmo_usage_counter {
+	uint64_t tx;
+	uint64_t rx;
+};
+
+struct tmo_usage_quota {
+	uint32_t soft_kb;     /* 0 = none; defers background traffic */
+	uint32_t hard_kb;     /* 0 = none; defers all but critical traffic */
+};
+
+void tmo_usage_add(int iface_idx, enum tmo_usage_tag tag, size_t tx, size_t rx);
+int tmo_usage_check(int iface_idx, enum tmo_usage_tag tag);
+int tmo_usage_get(int iface_idx, enum tmo_usage_tag tag, struct tmo_usage_counter *cnt);
+int tmo_usage_get_quota(int iface_idx, struct tmo_usage_quota *quota);
+int tmo_usage_set_quota(int iface_idx, const struct tmo_usage_quota *quota);
+void tmo_usage_reset(int iface_idx);
+int tmo_usage_save(void);
+const char *tmo_usage_tag_name(enum tmo_usage_tag tag);
+
+#endif
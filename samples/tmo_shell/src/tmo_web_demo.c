@@ -24,6 +24,7 @@
 #include "tmo_http_request.h"
 #include "tmo_shell.h"
 #include "tmo_battery_ctrl.h"
+#include "tmo_telemetry_sched.h"
 
 static struct web_demo_settings_t web_demo_settings = {false, 0, 2, TRANSMIT_INTERVAL_SECS_WEB};
 #define MAX_BASE_URL_SIZE  100
@@ -160,145 +161,355 @@ int get_gnss_location_info(double* latitude, double* longitude, double* alt, dou
 	return 0;
 }
 
-int  create_json()
+/* Field values are ordered so that the first "tracked" entries are the ones
+ * compared against the last acknowledged report; the rest ride along.
+ */
+static const struct telemetry_field_desc {
+	const char *name;
+	uint8_t tracked;
+} telemetry_fields[TELEM_FIELD_COUNT] = {
+	[TELEM_ACCELEROMETER] = {"accelerometer", 3},
+	[TELEM_BATTERY]       = {"battery", 2},
+	[TELEM_CELL_SIGNAL]   = {"cellSignalStrength", 1},
+	[TELEM_TEMPERATURE]   = {"temperature", 1},
+	[TELEM_AMBIENT_LIGHT] = {"ambientLight", 2},
+	[TELEM_PRESSURE]      = {"pressure", 1},
+	[TELEM_MAP]           = {"map", 2},
+};
+
+static struct telemetry_policy telemetry_policies[TELEM_FIELD_COUNT] = {
+	[TELEM_ACCELEROMETER] = {0.5, 0, 0, false},
+	[TELEM_BATTERY]       = {1.0, 0, 0, false},
+	[TELEM_CELL_SIGNAL]   = {3.0, 0, 0, false},
+	[TELEM_TEMPERATURE]   = {0.5, 0, 0, false},
+	[TELEM_AMBIENT_LIGHT] = {5.0, 0, 0, false},
+	[TELEM_PRESSURE]      = {0.1, 0, 0, false},
+	[TELEM_MAP]           = {0.0001, 0, 0, false},
+};
+
+struct telemetry_value {
+	bool valid;
+	double val[TELEM_MAX_VALUES];
+};
+
+static struct telemetry_field_state {
+	struct telemetry_value acked;
+	struct telemetry_value pending;
+	bool acked_once;
+	int64_t last_report_ms;
+} telemetry_state[TELEM_FIELD_COUNT];
+
+static bool telemetry_sparse = IS_ENABLED(CONFIG_TMO_TELEMETRY_SPARSE);
+static unsigned int telemetry_heartbeat_secs = CONFIG_TMO_TELEMETRY_HEARTBEAT_SECS;
+static int64_t telemetry_last_heartbeat_ms;
+static bool telemetry_heartbeat_acked;
+static bool telemetry_pending_heartbeat;
+static uint32_t telemetry_pending_mask;
+
+int telemetry_field_from_name(const char *name)
+{
+	for (int i = 0; i < TELEM_FIELD_COUNT; i++) {
+		if (!strcmp(name, telemetry_fields[i].name)) {
+			return i;
+		}
+	}
+	return -EINVAL;
+}
+
+const char *telemetry_field_name(enum telemetry_field field)
+{
+	if (field >= TELEM_FIELD_COUNT) {
+		return NULL;
+	}
+	return telemetry_fields[field].name;
+}
+
+int set_telemetry_policy(enum telemetry_field field, const struct telemetry_policy *policy)
+{
+	if (field >= TELEM_FIELD_COUNT || policy == NULL || policy->deadband < 0) {
+		return -EINVAL;
+	}
+	if (policy->max_interval && policy->max_interval < policy->min_interval) {
+		return -EINVAL;
+	}
+	telemetry_policies[field] = *policy;
+	return 0;
+}
+
+int get_telemetry_policy(enum telemetry_field field, struct telemetry_policy *policy)
+{
+	if (field >= TELEM_FIELD_COUNT || policy == NULL) {
+		return -EINVAL;
+	}
+	*policy = telemetry_policies[field];
+	return 0;
+}
+
+void set_telemetry_sparse(bool sparse)
+{
+	telemetry_sparse = sparse;
+}
+
+bool get_telemetry_sparse(void)
 {
+	return telemetry_sparse;
+}
+
+void set_telemetry_heartbeat(unsigned int secs)
+{
+	telemetry_heartbeat_secs = secs;
+}
+
+unsigned int get_telemetry_heartbeat(void)
+{
+	return telemetry_heartbeat_secs;
+}
+
+static void sample_telemetry(struct telemetry_value *cur)
+{
+	struct sensor_value sensor_value_arr[3];
 	int val;
 	double lat, lon, alt, hdop;
-	int ret_val;
-	struct sensor_value sensor_value_arr[3];
-	int buffer_size = MAX_PAYLOAD_BUFFER_SIZE;
-	memset(json_payload, 0, MAX_PAYLOAD_BUFFER_SIZE);
 
-	// test blank payload
-	// json_payload[0] = '\0';
-	// return strlen(json_payload);
+	memset(cur, 0, sizeof(struct telemetry_value) * TELEM_FIELD_COUNT);
 
-	// test simple payload
-	// snprintf(json_payload, sizeof(json_payload), "{ \"x\":\"hello\" }");
-	// return strlen(json_payload);
+	if (read_accelerometer(sensor_value_arr) == 0) {
+		cur[TELEM_ACCELEROMETER].valid = true;
+		cur[TELEM_ACCELEROMETER].val[0] = sensor_value_to_double(sensor_value_arr);
+		cur[TELEM_ACCELEROMETER].val[1] = sensor_value_to_double(&sensor_value_arr[1]);
+		cur[TELEM_ACCELEROMETER].val[2] = sensor_value_to_double(&sensor_value_arr[2]);
+	}
 
-	// Initial bracket
-	int total_bytes_written = ret_val = snprintf(json_payload, buffer_size, "{\n");
-	int num_bytes_avail_buffer = buffer_size - total_bytes_written;
-
-	if (ret_val >= 0 && total_bytes_written < buffer_size) {
-		read_accelerometer(sensor_value_arr);
-		double val0 = sensor_value_to_double(sensor_value_arr);
-		double val1 = sensor_value_to_double(&sensor_value_arr[1]);
-		double val2 = sensor_value_to_double(&sensor_value_arr[2]);
-		ret_val = snprintf(json_payload+total_bytes_written, num_bytes_avail_buffer,
-				"\"accelerometer\":{\n\"x\":%.2lf,\n\"y\":%.2lf,\n\"z\":%.2lf\n},\n",
-				val0, val1, val2);
-	} else {
-		return ret_val;
-	}
-
-	num_bytes_avail_buffer -= ret_val;
-	total_bytes_written += ret_val;
-
-	if (ret_val >= 0 && total_bytes_written < buffer_size) {
-		uint8_t percent = 0;
-		uint32_t millivolts = 0;
-		enum battery_state e_bat_state = battery_state_not_attached;
-		if (battery_attached !=0) {
-			millivolts = read_battery_voltage();
-			millivolts_to_percent(millivolts, &percent);
-			if (is_battery_charging()) {
-				e_bat_state = battery_state_charging;
-			} else {
-				e_bat_state = battery_state_not_charging;
-			}
+	uint8_t percent = 0;
+	uint32_t millivolts = 0;
+	enum battery_state e_bat_state = battery_state_not_attached;
+	if (battery_attached != 0) {
+		millivolts = read_battery_voltage();
+		millivolts_to_percent(millivolts, &percent);
+		if (is_battery_charging()) {
+			e_bat_state = battery_state_charging;
 		} else {
-			e_bat_state = battery_state_not_attached;
+			e_bat_state = battery_state_not_charging;
 		}
-		ret_val = snprintf(json_payload+total_bytes_written, num_bytes_avail_buffer,
-				"\"battery\":{\n\"voltage\":%d.%03d,\n\"percent\":%d,\n\"state\":\"%s\"\n},\n",
-				millivolts/1000, millivolts%1000, percent,
-				battery_state_string[e_bat_state]);
-	} else {
-		return ret_val;
 	}
-	num_bytes_avail_buffer -= ret_val;
-	total_bytes_written += ret_val;
+	cur[TELEM_BATTERY].valid = true;
+	cur[TELEM_BATTERY].val[0] = percent;
+	cur[TELEM_BATTERY].val[1] = e_bat_state;
+	cur[TELEM_BATTERY].val[2] = millivolts;
+
+	/* A failed read is still reported, as "dbm":null */
+	if (get_cell_strength(&val) == 0) {
+		cur[TELEM_CELL_SIGNAL].valid = true;
+		cur[TELEM_CELL_SIGNAL].val[0] = val;
+	}
 
-	if (ret_val >= 0 && total_bytes_written < buffer_size) {
-		if (get_cell_strength(&val) == 0) {
-			ret_val = snprintf(json_payload+total_bytes_written, num_bytes_avail_buffer,
-				"\"cellSignalStrength\":{\n\"dbm\":%d\n},\n", val);
-		} else {
-			ret_val = snprintf(json_payload+total_bytes_written, num_bytes_avail_buffer,
-				"\"cellSignalStrength\":{\n\"dbm\":null\n},\n");
-		}
-	} else {
-		return ret_val;
+	if (fetch_temperature(&sensor_value_arr[0])) {
+		cur[TELEM_TEMPERATURE].valid = true;
+		cur[TELEM_TEMPERATURE].val[0] = sensor_value_to_double(sensor_value_arr);
+	}
+
+	if (fetch_light(&sensor_value_arr[0]) && fetch_ir(&sensor_value_arr[1])) {
+		cur[TELEM_AMBIENT_LIGHT].valid = true;
+		cur[TELEM_AMBIENT_LIGHT].val[0] = sensor_value_to_double(sensor_value_arr);
+		cur[TELEM_AMBIENT_LIGHT].val[1] = sensor_value_to_double(&sensor_value_arr[1]);
+	}
+
+#if CONFIG_LPS22HH
+	if (fetch_pressure(&sensor_value_arr[0])) {
+		cur[TELEM_PRESSURE].valid = true;
+		cur[TELEM_PRESSURE].val[0] = sensor_value_to_double(sensor_value_arr);
 	}
-	num_bytes_avail_buffer -= ret_val;
-	total_bytes_written += ret_val;
+#endif
+
+	get_gnss_location_info(&lat, &lon, &alt, &hdop);
+	cur[TELEM_MAP].valid = true;
+	cur[TELEM_MAP].val[0] = lat;
+	cur[TELEM_MAP].val[1] = lon;
+	cur[TELEM_MAP].val[2] = alt;
+	cur[TELEM_MAP].val[3] = hdop;
+}
+
+static bool telemetry_changed(enum telemetry_field field, const struct telemetry_value *cur)
+{
+	const struct telemetry_field_state *st = &telemetry_state[field];
+	const struct telemetry_policy *pol = &telemetry_policies[field];
 
-	if (ret_val >= 0 && total_bytes_written < buffer_size) {
-		if (fetch_temperature((struct sensor_value*) &sensor_value_arr[0])) {
-			double val = sensor_value_to_double(sensor_value_arr);
-			ret_val =  snprintf(json_payload+total_bytes_written, num_bytes_avail_buffer,
-					"\"temperature\":{\n\"temperatureCelsius\":%.1lf\n},\n", val);
+	if (!st->acked_once || st->acked.valid != cur->valid) {
+		return true;
+	}
+	if (!cur->valid) {
+		return false;
+	}
+	for (int i = 0; i < telemetry_fields[field].tracked; i++) {
+		double delta = cur->val[i] - st->acked.val[i];
+		if (delta < 0) {
+			delta = -delta;
 		}
-	} else {
-		return ret_val;
-	}
-	num_bytes_avail_buffer -=  ret_val;
-	total_bytes_written += ret_val;
-
-	if (ret_val >= 0 && total_bytes_written < buffer_size) {
-		if ((fetch_light((struct sensor_value*) &sensor_value_arr[0])) &&
-				(fetch_ir((struct sensor_value*) &sensor_value_arr[1]))) {
-			double val0 = sensor_value_to_double(sensor_value_arr);
-			double val1 = sensor_value_to_double(&sensor_value_arr[1]);
-			ret_val =  snprintf(json_payload+total_bytes_written, num_bytes_avail_buffer,
-					"\"ambientLight\":{\n\"visibleLux\":%.2lf,\n\"irLux\":%.2lf\n},\n",
-					val0, val1);
+		if ((pol->on_change && delta > 0) || (!pol->on_change && delta >= pol->deadband)) {
+			return true;
 		}
-	} else {
-		return ret_val;
 	}
-	num_bytes_avail_buffer -=  ret_val;
-	total_bytes_written += ret_val;
+	return false;
+}
 
-#if CONFIG_LPS22HH
-	if (ret_val >= 0 && total_bytes_written < buffer_size) {
-		if (fetch_pressure((struct sensor_value*) &sensor_value_arr[0])) {
-			double val = sensor_value_to_double(sensor_value_arr);
-			ret_val =  snprintf(json_payload+total_bytes_written, num_bytes_avail_buffer,
-					"\"pressure\":{\n\"kPa\":%.2lf\n},\n", val);
+static bool telemetry_field_due(enum telemetry_field field,
+		const struct telemetry_value *cur, int64_t now)
+{
+	const struct telemetry_field_state *st = &telemetry_state[field];
+	const struct telemetry_policy *pol = &telemetry_policies[field];
+	int64_t elapsed = now - st->last_report_ms;
+
+	if (!st->acked_once) {
+		return true;
+	}
+	if (pol->max_interval && elapsed >= (int64_t)pol->max_interval * MSEC_PER_SEC) {
+		return true;
+	}
+	if (elapsed < (int64_t)pol->min_interval * MSEC_PER_SEC) {
+		return false;
+	}
+	return telemetry_changed(field, cur);
+}
+
+static int format_field(enum telemetry_field field, const struct telemetry_value *v,
+		char *buf, size_t len)
+{
+	switch (field) {
+		case TELEM_ACCELEROMETER:
+			return snprintf(buf, len,
+					"\"accelerometer\":{\n\"x\":%.2lf,\n\"y\":%.2lf,\n\"z\":%.2lf\n}",
+					v->val[0], v->val[1], v->val[2]);
+		case TELEM_BATTERY:
+			{
+				uint32_t millivolts = (uint32_t)v->val[2];
+				return snprintf(buf, len,
+						"\"battery\":{\n\"voltage\":%d.%03d,\n\"percent\":%d,\n\"state\":\"%s\"\n}",
+						millivolts/1000, millivolts%1000, (int)v->val[0],
+						battery_state_string[(int)v->val[1]]);
+			}
+		case TELEM_CELL_SIGNAL:
+			if (v->valid) {
+				return snprintf(buf, len, "\"cellSignalStrength\":{\n\"dbm\":%d\n}",
+						(int)v->val[0]);
+			}
+			return snprintf(buf, len, "\"cellSignalStrength\":{\n\"dbm\":null\n}");
+		case TELEM_TEMPERATURE:
+			return snprintf(buf, len, "\"temperature\":{\n\"temperatureCelsius\":%.1lf\n}",
+					v->val[0]);
+		case TELEM_AMBIENT_LIGHT:
+			return snprintf(buf, len,
+					"\"ambientLight\":{\n\"visibleLux\":%.2lf,\n\"irLux\":%.2lf\n}",
+					v->val[0], v->val[1]);
+		case TELEM_PRESSURE:
+			return snprintf(buf, len, "\"pressure\":{\n\"kPa\":%.2lf\n}", v->val[0]);
+		case TELEM_MAP:
+			return snprintf(buf, len,
+					"\"map\":{\n\"lat\":%.6lf,\n\"lng\":%.6lf,\n\"alt\":%.2lf,\n\"hdop\":%.2lf\n}",
+					v->val[0], v->val[1], v->val[2], v->val[3]);
+		default:
+			return -EINVAL;
+	}
+}
+
+/**
+ * @brief Build the telemetry payload
+ *
+ * In sparse mode only fields whose reporting policy says they are due are
+ * written; a full-state heartbeat is sent every telemetry_heartbeat_secs.
+ *
+ * @return number of bytes written, 0 if nothing is due, <0 on error
+ */
+int  create_json()
+{
+	struct telemetry_value cur[TELEM_FIELD_COUNT];
+	int64_t now = k_uptime_get();
+	int buffer_size = MAX_PAYLOAD_BUFFER_SIZE;
+	int written = 0;
+	int ret_val;
+
+	memset(json_payload, 0, MAX_PAYLOAD_BUFFER_SIZE);
+	sample_telemetry(cur);
+
+	bool heartbeat = !telemetry_sparse || !telemetry_heartbeat_acked ||
+		(telemetry_heartbeat_secs &&
+		 (now - telemetry_last_heartbeat_ms) >= (int64_t)telemetry_heartbeat_secs * MSEC_PER_SEC);
+
+	telemetry_pending_mask = 0;
+	telemetry_pending_heartbeat = heartbeat;
+	for (int i = 0; i < TELEM_FIELD_COUNT; i++) {
+		/* Sensors that are absent are never reported (except cell, as null) */
+		if (!cur[i].valid && i != TELEM_CELL_SIGNAL) {
+			continue;
+		}
+		if (heartbeat || telemetry_field_due(i, &cur[i], now)) {
+			telemetry_pending_mask |= BIT(i);
+			telemetry_state[i].pending = cur[i];
 		}
-	} else {
-		return ret_val;
 	}
-	num_bytes_avail_buffer -=  ret_val;
-	total_bytes_written += ret_val;
-#endif
 
-	if (ret_val >= 0 && total_bytes_written < buffer_size) {
-		get_gnss_location_info(&lat, &lon, &alt, &hdop);
-		ret_val = snprintf(json_payload+total_bytes_written, num_bytes_avail_buffer,
-				"\"map\":{\n\"lat\":%.6lf,\n\"lng\":%.6lf,\n\"alt\":%.2lf,\n\"hdop\":%.2lf\n}\n", lat, lon, alt, hdop);
-	} else {
-		return ret_val;
+	if (!telemetry_pending_mask) {
+		printf_debug("No telemetry fields due\n");
+		return 0;
 	}
-	num_bytes_avail_buffer -=  ret_val;
-	total_bytes_written += ret_val;
 
-	if (ret_val >= 0 && total_bytes_written < buffer_size) {
-		// Final bracket
-		ret_val = snprintf(json_payload+total_bytes_written, num_bytes_avail_buffer, "}\n");
-	} else {
-		return ret_val;
+	// Initial bracket
+	ret_val = snprintf(json_payload, buffer_size, "{\n");
+	written += ret_val;
+
+	bool first = true;
+	for (int i = 0; i < TELEM_FIELD_COUNT; i++) {
+		if (!(telemetry_pending_mask & BIT(i))) {
+			continue;
+		}
+		if (!first) {
+			ret_val = snprintf(json_payload + written, buffer_size - written, ",\n");
+			if (ret_val < 0 || written + ret_val >= buffer_size) {
+				return -ENOMEM;
+			}
+			written += ret_val;
+		}
+		ret_val = format_field(i, &cur[i], json_payload + written, buffer_size - written);
+		if (ret_val < 0 || written + ret_val >= buffer_size) {
+			return -ENOMEM;
+		}
+		written += ret_val;
+		first = false;
+	}
+
+	// Final bracket
+	ret_val = snprintf(json_payload + written, buffer_size - written, "\n}\n");
+	if (ret_val < 0 || written + ret_val >= buffer_size) {
+		return -ENOMEM;
 	}
-	total_bytes_written += ret_val;
+	written += ret_val;
 
 #ifdef CONFIG_DEBUG_JSON_GENERATION
-	printf("\n total_bytes_written %d ", total_bytes_written);
+	printf("\n total_bytes_written %d ", written);
 	printf("\n%s\n", json_payload);
 #endif
-	return total_bytes_written;
+	return written;
+}
+
+/**
+ * @brief Mark the fields of the last payload as acknowledged by the server
+ */
+void telemetry_ack(void)
+{
+	int64_t now = k_uptime_get();
+
+	for (int i = 0; i < TELEM_FIELD_COUNT; i++) {
+		if (telemetry_pending_mask & BIT(i)) {
+			telemetry_state[i].acked = telemetry_state[i].pending;
+			telemetry_state[i].acked_once = true;
+			telemetry_state[i].last_report_ms = now;
+		}
+	}
+	if (telemetry_pending_heartbeat) {
+		telemetry_last_heartbeat_ms = now;
+		telemetry_heartbeat_acked = true;
+	}
+	telemetry_pending_mask = 0;
+	telemetry_pending_heartbeat = false;
 }
 
 char* get_json_payload_pointer()
@@ -311,17 +522,33 @@ static void tmo_web_demo_notif_thread(void *a, void *b, void *c)
 	ARG_UNUSED(a);
 	ARG_UNUSED(b);
 	ARG_UNUSED(c);
-	k_sleep(K_SECONDS(TRANSMIT_INTERVAL_SECS_WEB));
+	k_sleep(K_SECONDS(TRANSMIT_INTERVAL_SECS_WEB + tmo_telemetry_sched_start_delay()));
+	tmo_telemetry_sched_init();
 
 	while (1) {
-		k_sleep(K_SECONDS(web_demo_settings.transmit_interval));
+		tmo_telemetry_sched_wait(tmo_telemetry_sched_next(web_demo_settings.transmit_interval));
 		uint8_t charging = 0;
 		uint8_t vbus = 0;
 		if (get_transmit_flag()) {
 			get_battery_charging_status(&charging, &vbus, &battery_attached, &fault);
-			create_json();
+			if (create_json() <= 0) {
+				continue;
+			}
+			bool retry = tmo_telemetry_sched_retrying();
+			if (retry && tmo_http_retry_begin(K_NO_WAIT) != 0) {
+				printf_debug("Retry slots busy, deferring telemetry\n");
+				continue;
+			}
 			increment_number_http_requests();
-			tmo_http_json();
+			int retry_after;
+			int ret = tmo_http_json(&retry_after);
+			if (ret == 0) {
+				telemetry_ack();
+			}
+			tmo_telemetry_sched_result(ret, retry_after);
+			if (retry) {
+				tmo_http_retry_end();
+			}
 		}
 	}
 }
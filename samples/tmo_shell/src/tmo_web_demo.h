@@ -18,6 +18,32 @@ struct web_demo_settings_t {
 	unsigned int transmit_interval;
 };
 
+#define TELEM_MAX_VALUES             4
+
+enum telemetry_field {
+	TELEM_ACCELEROMETER,
+	TELEM_BATTERY,
+	TELEM_CELL_SIGNAL,
+	TELEM_TEMPERATURE,
+	TELEM_AMBIENT_LIGHT,
+	TELEM_PRESSURE,
+	TELEM_MAP,
+	TELEM_FIELD_COUNT
+};
+
+/* Reporting policy of a single telemetry field
+ * deadband:     minimum change (absolute) that makes the field due
+ * min_interval: never report more often than this (secs, 0 = no limit)
+ * max_interval: always report at least this often (secs, 0 = heartbeat only)
+ * on_change:    report on any change, ignoring the deadband
+ */
+struct telemetry_policy {
+	double deadband;
+	unsigned int min_interval;
+	unsigned int max_interval;
+	bool on_change;
+};
+
 enum battery_state {
 	battery_state_charging,
 	battery_state_not_charging,
@@ -40,6 +66,15 @@ char *get_json_path();
 int get_cell_strength(int *val);
 
 int  create_json();
+void telemetry_ack(void);
+int telemetry_field_from_name(const char *name);
+const char *telemetry_field_name(enum telemetry_field field);
+int set_telemetry_policy(enum telemetry_field field, const struct telemetry_policy *policy);
+int get_telemetry_policy(enum telemetry_field field, struct telemetry_policy *policy);
+void set_telemetry_sparse(bool sparse);
+bool get_telemetry_sparse(void);
+void set_telemetry_heartbeat(unsigned int secs);
+unsigned int get_telemetry_heartbeat(void);
 int read_accelerometer( SENSOR_VALUE_STRUCT *acc_sensor_arr);
 #ifdef CONFIG_DEBUG_TMO_WEB_DEMO
 #define printf_debug printf
@@ -17,6 +17,7 @@
 #endif
 
 #include "tmo_shell.h"
+#include "tmo_link_mgr.h"
 
 #define WIFI_SHELL_MGMT_EVENTS (NET_EVENT_WIFI_SCAN_RESULT | \
 		NET_EVENT_WIFI_SCAN_DONE |		\
@@ -222,9 +223,12 @@ static void wifi_mgmt_event_handler(struct net_mgmt_event_callback *cb,
 			break;
 		case NET_EVENT_WIFI_CONNECT_RESULT:
 			handle_wifi_connect_result(cb);
+			tmo_link_set_up(net_if_get_by_iface(iface),
+					!((const struct wifi_status *)cb->info)->status);
 			break;
 		case NET_EVENT_WIFI_DISCONNECT_RESULT:
 			handle_wifi_disconnect_result(cb);
+			tmo_link_set_up(net_if_get_by_iface(iface), false);
 			break;
 		case NET_EVENT_WIFI_STATUS_RESULT:
 			handle_wifi_status_result(cb);
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tmo_xfer_buf, LOG_LEVEL_INF);
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+
+#include "tmo_xfer_buf.h"
+#ifdef BOOT_SLOT
+#include "dfu_gecko_lib.h"
+#endif
+
+/*
+ * Large transfer buffers shared by the shell socket commands, file
+ * copies, kermit, certificate parsing, HTTP transfers and the DFU
+ * paths. None of these used to hold their buffer for long, but they all
+ * aliased the same static arrays. Each user now takes a whole buffer for the length of
+ * its transfer and tags it with its name, so a second transfer waits
+ * or fails cleanly instead of overwriting the first.
+ */
+
+static uint8_t pool[CONFIG_TMO_XFER_BUF_COUNT][TMO_XFER_BUF_SIZE] __aligned(4);
+
+static struct {
+	const char *owner;
+	const char *last_owner;
+	int64_t since;
+	uint32_t max_held_ms;
+	uint32_t uses;
+} slot[CONFIG_TMO_XFER_BUF_COUNT];
+
+static struct tmo_xfer_buf_stats stats;
+static K_SEM_DEFINE(xfer_buf_free, CONFIG_TMO_XFER_BUF_COUNT, CONFIG_TMO_XFER_BUF_COUNT);
+static K_MUTEX_DEFINE(xfer_buf_mutex);
+
+uint8_t *tmo_xfer_buf_acquire(const char *owner, k_timeout_t timeout)
+{
+	uint8_t *buf = NULL;
+
+	k_mutex_lock(&xfer_buf_mutex, K_FOREVER);
+	stats.acquires++;
+	if (k_sem_count_get(&xfer_buf_free) == 0) {
+		stats.waits++;
+	}
+	k_mutex_unlock(&xfer_buf_mutex);
+
+	if (k_sem_take(&xfer_buf_free, timeout)) {
+		k_mutex_lock(&xfer_buf_mutex, K_FOREVER);
+		stats.fails++;
+		stats.fail_owner = owner;
+		k_mutex_unlock(&xfer_buf_mutex);
+		LOG_WRN("No transfer buffer for %s", owner);
+		return NULL;
+	}
+
+	k_mutex_lock(&xfer_buf_mutex, K_FOREVER);
+	for (int i = 0; i < CONFIG_TMO_XFER_BUF_COUNT; i++) {
+		if (slot[i].owner == NULL) {
+			slot[i].owner = owner;
+			slot[i].last_owner = owner;
+			slot[i].since = k_uptime_get();
+			slot[i].uses++;
+			buf = pool[i];
+			break;
+		}
+	}
+	stats.in_use++;
+	stats.peak = MAX(stats.peak, stats.in_use);
+	k_mutex_unlock(&xfer_buf_mutex);
+	LOG_DBG("%s took buffer %d", owner, (int)((buf - pool[0]) / TMO_XFER_BUF_SIZE));
+	return buf;
+}
+
+void tmo_xfer_buf_release(uint8_t *buf)
+{
+	int i;
+
+	if (buf == NULL) {
+		return;
+	}
+	if (buf < pool[0] || buf > pool[CONFIG_TMO_XFER_BUF_COUNT - 1] ||
+			(buf - pool[0]) % TMO_XFER_BUF_SIZE) {
+		LOG_ERR("Release of unknown buffer %p", (void *)buf);
+		return;
+	}
+	i = (buf - pool[0]) / TMO_XFER_BUF_SIZE;
+
+	k_mutex_lock(&xfer_buf_mutex, K_FOREVER);
+	if (slot[i].owner == NULL) {
+		k_mutex_unlock(&xfer_buf_mutex);
+		LOG_ERR("Buffer %d released twice", i);
+		return;
+	}
+	slot[i].max_held_ms = MAX(slot[i].max_held_ms, (uint32_t)(k_uptime_get() - slot[i].since));
+	slot[i].owner = NULL;
+	stats.in_use--;
+	k_mutex_unlock(&xfer_buf_mutex);
+	k_sem_give(&xfer_buf_free);
+}
+
+void tmo_xfer_buf_get_stats(struct tmo_xfer_buf_stats *st)
+{
+	k_mutex_lock(&xfer_buf_mutex, K_FOREVER);
+	*st = stats;
+	k_mutex_unlock(&xfer_buf_mutex);
+	st->count = CONFIG_TMO_XFER_BUF_COUNT;
+	st->size = TMO_XFER_BUF_SIZE;
+}
+
+int tmo_xfer_buf_get_owners(struct tmo_xfer_buf_owner *owners, int max)
+{
+	int n = MIN(max, CONFIG_TMO_XFER_BUF_COUNT);
+
+	k_mutex_lock(&xfer_buf_mutex, K_FOREVER);
+	for (int i = 0; i < n; i++) {
+		owners[i].owner = slot[i].owner;
+		owners[i].last_owner = slot[i].last_owner;
+		owners[i].held_ms = slot[i].owner ? k_uptime_get() - slot[i].since : 0;
+		owners[i].max_held_ms = MAX(slot[i].max_held_ms, owners[i].held_ms);
+		owners[i].uses = slot[i].uses;
+	}
+	k_mutex_unlock(&xfer_buf_mutex);
+	return n;
+}
+
+#if defined(BOOT_SLOT) && IS_ENABLED(CONFIG_DFU_GECKO_LIB)
+/* Required by CONFIG_DFU_GECKO_BUF_OPS, the lib has no buffer of its own then */
+static uint8_t *gecko_buf_get(size_t len)
+{
+	if (len > TMO_XFER_BUF_SIZE) {
+		return NULL;
+	}
+	return tmo_xfer_buf_acquire("dfu_mcu", K_SECONDS(1));
+}
+
+static int tmo_xfer_buf_init(const struct device *dev)
+{
+	ARG_UNUSED(dev);
+	dfu_mcu_set_buf_ops(gecko_buf_get, tmo_xfer_buf_release);
+	return 0;
+}
+
+SYS_INIT(tmo_xfer_buf_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
+#endif
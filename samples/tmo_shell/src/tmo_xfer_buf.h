@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TMO_XFER_BUF_H
+#define TMO_XFER_BUF_H
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/* Big enough for the 5000 byte socket transfers plus a terminator */
+#define TMO_XFER_BUF_SIZE 5120
+
+struct tmo_xfer_buf_stats {
+	uint32_t count;
+	uint32_t size;
+	uint32_t in_use;
+	uint32_t peak;            /* most buffers held at once */
+	uint32_t acquires;
+	uint32_t waits;           /* acquires that found the pool empty */
+	uint32_t fails;           /* acquires that timed out */
+	const char *fail_owner;   /* last owner that could not get a buffer */
+};
+
+struct tmo_xfer_buf_owner {
+	const char *owner;        /* NULL while free */
+	const char *last_owner;
+	uint32_t held_ms;         /* time the current owner has held it */
+	uint32_t max_held_ms;
+	uint32_t uses;
+};
+
+/**
+ * @brief Take a buffer of TMO_XFER_BUF_SIZE bytes from the pool
+ *
+ * @param owner static string naming the user, shown by "tmo bufs"
+ * @param timeout how long to wait for another user to release one
+ * @return the buffer, or NULL if none was released in time
+ */
+uint8_t *tmo_xfer_buf_acquire(const char *owner, k_timeout_t timeout);
+
+/** @brief Give a buffer back, NULL is ignored */
+void tmo_xfer_buf_release(uint8_t *buf);
+
+void tmo_xfer_buf_get_stats(struct tmo_xfer_buf_stats *st);
+
+/** @brief Copy out one entry per buffer, return the number copied */
+int tmo_xfer_buf_get_owners(struct tmo_xfer_buf_owner *owners, int max);
+
+#endif
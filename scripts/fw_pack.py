@@ -0,0 +1,164 @@
+"""Pack Gecko slot images for compressed DFU.
+
+Writes <image>.hs: the "HSZ1" header followed by a heatshrink stream, which
+dfu_gecko_lib unpacks into the inactive slot while flashing. Every packed
+image is unpacked again and compared with the input before it is written.
+
+  python fw_pack.py zephyr.slot0.bin zephyr.slot1.bin --sha1
+"""
+import argparse, hashlib, os, struct
+
+MAGIC = b'HSZ1'
+HEADER = struct.Struct('<4sBBHI')
+
+
+class BitWriter:
+	def __init__(self):
+		self.out = bytearray()
+		self.acc = 0
+		self.count = 0
+
+	def put(self, value, bits):
+		for shift in range(bits - 1, -1, -1):
+			self.acc = (self.acc << 1) | ((value >> shift) & 1)
+			self.count += 1
+			if self.count == 8:
+				self.out.append(self.acc)
+				self.acc = 0
+				self.count = 0
+
+	def flush(self):
+		if self.count:
+			self.out.append(self.acc << (8 - self.count))
+			self.acc = 0
+			self.count = 0
+		return bytes(self.out)
+
+
+def compress(data, window_sz2, lookahead_sz2, max_chain=128):
+	window = 1 << window_sz2
+	max_len = 1 << lookahead_sz2
+	# A back-reference only pays off once it is shorter than the literals
+	min_len = (1 + window_sz2 + lookahead_sz2) // 9 + 1
+	chains = {}
+	bw = BitWriter()
+	i = 0
+	n = len(data)
+
+	def insert(pos):
+		if pos + 1 < n:
+			chains.setdefault(data[pos:pos + 2], []).append(pos)
+
+	while i < n:
+		best_len = 0
+		best_dist = 0
+		candidates = chains.get(data[i:i + 2], [])
+		while candidates and candidates[0] < i - window:
+			candidates.pop(0)
+		limit = min(max_len, n - i)
+		for pos in reversed(candidates[-max_chain:]):
+			length = 0
+			while length < limit and data[pos + length] == data[i + length]:
+				length += 1
+			if length > best_len:
+				best_len = length
+				best_dist = i - pos
+				if length == limit:
+					break
+		if best_len >= min_len:
+			bw.put(0, 1)
+			bw.put(best_dist - 1, window_sz2)
+			bw.put(best_len - 1, lookahead_sz2)
+			for pos in range(i, i + best_len):
+				insert(pos)
+			i += best_len
+		else:
+			bw.put(1, 1)
+			bw.put(data[i], 8)
+			insert(i)
+			i += 1
+	return bw.flush()
+
+
+def decompress(stream, raw_size, window_sz2, lookahead_sz2):
+	out = bytearray()
+	bit_pos = 0
+	total_bits = len(stream) * 8
+
+	def get(bits):
+		nonlocal bit_pos
+		if bit_pos + bits > total_bits:
+			raise ValueError('stream is truncated')
+		val = 0
+		for _ in range(bits):
+			val = (val << 1) | ((stream[bit_pos >> 3] >> (7 - (bit_pos & 7))) & 1)
+			bit_pos += 1
+		return val
+
+	while len(out) < raw_size:
+		if get(1):
+			out.append(get(8))
+		else:
+			dist = get(window_sz2) + 1
+			length = get(lookahead_sz2) + 1
+			for _ in range(length):
+				if len(out) == raw_size:
+					break
+				# the device window starts zero filled
+				out.append(out[-dist] if dist <= len(out) else 0)
+	return bytes(out)
+
+
+def pack(data, window_sz2, lookahead_sz2):
+	stream = compress(data, window_sz2, lookahead_sz2)
+	return HEADER.pack(MAGIC, window_sz2, lookahead_sz2, 0, len(data)) + stream
+
+
+def unpack(packed):
+	magic, window_sz2, lookahead_sz2, _, raw_size = HEADER.unpack_from(packed)
+	if magic != MAGIC:
+		raise ValueError('not a packed image')
+	return decompress(packed[HEADER.size:], raw_size, window_sz2, lookahead_sz2)
+
+
+parser = argparse.ArgumentParser(prog='fw_pack')
+
+parser.add_argument('images', nargs='+', help='Raw slot images')
+parser.add_argument('-w', '--window', type=int, default=11,
+		help='Window size, log2 bytes (<= CONFIG_DFU_GECKO_HEATSHRINK_WINDOW_BITS)')
+parser.add_argument('-l', '--lookahead', type=int, default=4, help='Lookahead size, log2 bytes')
+parser.add_argument('-s', '--sha1', action='store_true', help='Also write <image>.sha1 of the raw image')
+parser.add_argument('-u', '--unpack', action='store_true', help='Unpack .hs files to <file>.raw instead')
+
+args = parser.parse_args()
+
+if not 4 <= args.window <= 14 or not 3 <= args.lookahead < args.window:
+	print('Window must be 4-14 and lookahead 3 to window-1')
+	exit(1)
+
+for image in args.images:
+	if not os.path.exists(image):
+		print(f"No such file {image}")
+		exit(1)
+	with open(image, 'rb') as f:
+		data = f.read()
+
+	if args.unpack:
+		raw = unpack(data)
+		out_name = image + '.raw'
+		with open(out_name, 'wb') as f:
+			f.write(raw)
+		print(f"{image}: {len(data)} -> {len(raw)} bytes, {out_name}")
+		continue
+
+	packed = pack(data, args.window, args.lookahead)
+	if unpack(packed) != data:
+		print(f"{image}: round trip mismatch, not written")
+		exit(2)
+	with open(image + '.hs', 'wb') as f:
+		f.write(packed)
+	if args.sha1:
+		with open(image + '.sha1', 'w') as f:
+			f.write(hashlib.sha1(data).hexdigest())
+	saved = 100 - len(packed) * 100 // max(len(data), 1)
+	print(f"{image}: {len(data)} -> {len(packed)} bytes ({saved}% smaller), {image}.hs")
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host driver for dfu_gecko_hs.c: decodes a packed image the way
+ * dfu_gecko_lib does, in reads of the given size, then rewinds and decodes
+ * it again as the verify pass does.
+ *
+ *   hs_host <image.hs> <out.raw> <read size>
+ *
+ * Exits 0 on success, or prints the failing call and its return value.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dfu_gecko_hs.h"
+
+static int decode(uint8_t *out, size_t max, size_t chunk)
+{
+	size_t total = 0;
+	int ret;
+
+	do {
+		ret = dfu_hs_read(out + total, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		total += ret;
+	} while (ret > 0 && total + chunk <= max);
+	return total;
+}
+
+int main(int argc, char **argv)
+{
+	struct fs_file_t file;
+	uint8_t *first;
+	uint8_t *again;
+	size_t chunk;
+	int raw_size;
+	int ret;
+
+	if (argc != 4) {
+		fprintf(stderr, "usage: hs_host <image.hs> <out.raw> <read size>\n");
+		return 2;
+	}
+	chunk = strtoul(argv[3], NULL, 0);
+	file.fp = fopen(argv[1], "rb");
+	if (file.fp == NULL || chunk == 0) {
+		perror(argv[1]);
+		return 2;
+	}
+
+	raw_size = dfu_hs_open(&file);
+	if (raw_size < 0) {
+		printf("open %d\n", raw_size);
+		return 1;
+	}
+	/* Room for one read past the end, which must return 0 */
+	first = calloc(1, raw_size + chunk);
+	again = calloc(1, raw_size + chunk);
+
+	ret = decode(first, raw_size + chunk, chunk);
+	if (ret != raw_size) {
+		printf("read %d of %d\n", ret, raw_size);
+		return 1;
+	}
+	ret = dfu_hs_rewind();
+	if (ret) {
+		printf("rewind %d\n", ret);
+		return 1;
+	}
+	ret = decode(again, raw_size + chunk, chunk);
+	if (ret != raw_size || memcmp(first, again, raw_size)) {
+		printf("second pass differs\n");
+		return 1;
+	}
+
+	FILE *out = fopen(argv[2], "wb");
+
+	fwrite(first, 1, raw_size, out);
+	fclose(out);
+	fclose(file.fp);
+	return 0;
+}
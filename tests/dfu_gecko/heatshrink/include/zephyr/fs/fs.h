@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Host stand-in for the Zephyr file system API, backed by stdio */
+
+#ifndef HOST_ZEPHYR_FS_H
+#define HOST_ZEPHYR_FS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#define FS_SEEK_SET SEEK_SET
+
+struct fs_file_t {
+	FILE *fp;
+};
+
+static inline ssize_t fs_read(struct fs_file_t *file, void *ptr, size_t size)
+{
+	size_t ret = fread(ptr, 1, size, file->fp);
+
+	return ferror(file->fp) ? -5 : (ssize_t)ret;
+}
+
+static inline int fs_seek(struct fs_file_t *file, off_t offset, int whence)
+{
+	return fseek(file->fp, offset, whence) ? -5 : 0;
+}
+
+#endif
@@ -0,0 +1,16 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_ZEPHYR_LOG_H
+#define HOST_ZEPHYR_LOG_H
+
+#include <stdio.h>
+
+#define LOG_MODULE_REGISTER(name, level)
+#define LOG_ERR(fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+#define LOG_INF(fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+
+#endif
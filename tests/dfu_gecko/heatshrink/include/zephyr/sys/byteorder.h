@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_ZEPHYR_BYTEORDER_H
+#define HOST_ZEPHYR_BYTEORDER_H
+
+#include <stdint.h>
+
+static inline uint32_t sys_get_le32(const uint8_t src[4])
+{
+	return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+#endif
@@ -0,0 +1,126 @@
+"""Round trip scripts/fw_pack.py images through the device decoder.
+
+dfu_gecko_hs.c is built for the host against the stand-in headers in
+include/, and must reproduce every packed image bit for bit.
+
+  python -m pytest tests/dfu_gecko/heatshrink
+"""
+import errno, os, random, shutil, subprocess, sys
+
+import pytest
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.normpath(os.path.join(HERE, '..', '..', '..'))
+FW_PACK = os.path.join(ROOT, 'scripts', 'fw_pack.py')
+DECODER = os.path.join(ROOT, 'dfu_gecko', 'dfu_gecko_hs.c')
+# Kconfig default of CONFIG_DFU_GECKO_HEATSHRINK_WINDOW_BITS
+DEVICE_WINDOW = 11
+
+
+def sample_images():
+	rnd = random.Random(1)
+	code = bytes(rnd.choice(b'\x00\x20\x48\x68\xb5\xbd\xf0\xff') for _ in range(6000))
+	return {
+		'empty': b'',
+		'one_byte': b'\x5a',
+		'zeros': bytes(70000),
+		'erased_flash': b'\xff' * 8192,
+		'random': rnd.randbytes(20000),
+		'text': b'Gecko DFU slot image, packed by fw_pack.py\n' * 900,
+		# Runs longer than the lookahead and matches at the far end of the window
+		'long_runs': (b'A' * 300 + rnd.randbytes(1500)) * 12,
+		'code_like': code * 3 + rnd.randbytes(3000) + code,
+		'page_multiple': rnd.randbytes(1024) * 8,
+	}
+
+
+@pytest.fixture(scope='module')
+def build(tmp_path_factory):
+	cc = shutil.which(os.environ.get('CC', 'cc'))
+	if cc is None:
+		pytest.skip('no host C compiler')
+	out = tmp_path_factory.mktemp('bin')
+	built = {}
+
+	def compile(window_bits):
+		if window_bits in built:
+			return built[window_bits]
+		exe = str(out / f'hs_host_{window_bits}')
+		subprocess.run([cc, '-Wall', '-Werror', '-O2',
+				f'-DCONFIG_DFU_GECKO_HEATSHRINK_WINDOW_BITS={window_bits}',
+				'-I', os.path.join(HERE, 'include'), '-I', os.path.join(ROOT, 'dfu_gecko'),
+				os.path.join(HERE, 'hs_host.c'), DECODER, '-o', exe], check=True)
+		built[window_bits] = exe
+		return exe
+	return compile
+
+
+def fw_pack(*args):
+	return subprocess.run([sys.executable, FW_PACK, *args], capture_output=True, text=True)
+
+
+def decode(exe, packed, raw_out, chunk):
+	return subprocess.run([exe, str(packed), str(raw_out), str(chunk)],
+			capture_output=True, text=True)
+
+
+@pytest.mark.parametrize('name', sample_images().keys())
+@pytest.mark.parametrize('window,lookahead', [(DEVICE_WINDOW, 4), (8, 4), (11, 8), (4, 3)])
+def test_round_trip(build, tmp_path, name, window, lookahead):
+	data = sample_images()[name]
+	image = tmp_path / f'{name}.bin'
+	image.write_bytes(data)
+
+	res = fw_pack('-w', str(window), '-l', str(lookahead), '--sha1', str(image))
+	assert res.returncode == 0, res.stdout
+	packed = tmp_path / f'{name}.bin.hs'
+
+	exe = build(DEVICE_WINDOW)
+	# dfu_gecko_lib reads a flash page at a time, odd sizes cross every boundary
+	for chunk in (2048, 1, 333):
+		raw = tmp_path / f'{name}.{chunk}.raw'
+		res = decode(exe, packed, raw, chunk)
+		assert res.returncode == 0, res.stdout
+		assert raw.read_bytes() == data, f'read size {chunk}'
+
+
+def test_window_too_large(build, tmp_path):
+	image = tmp_path / 'img.bin'
+	image.write_bytes(b'window' * 1000)
+	assert fw_pack('-w', str(DEVICE_WINDOW + 1), str(image)).returncode == 0
+
+	res = decode(build(DEVICE_WINDOW), tmp_path / 'img.bin.hs', tmp_path / 'img.raw', 2048)
+	assert res.stdout.strip() == f'open {-errno.ENOTSUP}'
+	res = decode(build(DEVICE_WINDOW + 1), tmp_path / 'img.bin.hs', tmp_path / 'img.raw', 2048)
+	assert res.returncode == 0, res.stdout
+
+
+def test_raw_image_not_decoded(build, tmp_path):
+	image = tmp_path / 'img.bin'
+	image.write_bytes(bytes(range(256)) * 4)
+
+	res = decode(build(DEVICE_WINDOW), image, tmp_path / 'img.raw', 2048)
+	assert res.stdout.strip() == f'open {-errno.ENOMSG}'
+
+
+def test_truncated_stream(build, tmp_path):
+	image = tmp_path / 'img.bin'
+	image.write_bytes(random.Random(2).randbytes(5000))
+	assert fw_pack(str(image)).returncode == 0
+	packed = tmp_path / 'img.bin.hs'
+	packed.write_bytes(packed.read_bytes()[:-100])
+
+	res = decode(build(DEVICE_WINDOW), packed, tmp_path / 'img.raw', 2048)
+	assert res.returncode == 1
+	assert res.stdout.startswith(f'read {-errno.EIO}')
+
+
+def test_unpack_matches_device(build, tmp_path):
+	image = tmp_path / 'img.bin'
+	image.write_bytes(sample_images()['code_like'])
+	assert fw_pack(str(image)).returncode == 0
+	assert fw_pack('-u', str(tmp_path / 'img.bin.hs')).returncode == 0
+
+	res = decode(build(DEVICE_WINDOW), tmp_path / 'img.bin.hs', tmp_path / 'img.raw', 2048)
+	assert res.returncode == 0, res.stdout
+	assert (tmp_path / 'img.raw').read_bytes() == (tmp_path / 'img.bin.hs.raw').read_bytes()
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/ztest.h>
+
+#include "tmo_http_coding.h"
+
+#define PARSE(s) tmo_http_coding_parse(s, strlen(s))
+
+ZTEST(http_coding, test_parse_codings)
+{
+	zassert_equal(PARSE("gzip"), TMO_HTTP_GZIP);
+	zassert_equal(PARSE("GZip"), TMO_HTTP_GZIP);
+	zassert_equal(PARSE("x-gzip"), TMO_HTTP_GZIP);
+	zassert_equal(PARSE("deflate"), TMO_HTTP_DEFLATE);
+	zassert_equal(PARSE("identity"), TMO_HTTP_IDENTITY);
+	zassert_equal(PARSE("br"), TMO_HTTP_IDENTITY);
+	zassert_equal(PARSE(""), TMO_HTTP_IDENTITY);
+}
+
+ZTEST(http_coding, test_parse_uses_length)
+{
+	/* The parser hands over values that are not NUL terminated */
+	zassert_equal(tmo_http_coding_parse("gzipped", 4), TMO_HTTP_GZIP);
+	zassert_equal(tmo_http_coding_parse("gzip", 3), TMO_HTTP_IDENTITY);
+	zassert_equal(tmo_http_coding_parse("deflate, gzip", 13), TMO_HTTP_IDENTITY);
+}
+
+ZTEST(http_coding, test_resume_same_coding)
+{
+	zassert_ok(tmo_http_resume_check(206, TMO_HTTP_IDENTITY, TMO_HTTP_IDENTITY));
+	zassert_ok(tmo_http_resume_check(206, TMO_HTTP_GZIP, TMO_HTTP_GZIP));
+	zassert_ok(tmo_http_resume_check(206, TMO_HTTP_DEFLATE, TMO_HTTP_DEFLATE));
+}
+
+ZTEST(http_coding, test_resume_needs_partial_content)
+{
+	zassert_equal(tmo_http_resume_check(200, TMO_HTTP_GZIP, TMO_HTTP_GZIP), -ESPIPE);
+	zassert_equal(tmo_http_resume_check(200, TMO_HTTP_IDENTITY, TMO_HTTP_IDENTITY), -ESPIPE);
+	zassert_equal(tmo_http_resume_check(416, TMO_HTTP_GZIP, TMO_HTTP_GZIP), -ESPIPE);
+	/* A full body is refused before its coding is looked at */
+	zassert_equal(tmo_http_resume_check(200, TMO_HTTP_GZIP, TMO_HTTP_IDENTITY), -ESPIPE);
+}
+
+ZTEST(http_coding, test_resume_coding_changed)
+{
+	zassert_equal(tmo_http_resume_check(206, TMO_HTTP_GZIP, TMO_HTTP_IDENTITY), -EBADMSG);
+	zassert_equal(tmo_http_resume_check(206, TMO_HTTP_IDENTITY, TMO_HTTP_GZIP), -EBADMSG);
+	zassert_equal(tmo_http_resume_check(206, TMO_HTTP_GZIP, TMO_HTTP_DEFLATE), -EBADMSG);
+}
+
+ZTEST_SUITE(http_coding, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Host stand-in for the kernel objects tmo_inflate.c uses, on pthreads */
+
+#ifndef HOST_ZEPHYR_KERNEL_H
+#define HOST_ZEPHYR_KERNEL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define BUILD_ASSERT(cond, msg) _Static_assert(cond, msg)
+
+typedef int k_timeout_t;
+#define K_FOREVER 0
+#define K_NO_WAIT 0
+
+struct k_sem {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int count;
+	unsigned int limit;
+};
+
+#define K_SEM_DEFINE(name, initial, max) \
+	struct k_sem name = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, initial, max}
+
+static inline int k_sem_take(struct k_sem *sem, k_timeout_t timeout)
+{
+	pthread_mutex_lock(&sem->lock);
+	while (sem->count == 0) {
+		pthread_cond_wait(&sem->cond, &sem->lock);
+	}
+	sem->count--;
+	pthread_mutex_unlock(&sem->lock);
+	return 0;
+}
+
+static inline void k_sem_give(struct k_sem *sem)
+{
+	pthread_mutex_lock(&sem->lock);
+	if (sem->count < sem->limit) {
+		sem->count++;
+	}
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->lock);
+}
+
+static inline void k_sem_reset(struct k_sem *sem)
+{
+	pthread_mutex_lock(&sem->lock);
+	sem->count = 0;
+	pthread_mutex_unlock(&sem->lock);
+}
+
+typedef void (*k_thread_entry_t)(void *p1, void *p2, void *p3);
+
+struct k_thread {
+	pthread_t tid;
+	k_thread_entry_t entry;
+};
+
+#define K_THREAD_STACK_DEFINE(name, size) char name[1]
+#define K_THREAD_STACK_SIZEOF(stack) sizeof(stack)
+
+static inline void *host_thread_main(void *arg)
+{
+	struct k_thread *thread = arg;
+
+	thread->entry(NULL, NULL, NULL);
+	return NULL;
+}
+
+static inline void k_thread_create(struct k_thread *thread, char *stack, size_t size,
+		k_thread_entry_t entry, void *p1, void *p2, void *p3, int prio,
+		uint32_t options, k_timeout_t delay)
+{
+	thread->entry = entry;
+	pthread_create(&thread->tid, NULL, host_thread_main, thread);
+}
+
+static inline void k_thread_name_set(struct k_thread *thread, const char *name)
+{
+}
+
+static inline int k_thread_join(struct k_thread *thread, k_timeout_t timeout)
+{
+	return pthread_join(thread->tid, NULL);
+}
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host driver for tmo_inflate.c: decodes a compressed file fed in pieces
+ * of the given size, the way the download callback feeds HTTP fragments.
+ * With "split" the input is instead cut in two at every byte boundary in
+ * turn, and each of those decodes must give the same output.
+ *
+ *   inflate_host <gzip|deflate> <in> <out> <feed size|split>
+ *
+ * Exits 0 on success, or prints the failing call and its return value.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmo_inflate.h"
+
+struct sink {
+	uint8_t *buf;
+	size_t len;
+	size_t size;
+};
+
+static int collect(const uint8_t *buf, size_t len, void *user_data)
+{
+	struct sink *s = user_data;
+
+	if (s->len + len > s->size) {
+		s->size = (s->len + len) * 2;
+		s->buf = realloc(s->buf, s->size);
+	}
+	memcpy(s->buf + s->len, buf, len);
+	s->len += len;
+	return 0;
+}
+
+/* Feed in[0, len) cut at each of the cuts, then finish */
+static int decode(enum tmo_inflate_fmt fmt, const uint8_t *in, size_t len,
+		const size_t *cuts, int ncuts, struct sink *out)
+{
+	size_t pos = 0;
+	int ret;
+
+	out->len = 0;
+	ret = tmo_inflate_start(fmt, collect, out);
+	if (ret) {
+		printf("start %d\n", ret);
+		return ret;
+	}
+	for (int i = 0; i <= ncuts; i++) {
+		size_t end = i < ncuts ? cuts[i] : len;
+
+		ret = tmo_inflate_feed(in + pos, end - pos);
+		if (ret) {
+			printf("feed %d\n", ret);
+			tmo_inflate_finish();
+			return ret;
+		}
+		pos = end;
+	}
+	ret = tmo_inflate_finish();
+	if (ret) {
+		printf("finish %d\n", ret);
+		return ret;
+	}
+	if (tmo_inflate_total_out() != out->len) {
+		printf("total %u of %zu\n", tmo_inflate_total_out(), out->len);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	enum tmo_inflate_fmt fmt;
+	struct sink first = {0};
+	struct sink again = {0};
+	uint8_t *in;
+	long len;
+	FILE *fp;
+
+	if (argc != 5) {
+		fprintf(stderr, "usage: inflate_host <gzip|deflate> <in> <out> <feed size|split>\n");
+		return 2;
+	}
+	fmt = strcmp(argv[1], "gzip") ? TMO_INFLATE_DEFLATE : TMO_INFLATE_GZIP;
+	fp = fopen(argv[2], "rb");
+	if (fp == NULL) {
+		perror(argv[2]);
+		return 2;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	rewind(fp);
+	in = malloc(len + 1);
+	if (fread(in, 1, len, fp) != (size_t)len) {
+		perror(argv[2]);
+		return 2;
+	}
+	fclose(fp);
+
+	if (strcmp(argv[4], "split") == 0) {
+		if (decode(fmt, in, len, NULL, 0, &first)) {
+			return 1;
+		}
+		for (size_t cut = 0; cut <= (size_t)len; cut++) {
+			if (decode(fmt, in, len, &cut, 1, &again)) {
+				printf("at cut %zu\n", cut);
+				return 1;
+			}
+			if (again.len != first.len || memcmp(again.buf, first.buf, first.len)) {
+				printf("cut %zu differs\n", cut);
+				return 1;
+			}
+		}
+	} else {
+		long chunk = strtol(argv[4], NULL, 0);
+		int ncuts;
+		size_t *cuts;
+
+		if (chunk <= 0) {
+			fprintf(stderr, "bad feed size %s\n", argv[4]);
+			return 2;
+		}
+		ncuts = len > 0 ? (len - 1) / chunk : 0;
+		cuts = calloc(ncuts + 1, sizeof(*cuts));
+		for (int i = 0; i < ncuts; i++) {
+			cuts[i] = (i + 1) * chunk;
+		}
+		if (decode(fmt, in, len, cuts, ncuts, &first)) {
+			return 1;
+		}
+	}
+
+	fp = fopen(argv[3], "wb");
+	fwrite(first.buf, 1, first.len, fp);
+	fclose(fp);
+	return 0;
+}
@@ -0,0 +1,189 @@
+"""Round trip zlib compressed streams through the download inflater.
+
+tmo_inflate.c is built for the host against the stand-in headers in
+include/, and must decode what Python's zlib produces, for every block
+type and wrapper, however the input is split into HTTP fragments.
+
+  python -m pytest tests/tmo_shell/inflate
+"""
+import errno, os, random, shutil, struct, subprocess, zlib
+
+import pytest
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.normpath(os.path.join(HERE, '..', '..', '..'))
+SRC = os.path.join(ROOT, 'samples', 'tmo_shell', 'src')
+DECODER = os.path.join(SRC, 'tmo_inflate.c')
+# Kconfig default of CONFIG_TMO_HTTP_INFLATE_WINDOW
+DEVICE_WINDOW = 32768
+
+STORED, FIXED, DYNAMIC = 0, 1, 2
+# zlib falls back to a stored or fixed block when it is smaller, as it is
+# for random data and a lone byte. The other samples get what was asked for.
+COMPRESSIBLE = ('text', 'words', 'zeros')
+# wbits selecting each wrapper in zlib.compressobj()
+WRAPPERS = {'gzip': 31, 'zlib': 15, 'raw': -15}
+
+
+def sample_data():
+	rnd = random.Random(1)
+	words = [rnd.randbytes(rnd.randint(2, 9)) for _ in range(200)]
+	return {
+		'empty': b'',
+		'one_byte': b'\x5a',
+		'text': b'{"temperature": 21.5, "humidity": 40, "light": 310}\n' * 400,
+		'random': rnd.randbytes(20000),
+		'words': b' '.join(rnd.choice(words) for _ in range(8000)),
+		# More than one stored block, which holds at most 65535 bytes
+		'zeros': bytes(150000),
+	}
+
+
+def compress(data, wrapper, block):
+	level = 0 if block == STORED else 9
+	strategy = zlib.Z_FIXED if block == FIXED else zlib.Z_DEFAULT_STRATEGY
+	c = zlib.compressobj(level, zlib.DEFLATED, WRAPPERS[wrapper], 8, strategy)
+	return c.compress(data) + c.flush()
+
+
+def first_block_type(stream, wrapper):
+	start = {'gzip': 10, 'zlib': 2, 'raw': 0}[wrapper]
+	return (stream[start] >> 1) & 3
+
+
+@pytest.fixture(scope='module')
+def build(tmp_path_factory):
+	cc = shutil.which(os.environ.get('CC', 'cc'))
+	if cc is None:
+		pytest.skip('no host C compiler')
+	out = tmp_path_factory.mktemp('bin')
+	built = {}
+
+	def compile(window):
+		if window in built:
+			return built[window]
+		exe = str(out / f'inflate_host_{window}')
+		subprocess.run([cc, '-Wall', '-Werror', '-O2',
+				f'-DCONFIG_TMO_HTTP_INFLATE_WINDOW={window}',
+				'-DCONFIG_MAIN_THREAD_PRIORITY=0',
+				'-I', os.path.join(HERE, 'include'), '-I', SRC,
+				os.path.join(HERE, 'inflate_host.c'), DECODER, '-pthread', '-o', exe],
+				check=True)
+		built[window] = exe
+		return exe
+	return compile
+
+
+def inflate(exe, tmp_path, stream, wrapper, feed):
+	src = tmp_path / 'in.z'
+	src.write_bytes(stream)
+	fmt = 'gzip' if wrapper == 'gzip' else 'deflate'
+	res = subprocess.run([exe, fmt, str(src), str(tmp_path / 'out'), str(feed)],
+			capture_output=True, text=True)
+	return res, (tmp_path / 'out').read_bytes() if res.returncode == 0 else None
+
+
+def error_of(res):
+	"""The error a failed run printed, from whichever call reported it"""
+	assert res.returncode == 1, res.stdout
+	return int(res.stdout.split()[1])
+
+
+@pytest.mark.parametrize('name', sample_data().keys())
+@pytest.mark.parametrize('wrapper', WRAPPERS.keys())
+@pytest.mark.parametrize('block', [STORED, FIXED, DYNAMIC], ids=['stored', 'fixed', 'dynamic'])
+def test_round_trip(build, tmp_path, name, wrapper, block):
+	data = sample_data()[name]
+	stream = compress(data, wrapper, block)
+	if name in COMPRESSIBLE:
+		assert first_block_type(stream, wrapper) == block
+
+	exe = build(DEVICE_WINDOW)
+	# One byte at a time splits the stream at every boundary at once
+	for feed in (1, 7, 1460, len(stream) + 1):
+		res, out = inflate(exe, tmp_path, stream, wrapper, feed)
+		assert res.returncode == 0, f'feed {feed}: {res.stdout}'
+		assert out == data, f'feed {feed}'
+
+
+@pytest.mark.parametrize('wrapper', WRAPPERS.keys())
+@pytest.mark.parametrize('block', [STORED, FIXED, DYNAMIC], ids=['stored', 'fixed', 'dynamic'])
+def test_split_at_every_byte(build, tmp_path, wrapper, block):
+	data = sample_data()['text'][:3000]
+	stream = compress(data, wrapper, block)
+
+	res, out = inflate(build(DEVICE_WINDOW), tmp_path, stream, wrapper, 'split')
+	assert res.returncode == 0, res.stdout
+	assert out == data
+
+
+def test_gzip_optional_header_fields(build, tmp_path):
+	data = sample_data()['words']
+	deflated = compress(data, 'raw', DYNAMIC)
+	# FHCRC, FEXTRA, FNAME and FCOMMENT
+	flags = 0x02 | 0x04 | 0x08 | 0x10
+	header = struct.pack('<BBBBIBB', 0x1f, 0x8b, 8, flags, 0, 0, 3)
+	header += struct.pack('<H', 6) + b'AB\x02\x00xy' + b'log.bin\x00' + b'from the field\x00'
+	header += struct.pack('<H', zlib.crc32(header) & 0xffff)
+	stream = header + deflated + struct.pack('<II', zlib.crc32(data), len(data))
+
+	for feed in (1, 1460):
+		res, out = inflate(build(DEVICE_WINDOW), tmp_path, stream, 'gzip', feed)
+		assert res.returncode == 0, res.stdout
+		assert out == data
+
+
+@pytest.mark.parametrize('wrapper', WRAPPERS.keys())
+def test_truncated(build, tmp_path, wrapper):
+	stream = compress(sample_data()['words'], wrapper, DYNAMIC)
+
+	for cut in (1, 5, len(stream) // 2):
+		res, _ = inflate(build(DEVICE_WINDOW), tmp_path, stream[:-cut], wrapper, 1460)
+		assert error_of(res) == -errno.EPIPE, f'cut {cut}'
+
+
+def test_bad_crc(build, tmp_path):
+	stream = bytearray(compress(sample_data()['text'], 'gzip', DYNAMIC))
+	stream[-8] ^= 0x01
+
+	res, _ = inflate(build(DEVICE_WINDOW), tmp_path, bytes(stream), 'gzip', 1460)
+	assert error_of(res) == -errno.EBADMSG
+
+
+def test_bad_isize(build, tmp_path):
+	stream = bytearray(compress(sample_data()['text'], 'gzip', DYNAMIC))
+	stream[-4] ^= 0x01
+
+	res, _ = inflate(build(DEVICE_WINDOW), tmp_path, bytes(stream), 'gzip', 1460)
+	assert error_of(res) == -errno.EBADMSG
+
+
+def test_bad_adler32(build, tmp_path):
+	stream = bytearray(compress(sample_data()['text'], 'zlib', DYNAMIC))
+	stream[-1] ^= 0x01
+
+	res, _ = inflate(build(DEVICE_WINDOW), tmp_path, bytes(stream), 'zlib', 1460)
+	assert error_of(res) == -errno.EBADMSG
+
+
+def test_corrupt_data(build, tmp_path):
+	stream = bytearray(compress(sample_data()['words'], 'raw', DYNAMIC))
+	# An invalid block type
+	stream[0] |= 0x06
+
+	res, _ = inflate(build(DEVICE_WINDOW), tmp_path, bytes(stream), 'raw', 1460)
+	assert error_of(res) == -errno.EBADMSG
+
+
+def test_window_too_large(build, tmp_path):
+	rnd = random.Random(3)
+	block = rnd.randbytes(3000)
+	# Repeats 3000 bytes back, past a 2 KB window
+	data = block + rnd.randbytes(500) + block
+	stream = compress(data, 'zlib', DYNAMIC)
+
+	res, _ = inflate(build(2048), tmp_path, stream, 'zlib', 1460)
+	assert error_of(res) == -errno.E2BIG
+	res, out = inflate(build(4096), tmp_path, stream, 'zlib', 1460)
+	assert res.returncode == 0, res.stdout
+	assert out == data
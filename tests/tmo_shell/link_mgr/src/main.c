@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <zephyr/ztest.h>
+
+#include "tmo_link_mgr.h"
+
+/* Interface indexes the tests place the two links at */
+#define MODEM 1
+#define WIFI  2
+#define BOTH  (BIT(MODEM) | BIT(WIFI))
+
+#define HOLDOFF_MS (CONFIG_TMO_LINK_FAIL_HOLDOFF_SECS * MSEC_PER_SEC)
+
+static struct tmo_link_stats links[TMO_LINK_MAX_IFACES + 1];
+
+static void set_link(int idx, uint32_t rtt_ms, uint32_t bps, uint32_t nj_per_byte)
+{
+	memset(&links[idx], 0, sizeof(links[idx]));
+	links[idx].present = true;
+	links[idx].up = true;
+	links[idx].is_wifi = idx == WIFI;
+	links[idx].rtt_ms = rtt_ms;
+	links[idx].throughput_bps = bps;
+	links[idx].energy_nj_per_byte = nj_per_byte;
+}
+
+/* The priors the link manager starts each interface with */
+static void link_mgr_before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+	memset(links, 0, sizeof(links));
+	set_link(MODEM, 300, 300000, CONFIG_TMO_LINK_MODEM_NJ_PER_BYTE);
+	set_link(WIFI, 50, 5000000, CONFIG_TMO_LINK_WIFI_NJ_PER_BYTE);
+}
+
+ZTEST(link_mgr, test_cost_depends_only_on_inputs)
+{
+	for (int c = 0; c < TMO_LINK_CLASS_COUNT; c++) {
+		uint32_t cost = tmo_link_cost(&links[MODEM], c, 1000);
+
+		zassert_true(cost > 0, "zero cost for %s", tmo_link_class_name(c));
+		zassert_equal(cost, tmo_link_cost(&links[MODEM], c, 1000));
+		/* Without a failure the time does not matter */
+		zassert_equal(cost, tmo_link_cost(&links[MODEM], c, 10 * HOLDOFF_MS));
+	}
+}
+
+ZTEST(link_mgr, test_cost_fail_rate)
+{
+	uint32_t base = tmo_link_cost(&links[WIFI], TMO_LINK_BULK, 0);
+
+	links[WIFI].fail_permille = 500;
+	zassert_equal(tmo_link_cost(&links[WIFI], TMO_LINK_BULK, 0), (uint64_t)base * 2500 / 1000);
+}
+
+ZTEST(link_mgr, test_cost_fail_holdoff)
+{
+	int64_t fail_at = 5000;
+	uint32_t base = tmo_link_cost(&links[WIFI], TMO_LINK_CONTROL, fail_at);
+
+	links[WIFI].last_fail_ms = fail_at;
+	zassert_equal(tmo_link_cost(&links[WIFI], TMO_LINK_CONTROL, fail_at + 1), base * 4);
+	zassert_equal(tmo_link_cost(&links[WIFI], TMO_LINK_CONTROL, fail_at + HOLDOFF_MS - 1),
+			base * 4);
+	zassert_equal(tmo_link_cost(&links[WIFI], TMO_LINK_CONTROL, fail_at + HOLDOFF_MS), base);
+}
+
+ZTEST(link_mgr, test_choose_cheapest)
+{
+	for (int c = 0; c < TMO_LINK_CLASS_COUNT; c++) {
+		zassert_equal(tmo_link_choose(links, BOTH, c, 0, 0), WIFI,
+				"%s not on wifi", tmo_link_class_name(c));
+	}
+	zassert_equal(tmo_link_choose(links, BIT(MODEM), TMO_LINK_BULK, 0, 0), MODEM);
+	zassert_equal(tmo_link_choose(links, 0, TMO_LINK_BULK, 0, 0), -ENETDOWN);
+}
+
+ZTEST(link_mgr, test_choose_hysteresis)
+{
+	/* Same link but for RTT, control traffic is priced by time alone */
+	set_link(WIFI, 250, 300000, CONFIG_TMO_LINK_MODEM_NJ_PER_BYTE);
+	zassert_equal(tmo_link_choose(links, BOTH, TMO_LINK_CONTROL, MODEM, 0), MODEM,
+			"switched for a small gain");
+	zassert_equal(tmo_link_choose(links, BOTH, TMO_LINK_CONTROL, 0, 0), WIFI);
+
+	links[WIFI].rtt_ms = 200;
+	zassert_equal(tmo_link_choose(links, BOTH, TMO_LINK_CONTROL, MODEM, 0), WIFI,
+			"stayed despite a clear gain");
+}
+
+ZTEST(link_mgr, test_choose_failover)
+{
+	/* The current link is excluded, as tmo_link_failover() does */
+	zassert_equal(tmo_link_choose(links, BIT(MODEM), TMO_LINK_BULK, WIFI, 0), MODEM);
+
+	/* A link that keeps failing loses the class while it is held off */
+	links[WIFI].fail_permille = 1000;
+	links[WIFI].last_fail_ms = 1000;
+	zassert_equal(tmo_link_choose(links, BOTH, TMO_LINK_CONTROL, WIFI, 1000), MODEM);
+	links[WIFI].fail_permille = 0;
+	zassert_equal(tmo_link_choose(links, BOTH, TMO_LINK_CONTROL, MODEM, 1000 + HOLDOFF_MS),
+			WIFI);
+}
+
+ZTEST_SUITE(link_mgr, NULL, NULL, link_mgr_before, NULL, NULL);
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/ztest.h>
+
+#include "tmo_http_mock_socket.h"
+
+/* Each run fetches the tail of the body so it stays short */
+#define RANGE_LEN      4096
+#define TCPIP_OVERHEAD 40
+#define MAX_RECVS      512
+#define SEED_RUNS      200
+
+struct run {
+	int err;                 /* 0, or the errno that ended the run */
+	int status;
+	uint32_t hdr_bytes;
+	uint32_t body;
+	uint32_t recvs;
+	uint32_t max_seg;
+	uint32_t elapsed_ms;
+	uint16_t len[MAX_RECVS];
+};
+
+static uint8_t buf[2048];
+static char hdr[256];
+
+static bool body_ok(const uint8_t *data, size_t len, uint32_t off)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (data[i] != 0x20 + ((off + i) % 97)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* GET the last RANGE_LEN bytes of the profile's body */
+static void fetch_tail(struct run *r, int rcvtimeo_ms)
+{
+	const struct tmo_mock_profile *p = tmo_mock_get_profile();
+	struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(80)};
+	uint32_t off = p->body_size - RANGE_LEN;
+	int64_t start = k_uptime_get();
+	int hdr_len = 0;
+	char req[96];
+	int sd;
+	int len;
+
+	memset(r, 0, sizeof(*r));
+	sd = http_fail_unit_test_socket_create();
+	zassert_true(sd >= 0, "no mock socket");
+	if (rcvtimeo_ms) {
+		struct timeval tv = {
+			.tv_sec = rcvtimeo_ms / MSEC_PER_SEC,
+			.tv_usec = (rcvtimeo_ms % MSEC_PER_SEC) * USEC_PER_MSEC,
+		};
+
+		zassert_ok(zsock_setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+	}
+	zassert_ok(zsock_connect(sd, (struct sockaddr *)&addr, sizeof(addr)));
+	len = snprintf(req, sizeof(req), "GET /f HTTP/1.1\r\nRange: bytes=%u-\r\n\r\n", off);
+	zassert_equal(zsock_send(sd, req, len, 0), len);
+
+	while (r->recvs < MAX_RECVS) {
+		len = zsock_recv(sd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			r->err = errno;
+			break;
+		}
+		if (len == 0) {
+			break;
+		}
+		r->len[r->recvs++] = len;
+		r->max_seg = MAX(r->max_seg, len);
+		/* The mock never returns header and body in one recv */
+		if (!strstr(hdr, "\r\n\r\n")) {
+			zassert_true(hdr_len + len < sizeof(hdr), "header too long");
+			memcpy(hdr + hdr_len, buf, len);
+			hdr_len += len;
+			hdr[hdr_len] = '\0';
+			continue;
+		}
+		zassert_true(body_ok(buf, len, off + r->body), "body corrupt at %u", r->body);
+		r->body += len;
+	}
+	r->hdr_bytes = hdr_len;
+	sscanf(hdr, "HTTP/1.1 %d", &r->status);
+	hdr[0] = '\0';
+	zsock_close(sd);
+	r->elapsed_ms = k_uptime_get() - start;
+}
+
+static void mock_before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+	tmo_mock_set_seed(1);
+	tmo_mock_reset_stats();
+	hdr[0] = '\0';
+}
+
+ZTEST(mock_socket, test_profiles)
+{
+	static struct run r;
+	const struct tmo_mock_profile *p;
+
+	for (int i = 0; (p = tmo_mock_get_profile_by_idx(i)) != NULL; i++) {
+		struct tmo_mock_stats st;
+
+		zassert_ok(tmo_mock_set_profile(p->name));
+		tmo_mock_reset_stats();
+		fetch_tail(&r, 0);
+		tmo_mock_get_stats(&st);
+		if (r.err == ECONNRESET) {
+			zassert_equal(st.resets, 1, "%s: reset not counted", p->name);
+			continue;
+		}
+		zassert_equal(r.err, 0, "%s: errno %d", p->name, r.err);
+		zassert_equal(r.status, 206, "%s: status %d", p->name, r.status);
+		zassert_equal(r.body, RANGE_LEN, "%s: body %u", p->name, r.body);
+		zassert_true(r.max_seg <= p->mtu - TCPIP_OVERHEAD, "%s: %u byte segment",
+				p->name, r.max_seg);
+		zassert_equal(st.connects, 1);
+		zassert_equal(st.requests, 1);
+		zassert_equal(st.bytes_received, r.hdr_bytes + r.body);
+
+		/* One RTT to connect, one for the response, then serialization */
+		uint32_t min_ms = 2 * p->rtt_ms;
+
+		if (p->bandwidth_bps) {
+			min_ms += (uint64_t)RANGE_LEN * 8 * MSEC_PER_SEC / p->bandwidth_bps - 1;
+		}
+		zassert_true(r.elapsed_ms >= min_ms, "%s: %u ms, expected at least %u",
+				p->name, r.elapsed_ms, min_ms);
+	}
+}
+
+ZTEST(mock_socket, test_seed_replays_run)
+{
+	static struct run r1, r2;
+	struct tmo_mock_stats st1, st2;
+
+	zassert_ok(tmo_mock_set_profile("catm_edge"));
+	tmo_mock_set_seed(7);
+	fetch_tail(&r1, 0);
+	tmo_mock_get_stats(&st1);
+
+	tmo_mock_set_seed(7);
+	tmo_mock_reset_stats();
+	fetch_tail(&r2, 0);
+	tmo_mock_get_stats(&st2);
+
+	zassert_equal(r1.err, r2.err);
+	zassert_equal(r1.body, r2.body);
+	zassert_equal(r1.recvs, r2.recvs);
+	zassert_mem_equal(r1.len, r2.len, r1.recvs * sizeof(r1.len[0]));
+	zassert_mem_equal(&st1, &st2, sizeof(st1));
+}
+
+ZTEST(mock_socket, test_edge_errors)
+{
+	static struct run r;
+	struct tmo_mock_stats st;
+	uint32_t resets = 0;
+	uint32_t timeouts = 0;
+
+	zassert_ok(tmo_mock_set_profile("catm_edge"));
+	for (uint32_t seed = 1; seed <= SEED_RUNS; seed++) {
+		tmo_mock_set_seed(seed);
+		/* A lost segment stalls until the receive timeout */
+		fetch_tail(&r, 1000);
+		if (r.err == ECONNRESET) {
+			resets++;
+		} else if (r.err == EAGAIN) {
+			timeouts++;
+		} else {
+			zassert_equal(r.err, 0, "seed %u: errno %d", seed, r.err);
+			zassert_equal(r.body, RANGE_LEN, "seed %u: body %u", seed, r.body);
+		}
+	}
+	tmo_mock_get_stats(&st);
+	zassert_equal(st.connects, SEED_RUNS);
+	zassert_equal(st.resets, resets);
+	zassert_equal(st.losses, timeouts);
+	zassert_true(resets > 0, "no resets in %d runs", SEED_RUNS);
+	zassert_true(timeouts > 0, "no losses in %d runs", SEED_RUNS);
+	zassert_true(st.short_reads > 0, "no short reads in %d runs", SEED_RUNS);
+}
+
+ZTEST_SUITE(mock_socket, NULL, NULL, mock_before, NULL, NULL);
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/net_if.h>
+#include <zephyr/net/net_l2.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/shell/shell_dummy.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/ztest.h>
+
+#include "tmo_dns_cache.h"
+#include "tmo_perf.h"
+#include "tmo_usage.h"
+
+/*
+ * tmo perf against iperf2 style peers on the loopback interface. The peer
+ * runs in its own thread and counts what actually crossed the socket, the
+ * usage hook records what tmo perf claims to have moved.
+ */
+
+#define PEER_STACK_SIZE 2048
+#define PEER_PRIORITY   K_PRIO_PREEMPT(8)
+#define PEER_TIMEOUT    K_SECONDS(20)
+#define RECV_TEST_BYTES (64 * 1024)
+
+/* iperf2 datagram header and the start of the server report */
+struct udp_hdr {
+	int32_t id;
+	uint32_t tv_sec;
+	uint32_t tv_usec;
+};
+
+struct udp_report {
+	int32_t flags;
+	int32_t total_len1;
+	int32_t total_len2;
+	int32_t stop_sec;
+	int32_t stop_usec;
+	int32_t error_cnt;
+	int32_t outorder_cnt;
+	int32_t datagrams;
+	int32_t jitter1;
+	int32_t jitter2;
+};
+
+static K_THREAD_STACK_DEFINE(peer_stack, PEER_STACK_SIZE);
+static struct k_thread peer_thread;
+static K_SEM_DEFINE(peer_ready, 0, 1);
+static uint8_t peer_buf[2048];
+static uint16_t peer_port;
+static uint64_t peer_bytes;
+static uint32_t peer_datagrams;
+
+static uint64_t usage_tx;
+static uint64_t usage_rx;
+static int lo_idx;
+
+/* Hooks normally provided by tmo_shell.c, tmo_usage.c and tmo_dns_cache.c */
+int tmo_offload_init(int devid)
+{
+	return 0;
+}
+
+int tmo_usage_check(int iface_idx, enum tmo_usage_tag tag)
+{
+	return 0;
+}
+
+void tmo_usage_add(int iface_idx, enum tmo_usage_tag tag, size_t tx, size_t rx)
+{
+	zassert_equal(iface_idx, lo_idx);
+	zassert_equal(tag, TMO_USAGE_PERF);
+	usage_tx += tx;
+	usage_rx += rx;
+}
+
+int tmo_dns_resolve_addr(const char *host, const char *service,
+		const struct zsock_addrinfo *hints, int iface_idx,
+		struct zsock_addrinfo *ai, struct sockaddr *addr)
+{
+	struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+
+	memset(addr, 0, sizeof(*addr));
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(strtol(service, NULL, 10));
+	if (zsock_inet_pton(AF_INET, host, &sin->sin_addr) != 1) {
+		return DNS_EAI_NONAME;
+	}
+	memset(ai, 0, sizeof(*ai));
+	ai->ai_family = AF_INET;
+	ai->ai_socktype = hints->ai_socktype;
+	ai->ai_addr = addr;
+	ai->ai_addrlen = sizeof(*sin);
+	return 0;
+}
+
+static int peer_socket(int type)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(peer_port),
+	};
+	int sd = zsock_socket(AF_INET, type, type == SOCK_STREAM ? IPPROTO_TCP : IPPROTO_UDP);
+
+	zassert_true(sd >= 0, "peer socket: %d", errno);
+	zsock_inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	zassert_ok(zsock_bind(sd, (struct sockaddr *)&addr, sizeof(addr)));
+	return sd;
+}
+
+/* "iperf -s": count bytes until the client closes */
+static void tcp_sink(void *p1, void *p2, void *p3)
+{
+	int lsd = peer_socket(SOCK_STREAM);
+	int sd;
+	int ret;
+
+	zassert_ok(zsock_listen(lsd, 1));
+	k_sem_give(&peer_ready);
+	sd = zsock_accept(lsd, NULL, NULL);
+	zassert_true(sd >= 0, "accept: %d", errno);
+	while ((ret = zsock_recv(sd, peer_buf, sizeof(peer_buf), 0)) > 0) {
+		peer_bytes += ret;
+	}
+	zsock_close(sd);
+	zsock_close(lsd);
+}
+
+/* "iperf -s -u": count datagrams and answer the FIN with a report */
+static void udp_sink(void *p1, void *p2, void *p3)
+{
+	int sd = peer_socket(SOCK_DGRAM);
+	struct sockaddr from;
+	socklen_t fromlen;
+	int ret;
+
+	k_sem_give(&peer_ready);
+	while (true) {
+		fromlen = sizeof(from);
+		ret = zsock_recvfrom(sd, peer_buf, sizeof(peer_buf), 0, &from, &fromlen);
+		zassert_true(ret >= (int)sizeof(struct udp_hdr), "recvfrom: %d", ret);
+
+		struct udp_hdr *hdr = (struct udp_hdr *)peer_buf;
+
+		if ((int32_t)sys_be32_to_cpu(hdr->id) >= 0) {
+			peer_bytes += ret;
+			peer_datagrams++;
+			continue;
+		}
+
+		struct udp_report *rpt = (struct udp_report *)(peer_buf + sizeof(*hdr));
+
+		memset(rpt, 0, sizeof(*rpt));
+		rpt->flags = sys_cpu_to_be32(0x80000000);
+		rpt->datagrams = sys_cpu_to_be32(peer_datagrams);
+		zsock_sendto(sd, peer_buf, sizeof(*hdr) + sizeof(*rpt), 0, &from, fromlen);
+		break;
+	}
+	zsock_close(sd);
+}
+
+/* "iperf -c": connect once tmo perf listens, send a fixed amount, close */
+static void tcp_source(void *p1, void *p2, void *p3)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(peer_port),
+	};
+	int sd = -1;
+
+	zsock_inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	for (int i = 0; i < 50 && sd < 0; i++) {
+		sd = zsock_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (zsock_connect(sd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			zsock_close(sd);
+			sd = -1;
+			k_msleep(100);
+		}
+	}
+	zassert_true(sd >= 0, "could not connect to tmo perf");
+	memset(peer_buf, 'x', sizeof(peer_buf));
+	while (peer_bytes < RECV_TEST_BYTES) {
+		int ret = zsock_send(sd, peer_buf, MIN(sizeof(peer_buf),
+					RECV_TEST_BYTES - peer_bytes), 0);
+
+		zassert_true(ret > 0, "send: %d", errno);
+		peer_bytes += ret;
+	}
+	zsock_close(sd);
+}
+
+static void start_peer(k_thread_entry_t fn, uint16_t port, bool wait_ready)
+{
+	peer_port = port;
+	k_thread_create(&peer_thread, peer_stack, K_THREAD_STACK_SIZEOF(peer_stack),
+			fn, NULL, NULL, NULL, PEER_PRIORITY, 0, K_NO_WAIT);
+	if (wait_ready) {
+		zassert_ok(k_sem_take(&peer_ready, PEER_TIMEOUT));
+	}
+}
+
+static int run_perf(const char *fmt, ...)
+{
+	const struct shell *sh = shell_backend_dummy_get_ptr();
+	char cmd[96];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(cmd, sizeof(cmd), fmt, ap);
+	va_end(ap);
+	shell_backend_dummy_clear_output(sh);
+	return shell_execute_cmd(sh, cmd);
+}
+
+static bool output_has(const char *str)
+{
+	size_t len;
+
+	return strstr(shell_backend_dummy_get_output(shell_backend_dummy_get_ptr(), &len),
+			str) != NULL;
+}
+
+static void *perf_setup(void)
+{
+	struct net_if *lo = net_if_get_first_by_type(&NET_L2_GET_NAME(DUMMY));
+
+	zassert_not_null(lo, "no loopback interface");
+	lo_idx = net_if_get_by_iface(lo);
+	return NULL;
+}
+
+static void perf_before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+	peer_bytes = 0;
+	peer_datagrams = 0;
+	usage_tx = 0;
+	usage_rx = 0;
+	k_sem_reset(&peer_ready);
+}
+
+ZTEST(perf, test_tcp_send)
+{
+	start_peer(tcp_sink, 5101, true);
+	zassert_ok(run_perf("perf -t 2 -l 1024 -p 5101 %d 127.0.0.1", lo_idx));
+	zassert_ok(k_thread_join(&peer_thread, PEER_TIMEOUT));
+
+	zassert_true(peer_bytes > 0, "nothing sent");
+	zassert_equal(peer_bytes, usage_tx, "peer got %llu, perf sent %llu",
+			peer_bytes, usage_tx);
+	zassert_true(output_has("[SUM]"), "no summary");
+}
+
+ZTEST(perf, test_udp_send)
+{
+	start_peer(udp_sink, 5102, true);
+	zassert_ok(run_perf("perf -u -t 2 -l 512 -b 200000 -p 5102 %d 127.0.0.1", lo_idx));
+	zassert_ok(k_thread_join(&peer_thread, PEER_TIMEOUT));
+
+	zassert_true(peer_datagrams > 0, "nothing sent");
+	zassert_equal(peer_bytes, usage_tx, "peer got %llu, perf sent %llu",
+			peer_bytes, usage_tx);
+	zassert_true(output_has("Server report"), "FIN not acknowledged");
+	zassert_true(output_has("0 lost"), "loss on loopback");
+}
+
+ZTEST(perf, test_tcp_recv)
+{
+	start_peer(tcp_source, 5103, false);
+	zassert_ok(run_perf("perf -r -t 2 -p 5103 %d", lo_idx));
+	zassert_ok(k_thread_join(&peer_thread, PEER_TIMEOUT));
+
+	zassert_equal(usage_rx, RECV_TEST_BYTES, "perf received %llu", usage_rx);
+	zassert_equal(usage_tx, 0);
+	zassert_true(output_has("[SUM]"), "no summary");
+}
+
+SHELL_CMD_ARG_REGISTER(perf, NULL, "tmo perf under test", cmd_perf, 2, 14);
+
+ZTEST_SUITE(perf, NULL, perf_setup, perf_before, NULL, NULL);
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2022 T-Mobile USA, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/ztest.h>
+#include <zephyr/drivers/sensor.h>
+
+#include "tmo_gnss.h"
+#include "tmo_web_demo.h"
+#include "tmo_telemetry_sched.h"
+
+#define MIN_SECS   TRANSMIT_INTERVAL_SECS_WEB
+#define RETRY_SECS 120
+
+/* Hooks normally provided by tmo_web_demo.c, tmo_gnss.c and the battery code */
+struct tmo_gnss_struct gnss_values;
+
+int read_accelerometer(SENSOR_VALUE_STRUCT *acc_sensor_arr)
+{
+	return -ENODEV;
+}
+
+int read_battery_voltage(void)
+{
+	return 0;
+}
+
+float get_remaining_capacity(float battery_voltage)
+{
+	return 100;
+}
+
+int get_battery_charging_status(uint8_t *charging, uint8_t *vbus, uint8_t *attached,
+		uint8_t *fault)
+{
+	*attached = 0;
+	return 0;
+}
+
+static void motion_expiry(struct k_timer *timer)
+{
+	tmo_telemetry_sched_motion();
+}
+
+static K_TIMER_DEFINE(motion_timer, motion_expiry, NULL);
+
+static void sched_before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+	tmo_telemetry_sched_enable(true);
+	tmo_telemetry_sched_result(0, -1);
+	tmo_telemetry_sched_next(MIN_SECS);
+}
+
+ZTEST(telemetry_sched, test_motion_cuts_interval_to_minimum)
+{
+	int64_t start = k_uptime_get();
+
+	k_timer_start(&motion_timer, K_SECONDS(1), K_NO_WAIT);
+	zassert_equal(tmo_telemetry_sched_wait(10 * MIN_SECS), 1);
+	int64_t elapsed = k_uptime_get() - start;
+
+	zassert_true(elapsed >= MIN_SECS * MSEC_PER_SEC, "woke after %lld ms", elapsed);
+	zassert_true(elapsed < 2 * MIN_SECS * MSEC_PER_SEC, "woke after %lld ms", elapsed);
+}
+
+ZTEST(telemetry_sched, test_motion_during_retry_after)
+{
+	tmo_telemetry_sched_result(-EAGAIN, RETRY_SECS);
+	zassert_true(tmo_telemetry_sched_retrying());
+
+	unsigned int secs = tmo_telemetry_sched_next(MIN_SECS);
+	int64_t start = k_uptime_get();
+
+	/* Moving must not bring the retry forward */
+	k_timer_start(&motion_timer, K_SECONDS(1), K_NO_WAIT);
+	zassert_equal(tmo_telemetry_sched_wait(secs), 1);
+	zassert_true(k_uptime_get() - start >= RETRY_SECS * MSEC_PER_SEC,
+			"retried after %lld ms", k_uptime_get() - start);
+}
+
+ZTEST(telemetry_sched, test_jitter_keeps_retry_after)
+{
+	tmo_telemetry_sched_result(-EAGAIN, RETRY_SECS);
+
+	unsigned int secs = tmo_telemetry_sched_next(MIN_SECS);
+	int64_t start = k_uptime_get();
+
+	zassert_equal(tmo_telemetry_sched_wait(secs), 0);
+	zassert_true(k_uptime_get() - start >= RETRY_SECS * MSEC_PER_SEC,
+			"retried after %lld ms", k_uptime_get() - start);
+}
+
+ZTEST(telemetry_sched, test_success_clears_backoff)
+{
+	tmo_telemetry_sched_result(-EAGAIN, RETRY_SECS);
+	tmo_telemetry_sched_result(0, -1);
+	zassert_false(tmo_telemetry_sched_retrying());
+
+	int64_t start = k_uptime_get();
+
+	k_timer_start(&motion_timer, K_MSEC(100), K_NO_WAIT);
+	zassert_equal(tmo_telemetry_sched_wait(RETRY_SECS), 1);
+	zassert_true(k_uptime_get() - start < RETRY_SECS * MSEC_PER_SEC);
+}
+
+ZTEST_SUITE(telemetry_sched, NULL, NULL, sched_before, NULL, NULL);